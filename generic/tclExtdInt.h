@@ -203,6 +203,14 @@ typedef int
 					int          caseSensitive,
 					ClientData   clientData);
 
+/*
+ * Callback type for watching a file for changes.  Moved is TRUE if the file
+ * was renamed or removed, after which no more changes are reported.
+ */
+typedef void
+(TclX_WatchFileProc) (ClientData  clientData,
+                      int         moved);
+
 /*
  * Prototypes for utility procedures.
  */
@@ -291,6 +299,11 @@ TclX_SetChannelOption (Tcl_Interp  *interp,
                        int          option,
                        int          value);
 
+extern int
+TclX_GetMappedLineInfo (Tcl_Channel   channel,
+                        int          *crIsEolPtr,
+                        Tcl_Encoding *encodingPtr);
+
 extern char *
 TclX_JoinPath (char        *path1,
                char        *path2,
@@ -505,6 +518,18 @@ extern int
 TclXOSGetFileSize (Tcl_Channel  channel,
                    off_t       *fileSize);
 
+extern VOID *
+TclXOSWatchFile (char               *path,
+                 TclX_WatchFileProc *proc,
+                 ClientData          clientData);
+
+extern void
+TclXOSUnwatchFile (VOID *watchPtr);
+
+extern int
+TclXOSGetChannelPath (Tcl_Channel  channel,
+                      Tcl_DString *pathPtr);
+
 extern int
 TclXOSftruncate (Tcl_Interp  *interp,
                  Tcl_Channel  channel,
@@ -125,6 +125,18 @@ EXTERN int	TclX_KeyedListSet (Tcl_Interp *interp,
                                char	  *key,
                                Tcl_Obj	  *valuePtr);
 
+EXTERN int	TclX_KeyedListGetMany (Tcl_Interp *interp,
+                                   Tcl_Obj    *keylPtr,
+                                   int	       keyc,
+                                   char	     **keyv,
+                                   Tcl_Obj   **valuev);
+
+EXTERN int	TclX_KeyedListSetMany (Tcl_Interp *interp,
+                                   Tcl_Obj    *keylPtr,
+                                   int	       keyc,
+                                   char	     **keyv,
+                                   Tcl_Obj   **valuev);
+
 EXTERN int	TclX_KeyedListDelete (Tcl_Interp *interp,
                                   Tcl_Obj    *keylPtr,
                                   char	     *key);
@@ -134,6 +146,50 @@ EXTERN int	TclX_KeyedListGetKeys (Tcl_Interp *interp,
                                    char	      *key,
                                    Tcl_Obj   **listObjPtrPtr);
 
+EXTERN int	TclX_KeyedListSerialize (Tcl_Interp *interp,
+                                     Tcl_Obj    *keylPtr,
+                                     Tcl_Obj   **dataPtrPtr);
+
+EXTERN int	TclX_KeyedListDeserialize (Tcl_Interp *interp,
+                                       Tcl_Obj    *dataPtr,
+                                       Tcl_Obj   **keylPtrPtr);
+
+EXTERN int	TclX_KeyedListDeserializeFile (Tcl_Interp *interp,
+                                           char	      *fileName,
+                                           Tcl_Obj   **keylPtrPtr);
+
+/*
+ * Exported sorted file search functions.  A TclX_BsearchCompare selects how
+ * keys are compared to lines; NULL compares them as strings to the first
+ * white-space separated field.
+ */
+#define TCLX_BSEARCH_NOCASE   1   /* Compare strings ignoring case.        */
+#define TCLX_BSEARCH_INTEGER  2   /* Compare as integers.                  */
+#define TCLX_BSEARCH_REAL     4   /* Compare as floating-point numbers.    */
+
+typedef struct TclX_BsearchCompare {
+    char *compareProc;   /* Tcl procedure to compare with, or NULL.        */
+    int   flags;         /* TCLX_BSEARCH_* flags.                          */
+    int   field;         /* Field of the line compared, from zero.         */
+    char *separators;    /* Field separator characters, or NULL for runs   */
+                         /* of white space.                                */
+} TclX_BsearchCompare;
+
+EXTERN int	TclX_BsearchKeys (Tcl_Interp          *interp,
+                              Tcl_Channel          channel,
+                              int                  keyc,
+                              char               **keyv,
+                              TclX_BsearchCompare *comparePtr,
+                              Tcl_Obj            **valuev);
+
+EXTERN int	TclX_BsearchRange (Tcl_Interp          *interp,
+                               Tcl_Channel          channel,
+                               char                *lowKey,
+                               char                *highKey,
+                               TclX_BsearchCompare *comparePtr,
+                               int                  limit,
+                               Tcl_Obj             *linesObj);
+
 /*
  * Exported handle table manipulation functions.
  */
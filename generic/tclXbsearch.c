@@ -18,18 +18,131 @@
 
 #include "tclExtdInt.h"
 
+/*
+ * Key for the interpreter's bsearchInfo_t.
+ */
+#define BSEARCH_ASSOC_KEY "TclX_bsearch"
+
+/*
+ * Regular files are read in blocks with Tcl_ReadRaw, finding line
+ * boundaries in the blocks instead of reading lines through the channel.
+ * The blocks are kept between searches, until the channel is closed or the
+ * file changes, along with a cache of where the lines after recently probed
+ * offsets are.  Searches for different keys probe the same offsets near the
+ * top of the search, so these are found without reading the file again.  A
+ * file that shrinks during a search just reads short, ending its last line
+ * early.
+ */
+#define BSEARCH_BLOCK_SIZE  4096
+#define BSEARCH_BLOCK_CACHE 64
+#define BSEARCH_PROBE_CACHE 64
+
+typedef struct {
+    off_t  offset;       /* Offset of the block, or -1 if it is unused.  */
+    int    length;       /* Bytes read, short at the end of the file.    */
+    char   bytes [BSEARCH_BLOCK_SIZE];
+} fileBlock_t;
+
+typedef struct {
+    off_t  probe;        /* Offset probed, or -1 if the entry is unused. */
+    off_t  lineStart;    /* Start of the first line after the probe.     */
+    off_t  lineEnd;      /* End of the line's text.                      */
+    off_t  nextLine;     /* Start of the line after it.                  */
+} probeCache_t;
+
+typedef struct {
+    Tcl_Channel    channel;
+    Tcl_HashEntry *entryPtr;      /* Entry in the table of cached files.     */
+    off_t          size;          /* Size of the file when it was cached.    */
+    struct stat    statBuf;       /* To tell if the file has changed.        */
+    int            crIsEol;       /* Auto translation: CR ends a line.       */
+    Tcl_Encoding   encoding;
+    probeCache_t   cache [BSEARCH_PROBE_CACHE];
+    fileBlock_t    blocks [BSEARCH_BLOCK_CACHE];
+} searchFile_t;
+
+/*
+ * A sorted file may have an index, written by bsearch_index into a file of
+ * the same name with BSX_SUFFIX appended.  It holds the start of every Nth
+ * line and a prefix of its key, so a search can find the indexed lines
+ * around a key in memory and only probe the file between them.  Indexes
+ * are kept by the device and inode of the file, and are only used while the
+ * size, inode and modification time, to the nanosecond where the system
+ * has it, of the file match those recorded in the index.  The index file
+ * name is made from the path the channel's file resolves to, so a file
+ * opened through a link finds the same index.  Files found to have no
+ * index are checked again at most once a second.
+ *
+ * The index file is UTF-8 text.  The first line is a list of BSX_MAGIC, the
+ * version, the size, modification time in seconds and nanoseconds and inode
+ * of the file, the interval between indexed lines, the translation (auto or
+ * lf) and the encoding the file was read with.  Each following line is the
+ * offset of an indexed line, 1 if its key was cut to BSX_KEY_MAX bytes or 0
+ * if not, and the key, separated by single spaces.
+ */
+#define BSX_SUFFIX               ".bsx"
+#define BSX_MAGIC                "TclX-bsearch-index"
+#define BSX_VERSION              2
+#define BSX_KEY_MAX              32
+#define BSX_DEFAULT_INTERVAL     64
+
+typedef struct {
+    off_t  offset;       /* Start of the line.                           */
+    int    keyStart;     /* Start of its key prefix in keyBuf.           */
+    int    keyLen;
+    int    truncated;    /* Was the key longer than the prefix?          */
+} indexEntry_t;
+
+typedef struct {
+    off_t          fileSize;     /* The file's size, modification time and */
+    off_t          fileMtime;    /* inode.                                 */
+    long           fileMtimeNsec;
+    off_t          fileIno;
+    time_t         checked;      /* When a missing index was looked for.   */
+    int            crIsEol;      /* Indexed with auto translation.         */
+    char          *encodingName; /* Encoding indexed with, NULL if the     */
+                                 /* file has no index.                     */
+    int            numEntries;
+    indexEntry_t  *entries;
+    char          *keyBuf;
+} searchIndex_t;
+
+/*
+ * Per-interpreter data.
+ */
+typedef struct {
+    Tcl_HashTable  fileTable;    /* searchFile_t by channel.               */
+    Tcl_HashTable  indexTable;   /* searchIndex_t by "device.inode".       */
+} bsearchInfo_t;
+
 /*
  * Control block used to pass data used by the binary search routines.
  */
 typedef struct binSearchCB_t {
     Tcl_Interp   *interp;         /* Pointer to the interpreter.             */
     char         *key;            /* The key to search for.                  */
+    int           keyLen;
 
     Tcl_Channel   channel;        /* I/O channel.                            */
     Tcl_DString   lineBuf;        /* Dynamic buffer to hold a line of file.  */
     off_t         lastRecOffset;  /* Offset of last record read.             */
     int           cmpResult;      /* -1, 0 or 1 result of string compare.    */
+    int           lowerBound;     /* Search for the first line not less than */
+                                  /* the key rather than a matching one.     */
     char         *tclProc;        /* Name of Tcl comparsion proc, or NULL.   */
+    Tcl_Obj      *procObj;        /* tclProc, and the key it was last called */
+    Tcl_Obj      *keyObj;         /* with, or NULL.                          */
+    char         *keyObjKey;
+    int           compareFlags;   /* TCLX_BSEARCH_* flags.                   */
+    int           field;          /* Field of the line compared.             */
+    char         *separators;     /* Field separators, NULL for white space. */
+    int           standardCompare; /* Compare to the first field as ASCII?   */
+    searchFile_t *filePtr;        /* Cached blocks of the file, or NULL.     */
+    searchIndex_t *indexPtr;      /* Index of the file, or NULL.             */
+    Tcl_DString   rawBuf;         /* Bytes of a line read from filePtr.      */
+    off_t         lineEnd;        /* End of last line compared in filePtr.   */
+    off_t         readOffset;     /* Where reading would leave the channel.  */
+    int           lineInBuf;      /* Is the last line compared in lineBuf?   */
     } binSearchCB_t;
 
 /*
@@ -38,6 +151,24 @@ typedef struct binSearchCB_t {
 static int
 StandardKeyCompare (char *key, char *line);
 
+static char *
+FindField (binSearchCB_t *searchCBPtr,
+           char          *line,
+           int           *fieldLenPtr);
+
+static int
+CompareValues (Tcl_Interp *interp,
+               int         compareFlags,
+               char       *key,
+               char       *value,
+               int        *cmpResultPtr);
+
+static int
+FieldKeyCompare (binSearchCB_t *searchCBPtr);
+
+static int
+LineKeyCompare (binSearchCB_t *searchCBPtr);
+
 static int
 TclProcKeyCompare (binSearchCB_t *searchCBPtr);
 
@@ -45,8 +176,165 @@ static int
 ReadAndCompare (off_t          fileOffset,
                 binSearchCB_t *searchCBPtr);
 
+static fileBlock_t *
+GetFileBlock (Tcl_Interp   *interp,
+              searchFile_t *filePtr,
+              off_t         fileOffset);
+
+static int
+FindLineEnd (Tcl_Interp   *interp,
+             searchFile_t *filePtr,
+             off_t         lineStart,
+             off_t        *lineEndPtr,
+             off_t        *nextLinePtr);
+
+static int
+ReadFileBytes (Tcl_Interp   *interp,
+               searchFile_t *filePtr,
+               off_t         start,
+               off_t         end,
+               Tcl_DString  *bufPtr);
+
+static int
+FindProbeLine (Tcl_Interp   *interp,
+               searchFile_t *filePtr,
+               off_t         fileOffset,
+               probeCache_t *probePtr);
+
+static int
+CachedLineToBuf (binSearchCB_t *searchCBPtr,
+                 off_t          lineStart);
+
+static int
+CachedReadAndCompare (off_t          fileOffset,
+                      binSearchCB_t *searchCBPtr);
+
+static void
+SearchFileCloseHandler (ClientData clientData);
+
+static void
+ReleaseSearchFile (searchFile_t *filePtr);
+
+static void
+FreeSearchFile (char *clientData);
+
+static searchFile_t *
+NewSearchFile (Tcl_Channel  channel,
+               struct stat *statBufPtr,
+               int          crIsEol,
+               Tcl_Encoding encoding);
+
+static searchFile_t *
+GetSearchFile (Tcl_Interp *interp,
+               Tcl_Channel channel);
+
+static searchIndex_t *
+NewSearchIndex (struct stat *statBufPtr);
+
+static int
+SearchIndexCurrent (searchIndex_t *indexPtr,
+                    struct stat   *statBufPtr);
+
+static void
+FreeSearchIndex (searchIndex_t *indexPtr);
+
+static CONST char *
+ScanOffset (CONST char *str,
+            off_t      *offsetPtr);
+
+static int
+ReadSearchIndex (char          *indexPath,
+                 searchIndex_t *indexPtr);
+
+static searchIndex_t *
+GetSearchIndex (Tcl_Interp   *interp,
+                Tcl_Channel   channel,
+                searchFile_t *filePtr);
+
+static void
+SetSearchIndex (bsearchInfo_t *infoPtr,
+                struct stat   *statBufPtr,
+                searchIndex_t *indexPtr);
+
+static int
+IndexKeyCompare (searchIndex_t *indexPtr,
+                 indexEntry_t  *entryPtr,
+                 CONST char    *key,
+                 int            keyLen);
+
+static void
+IndexWindow (searchIndex_t *indexPtr,
+             CONST char    *key,
+             int            keyLen,
+             off_t         *lowPtr,
+             off_t         *highPtr);
+
+static int
+BuildSearchIndex (Tcl_Interp *interp,
+                  char       *fileName,
+                  int         interval,
+                  char       *encodingName,
+                  int         crIsEol);
+
+static int
+TclX_BsearchIndexObjCmd (ClientData clientData, 
+                         Tcl_Interp *interp,
+                         int objc,
+                         Tcl_Obj *CONST objv[]);
+
+static void
+BsearchCleanUp (ClientData  clientData,
+                Tcl_Interp *interp);
+
+static int
+BinSearch (binSearchCB_t *searchCBPtr,
+           off_t         *lowPtr,
+           off_t         *highPtr);
+
+static int
+SearchKeyRange (binSearchCB_t *searchCBPtr,
+                char         **keyv,
+                char        ***orderv,
+                int            first,
+                int            last,
+                off_t          low,
+                off_t          high,
+                Tcl_Obj      **valuev);
+
+static int
+CompareKeyPtrs (CONST VOID *left,
+                CONST VOID *right);
+
 static int
-BinSearch (binSearchCB_t *searchCBPtr);
+CompareKeyPtrsNoCase (CONST VOID *left,
+                      CONST VOID *right);
+
+static int
+CompareKeyPtrsInteger (CONST VOID *left,
+                       CONST VOID *right);
+
+static int
+CompareKeyPtrsReal (CONST VOID *left,
+                    CONST VOID *right);
+
+static int
+InitSearchCB (binSearchCB_t       *searchCBPtr,
+              Tcl_Interp          *interp,
+              Tcl_Channel          channel,
+              TclX_BsearchCompare *comparePtr,
+              off_t               *sizePtr);
+
+static void
+FreeSearchCB (binSearchCB_t *searchCBPtr);
+
+static int
+ReadRunLine (binSearchCB_t *searchCBPtr,
+             off_t         *lineStartPtr);
+
+static int
+CompareRunLine (binSearchCB_t *searchCBPtr,
+                char          *key);
+
 
 static int 
 TclX_BsearchObjCmd (ClientData clientData, 
@@ -102,18 +390,26 @@ StandardKeyCompare (char *key, char *line)
 static int
 TclProcKeyCompare (binSearchCB_t *searchCBPtr)
 {
-    const char *cmdArgv [3];
-    char *command, *oldResult;
+    Tcl_Obj *cmdObjv [3];
+    char *oldResult;
     int   result;
 
-    cmdArgv [0] = searchCBPtr->tclProc;
-    cmdArgv [1] = searchCBPtr->key;
-    cmdArgv [2] = searchCBPtr->lineBuf.string;
-    command = Tcl_Merge (3, cmdArgv);
+    if (searchCBPtr->keyObjKey != searchCBPtr->key) {
+        if (searchCBPtr->keyObj != NULL)
+            Tcl_DecrRefCount (searchCBPtr->keyObj);
+        searchCBPtr->keyObj = Tcl_NewStringObj (searchCBPtr->key, -1);
+        Tcl_IncrRefCount (searchCBPtr->keyObj);
+        searchCBPtr->keyObjKey = searchCBPtr->key;
+    }
+    cmdObjv [0] = searchCBPtr->procObj;
+    cmdObjv [1] = searchCBPtr->keyObj;
+    cmdObjv [2] = Tcl_NewStringObj (Tcl_DStringValue (&searchCBPtr->lineBuf),
+                                    Tcl_DStringLength (&searchCBPtr->lineBuf));
+    Tcl_IncrRefCount (cmdObjv [2]);
 
-    result = Tcl_Eval (searchCBPtr->interp, command);
+    result = Tcl_EvalObjv (searchCBPtr->interp, 3, cmdObjv, 0);
 
-    ckfree (command);
+    Tcl_DecrRefCount (cmdObjv [2]);
     if (result == TCL_ERROR)
         return TCL_ERROR;
 
@@ -134,6 +430,155 @@ TclProcKeyCompare (binSearchCB_t *searchCBPtr)
     Tcl_ResetResult (searchCBPtr->interp);
     return TCL_OK;
 }
+
+/*-----------------------------------------------------------------------------
+ * FindField --
+ *    Find the field of a line that keys are compared to.  Fields are
+ *    separated by runs of white space, ignoring any at the start of the
+ *    line, or by each of the separator characters.  A line with too few
+ *    fields has an empty one at its end.
+ *
+ * Parameters:
+ *   o searchCBPtr (I) - The search control block.
+ *   o line (I) - The line.
+ *   o fieldLenPtr (O) - The length of the field in bytes is returned here.
+ * Results:
+ *   A pointer to the start of the field.
+ *-----------------------------------------------------------------------------
+ */
+static char *
+FindField (binSearchCB_t *searchCBPtr, char *line, int *fieldLenPtr)
+{
+    char *separators = searchCBPtr->separators;
+    char *scanPtr;
+    Tcl_UniChar uniChar;
+    int field, charLen;
+
+    if (separators == NULL) {
+        line += strspn (line, " \t\r\n\v\f");
+        for (field = searchCBPtr->field; field > 0; field--) {
+            line += strcspn (line, " \t\r\n\v\f");
+            line += strspn (line, " \t\r\n\v\f");
+        }
+        *fieldLenPtr = strcspn (line, " \t\r\n\v\f");
+        return line;
+    }
+
+    field = searchCBPtr->field;
+    for (scanPtr = line; *scanPtr != '\0'; scanPtr += charLen) {
+        charLen = Tcl_UtfToUniChar (scanPtr, &uniChar);
+        if (Tcl_UtfFindFirst (separators, uniChar) == NULL)
+            continue;
+        if (field == 0)
+            break;
+        field--;
+        line = scanPtr + charLen;
+    }
+    *fieldLenPtr = (field == 0) ? (scanPtr - line) : 0;
+    return (field == 0) ? line : scanPtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * CompareValues --
+ *    Compare a key to a field, or to another key, as strings or numbers.
+ *
+ * Parameters:
+ *   o interp (I) - Errors are returned here, may be NULL.
+ *   o compareFlags (I) - TCLX_BSEARCH_* flags.
+ *   o key, value (I) - The strings to compare.
+ *   o cmpResultPtr (O) - < 0, 0 or > 0 as the key is less than, equal to or
+ *     greater than the value.
+ * Results:
+ *   TCL_OK, or TCL_ERROR if a number is expected and either isn't one.
+ *-----------------------------------------------------------------------------
+ */
+static int
+CompareValues (Tcl_Interp *interp,
+               int         compareFlags,
+               char       *key,
+               char       *value,
+               int        *cmpResultPtr)
+{
+    off_t keyInt, valueInt;
+    double keyReal, valueReal;
+    int keyChars, valueChars;
+
+    if (compareFlags & TCLX_BSEARCH_INTEGER) {
+        if (!TclX_StrToOffset (key, 10, &keyInt) ||
+            !TclX_StrToOffset (value, 10, &valueInt)) {
+            if (interp != NULL)
+                TclX_AppendObjResult (interp,
+                                      "expected integer but got \"",
+                                      TclX_StrToOffset (key, 10, &keyInt) ?
+                                      value : key, "\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+        *cmpResultPtr = (keyInt < valueInt) ? -1 : (keyInt > valueInt);
+    } else if (compareFlags & TCLX_BSEARCH_REAL) {
+        if ((Tcl_GetDouble (interp, key, &keyReal) != TCL_OK) ||
+            (Tcl_GetDouble (interp, value, &valueReal) != TCL_OK))
+            return TCL_ERROR;
+        *cmpResultPtr = (keyReal < valueReal) ? -1 : (keyReal > valueReal);
+    } else if (compareFlags & TCLX_BSEARCH_NOCASE) {
+        keyChars = Tcl_NumUtfChars (key, -1);
+        valueChars = Tcl_NumUtfChars (value, -1);
+        *cmpResultPtr = Tcl_UtfNcasecmp (key, value, (keyChars < valueChars) ?
+                                         keyChars : valueChars);
+        if (*cmpResultPtr == 0)
+            *cmpResultPtr = keyChars - valueChars;
+    } else {
+        *cmpResultPtr = strcmp (key, value);
+    }
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * FieldKeyCompare --
+ *    Comparison routine for BinSearch that compares the key to the field
+ *    of the line in lineBuf selected by the search's comparison options.
+ *
+ * Results:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+FieldKeyCompare (binSearchCB_t *searchCBPtr)
+{
+    char *fieldPtr, saveChar;
+    int fieldLen, status;
+
+    fieldPtr = FindField (searchCBPtr, Tcl_DStringValue (&searchCBPtr->lineBuf),
+                          &fieldLen);
+    saveChar = fieldPtr [fieldLen];
+    fieldPtr [fieldLen] = 0;
+    status = CompareValues (searchCBPtr->interp, searchCBPtr->compareFlags,
+                            searchCBPtr->key, fieldPtr,
+                            &searchCBPtr->cmpResult);
+    fieldPtr [fieldLen] = saveChar;
+    return status;
+}
+
+/*-----------------------------------------------------------------------------
+ * LineKeyCompare --
+ *    Compare the key to the line in lineBuf, leaving the result in
+ *    cmpResult.
+ *
+ * Results:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+LineKeyCompare (binSearchCB_t *searchCBPtr)
+{
+    if (searchCBPtr->tclProc != NULL)
+        return TclProcKeyCompare (searchCBPtr);
+    if (!searchCBPtr->standardCompare)
+        return FieldKeyCompare (searchCBPtr);
+    searchCBPtr->cmpResult =
+        StandardKeyCompare (searchCBPtr->key,
+                            Tcl_DStringValue (&searchCBPtr->lineBuf));
+    return TCL_OK;
+}
 
 /*-----------------------------------------------------------------------------
  * ReadAndCompare --
@@ -160,6 +605,9 @@ TclProcKeyCompare (binSearchCB_t *searchCBPtr)
 static int
 ReadAndCompare (off_t fileOffset, binSearchCB_t *searchCBPtr)
 {
+    if (searchCBPtr->filePtr != NULL)
+        return CachedReadAndCompare (fileOffset, searchCBPtr);
+
     if (Tcl_Seek (searchCBPtr->channel, fileOffset, SEEK_SET) < 0)
         goto posixError;
 
@@ -209,16 +657,7 @@ ReadAndCompare (off_t fileOffset, binSearchCB_t *searchCBPtr)
     /*
      * Compare the line.
      */
-    if (searchCBPtr->tclProc == NULL) {
-        searchCBPtr->cmpResult =
-            StandardKeyCompare (searchCBPtr->key, 
-                                searchCBPtr->lineBuf.string);
-    } else {
-        if (TclProcKeyCompare (searchCBPtr) != TCL_OK)
-            return TCL_ERROR;
-    }
-
-    return TCL_OK;
+    return LineKeyCompare (searchCBPtr);
 
   posixError:
    TclX_AppendObjResult (searchCBPtr->interp,
@@ -228,150 +667,2035 @@ ReadAndCompare (off_t fileOffset, binSearchCB_t *searchCBPtr)
 }
 
 /*-----------------------------------------------------------------------------
- * BinSearch --
- *      Binary search a sorted ASCII file.
+ * GetFileBlock --
+ *    Get the cached block of a file holding an offset, reading it from the
+ *    channel if it is not cached.
  *
  * Parameters:
- *   o searchCBPtr (I/O) - The search control block, if the line is found,
- *     it is returned in lineBuf.
+ *   o interp (I) - Errors are returned here.
+ *   o filePtr (I/O) - The file.
+ *   o fileOffset (I) - The offset.
  * Results:
- *     TCL_OK - If the key was found.
- *     TCL_BREAK - If it was not found.
- *     TCL_ERROR - If there was an error.
- *
- * based on getpath.c from smail 2.5 (9/15/87)
- *
+ *   The block, or NULL if it could not be read.  The block is short, or
+ *   empty, past the end of the file.
  *-----------------------------------------------------------------------------
  */
-static int
-BinSearch (binSearchCB_t *searchCBPtr)
+static fileBlock_t *
+GetFileBlock (Tcl_Interp *interp, searchFile_t *filePtr, off_t fileOffset)
 {
-    off_t middle, high, low;
+    fileBlock_t *blockPtr;
+    int numRead;
 
-    low = 0;
-    if (TclXOSGetFileSize (searchCBPtr->channel, &high) != TCL_OK)
+    fileOffset -= fileOffset % BSEARCH_BLOCK_SIZE;
+    blockPtr = &filePtr->blocks [(fileOffset / BSEARCH_BLOCK_SIZE) %
+                                 BSEARCH_BLOCK_CACHE];
+    if (blockPtr->offset == fileOffset)
+        return blockPtr;
+
+    blockPtr->offset = -1;
+    if (Tcl_Seek (filePtr->channel, fileOffset, SEEK_SET) < 0)
         goto posixError;
+    blockPtr->length = 0;
+    while (blockPtr->length < BSEARCH_BLOCK_SIZE) {
+        numRead = Tcl_ReadRaw (filePtr->channel,
+                               blockPtr->bytes + blockPtr->length,
+                               BSEARCH_BLOCK_SIZE - blockPtr->length);
+        if (numRead < 0)
+            goto posixError;
+        if (numRead == 0)
+            break;
+        blockPtr->length += numRead;
+    }
+    blockPtr->offset = fileOffset;
+    return blockPtr;
 
-    /*
-     * "Binary search routines are never written right the first time around."
-     * - Robert G. Sheldon.
-     */
+  posixError:
+    TclX_AppendObjResult (interp, Tcl_GetChannelName (filePtr->channel), ": ",
+                          Tcl_PosixError (interp), (char *) NULL);
+    return NULL;
+}
 
-    while (TRUE) {
-        middle = (high + low + 1) / 2;
+/*-----------------------------------------------------------------------------
+ * FindLineEnd --
+ *    Find the end of a line in a cached file, as a gets on the channel
+ *    would.  Only the bytes up to the size of the file when it was cached
+ *    are looked at.
+ *
+ * Parameters:
+ *   o interp (I) - Errors are returned here.
+ *   o filePtr (I/O) - The file.
+ *   o lineStart (I) - Start of the line.
+ *   o lineEndPtr (O) - The end of the text of the line is returned here.
+ *   o nextLinePtr (O) - The start of the next line is returned here.  It
+ *     is the same as the end of the text if the line runs to the end of
+ *     the file.
+ * Results:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+FindLineEnd (Tcl_Interp   *interp,
+             searchFile_t *filePtr,
+             off_t         lineStart,
+             off_t        *lineEndPtr,
+             off_t        *nextLinePtr)
+{
+    fileBlock_t *blockPtr;
+    CONST char *startPtr, *endPtr, *scanPtr;
+    off_t offset = lineStart;
+    int eolLen = 0;
 
-        if (ReadAndCompare (middle, searchCBPtr) != TCL_OK)
+    while (offset < filePtr->size) {
+        blockPtr = GetFileBlock (interp, filePtr, offset);
+        if (blockPtr == NULL)
             return TCL_ERROR;
+        startPtr = blockPtr->bytes + (offset - blockPtr->offset);
+        endPtr = blockPtr->bytes + blockPtr->length;
+        if (endPtr - startPtr > filePtr->size - offset)
+            endPtr = startPtr + (filePtr->size - offset);
+        if (startPtr >= endPtr)
+            break;  /* The file has shrunk. */
 
-        if (searchCBPtr->cmpResult == 0)
-            return TCL_OK;     /* Found   */
-        
-        if (low >= middle)  
-            return TCL_BREAK;  /* Failure */
-
-        /*
-         * Close window.
-         */
-        if (searchCBPtr->cmpResult > 0) {
-            low = middle;
+        if (!filePtr->crIsEol) {
+            scanPtr = memchr (startPtr, '\n', endPtr - startPtr);
+            if (scanPtr == NULL)
+                scanPtr = endPtr;
         } else {
-            high = middle - 1;
+            for (scanPtr = startPtr; scanPtr < endPtr; scanPtr++) {
+                if ((*scanPtr == '\n') || (*scanPtr == '\r'))
+                    break;
+            }
         }
-    }
+        offset += scanPtr - startPtr;
+        if (scanPtr == endPtr)
+            continue;
 
-  posixError:
-   TclX_AppendObjResult (searchCBPtr->interp,
-                         Tcl_GetChannelName (searchCBPtr->channel), ": ",
-                         Tcl_PosixError (searchCBPtr->interp), (char *) NULL);
-   return TCL_ERROR;
+        eolLen = 1;
+        if ((*scanPtr == '\r') && (offset + 1 < filePtr->size)) {
+            if (scanPtr + 1 < endPtr) {
+                if (scanPtr [1] == '\n')
+                    eolLen = 2;
+            } else {
+                blockPtr = GetFileBlock (interp, filePtr, offset + 1);
+                if (blockPtr == NULL)
+                    return TCL_ERROR;
+                if ((blockPtr->length > 0) && (blockPtr->bytes [0] == '\n'))
+                    eolLen = 2;
+            }
+        }
+        break;
+    }
+    *lineEndPtr = offset;
+    *nextLinePtr = offset + eolLen;
+    return TCL_OK;
 }
-
+
 /*-----------------------------------------------------------------------------
- * TclX_BsearchObjCmd --
- *     Implements the TCL bsearch command:
- *        bsearch filehandle key ?retvar?
+ * ReadFileBytes --
+ *    Copy part of a cached file into a buffer.
+ *
+ * Parameters:
+ *   o interp (I) - Errors are returned here.
+ *   o filePtr (I/O) - The file.
+ *   o start, end (I) - The part of the file to copy.
+ *   o bufPtr (O) - The bytes are returned here, fewer if the file has
+ *     shrunk.
+ * Results:
+ *   TCL_OK or TCL_ERROR.
  *-----------------------------------------------------------------------------
  */
 static int
-TclX_BsearchObjCmd (ClientData clientData,
-                    Tcl_Interp *interp,
-                    int objc,
-                    Tcl_Obj *CONST objv[])
+ReadFileBytes (Tcl_Interp   *interp,
+               searchFile_t *filePtr,
+               off_t         start,
+               off_t         end,
+               Tcl_DString  *bufPtr)
 {
-    int status;
-    binSearchCB_t searchCB;
+    fileBlock_t *blockPtr;
+    off_t offset;
+    int length;
 
-    if ((objc < 3) || (objc > 5)) {
-        TclX_WrongArgs (interp, objv [0], 
-                        "handle key ?retvar? ?compare_proc?");
-        return TCL_ERROR;
+    Tcl_DStringSetLength (bufPtr, 0);
+    for (offset = start; offset < end; offset += length) {
+        blockPtr = GetFileBlock (interp, filePtr, offset);
+        if (blockPtr == NULL)
+            return TCL_ERROR;
+        length = blockPtr->length - (int) (offset - blockPtr->offset);
+        if (length <= 0)
+            break;
+        if (length > end - offset)
+            length = (int) (end - offset);
+        Tcl_DStringAppend (bufPtr,
+                           blockPtr->bytes + (offset - blockPtr->offset),
+                           length);
     }
+    return TCL_OK;
+}
 
-    searchCB.channel = TclX_GetOpenChannelObj (interp,
-                                               objv [1],
-                                               TCL_READABLE);
-    if (searchCB.channel == NULL)
-        return TCL_ERROR;
-
-    searchCB.interp = interp;
-    searchCB.key = Tcl_GetStringFromObj (objv [2], NULL);
-    searchCB.lastRecOffset = -1;
-    searchCB.tclProc = (objc == 5) ? Tcl_GetStringFromObj (objv [4], NULL) :
-        NULL;
-
-    Tcl_DStringInit (&searchCB.lineBuf);
+/*-----------------------------------------------------------------------------
+ * FindProbeLine --
+ *    Find the first line starting after an offset in a cached file, looking
+ *    in the cache of recently probed offsets first.
+ *
+ * Parameters:
+ *   o interp (I) - Errors are returned here.
+ *   o filePtr (I/O) - The file, the line is added to its cache.
+ *   o fileOffset (I) - The offset probed.
+ *   o probePtr (O) - The line is returned here.  The line start is the
+ *     size of the file if there is no line after the offset and -1 if the
+ *     offset is at the end of the file.
+ * Results:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+FindProbeLine (Tcl_Interp   *interp,
+               searchFile_t *filePtr,
+               off_t         fileOffset,
+               probeCache_t *probePtr)
+{
+    probeCache_t *cachePtr;
+    off_t lineEnd;
 
-    status = BinSearch (&searchCB);
-    if (status == TCL_ERROR) {
-        Tcl_DStringFree (&searchCB.lineBuf);
-        return TCL_ERROR;
+    cachePtr = &filePtr->cache [(((unsigned long) fileOffset * 2654435761UL)
+                                 >> 16) % BSEARCH_PROBE_CACHE];
+    if (cachePtr->probe == fileOffset) {
+        *probePtr = *cachePtr;
+        return TCL_OK;
     }
 
-    if (status == TCL_BREAK) {
-        if ((objc >= 4) && !TclX_IsNullObj (objv [3]))
-            Tcl_SetBooleanObj (Tcl_GetObjResult (interp), FALSE);
-        goto okExit;
+    probePtr->probe = fileOffset;
+    if (fileOffset == 0) {
+        probePtr->lineStart = 0;
+    } else if (fileOffset >= filePtr->size) {
+        probePtr->lineStart = -1;
+    } else if (FindLineEnd (interp, filePtr, fileOffset, &lineEnd,
+                            &probePtr->lineStart) != TCL_OK) {
+        return TCL_ERROR;
     }
 
-    if ((objc == 3) || TclX_IsNullObj (objv [3])) {
-        Tcl_SetStringObj (Tcl_GetObjResult (interp),
-                          Tcl_DStringValue (&searchCB.lineBuf),
-                          -1);
+    if ((probePtr->lineStart < 0) || (probePtr->lineStart >= filePtr->size)) {
+        probePtr->lineEnd = probePtr->nextLine = filePtr->size;
     } else {
-        Tcl_Obj *valPtr;
+        if (FindLineEnd (interp, filePtr, probePtr->lineStart,
+                         &probePtr->lineEnd, &probePtr->nextLine) != TCL_OK)
+            return TCL_ERROR;
 
-        valPtr = Tcl_NewStringObj (Tcl_DStringValue (&searchCB.lineBuf),
-                                   -1);
-        if (Tcl_ObjSetVar2(interp, objv[3], NULL, valPtr,
-                           TCL_PARSE_PART1|TCL_LEAVE_ERR_MSG) == NULL) {
-            Tcl_DecrRefCount (valPtr);
-            goto errorExit;
-        }
-        Tcl_SetBooleanObj (Tcl_GetObjResult (interp), TRUE);
+        /*
+         * Nothing could be read where the line starts, so the file has
+         * shrunk.  Treat it as the end of the file.
+         */
+        if (probePtr->nextLine == probePtr->lineStart)
+            probePtr->lineStart = probePtr->lineEnd = probePtr->nextLine =
+                filePtr->size;
     }
-
-  okExit:
-    Tcl_DStringFree (&searchCB.lineBuf);
+    *cachePtr = *probePtr;
     return TCL_OK;
+}
 
-  errorExit:
-    Tcl_DStringFree (&searchCB.lineBuf);
+/*-----------------------------------------------------------------------------
+ * CachedLineToBuf --
+ *    Convert the last line compared in a cached file from the channel's
+ *    encoding into the line buffer.
+ *
+ * Parameters:
+ *   o searchCBPtr (I/O) - The search control block.
+ *   o lineStart (I) - Offset of the start of the line.
+ * Results:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+CachedLineToBuf (binSearchCB_t *searchCBPtr, off_t lineStart)
+{
+    searchFile_t *filePtr = searchCBPtr->filePtr;
+
+    if (ReadFileBytes (searchCBPtr->interp, filePtr, lineStart,
+                       searchCBPtr->lineEnd, &searchCBPtr->rawBuf) != TCL_OK)
+        return TCL_ERROR;
+    Tcl_DStringFree (&searchCBPtr->lineBuf);
+    Tcl_ExternalToUtfDString (filePtr->encoding,
+                              Tcl_DStringValue (&searchCBPtr->rawBuf),
+                              Tcl_DStringLength (&searchCBPtr->rawBuf),
+                              &searchCBPtr->lineBuf);
+    searchCBPtr->lineInBuf = TRUE;
     return TCL_OK;
 }
-
+
 /*-----------------------------------------------------------------------------
- * TclX_BsearchInit --
- *     Initialize the bsearch command.
+ * CachedReadAndCompare --
+ *    ReadAndCompare for a cached file.  With the standard comparison, a key
+ *    field that is plain ASCII is compared to the bytes of the line, as it
+ *    reads the same in all the encodings a file is cached with, otherwise
+ *    the line is converted into the line buffer first.
+ *
+ * Parameters:
+ *   o fileOffset (I) - The offset of the next byte of the search, not
+ *     necessarly the start of a record.
+ *   o searchCBPtr (I/O) - The search control block, the comparsion result
+ *     is returned in cmpResult.  If the EOF is hit, a less-than result is
+ *     returned.
+ *
+ * Results:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+CachedReadAndCompare (off_t fileOffset, binSearchCB_t *searchCBPtr)
+{
+    searchFile_t *filePtr = searchCBPtr->filePtr;
+    probeCache_t probe;
+    CONST unsigned char *fieldPtr, *scanPtr, *endPtr;
+    int fieldLen, cmpLen;
+
+    if (FindProbeLine (searchCBPtr->interp, filePtr, fileOffset,
+                       &probe) != TCL_OK)
+        return TCL_ERROR;
+    if (probe.lineStart < 0) {
+        TclX_AppendObjResult (searchCBPtr->interp,
+                              "bsearch got unexpected EOF on \"",
+                              Tcl_GetChannelName (searchCBPtr->channel),
+                              "\"", (char *) NULL);
+        return TCL_ERROR;
+    }
+
+    /*
+     * If this is the same line as before, then just leave the comparison
+     * result unchanged.
+     */
+    if (probe.lineStart == searchCBPtr->lastRecOffset) {
+        searchCBPtr->readOffset = probe.lineStart;
+        return TCL_OK;
+    }
+
+    searchCBPtr->lastRecOffset = probe.lineStart;
+    searchCBPtr->lineEnd = probe.lineEnd;
+    searchCBPtr->readOffset = probe.nextLine;
+    searchCBPtr->lineInBuf = FALSE;
+
+    if (probe.lineStart >= filePtr->size) {
+        searchCBPtr->cmpResult = -1;
+        return TCL_OK;
+    }
+
+    if (!searchCBPtr->standardCompare) {
+        if (CachedLineToBuf (searchCBPtr, probe.lineStart) != TCL_OK)
+            return TCL_ERROR;
+        if (LineKeyCompare (searchCBPtr) != TCL_OK)
+            return TCL_ERROR;
+        if (filePtr->channel == NULL) {
+            TclX_AppendObjResult (searchCBPtr->interp,
+                                  "file was closed by bsearch compare proc \"",
+                                  searchCBPtr->tclProc, "\"", (char *) NULL);
+            return TCL_ERROR;
+        }
+        return TCL_OK;
+    }
+
+    if (ReadFileBytes (searchCBPtr->interp, filePtr, probe.lineStart,
+                       probe.lineEnd, &searchCBPtr->rawBuf) != TCL_OK)
+        return TCL_ERROR;
+    fieldPtr = (CONST unsigned char *) Tcl_DStringValue (&searchCBPtr->rawBuf);
+    endPtr = fieldPtr + Tcl_DStringLength (&searchCBPtr->rawBuf);
+    for (scanPtr = fieldPtr; scanPtr < endPtr; scanPtr++) {
+        if ((*scanPtr == ' ') || ((*scanPtr >= '\t') && (*scanPtr <= '\r')))
+            break;
+        if ((*scanPtr == 0) || (*scanPtr >= 0x80)) {
+            if (CachedLineToBuf (searchCBPtr, probe.lineStart) != TCL_OK)
+                return TCL_ERROR;
+            return LineKeyCompare (searchCBPtr);
+        }
+    }
+    fieldLen = scanPtr - fieldPtr;
+
+    cmpLen = (searchCBPtr->keyLen < fieldLen) ? searchCBPtr->keyLen : fieldLen;
+    searchCBPtr->cmpResult = memcmp (searchCBPtr->key, fieldPtr, cmpLen);
+    if (searchCBPtr->cmpResult == 0)
+        searchCBPtr->cmpResult = searchCBPtr->keyLen - fieldLen;
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * BinSearch --
+ *      Binary search a sorted ASCII file.
+ *
+ * Parameters:
+ *   o searchCBPtr (I/O) - The search control block, if the line is found,
+ *     it is returned in lineBuf.
+ *   o lowPtr, highPtr (I/O) - The window of offsets to search, normally
+ *     zero and the size of the file.  On return, a search for a greater key
+ *     can start from *lowPtr and one for a lesser key can end at *highPtr,
+ *     as every line probed outside of these was on the same side of the key.
+ * Results:
+ *     TCL_OK - If the key was found.
+ *     TCL_BREAK - If it was not found.  This is always the result of a
+ *       lowerBound search.  The last line compared is then the one after
+ *       *lowPtr, and the lines not less than the key start with it or the
+ *       line after it.
+ *     TCL_ERROR - If there was an error.
+ *
+ * based on getpath.c from smail 2.5 (9/15/87)
+ *
+ *-----------------------------------------------------------------------------
+ */
+static int
+BinSearch (binSearchCB_t *searchCBPtr, off_t *lowPtr, off_t *highPtr)
+{
+    off_t middle, high, low;
+
+    low = *lowPtr;
+    high = *highPtr;
+
+    /*
+     * "Binary search routines are never written right the first time around."
+     * - Robert G. Sheldon.
+     */
+
+    while (TRUE) {
+        middle = (high + low + 1) / 2;
+
+        if (ReadAndCompare (middle, searchCBPtr) != TCL_OK)
+            return TCL_ERROR;
+
+        if ((searchCBPtr->cmpResult == 0) && !searchCBPtr->lowerBound) {
+            *lowPtr = middle;
+            *highPtr = middle - 1;
+            return TCL_OK;     /* Found   */
+        }
+        
+        if (low >= middle) {
+            *lowPtr = low;
+            *highPtr = high;
+            return TCL_BREAK;  /* Failure */
+        }
+
+        /*
+         * Close window.
+         */
+        if (searchCBPtr->cmpResult > 0) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * SearchKeyRange --
+ *      Search for a range of keys in sorted order.  The middle key is
+ *      searched for first, then the keys before it in the part of the file
+ *      before its line and those after it in the part after.
+ *
+ * Parameters:
+ *   o searchCBPtr (I/O) - The search control block.
+ *   o keyv, orderv (I) - The keys and pointers to them in sorted order.
+ *   o first, last (I) - The range of orderv to search for.
+ *   o low, high (I) - The window of offsets these keys are in.
+ *   o valuev (O) - The lines found are returned here.
+ * Results:
+ *     TCL_OK - If the keys were found.
+ *     TCL_BREAK - If one or more were not found.
+ *     TCL_ERROR - If there was an error.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SearchKeyRange (binSearchCB_t *searchCBPtr,
+                char         **keyv,
+                char        ***orderv,
+                int            first,
+                int            last,
+                off_t          low,
+                off_t          high,
+                Tcl_Obj      **valuev)
+{
+    int middle, keyIdx, status, rangeStatus;
+    off_t keyLow = low, keyHigh = high;
+
+    if (first > last)
+        return TCL_OK;
+    middle = (first + last) / 2;
+    keyIdx = (int) (orderv [middle] - keyv);
+
+    searchCBPtr->key = keyv [keyIdx];
+    searchCBPtr->keyLen = strlen (searchCBPtr->key);
+    searchCBPtr->lastRecOffset = -1;
+    if (searchCBPtr->indexPtr != NULL)
+        IndexWindow (searchCBPtr->indexPtr, searchCBPtr->key,
+                     searchCBPtr->keyLen, &keyLow, &keyHigh);
+    status = BinSearch (searchCBPtr, &keyLow, &keyHigh);
+    if (status == TCL_ERROR)
+        return TCL_ERROR;
+    if (status == TCL_OK) {
+        if ((searchCBPtr->filePtr != NULL) && !searchCBPtr->lineInBuf &&
+            (CachedLineToBuf (searchCBPtr,
+                              searchCBPtr->lastRecOffset) != TCL_OK))
+            return TCL_ERROR;
+        valuev [keyIdx] =
+            Tcl_NewStringObj (Tcl_DStringValue (&searchCBPtr->lineBuf),
+                              Tcl_DStringLength (&searchCBPtr->lineBuf));
+    }
+
+    rangeStatus = SearchKeyRange (searchCBPtr, keyv, orderv, first,
+                                  middle - 1, low, keyHigh, valuev);
+    if (rangeStatus != TCL_OK)
+        status = rangeStatus;
+    if (status == TCL_ERROR)
+        return TCL_ERROR;
+    rangeStatus = SearchKeyRange (searchCBPtr, keyv, orderv, middle + 1,
+                                  last, keyLow, high, valuev);
+    if (rangeStatus != TCL_OK)
+        status = rangeStatus;
+    return status;
+}
+
+/*-----------------------------------------------------------------------------
+ * SearchFileCloseHandler --
+ *    Release the cached blocks of a file when its channel is closed.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SearchFileCloseHandler (ClientData clientData)
+{
+    ReleaseSearchFile ((searchFile_t *) clientData);
+}
+
+/*-----------------------------------------------------------------------------
+ * ReleaseSearchFile --
+ *    Forget the cached blocks of a file.  They are freed once no search is
+ *    using them.
+ *-----------------------------------------------------------------------------
+ */
+static void
+ReleaseSearchFile (searchFile_t *filePtr)
+{
+    Tcl_DeleteCloseHandler (filePtr->channel, SearchFileCloseHandler,
+                            (ClientData) filePtr);
+    Tcl_DeleteHashEntry (filePtr->entryPtr);
+    filePtr->channel = NULL;
+    Tcl_EventuallyFree ((ClientData) filePtr, FreeSearchFile);
+}
+
+/*-----------------------------------------------------------------------------
+ * FreeSearchFile --
+ *    Free a searchFile_t.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FreeSearchFile (char *clientData)
+{
+    searchFile_t *filePtr = (searchFile_t *) clientData;
+
+    Tcl_FreeEncoding (filePtr->encoding);
+    ckfree ((char *) filePtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * NewSearchFile --
+ *    Allocate a searchFile_t with nothing cached.
+ *
+ * Parameters:
+ *   o channel (I) - The channel the file is read through.
+ *   o statBufPtr (I) - The file's status.
+ *   o crIsEol (I) - Does CR end a line?
+ *   o encoding (I) - The channel's encoding, owned by the searchFile_t.
+ * Results:
+ *   The searchFile_t.
+ *-----------------------------------------------------------------------------
+ */
+static searchFile_t *
+NewSearchFile (Tcl_Channel  channel,
+               struct stat *statBufPtr,
+               int          crIsEol,
+               Tcl_Encoding encoding)
+{
+    searchFile_t *filePtr;
+    int idx;
+
+    filePtr = (searchFile_t *) ckalloc (sizeof (searchFile_t));
+    filePtr->channel = channel;
+    filePtr->entryPtr = NULL;
+    filePtr->size = statBufPtr->st_size;
+    filePtr->statBuf = *statBufPtr;
+    filePtr->crIsEol = crIsEol;
+    filePtr->encoding = encoding;
+    for (idx = 0; idx < BSEARCH_PROBE_CACHE; idx++)
+        filePtr->cache [idx].probe = -1;
+    for (idx = 0; idx < BSEARCH_BLOCK_CACHE; idx++)
+        filePtr->blocks [idx].offset = -1;
+    return filePtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * GetSearchFile --
+ *    Get the cached blocks of the file open on a channel, starting a new
+ *    cache if there is none yet or the file has changed since the last
+ *    search.
+ *
+ * Parameters:
+ *   o interp (I) - The interpreter, its result is left unchanged.
+ *   o channel (I) - The channel being searched.
+ * Results:
+ *   The cached file, or NULL if the file must be read a line at a time
+ *   through the channel.
+ *-----------------------------------------------------------------------------
+ */
+static searchFile_t *
+GetSearchFile (Tcl_Interp *interp,
+               Tcl_Channel channel)
+{
+    bsearchInfo_t *infoPtr;
+    Tcl_HashTable *fileTablePtr;
+    Tcl_HashEntry *entryPtr;
+    searchFile_t *filePtr = NULL;
+    struct stat statBuf;
+    Tcl_Encoding encoding;
+    int crIsEol, newEntry, seekable;
+
+    infoPtr = (bsearchInfo_t *) Tcl_GetAssocData (interp, BSEARCH_ASSOC_KEY,
+                                                  NULL);
+    if (infoPtr == NULL)
+        return NULL;
+    fileTablePtr = &infoPtr->fileTable;
+
+    entryPtr = Tcl_FindHashEntry (fileTablePtr, (char *) channel);
+    if (entryPtr != NULL)
+        filePtr = (searchFile_t *) Tcl_GetHashValue (entryPtr);
+
+    /*
+     * A file also open for writing may have output waiting in the channel.
+     */
+    if ((Tcl_GetChannelMode (channel) & TCL_WRITABLE) ||
+        !TclX_GetMappedLineInfo (channel, &crIsEol, &encoding)) {
+        if (filePtr != NULL)
+            ReleaseSearchFile (filePtr);
+        return NULL;
+    }
+    if ((TclXOSSeekable (interp, channel, &seekable) != TCL_OK) ||
+        (TclXOSFstat (interp, channel, &statBuf, NULL) != TCL_OK)) {
+        Tcl_ResetResult (interp);
+        seekable = FALSE;
+    }
+    if (!seekable) {
+        if (filePtr != NULL)
+            ReleaseSearchFile (filePtr);
+        Tcl_FreeEncoding (encoding);
+        return NULL;
+    }
+
+    if (filePtr != NULL) {
+        if ((statBuf.st_size == filePtr->statBuf.st_size) &&
+            (statBuf.st_mtime == filePtr->statBuf.st_mtime) &&
+            (statBuf.st_ctime == filePtr->statBuf.st_ctime) &&
+            (statBuf.st_ino == filePtr->statBuf.st_ino) &&
+            (statBuf.st_dev == filePtr->statBuf.st_dev) &&
+            (crIsEol == filePtr->crIsEol) &&
+            (encoding == filePtr->encoding)) {
+            Tcl_FreeEncoding (encoding);
+            return filePtr;
+        }
+        ReleaseSearchFile (filePtr);
+    }
+
+    filePtr = NewSearchFile (channel, &statBuf, crIsEol, encoding);
+    filePtr->entryPtr = Tcl_CreateHashEntry (fileTablePtr, (char *) channel,
+                                             &newEntry);
+    Tcl_SetHashValue (filePtr->entryPtr, (ClientData) filePtr);
+    Tcl_CreateCloseHandler (channel, SearchFileCloseHandler,
+                            (ClientData) filePtr);
+    return filePtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * NewSearchIndex --
+ *    Allocate an empty searchIndex_t for a file.
+ *
+ * Parameters:
+ *   o statBufPtr (I) - The status of the file.
+ * Returns:
+ *   The index, with no entries.
+ *-----------------------------------------------------------------------------
+ */
+static searchIndex_t *
+NewSearchIndex (struct stat *statBufPtr)
+{
+    searchIndex_t *indexPtr;
+
+    indexPtr = (searchIndex_t *) ckalloc (sizeof (searchIndex_t));
+    memset (indexPtr, 0, sizeof (searchIndex_t));
+    indexPtr->fileSize = statBufPtr->st_size;
+    indexPtr->fileMtime = (off_t) statBufPtr->st_mtime;
+    indexPtr->fileMtimeNsec = TCLX_ST_MTIME_NSEC (statBufPtr);
+    indexPtr->fileIno = (off_t) statBufPtr->st_ino;
+    indexPtr->checked = time (NULL);
+    return indexPtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * SearchIndexCurrent --
+ *    Check that an index was made for a file as it is now.
+ *
+ * Parameters:
+ *   o indexPtr (I) - The index.
+ *   o statBufPtr (I) - The status of the file.
+ * Returns:
+ *   TRUE if the file's size, modification time and inode are those of the
+ *   index.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SearchIndexCurrent (searchIndex_t *indexPtr, struct stat *statBufPtr)
+{
+    return (indexPtr->fileSize == statBufPtr->st_size) &&
+        (indexPtr->fileMtime == (off_t) statBufPtr->st_mtime) &&
+        (indexPtr->fileMtimeNsec == TCLX_ST_MTIME_NSEC (statBufPtr)) &&
+        (indexPtr->fileIno == (off_t) statBufPtr->st_ino);
+}
+
+/*-----------------------------------------------------------------------------
+ * FreeSearchIndex --
+ *    Free a searchIndex_t.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FreeSearchIndex (searchIndex_t *indexPtr)
+{
+    if (indexPtr->encodingName != NULL)
+        ckfree (indexPtr->encodingName);
+    if (indexPtr->entries != NULL)
+        ckfree ((char *) indexPtr->entries);
+    if (indexPtr->keyBuf != NULL)
+        ckfree (indexPtr->keyBuf);
+    ckfree ((char *) indexPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * ScanOffset --
+ *    Scan a decimal file offset.
+ *
+ * Parameters:
+ *   o str (I) - The string to scan.
+ *   o offsetPtr (O) - The offset is returned here.
+ * Results:
+ *   A pointer to the character after the offset, or NULL if there were no
+ *   digits.
+ *-----------------------------------------------------------------------------
+ */
+static CONST char *
+ScanOffset (CONST char *str, off_t *offsetPtr)
+{
+    CONST char *scanPtr;
+    off_t offset = 0;
+
+    for (scanPtr = str; ISDIGIT (*scanPtr); scanPtr++)
+        offset = (offset * 10) + (*scanPtr - '0');
+    *offsetPtr = offset;
+    return (scanPtr == str) ? NULL : scanPtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * ReadSearchIndex --
+ *    Read an index file.
+ *
+ * Parameters:
+ *   o indexPath (I) - The index file.
+ *   o indexPtr (I/O) - The size, modification time and inode of the indexed
+ *     file are passed in here.  If the index matches them, the rest of it is
+ *     filled in.
+ * Results:
+ *   TRUE if the index was read, FALSE if it is missing, damaged or out of
+ *   date.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ReadSearchIndex (char *indexPath, searchIndex_t *indexPtr)
+{
+    Tcl_Channel channel;
+    Tcl_DString lineBuf, keyBuf;
+    CONST char **headerv, *scanPtr;
+    indexEntry_t *entryPtr;
+    off_t fileSize, fileMtime, fileMtimeNsec, fileIno, interval;
+    int headerc = 0, maxEntries = 0, numEntries = 0, ok = FALSE;
+
+    channel = Tcl_OpenFileChannel (NULL, indexPath, "r", 0);
+    if (channel == NULL)
+        return FALSE;
+    if ((Tcl_SetChannelOption (NULL, channel, "-encoding",
+                               "utf-8") != TCL_OK) ||
+        (Tcl_SetChannelOption (NULL, channel, "-translation",
+                               "lf") != TCL_OK)) {
+        Tcl_Close (NULL, channel);
+        return FALSE;
+    }
+    Tcl_DStringInit (&lineBuf);
+    Tcl_DStringInit (&keyBuf);
+
+    if ((Tcl_Gets (channel, &lineBuf) < 0) ||
+        (Tcl_SplitList (NULL, Tcl_DStringValue (&lineBuf), &headerc,
+                        &headerv) != TCL_OK))
+        goto exitPoint;
+    if ((headerc != 9) || !STREQU (headerv [0], BSX_MAGIC) ||
+        (atoi (headerv [1]) != BSX_VERSION) ||
+        (ScanOffset (headerv [2], &fileSize) == NULL) ||
+        (ScanOffset (headerv [3], &fileMtime) == NULL) ||
+        (ScanOffset (headerv [4], &fileMtimeNsec) == NULL) ||
+        (ScanOffset (headerv [5], &fileIno) == NULL) ||
+        (ScanOffset (headerv [6], &interval) == NULL) ||
+        !(STREQU (headerv [7], "auto") || STREQU (headerv [7], "lf")))
+        goto exitPoint;
+    if ((fileSize != indexPtr->fileSize) ||
+        (fileMtime != indexPtr->fileMtime) ||
+        (fileMtimeNsec != (off_t) indexPtr->fileMtimeNsec) ||
+        (fileIno != indexPtr->fileIno))
+        goto exitPoint;
+
+    indexPtr->entries = NULL;
+    while (TRUE) {
+        Tcl_DStringSetLength (&lineBuf, 0);
+        if (Tcl_Gets (channel, &lineBuf) < 0) {
+            if (!Tcl_Eof (channel))
+                goto exitPoint;
+            break;
+        }
+        if (numEntries == maxEntries) {
+            maxEntries = (maxEntries == 0) ? 256 : (maxEntries * 2);
+            indexPtr->entries = (indexEntry_t *)
+                ckrealloc ((char *) indexPtr->entries,
+                           maxEntries * sizeof (indexEntry_t));
+        }
+        entryPtr = &indexPtr->entries [numEntries];
+
+        /*
+         * Offsets must be in order and inside the file.
+         */
+        scanPtr = ScanOffset (Tcl_DStringValue (&lineBuf), &entryPtr->offset);
+        if ((scanPtr == NULL) || (entryPtr->offset >= fileSize) ||
+            ((numEntries > 0) && (entryPtr->offset <= entryPtr [-1].offset)))
+            goto exitPoint;
+        if ((scanPtr [0] != ' ') || ((scanPtr [1] != '0') &&
+                                     (scanPtr [1] != '1')) ||
+            (scanPtr [2] != ' '))
+            goto exitPoint;
+        entryPtr->truncated = (scanPtr [1] == '1');
+        scanPtr += 3;
+        entryPtr->keyStart = Tcl_DStringLength (&keyBuf);
+        entryPtr->keyLen = Tcl_DStringLength (&lineBuf) -
+            (scanPtr - Tcl_DStringValue (&lineBuf));
+        Tcl_DStringAppend (&keyBuf, scanPtr, entryPtr->keyLen);
+        numEntries++;
+    }
+
+    indexPtr->numEntries = numEntries;
+    indexPtr->crIsEol = STREQU (headerv [7], "auto");
+    indexPtr->encodingName = ckstrdup (headerv [8]);
+    indexPtr->keyBuf = ckalloc (Tcl_DStringLength (&keyBuf) + 1);
+    memcpy (indexPtr->keyBuf, Tcl_DStringValue (&keyBuf),
+            Tcl_DStringLength (&keyBuf) + 1);
+    ok = TRUE;
+
+  exitPoint:
+    if (!ok && (indexPtr->entries != NULL)) {
+        ckfree ((char *) indexPtr->entries);
+        indexPtr->entries = NULL;
+    }
+    if (headerc > 0)
+        ckfree ((char *) headerv);
+    Tcl_DStringFree (&lineBuf);
+    Tcl_DStringFree (&keyBuf);
+    Tcl_Close (NULL, channel);
+    return ok;
+}
+
+/*-----------------------------------------------------------------------------
+ * SetSearchIndex --
+ *    Set the index of a file in the interpreter's table of indexes,
+ *    replacing any index it had.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SetSearchIndex (bsearchInfo_t *infoPtr,
+                struct stat   *statBufPtr,
+                searchIndex_t *indexPtr)
+{
+    Tcl_HashEntry *entryPtr;
+    char idKey [64];
+    int newEntry;
+
+    sprintf (idKey, "%lu.%lu", (unsigned long) statBufPtr->st_dev,
+             (unsigned long) statBufPtr->st_ino);
+    entryPtr = Tcl_CreateHashEntry (&infoPtr->indexTable, idKey, &newEntry);
+    if (!newEntry)
+        FreeSearchIndex ((searchIndex_t *) Tcl_GetHashValue (entryPtr));
+    Tcl_SetHashValue (entryPtr, (ClientData) indexPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * GetSearchIndex --
+ *    Get the index of the file open on a channel, reading the index file if
+ *    the file has not been searched before or has changed since.
+ *
+ * Parameters:
+ *   o interp (I) - The interpreter, its result is left unchanged.
+ *   o channel (I) - The channel being searched.
+ *   o filePtr (I) - The cached file, or NULL if it is not cached.
+ * Results:
+ *   The index, or NULL if the file has no index that can be used with the
+ *   channel.
+ *-----------------------------------------------------------------------------
+ */
+static searchIndex_t *
+GetSearchIndex (Tcl_Interp   *interp,
+                Tcl_Channel   channel,
+                searchFile_t *filePtr)
+{
+    bsearchInfo_t *infoPtr;
+    Tcl_HashEntry *entryPtr;
+    searchIndex_t *indexPtr = NULL;
+    struct stat statBuf;
+    Tcl_Encoding encoding;
+    Tcl_DString indexPath;
+    char idKey [64];
+    int crIsEol;
+
+    infoPtr = (bsearchInfo_t *) Tcl_GetAssocData (interp, BSEARCH_ASSOC_KEY,
+                                                  NULL);
+    if (infoPtr == NULL)
+        return NULL;
+
+    if (filePtr != NULL) {
+        statBuf = filePtr->statBuf;
+        crIsEol = filePtr->crIsEol;
+        encoding = filePtr->encoding;
+    } else {
+        if (!TclX_GetMappedLineInfo (channel, &crIsEol, &encoding))
+            return NULL;
+        Tcl_FreeEncoding (encoding);  /* Still used by the channel */
+        if (TclXOSFstat (interp, channel, &statBuf, NULL) != TCL_OK) {
+            Tcl_ResetResult (interp);
+            return NULL;
+        }
+    }
+
+    sprintf (idKey, "%lu.%lu", (unsigned long) statBuf.st_dev,
+             (unsigned long) statBuf.st_ino);
+    entryPtr = Tcl_FindHashEntry (&infoPtr->indexTable, idKey);
+    if (entryPtr != NULL) {
+        indexPtr = (searchIndex_t *) Tcl_GetHashValue (entryPtr);
+        if (!SearchIndexCurrent (indexPtr, &statBuf) ||
+            ((indexPtr->encodingName == NULL) &&
+             (indexPtr->checked != time (NULL))))
+            indexPtr = NULL;
+    }
+
+    if (indexPtr == NULL) {
+        indexPtr = NewSearchIndex (&statBuf);
+
+        Tcl_DStringInit (&indexPath);
+        if (TclXOSGetChannelPath (channel, &indexPath)) {
+            Tcl_DStringAppend (&indexPath, BSX_SUFFIX, -1);
+            ReadSearchIndex (Tcl_DStringValue (&indexPath), indexPtr);
+        }
+        Tcl_DStringFree (&indexPath);
+        SetSearchIndex (infoPtr, &statBuf, indexPtr);
+    }
+
+    if ((indexPtr->encodingName == NULL) || (indexPtr->crIsEol != crIsEol) ||
+        !STREQU (indexPtr->encodingName, Tcl_GetEncodingName (encoding)))
+        return NULL;
+    return indexPtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * IndexKeyCompare --
+ *    Compare the key prefix of an index entry to a key.
+ *
+ * Results:
+ *   < 0 if the line's key is less than the key, > 0 if it is greater and 0
+ *   if it is equal or can't be told from the prefix.
+ *-----------------------------------------------------------------------------
+ */
+static int
+IndexKeyCompare (searchIndex_t *indexPtr,
+                 indexEntry_t  *entryPtr,
+                 CONST char    *key,
+                 int            keyLen)
+{
+    int cmpResult;
+
+    cmpResult = memcmp (indexPtr->keyBuf + entryPtr->keyStart, key,
+                        (entryPtr->keyLen < keyLen) ? entryPtr->keyLen :
+                        keyLen);
+    if (cmpResult != 0)
+        return cmpResult;
+    if (!entryPtr->truncated)
+        return entryPtr->keyLen - keyLen;
+    return (keyLen < entryPtr->keyLen) ? 1 : 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * IndexWindow --
+ *    Narrow a search window to the part of the file between the indexed
+ *    lines around a key.  The window is left unchanged where the index
+ *    doesn't narrow it.
+ *
+ * Parameters:
+ *   o indexPtr (I) - The file's index.
+ *   o key, keyLen (I) - The key.
+ *   o lowPtr, highPtr (I/O) - The window, as passed to BinSearch.
+ *-----------------------------------------------------------------------------
+ */
+static void
+IndexWindow (searchIndex_t *indexPtr,
+             CONST char    *key,
+             int            keyLen,
+             off_t         *lowPtr,
+             off_t         *highPtr)
+{
+    int low, high, middle;
+    off_t offset;
+
+    /*
+     * Find the last indexed line less than the key.  BinSearch treats an
+     * offset as less than the key if the line after it is.
+     */
+    low = 0;
+    high = indexPtr->numEntries;
+    while (low < high) {
+        middle = (low + high) / 2;
+        if (IndexKeyCompare (indexPtr, &indexPtr->entries [middle],
+                             key, keyLen) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low > 0) {
+        offset = indexPtr->entries [low - 1].offset;
+        offset = (offset > 0) ? (offset - 1) : 0;
+        if (offset > *lowPtr)
+            *lowPtr = offset;
+    }
+
+    /*
+     * Find the first indexed line greater than the key.  BinSearch probes
+     * the byte before it to find it, and would end its window before that.
+     */
+    high = indexPtr->numEntries;
+    while (low < high) {
+        middle = (low + high) / 2;
+        if (IndexKeyCompare (indexPtr, &indexPtr->entries [middle],
+                             key, keyLen) <= 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low < indexPtr->numEntries) {
+        offset = indexPtr->entries [low].offset - 2;
+        if (offset < *highPtr)
+            *highPtr = offset;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * BuildSearchIndex --
+ *    Write the index file for a sorted file and use it for searches in this
+ *    interpreter.  The index is written to a temporary file that is then
+ *    renamed, so searches in other processes never see part of an index.
+ *
+ * Parameters:
+ *   o interp (I) - Errors are returned here, otherwise the index file name.
+ *   o fileName (I) - The sorted file.
+ *   o interval (I) - Index every this many lines.
+ *   o encodingName (I) - Encoding the file is read with, NULL for the system
+ *     encoding.
+ *   o crIsEol (I) - Index lines as read with auto translation rather than lf.
+ * Results:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+BuildSearchIndex (Tcl_Interp *interp,
+                  char       *fileName,
+                  int         interval,
+                  char       *encodingName,
+                  int         crIsEol)
+{
+    bsearchInfo_t *infoPtr;
+    Tcl_Channel channel, indexChannel = NULL;
+    Tcl_Encoding encoding;
+    Tcl_DString lineBuf, rawBuf, keyBuf, indexPath, tmpPath;
+    Tcl_Obj *headerObj, *indexPathObj = NULL, *tmpPathObj = NULL;
+    searchFile_t *filePtr = NULL;
+    searchIndex_t *indexPtr;
+    struct stat statBuf;
+    CONST char *linePtr, *endPtr, *fieldPtr;
+    off_t lineNum = 0, lineStart, lineEnd, nextLine;
+    char offsetStr [64];
+    int keyLen, truncated, status = TCL_ERROR;
+
+    encoding = Tcl_GetEncoding (interp, encodingName);
+    if (encoding == NULL)
+        return TCL_ERROR;
+    Tcl_DStringInit (&lineBuf);
+    Tcl_DStringInit (&rawBuf);
+    Tcl_DStringInit (&keyBuf);
+    Tcl_DStringInit (&indexPath);
+    Tcl_DStringInit (&tmpPath);
+
+    channel = Tcl_OpenFileChannel (interp, fileName, "r", 0);
+    if (channel == NULL)
+        goto exitPoint;
+    if (TclXOSFstat (interp, channel, &statBuf, NULL) != TCL_OK) {
+        Tcl_Close (NULL, channel);
+        goto exitPoint;
+    }
+    filePtr = NewSearchFile (channel, &statBuf, crIsEol, NULL);
+
+    /*
+     * Name the index from the path the channel resolves to, as bsearch
+     * does, so it is found however the file is opened.
+     */
+    if (!TclXOSGetChannelPath (channel, &indexPath))
+        Tcl_DStringAppend (&indexPath, fileName, -1);
+    Tcl_DStringAppend (&indexPath, BSX_SUFFIX, -1);
+    Tcl_DStringAppend (&tmpPath, Tcl_DStringValue (&indexPath), -1);
+    Tcl_DStringAppend (&tmpPath, ".tmp", -1);
+    indexChannel = Tcl_OpenFileChannel (interp, Tcl_DStringValue (&tmpPath),
+                                        "w", 0666);
+    if (indexChannel == NULL)
+        goto exitPoint;
+    if ((Tcl_SetChannelOption (interp, indexChannel, "-encoding",
+                               "utf-8") != TCL_OK) ||
+        (Tcl_SetChannelOption (interp, indexChannel, "-translation",
+                               "lf") != TCL_OK))
+        goto exitPoint;
+
+    headerObj = Tcl_NewListObj (0, NULL);
+    Tcl_IncrRefCount (headerObj);
+    Tcl_ListObjAppendElement (NULL, headerObj, Tcl_NewStringObj (BSX_MAGIC,
+                                                                 -1));
+    Tcl_ListObjAppendElement (NULL, headerObj, Tcl_NewIntObj (BSX_VERSION));
+    Tcl_ListObjAppendElement (NULL, headerObj,
+                              Tcl_NewWideIntObj ((Tcl_WideInt)
+                                                 filePtr->size));
+    Tcl_ListObjAppendElement (NULL, headerObj,
+                              Tcl_NewWideIntObj ((Tcl_WideInt)
+                                                 statBuf.st_mtime));
+    Tcl_ListObjAppendElement (NULL, headerObj,
+                              Tcl_NewWideIntObj ((Tcl_WideInt)
+                                       TCLX_ST_MTIME_NSEC (&statBuf)));
+    Tcl_ListObjAppendElement (NULL, headerObj,
+                              Tcl_NewWideIntObj ((Tcl_WideInt)
+                                                 statBuf.st_ino));
+    Tcl_ListObjAppendElement (NULL, headerObj, Tcl_NewIntObj (interval));
+    Tcl_ListObjAppendElement (NULL, headerObj,
+                              Tcl_NewStringObj (crIsEol ? "auto" : "lf", -1));
+    Tcl_ListObjAppendElement (NULL, headerObj,
+                              Tcl_NewStringObj (Tcl_GetEncodingName (encoding),
+                                                -1));
+    Tcl_DStringAppend (&lineBuf, Tcl_GetStringFromObj (headerObj, NULL), -1);
+    Tcl_DStringAppend (&lineBuf, "\n", 1);
+    Tcl_DecrRefCount (headerObj);
+
+    /*
+     * Write the offset and key prefix of every interval'th line.
+     */
+    lineStart = 0;
+    while (lineStart < filePtr->size) {
+        if (FindLineEnd (interp, filePtr, lineStart, &lineEnd,
+                         &nextLine) != TCL_OK)
+            goto exitPoint;
+        if ((lineNum % interval) == 0) {
+            if (ReadFileBytes (interp, filePtr, lineStart, lineEnd,
+                               &rawBuf) != TCL_OK)
+                goto exitPoint;
+            linePtr = Tcl_DStringValue (&rawBuf);
+            endPtr = linePtr + Tcl_DStringLength (&rawBuf);
+            for (fieldPtr = linePtr; fieldPtr < endPtr; fieldPtr++) {
+                if (strchr (" \t\r\n\v\f", *fieldPtr) != NULL)
+                    break;
+            }
+            Tcl_DStringFree (&keyBuf);
+            Tcl_ExternalToUtfDString (encoding, linePtr,
+                                      (int) (fieldPtr - linePtr), &keyBuf);
+            keyLen = Tcl_DStringLength (&keyBuf);
+            truncated = (keyLen > BSX_KEY_MAX);
+            if (truncated) {
+                keyLen = BSX_KEY_MAX;
+                while ((keyLen > 0) &&
+                       ((Tcl_DStringValue (&keyBuf) [keyLen] & 0xC0) == 0x80))
+                    keyLen--;
+            }
+            sprintf (offsetStr, "%" TCL_LL_MODIFIER "d %d ",
+                     (Tcl_WideInt) lineStart, truncated);
+            Tcl_DStringAppend (&lineBuf, offsetStr, -1);
+            Tcl_DStringAppend (&lineBuf, Tcl_DStringValue (&keyBuf), keyLen);
+            Tcl_DStringAppend (&lineBuf, "\n", 1);
+            if (Tcl_DStringLength (&lineBuf) > 8192) {
+                if (Tcl_WriteChars (indexChannel, Tcl_DStringValue (&lineBuf),
+                                    Tcl_DStringLength (&lineBuf)) < 0)
+                    goto posixError;
+                Tcl_DStringSetLength (&lineBuf, 0);
+            }
+        }
+        lineNum++;
+        if (nextLine == lineEnd)
+            break;
+        lineStart = nextLine;
+    }
+    if (Tcl_WriteChars (indexChannel, Tcl_DStringValue (&lineBuf),
+                        Tcl_DStringLength (&lineBuf)) < 0)
+        goto posixError;
+    status = Tcl_Close (interp, indexChannel);
+    indexChannel = NULL;
+    if (status != TCL_OK)
+        goto exitPoint;
+    status = TCL_ERROR;
+
+    indexPathObj = Tcl_NewStringObj (Tcl_DStringValue (&indexPath), -1);
+    Tcl_IncrRefCount (indexPathObj);
+    tmpPathObj = Tcl_NewStringObj (Tcl_DStringValue (&tmpPath), -1);
+    Tcl_IncrRefCount (tmpPathObj);
+    if (Tcl_FSRenameFile (tmpPathObj, indexPathObj) != TCL_OK) {
+        Tcl_FSDeleteFile (indexPathObj);
+        if (Tcl_FSRenameFile (tmpPathObj, indexPathObj) != TCL_OK) {
+            TclX_AppendObjResult (interp, "can't rename \"",
+                                  Tcl_DStringValue (&tmpPath), "\": ",
+                                  Tcl_PosixError (interp), (char *) NULL);
+            goto exitPoint;
+        }
+    }
+
+    /*
+     * Use the index from now on.
+     */
+    infoPtr = (bsearchInfo_t *) Tcl_GetAssocData (interp, BSEARCH_ASSOC_KEY,
+                                                  NULL);
+    if (infoPtr != NULL) {
+        indexPtr = NewSearchIndex (&statBuf);
+        ReadSearchIndex (Tcl_DStringValue (&indexPath), indexPtr);
+        SetSearchIndex (infoPtr, &statBuf, indexPtr);
+    }
+
+    Tcl_SetObjResult (interp, indexPathObj);
+    status = TCL_OK;
+    goto exitPoint;
+
+  posixError:
+    TclX_AppendObjResult (interp, Tcl_DStringValue (&tmpPath), ": ",
+                          Tcl_PosixError (interp), (char *) NULL);
+
+  exitPoint:
+    if (indexChannel != NULL) {
+        Tcl_Close (NULL, indexChannel);
+        tmpPathObj = Tcl_NewStringObj (Tcl_DStringValue (&tmpPath), -1);
+        Tcl_IncrRefCount (tmpPathObj);
+        Tcl_FSDeleteFile (tmpPathObj);
+    }
+    if (filePtr != NULL) {
+        Tcl_Close (NULL, filePtr->channel);
+        ckfree ((char *) filePtr);
+    }
+    if (indexPathObj != NULL)
+        Tcl_DecrRefCount (indexPathObj);
+    if (tmpPathObj != NULL)
+        Tcl_DecrRefCount (tmpPathObj);
+    Tcl_FreeEncoding (encoding);
+    Tcl_DStringFree (&lineBuf);
+    Tcl_DStringFree (&rawBuf);
+    Tcl_DStringFree (&keyBuf);
+    Tcl_DStringFree (&indexPath);
+    Tcl_DStringFree (&tmpPath);
+    return status;
+}
+
+/*-----------------------------------------------------------------------------
+ * CompareKeyPtrs --
+ *    qsort function to order pointers to keys the way the standard
+ *    comparison does.
+ *-----------------------------------------------------------------------------
+ */
+static int
+CompareKeyPtrs (CONST VOID *left, CONST VOID *right)
+{
+    return strcmp (**((char ***) left), **((char ***) right));
+}
+
+/*-----------------------------------------------------------------------------
+ * CompareKeyPtrsNoCase, CompareKeyPtrsInteger, CompareKeyPtrsReal --
+ *    qsort functions to order pointers to keys the way the -nocase,
+ *    -integer and -real comparisons do.  The keys must have been checked
+ *    to be numbers.
+ *-----------------------------------------------------------------------------
+ */
+static int
+CompareKeyPtrsNoCase (CONST VOID *left, CONST VOID *right)
+{
+    int cmpResult = 0;
+
+    CompareValues (NULL, TCLX_BSEARCH_NOCASE, **((char ***) left),
+                   **((char ***) right), &cmpResult);
+    return cmpResult;
+}
+
+static int
+CompareKeyPtrsInteger (CONST VOID *left, CONST VOID *right)
+{
+    int cmpResult = 0;
+
+    CompareValues (NULL, TCLX_BSEARCH_INTEGER, **((char ***) left),
+                   **((char ***) right), &cmpResult);
+    return cmpResult;
+}
+
+static int
+CompareKeyPtrsReal (CONST VOID *left, CONST VOID *right)
+{
+    int cmpResult = 0;
+
+    CompareValues (NULL, TCLX_BSEARCH_REAL, **((char ***) left),
+                   **((char ***) right), &cmpResult);
+    return cmpResult;
+}
+
+/*-----------------------------------------------------------------------------
+ * InitSearchCB --
+ *    Set up a search control block for searching the file open on a
+ *    channel.  The file's blocks are cached and its index looked up if they
+ *    can be used.
+ *
+ * Parameters:
+ *   o searchCBPtr (O) - The search control block to set up.  It must be
+ *     freed with FreeSearchCB if TCL_OK is returned.
+ *   o interp (I) - Errors are returned here.
+ *   o channel (I) - Channel open for reading on the file.
+ *   o comparePtr (I) - How to compare keys to lines, or NULL for the
+ *     standard comparison.
+ *   o sizePtr (O) - The size of the file is returned here.
+ * Results:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+InitSearchCB (binSearchCB_t       *searchCBPtr,
+              Tcl_Interp          *interp,
+              Tcl_Channel          channel,
+              TclX_BsearchCompare *comparePtr,
+              off_t               *sizePtr)
+{
+    searchCBPtr->interp = interp;
+    searchCBPtr->channel = channel;
+    searchCBPtr->lowerBound = FALSE;
+    searchCBPtr->tclProc = NULL;
+    searchCBPtr->procObj = NULL;
+    searchCBPtr->keyObj = NULL;
+    searchCBPtr->keyObjKey = NULL;
+    searchCBPtr->compareFlags = 0;
+    searchCBPtr->field = 0;
+    searchCBPtr->separators = NULL;
+    if (comparePtr != NULL) {
+        searchCBPtr->tclProc = comparePtr->compareProc;
+        searchCBPtr->compareFlags = comparePtr->flags;
+        searchCBPtr->field = comparePtr->field;
+        searchCBPtr->separators = comparePtr->separators;
+    }
+    searchCBPtr->standardCompare = (searchCBPtr->tclProc == NULL) &&
+        (searchCBPtr->compareFlags == 0) && (searchCBPtr->field == 0) &&
+        (searchCBPtr->separators == NULL);
+
+    searchCBPtr->filePtr = GetSearchFile (interp, channel);
+    if (searchCBPtr->filePtr != NULL) {
+        *sizePtr = searchCBPtr->filePtr->size;
+    } else if (TclXOSGetFileSize (channel, sizePtr) != TCL_OK) {
+        TclX_AppendObjResult (interp, Tcl_GetChannelName (channel), ": ",
+                              Tcl_PosixError (interp), (char *) NULL);
+        return TCL_ERROR;
+    }
+    searchCBPtr->indexPtr = searchCBPtr->standardCompare ?
+        GetSearchIndex (interp, channel, searchCBPtr->filePtr) : NULL;
+
+    Tcl_DStringInit (&searchCBPtr->lineBuf);
+    Tcl_DStringInit (&searchCBPtr->rawBuf);
+    if (searchCBPtr->filePtr != NULL) {
+        searchCBPtr->readOffset = *sizePtr;
+        Tcl_Preserve ((ClientData) searchCBPtr->filePtr);
+    }
+    if (searchCBPtr->tclProc != NULL) {
+        searchCBPtr->procObj = Tcl_NewStringObj (searchCBPtr->tclProc, -1);
+        Tcl_IncrRefCount (searchCBPtr->procObj);
+    }
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * FreeSearchCB --
+ *    Free the resources held by a search control block.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FreeSearchCB (binSearchCB_t *searchCBPtr)
+{
+    if (searchCBPtr->filePtr != NULL)
+        Tcl_Release ((ClientData) searchCBPtr->filePtr);
+    if (searchCBPtr->procObj != NULL)
+        Tcl_DecrRefCount (searchCBPtr->procObj);
+    if (searchCBPtr->keyObj != NULL)
+        Tcl_DecrRefCount (searchCBPtr->keyObj);
+    Tcl_DStringFree (&searchCBPtr->lineBuf);
+    Tcl_DStringFree (&searchCBPtr->rawBuf);
+}
+
+/*-----------------------------------------------------------------------------
+ * TclX_BsearchKeys --
+ *    Search a sorted file for a number of keys.  With the standard
+ *    comparison, the keys are sorted and each key is searched for only in
+ *    the part of the file between the lines probed for the keys around it,
+ *    or between the lines the file's index puts it between.
+ *    With a compare proc, the order of the keys relative to the lines isn't
+ *    known, so each key is searched for over the whole file.
+ *
+ * Parameters:
+ *   o interp - Error message will be return in result if there is an error.
+ *   o channel - Channel open for reading on the file.
+ *   o keyc - Number of keys in keyv.
+ *   o keyv - The keys to search for.
+ *   o comparePtr - How to compare keys to lines, or NULL to compare them
+ *     as strings to the first field of the lines.
+ *   o valuev - Array of keyc elements.  A new object containing the line
+ *     found for each key is returned here, or NULL if the key was not found.
+ * Returns:
+ *   o TCL_OK - If all of the keys were found.
+ *   o TCL_BREAK - If one or more of the keys were not found.
+ *   o TCL_ERROR - If an error occured.  No lines are returned.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclX_BsearchKeys (Tcl_Interp          *interp,
+                  Tcl_Channel          channel,
+                  int                  keyc,
+                  char               **keyv,
+                  TclX_BsearchCompare *comparePtr,
+                  Tcl_Obj            **valuev)
+{
+    binSearchCB_t searchCB;
+    char **staticOrderv [16], ***orderv;
+    int idx, keyStatus, cmpResult, status = TCL_OK;
+    int (*compareKeyPtrs) (CONST VOID *, CONST VOID *);
+    off_t size;
+
+    for (idx = 0; idx < keyc; idx++)
+        valuev [idx] = NULL;
+
+    if (InitSearchCB (&searchCB, interp, channel, comparePtr,
+                      &size) != TCL_OK)
+        return TCL_ERROR;
+
+    orderv = (keyc > 16) ?
+        (char ***) ckalloc (keyc * sizeof (char **)) : staticOrderv;
+    for (idx = 0; idx < keyc; idx++)
+        orderv [idx] = &keyv [idx];
+
+    if (searchCB.tclProc == NULL) {
+        if (searchCB.compareFlags & TCLX_BSEARCH_INTEGER) {
+            compareKeyPtrs = CompareKeyPtrsInteger;
+        } else if (searchCB.compareFlags & TCLX_BSEARCH_REAL) {
+            compareKeyPtrs = CompareKeyPtrsReal;
+        } else if (searchCB.compareFlags & TCLX_BSEARCH_NOCASE) {
+            compareKeyPtrs = CompareKeyPtrsNoCase;
+        } else {
+            compareKeyPtrs = CompareKeyPtrs;
+        }
+        for (idx = 0; idx < keyc; idx++) {
+            if (CompareValues (interp, searchCB.compareFlags, keyv [idx],
+                               keyv [idx], &cmpResult) != TCL_OK)
+                goto errorExit;
+        }
+        qsort ((VOID *) orderv, keyc, sizeof (char **), compareKeyPtrs);
+        status = SearchKeyRange (&searchCB, keyv, orderv, 0, keyc - 1,
+                                 0, size, valuev);
+    } else {
+        for (idx = 0; (idx < keyc) && (status != TCL_ERROR); idx++) {
+            keyStatus = SearchKeyRange (&searchCB, keyv, orderv, idx, idx,
+                                        0, size, valuev);
+            if (keyStatus != TCL_OK)
+                status = keyStatus;
+        }
+    }
+    if (status == TCL_ERROR)
+        goto errorExit;
+
+    /*
+     * Leave the channel where reading it would have.
+     */
+    if ((searchCB.filePtr != NULL) &&
+        (Tcl_Seek (channel, searchCB.readOffset, SEEK_SET) < 0)) {
+        TclX_AppendObjResult (interp, Tcl_GetChannelName (channel), ": ",
+                              Tcl_PosixError (interp), (char *) NULL);
+        goto errorExit;
+    }
+
+  exitPoint:
+    FreeSearchCB (&searchCB);
+    if (orderv != staticOrderv)
+        ckfree ((char *) orderv);
+    return status;
+
+  errorExit:
+    for (idx = 0; idx < keyc; idx++) {
+        if (valuev [idx] != NULL) {
+            Tcl_DecrRefCount (valuev [idx]);
+            valuev [idx] = NULL;
+        }
+    }
+    status = TCL_ERROR;
+    goto exitPoint;
+}
+
+/*-----------------------------------------------------------------------------
+ * ReadRunLine --
+ *    Read the next line of a run of lines into the line buffer.
+ *
+ * Parameters:
+ *   o searchCBPtr (I/O) - The search control block.  A cached file is read
+ *     from readOffset, which is advanced past the line.
+ *   o lineStartPtr (O) - The offset of the start of the line is returned
+ *     here, or of the end of the file.
+ * Results:
+ *   TCL_OK, TCL_BREAK at the end of the file or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ReadRunLine (binSearchCB_t *searchCBPtr, off_t *lineStartPtr)
+{
+    searchFile_t *filePtr = searchCBPtr->filePtr;
+
+    if (filePtr != NULL) {
+        *lineStartPtr = searchCBPtr->readOffset;
+        if (*lineStartPtr >= filePtr->size)
+            return TCL_BREAK;
+        if (FindLineEnd (searchCBPtr->interp, filePtr, *lineStartPtr,
+                         &searchCBPtr->lineEnd,
+                         &searchCBPtr->readOffset) != TCL_OK)
+            return TCL_ERROR;
+        if (searchCBPtr->readOffset == *lineStartPtr)
+            return TCL_BREAK;  /* The file has shrunk. */
+        return CachedLineToBuf (searchCBPtr, *lineStartPtr);
+    }
+
+    *lineStartPtr = (off_t) Tcl_Tell (searchCBPtr->channel);
+    Tcl_DStringSetLength (&searchCBPtr->lineBuf, 0);
+    if (Tcl_Gets (searchCBPtr->channel, &searchCBPtr->lineBuf) < 0) {
+        if (Tcl_Eof (searchCBPtr->channel) ||
+            Tcl_InputBlocked (searchCBPtr->channel))
+            return TCL_BREAK;
+        TclX_AppendObjResult (searchCBPtr->interp,
+                              Tcl_GetChannelName (searchCBPtr->channel), ": ",
+                              Tcl_PosixError (searchCBPtr->interp),
+                              (char *) NULL);
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * CompareRunLine --
+ *    Compare a key to the line in the line buffer, leaving the result in
+ *    cmpResult.
+ *
+ * Results:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+CompareRunLine (binSearchCB_t *searchCBPtr, char *key)
+{
+    searchCBPtr->key = key;
+    if (LineKeyCompare (searchCBPtr) != TCL_OK)
+        return TCL_ERROR;
+    if ((searchCBPtr->filePtr != NULL) &&
+        (searchCBPtr->filePtr->channel == NULL)) {
+        TclX_AppendObjResult (searchCBPtr->interp,
+                              "file was closed by bsearch compare proc \"",
+                              searchCBPtr->tclProc, "\"", (char *) NULL);
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclX_BsearchRange --
+ *    Return the run of lines of a sorted file whose keys are in a range, or
+ *    start with a prefix.  The start of the run is found with a binary
+ *    search, then the lines are read in order until one is past the end of
+ *    the range.
+ *
+ * Parameters:
+ *   o interp - Error message will be return in result if there is an error.
+ *   o channel - Channel open for reading on the file.  It is left at the
+ *     start of the first line after those returned.
+ *   o lowKey - The lowest key of the range, or the prefix.
+ *   o highKey - The highest key of the range, or NULL to return the lines
+ *     whose first field starts with lowKey.
+ *   o comparePtr - How to compare keys to lines, or NULL to compare them
+ *     as strings to the first field of the lines.  With a prefix, it may
+ *     not have a compare proc or compare numbers.
+ *   o limit - The most lines to return, or -1 for no limit.
+ *   o linesObj - List object the lines are appended to.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclX_BsearchRange (Tcl_Interp          *interp,
+                   Tcl_Channel          channel,
+                   char                *lowKey,
+                   char                *highKey,
+                   TclX_BsearchCompare *comparePtr,
+                   int                  limit,
+                   Tcl_Obj             *linesObj)
+{
+    binSearchCB_t searchCB;
+    off_t size, low, high, lineStart;
+    int status, prefixLen, prefixChars, fieldLen, lineCount = 0;
+    int started = FALSE;
+    char *line;
+
+    if ((highKey == NULL) && (comparePtr != NULL) &&
+        ((comparePtr->compareProc != NULL) ||
+         (comparePtr->flags & (TCLX_BSEARCH_INTEGER | TCLX_BSEARCH_REAL)))) {
+        TclX_AppendObjResult (interp, "a prefix can't be searched for with ",
+                              "a compare proc, -integer or -real",
+                              (char *) NULL);
+        return TCL_ERROR;
+    }
+    if (InitSearchCB (&searchCB, interp, channel, comparePtr,
+                      &size) != TCL_OK)
+        return TCL_ERROR;
+    searchCB.lowerBound = TRUE;
+
+    /*
+     * Find the start of the run.  The search ends by comparing the line it
+     * starts at or the line before it, so the run is read from that line,
+     * or the one after if it is less than the low key.
+     */
+    searchCB.key = lowKey;
+    searchCB.keyLen = strlen (lowKey);
+    searchCB.lastRecOffset = -1;
+    low = 0;
+    high = size;
+    if (searchCB.indexPtr != NULL)
+        IndexWindow (searchCB.indexPtr, lowKey, searchCB.keyLen, &low, &high);
+    if (BinSearch (&searchCB, &low, &high) == TCL_ERROR)
+        goto errorExit;
+
+    if (searchCB.filePtr != NULL) {
+        if (searchCB.cmpResult <= 0)
+            searchCB.readOffset = searchCB.lastRecOffset;
+    } else if ((off_t) Tcl_Tell (channel) != searchCB.lastRecOffset) {
+        if ((searchCB.cmpResult <= 0) &&
+            (Tcl_Seek (channel, searchCB.lastRecOffset, SEEK_SET) < 0))
+            goto posixError;
+    } else if (searchCB.cmpResult > 0) {
+        if (ReadRunLine (&searchCB, &lineStart) == TCL_ERROR)
+            goto errorExit;
+    }
+
+    /*
+     * Read the run, skipping the lines before it.
+     */
+    prefixLen = searchCB.keyLen;
+    prefixChars = Tcl_NumUtfChars (lowKey, prefixLen);
+    while (lineCount != limit) {
+        status = ReadRunLine (&searchCB, &lineStart);
+        if (status == TCL_ERROR)
+            goto errorExit;
+        if (status == TCL_BREAK)
+            break;
+        line = Tcl_DStringValue (&searchCB.lineBuf);
+        if (!started) {
+            if (CompareRunLine (&searchCB, lowKey) != TCL_OK)
+                goto errorExit;
+            if (searchCB.cmpResult > 0)
+                continue;
+            started = TRUE;
+        }
+        if (highKey != NULL) {
+            if (CompareRunLine (&searchCB, highKey) != TCL_OK)
+                goto errorExit;
+            if (searchCB.cmpResult < 0)
+                break;
+        } else {
+            line = FindField (&searchCB, line, &fieldLen);
+            if (searchCB.compareFlags & TCLX_BSEARCH_NOCASE) {
+                if ((Tcl_NumUtfChars (line, fieldLen) < prefixChars) ||
+                    (Tcl_UtfNcasecmp (line, lowKey, prefixChars) != 0))
+                    break;
+            } else if ((fieldLen < prefixLen) ||
+                       (strncmp (line, lowKey, prefixLen) != 0)) {
+                break;
+            }
+            line = Tcl_DStringValue (&searchCB.lineBuf);
+        }
+        Tcl_ListObjAppendElement (NULL, linesObj,
+            Tcl_NewStringObj (line, Tcl_DStringLength (&searchCB.lineBuf)));
+        lineCount++;
+    }
+    if (lineCount == limit) {
+        lineStart = (searchCB.filePtr != NULL) ? searchCB.readOffset :
+            (off_t) Tcl_Tell (channel);
+    }
+
+    /*
+     * Leave the channel at the first line not returned.
+     */
+    if (((searchCB.filePtr != NULL) ||
+         ((off_t) Tcl_Tell (channel) != lineStart)) &&
+        (Tcl_Seek (channel, lineStart, SEEK_SET) < 0))
+        goto posixError;
+    status = TCL_OK;
+
+  exitPoint:
+    FreeSearchCB (&searchCB);
+    return status;
+
+  posixError:
+    TclX_AppendObjResult (interp, Tcl_GetChannelName (channel), ": ",
+                          Tcl_PosixError (interp), (char *) NULL);
+  errorExit:
+    status = TCL_ERROR;
+    goto exitPoint;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclX_BsearchObjCmd --
+ *     Implements the TCL bsearch command:
+ *        bsearch ?options? filehandle key ?retvar? ?compare_proc?
+ *        bsearch ?options? -keys keyList filehandle ?compare_proc?
+ *        bsearch ?options? -prefix prefix ?-limit count? filehandle
+ *        bsearch ?options? -range low high ?-limit count? filehandle
+ *                ?compare_proc?
+ *     The options are -nocase, -integer, -real, -field index and
+ *     -separator chars.
+ *-----------------------------------------------------------------------------
+ */
+static int
+TclX_BsearchObjCmd (ClientData clientData,
+                    Tcl_Interp *interp,
+                    int objc,
+                    Tcl_Obj *CONST objv[])
+{
+    TclX_BsearchCompare compare;
+    Tcl_Channel channel;
+    Tcl_Obj *keyListObj = NULL, *lowObj = NULL, *highObj = NULL;
+    Tcl_Obj **keyObjv, **valuev, *resultObj;
+    char *option, **keyv;
+    int argIdx, numArgs, keyObjc, idx, status, limit = -1;
+
+    compare.compareProc = NULL;
+    compare.flags = 0;
+    compare.field = 0;
+    compare.separators = NULL;
+
+    for (argIdx = 1; argIdx < objc; argIdx++) {
+        option = Tcl_GetStringFromObj (objv [argIdx], NULL);
+        if (option [0] != '-')
+            break;
+        if (STREQU (option, "-nocase")) {
+            compare.flags |= TCLX_BSEARCH_NOCASE;
+            continue;
+        } else if (STREQU (option, "-integer")) {
+            compare.flags |= TCLX_BSEARCH_INTEGER;
+            continue;
+        } else if (STREQU (option, "-real")) {
+            compare.flags |= TCLX_BSEARCH_REAL;
+            continue;
+        }
+        numArgs = STREQU (option, "-range") ? 2 : 1;
+        if (argIdx + numArgs >= objc)
+            goto argError;
+        if (STREQU (option, "-keys") && (lowObj == NULL)) {
+            keyListObj = objv [argIdx + 1];
+        } else if (STREQU (option, "-prefix") && (keyListObj == NULL) &&
+                   (lowObj == NULL)) {
+            lowObj = objv [argIdx + 1];
+        } else if (STREQU (option, "-range") && (keyListObj == NULL) &&
+                   (lowObj == NULL)) {
+            lowObj = objv [argIdx + 1];
+            highObj = objv [argIdx + 2];
+        } else if (STREQU (option, "-limit")) {
+            if (Tcl_GetIntFromObj (interp, objv [argIdx + 1],
+                                   &limit) != TCL_OK)
+                return TCL_ERROR;
+            if (limit < 0) {
+                TclX_AppendObjResult (interp, "limit must be at least 0, ",
+                                      "got \"", Tcl_GetStringFromObj (
+                                          objv [argIdx + 1], NULL),
+                                      "\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+        } else if (STREQU (option, "-field")) {
+            if (Tcl_GetIntFromObj (interp, objv [argIdx + 1],
+                                   &compare.field) != TCL_OK)
+                return TCL_ERROR;
+            if (compare.field < 0) {
+                TclX_AppendObjResult (interp, "field must be at least 0, ",
+                                      "got \"", Tcl_GetStringFromObj (
+                                          objv [argIdx + 1], NULL),
+                                      "\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+        } else if (STREQU (option, "-separator")) {
+            compare.separators = Tcl_GetStringFromObj (objv [argIdx + 1],
+                                                       NULL);
+            if (compare.separators [0] == '\0') {
+                TclX_AppendObjResult (interp, "separator characters may ",
+                                      "not be empty", (char *) NULL);
+                return TCL_ERROR;
+            }
+        } else {
+            goto argError;
+        }
+        argIdx += numArgs;
+    }
+
+    /*
+     * Count the arguments after the options: the handle, the key and retvar
+     * of a single key search, and the compare proc.
+     */
+    numArgs = objc - argIdx;
+    if ((numArgs < 1) || ((keyListObj == NULL) && (lowObj == NULL) &&
+                          ((numArgs < 2) || (numArgs > 4))) ||
+        ((keyListObj != NULL) && (numArgs > 2)) ||
+        ((lowObj != NULL) && (numArgs > ((highObj != NULL) ? 2 : 1))) ||
+        ((limit >= 0) && (lowObj == NULL)))
+        goto argError;
+    if ((compare.flags & TCLX_BSEARCH_INTEGER) &&
+        (compare.flags & TCLX_BSEARCH_REAL)) {
+        TclX_AppendObjResult (interp, "-integer and -real can't both be ",
+                              "given", (char *) NULL);
+        return TCL_ERROR;
+    }
+    if ((numArgs == ((keyListObj == NULL) && (lowObj == NULL) ? 4 : 2))) {
+        compare.compareProc = Tcl_GetStringFromObj (objv [objc - 1], NULL);
+        if ((compare.flags != 0) || (compare.field != 0) ||
+            (compare.separators != NULL)) {
+            TclX_AppendObjResult (interp, "a compare proc can't be used ",
+                                  "with -nocase, -integer, -real, -field ",
+                                  "or -separator", (char *) NULL);
+            return TCL_ERROR;
+        }
+    }
+
+    channel = TclX_GetOpenChannelObj (interp, objv [argIdx], TCL_READABLE);
+    if (channel == NULL)
+        return TCL_ERROR;
+
+    /*
+     * -prefix and -range return a list of the lines found.
+     */
+    if (lowObj != NULL) {
+        resultObj = Tcl_NewListObj (0, NULL);
+        if (TclX_BsearchRange (interp, channel,
+                               Tcl_GetStringFromObj (lowObj, NULL),
+                               (highObj == NULL) ? NULL :
+                               Tcl_GetStringFromObj (highObj, NULL),
+                               &compare, limit, resultObj) != TCL_OK) {
+            Tcl_DecrRefCount (resultObj);
+            return TCL_ERROR;
+        }
+        Tcl_SetObjResult (interp, resultObj);
+        return TCL_OK;
+    }
+
+    /*
+     * -keys returns a dictionary of the lines found, by key.
+     */
+    if (keyListObj != NULL) {
+        if (Tcl_ListObjGetElements (interp, keyListObj, &keyObjc,
+                                    &keyObjv) != TCL_OK)
+            return TCL_ERROR;
+        keyv = (char **) ckalloc ((keyObjc + 1) * sizeof (char *));
+        valuev = (Tcl_Obj **) ckalloc ((keyObjc + 1) * sizeof (Tcl_Obj *));
+        for (idx = 0; idx < keyObjc; idx++)
+            keyv [idx] = Tcl_GetStringFromObj (keyObjv [idx], NULL);
+
+        status = TclX_BsearchKeys (interp, channel, keyObjc, keyv, &compare,
+                                   valuev);
+        if (status != TCL_ERROR) {
+            resultObj = Tcl_NewDictObj ();
+            for (idx = 0; idx < keyObjc; idx++) {
+                if (valuev [idx] != NULL)
+                    Tcl_DictObjPut (NULL, resultObj, keyObjv [idx],
+                                    valuev [idx]);
+            }
+            Tcl_SetObjResult (interp, resultObj);
+            status = TCL_OK;
+        }
+        ckfree ((char *) keyv);
+        ckfree ((char *) valuev);
+        return status;
+    }
+
+    option = Tcl_GetStringFromObj (objv [argIdx + 1], NULL);
+    status = TclX_BsearchKeys (interp, channel, 1, &option, &compare,
+                               &resultObj);
+    if (status == TCL_ERROR)
+        return TCL_ERROR;
+
+    if (status == TCL_BREAK) {
+        if ((numArgs >= 3) && !TclX_IsNullObj (objv [argIdx + 2]))
+            Tcl_SetBooleanObj (Tcl_GetObjResult (interp), FALSE);
+        return TCL_OK;
+    }
+
+    if ((numArgs == 2) || TclX_IsNullObj (objv [argIdx + 2])) {
+        Tcl_SetObjResult (interp, resultObj);
+    } else {
+        if (Tcl_ObjSetVar2(interp, objv [argIdx + 2], NULL, resultObj,
+                           TCL_PARSE_PART1|TCL_LEAVE_ERR_MSG) == NULL)
+            return TCL_ERROR;
+        Tcl_SetBooleanObj (Tcl_GetObjResult (interp), TRUE);
+    }
+    return TCL_OK;
+
+  argError:
+    if (keyListObj != NULL) {
+        TclX_WrongArgs (interp, objv [0], "?options? -keys keyList handle "
+                        "?compare_proc?");
+    } else if (highObj != NULL) {
+        TclX_WrongArgs (interp, objv [0], "?options? -range low high "
+                        "?-limit count? handle ?compare_proc?");
+    } else if (lowObj != NULL) {
+        TclX_WrongArgs (interp, objv [0], "?options? -prefix prefix "
+                        "?-limit count? handle");
+    } else {
+        TclX_WrongArgs (interp, objv [0], "?options? handle key ?retvar? "
+                        "?compare_proc?");
+    }
+    return TCL_ERROR;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclX_BsearchIndexObjCmd --
+ *     Implements the TCL bsearch_index command:
+ *        bsearch_index build ?-interval lines? ?-encoding name?
+ *                            ?-translation auto|lf? file
+ *-----------------------------------------------------------------------------
+ */
+static int
+TclX_BsearchIndexObjCmd (ClientData clientData,
+                         Tcl_Interp *interp,
+                         int objc,
+                         Tcl_Obj *CONST objv[])
+{
+    char *option, *encodingName = NULL;
+    int argIdx, interval = BSX_DEFAULT_INTERVAL, crIsEol = TRUE;
+
+    if ((objc < 3) || !STREQU (Tcl_GetStringFromObj (objv [1], NULL),
+                               "build") || ((objc % 2) == 0))
+        goto argError;
+
+    for (argIdx = 2; argIdx < objc - 1; argIdx += 2) {
+        option = Tcl_GetStringFromObj (objv [argIdx], NULL);
+        if (STREQU (option, "-interval")) {
+            if (Tcl_GetIntFromObj (interp, objv [argIdx + 1],
+                                   &interval) != TCL_OK)
+                return TCL_ERROR;
+            if (interval < 1) {
+                TclX_AppendObjResult (interp, "index interval must be at ",
+                                      "least 1, got \"",
+                                      Tcl_GetStringFromObj (objv [argIdx + 1],
+                                                            NULL),
+                                      "\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+        } else if (STREQU (option, "-encoding")) {
+            encodingName = Tcl_GetStringFromObj (objv [argIdx + 1], NULL);
+        } else if (STREQU (option, "-translation")) {
+            option = Tcl_GetStringFromObj (objv [argIdx + 1], NULL);
+            if (STREQU (option, "auto")) {
+                crIsEol = TRUE;
+            } else if (STREQU (option, "lf")) {
+                crIsEol = FALSE;
+            } else {
+                TclX_AppendObjResult (interp, "translation must be \"auto\" ",
+                                      "or \"lf\", got \"", option, "\"",
+                                      (char *) NULL);
+                return TCL_ERROR;
+            }
+        } else {
+            goto argError;
+        }
+    }
+
+    return BuildSearchIndex (interp, Tcl_GetStringFromObj (objv [objc - 1],
+                                                           NULL),
+                             interval, encodingName, crIsEol);
+
+  argError:
+    TclX_WrongArgs (interp, objv [0],
+                    "build ?-interval lines? ?-encoding name? "
+                    "?-translation auto|lf? file");
+    return TCL_ERROR;
+}
+
+/*-----------------------------------------------------------------------------
+ * BsearchCleanUp --
+ *     Release the files cached by bsearch and the indexes read by it when the
+ *     interpreter is deleted.
+ *-----------------------------------------------------------------------------
+ */
+static void
+BsearchCleanUp (ClientData clientData, Tcl_Interp *interp)
+{
+    bsearchInfo_t *infoPtr = (bsearchInfo_t *) clientData;
+    Tcl_HashEntry *entryPtr;
+    Tcl_HashSearch search;
+
+    while ((entryPtr = Tcl_FirstHashEntry (&infoPtr->fileTable,
+                                           &search)) != NULL)
+        ReleaseSearchFile ((searchFile_t *) Tcl_GetHashValue (entryPtr));
+    Tcl_DeleteHashTable (&infoPtr->fileTable);
+
+    for (entryPtr = Tcl_FirstHashEntry (&infoPtr->indexTable, &search);
+         entryPtr != NULL; entryPtr = Tcl_NextHashEntry (&search))
+        FreeSearchIndex ((searchIndex_t *) Tcl_GetHashValue (entryPtr));
+    Tcl_DeleteHashTable (&infoPtr->indexTable);
+    ckfree ((char *) infoPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * TclX_BsearchInit --
+ *     Initialize the bsearch and bsearch_index commands.  bsearch_index
+ * opens, writes and deletes files by name, so it is left out of safe
+ * interpreters.
  *-----------------------------------------------------------------------------
  */
 void
 TclX_BsearchInit (Tcl_Interp *interp)
 {
+    bsearchInfo_t *infoPtr;
+
+    if (Tcl_GetAssocData (interp, BSEARCH_ASSOC_KEY, NULL) == NULL) {
+        infoPtr = (bsearchInfo_t *) ckalloc (sizeof (bsearchInfo_t));
+        Tcl_InitHashTable (&infoPtr->fileTable, TCL_ONE_WORD_KEYS);
+        Tcl_InitHashTable (&infoPtr->indexTable, TCL_STRING_KEYS);
+        Tcl_SetAssocData (interp, BSEARCH_ASSOC_KEY, BsearchCleanUp,
+                          (ClientData) infoPtr);
+    }
+
     Tcl_CreateObjCommand (interp, 
                           "bsearch",
                           TclX_BsearchObjCmd, 
                           (ClientData) NULL,
                           (Tcl_CmdDeleteProc*) NULL);
+    if (!Tcl_IsSafe (interp)) {
+        Tcl_CreateObjCommand (interp, 
+                              "bsearch_index",
+                              TclX_BsearchIndexObjCmd, 
+                              (ClientData) NULL,
+                              (Tcl_CmdDeleteProc*) NULL);
+    }
 }
 
 /* vim: set ts=4 sw=4 sts=4 et : */
@@ -27,19 +27,118 @@
 typedef struct matchDef_t {
     Tcl_RegExp          regExp;
     Tcl_Obj            *regExpObj;
-    Tcl_Obj            *command;
+    int                 regExpFlags;
+    Tcl_Obj            *command;        /* May be NULL if there are actions. */
+    int                 hasActions;     /* Any of the following are set. */
+    Tcl_Obj            *countVarObj;    /* -count variable name. */
+    long                pendingCount;   /* Matches not yet added to it. */
+    Tcl_Obj            *appendVarObj;   /* -append variable name. */
+    Tcl_Obj            *pendingAppend;  /* List of lines not yet appended. */
+    Tcl_Channel         copyToChannel;  /* -copyto channel. */
     struct matchDef_t  *nextMatchDefPtr;
 } matchDef_t;
 
+/*
+ * Literal prefilter for a context.  Each pattern that can only match a line
+ * containing some literal string has that string recorded here, so that a
+ * single pass over a line tells which patterns are worth running.  Literals
+ * are chained by their first byte, folded to lower case.  The filter is built
+ * the first time the context is scanned and discarded when a pattern is
+ * added; scans in progress hold a reference to the one they started with.
+ */
+typedef struct {
+    int   index;      /* Position of the pattern in the match list. */
+    int   nocase;     /* Compare ignoring ASCII case; bytes are lower case. */
+    char *bytes;      /* The literal, pointing into filter storage. */
+    int   length;
+    int   next;       /* Next literal with the same first byte, or -1. */
+} scanLiteral_t;
+
+typedef struct {
+    int            refCount;
+    int            numPatterns;   /* Patterns in the list when built. */
+    int            numLiterals;
+    char          *noLiteral;     /* Per pattern, TRUE if always run. */
+    int            firstByte [256];
+    scanLiteral_t  literals [1];  /* numLiterals entries, then the bytes. */
+} scanFilter_t;
+
 typedef struct scanContext_t {
-    matchDef_t  *matchListHead;
-    matchDef_t  *matchListTail;
-    Tcl_Obj     *defaultAction;
-    char         contextHandle [16];
-    Tcl_Channel  copyFileChannel;
-    int          fileOpen;
+    matchDef_t    *matchListHead;
+    matchDef_t    *matchListTail;
+    Tcl_Obj       *defaultAction;
+    char           contextHandle [16];
+    Tcl_Channel    copyFileChannel;
+    int            fileOpen;
+    scanFilter_t  *filterPtr;
+    int            actionsPending;  /* Some match has pending counts or
+                                       lines to store. */
+    struct scanFollow_t *followPtr; /* File being followed, or NULL. */
+    int            inUse;           /* Scans in progress with the context,
+                                       it can't be deleted. */
 } scanContext_t;
 
+/*
+ * A file being followed with scanfile -follow.  Lines appended to the file
+ * are scanned from the event loop, when the file is reported changed or
+ * on a timer.  A last line without a terminator is left until it is
+ * complete.  If the file is truncated, scanning starts again at the
+ * beginning; if a new file appears under the name, the rest of the old one
+ * is scanned and the new one is opened.
+ */
+#define SCAN_FOLLOW_INTERVAL 1000
+
+typedef struct scanFollow_t {
+    Tcl_Interp     *interp;
+    scanContext_t  *contextPtr;
+    Tcl_Channel     channel;       /* NULL once it is closed. */
+    int             ownChannel;    /* Opened after a rotation. */
+    Tcl_Obj        *fileNameObj;
+    Tcl_Obj        *matchVarObj;
+    Tcl_Obj        *checkpointVarObj;
+    int             numThreads;
+    int             clearCopyFile; /* Copy file was set with -copyfile. */
+    int             interval;      /* Poll interval in milliseconds. */
+    Tcl_TimerToken  timer;
+    VOID           *watchPtr;      /* Change notification, or NULL. */
+    int             atPath;        /* The name still refers to the file. */
+    long            lineNum;       /* Lines scanned in the file. */
+    int             scanning;      /* In FollowFile. */
+    int             rescan;        /* Changed while scanning. */
+    int             stop;          /* Stop when the scan is done. */
+} scanFollow_t;
+
+/*
+ * Number of patterns whose prefilter results fit in ScanFile's stack buffer.
+ */
+#define SCAN_STATIC_PATTERNS 64
+
+/*
+ * Size of the blocks a file is read in when its lines are split without
+ * going through the channel's gets.
+ */
+#define SCAN_BLOCK_SIZE (64 * 1024)
+
+#define SCAN_LOWER(c) ((((c) >= 'A') && ((c) <= 'Z')) ? ((c) + 'a' - 'A') : (c))
+
+/*
+ * Keys of a -matchvar dictionary.
+ */
+#define MATCHVAR_LINE         0
+#define MATCHVAR_OFFSET       1
+#define MATCHVAR_LINENUM      2
+#define MATCHVAR_CONTEXT      3
+#define MATCHVAR_HANDLE       4
+#define MATCHVAR_COPYHANDLE   5
+#define MATCHVAR_SUBMATCHES   6
+#define MATCHVAR_SUBINDICES   7
+#define MATCHVAR_NUM_KEYS     8
+
+static CONST char *matchVarKeys [MATCHVAR_NUM_KEYS] = {
+    "line", "offset", "linenum", "context", "handle", "copyHandle",
+    "submatches", "subindices"
+};
+
 /*
  * Data kept on a specific scan.
  */
@@ -48,16 +147,116 @@ typedef struct {
                                        matchInfo? */
     scanContext_t    *contextPtr;   /* Current scan context. */
     Tcl_Channel       channel;      /* The channel being scanned. */
-    char             *line;         /* The line from the file. */
-    Tcl_UniChar      *uniLine;      /* UniCode (wide) char line. */
-    int               uniLineLen;
+    Tcl_Obj          *lineObj;      /* The line from the file.  The unicode
+                                       rep is only built if a regexp runs. */
+    char             *buf;          /* Block of the file being split into
+                                       lines, or NULL if it is read through
+                                       the channel with gets. */
+    int               bufSize;      /* Allocated size of buf. */
+    off_t             bufOffset;    /* File offset of the first byte in buf. */
+    off_t             bufEnd;       /* File offset after the last byte. */
+    int               bufEof;       /* Reading after bufEnd found the end of
+                                       the file. */
+    int               completeLines; /* Leave a last line without a
+                                       terminator unread. */
+    int               follow;       /* Scanning a followed file, which is
+                                       always read with gets. */
+    int               stopped;      /* A command terminated the scan. */
+    off_t             nextOffset;   /* Offset of the next line in the file. */
+    int               crIsEol;      /* Auto translation: CR ends a line. */
+    Tcl_Encoding      encoding;     /* Channel encoding for block lines. */
     off_t             offset;       /* The offset into the file. */
     long              bytesRead;    /* Number of translated bytes read.*/
     long              lineNum;      /* Current scanned line in the file. */
     matchDef_t       *matchPtr;     /* The current match, or NULL for the
                                        default. */
+    Tcl_Obj          *matchVarObj;  /* -matchvar name, or NULL to set the
+                                       matchInfo array. */
+    int               matchVarSet;  /* Has it been set on this scan? */
+    Tcl_Obj          *matchKeys [MATCHVAR_NUM_KEYS];
+    Tcl_Obj          *contextObj;   /* Values that change rarely, shared */
+    Tcl_Obj          *handleObj;    /* by every match. */
+    Tcl_Channel       copyChannel;  /* Channel named by copyHandleObj. */
+    Tcl_Obj          *copyHandleObj;
 } scanData_t;
 
+/*
+ * Submatches in a -matchvar dictionary are stored as an object holding the
+ * line and the character range of each submatch.  The strings are only
+ * extracted if the value is used.  One object type makes the list of
+ * submatches, the other the list of their indices.
+ */
+typedef struct {
+    Tcl_Obj  *lineObj;
+    int       numSubs;
+    int       maxSubs;
+    int       ranges [2];   /* Start and end character of each submatch, end
+                               exclusive; -1 start if it did not match. */
+} subMatchRep_t;
+
+#define SUBMATCH_REP(objPtr) \
+    ((subMatchRep_t *) (objPtr)->internalRep.otherValuePtr)
+#define SUBMATCH_REP_SIZE(numSubs) \
+    (sizeof (subMatchRep_t) + \
+     (((numSubs) > 1) ? (2 * ((numSubs) - 1) * sizeof (int)) : 0))
+
+#ifdef TCL_THREADS
+/*
+ * Threaded scanning of a file read in blocks.  The file is read a window of
+ * SCAN_THREAD_BLOCK bytes per thread at a time, and the window is split at
+ * line boundaries into chunks that worker threads match, each with its own
+ * compiled copies of the patterns.  A worker records, for each line with a
+ * match (or every line if unmatched lines need handling), which patterns
+ * matched.  The interpreter's thread takes the chunks in file order and runs
+ * the match commands, so workers are kept at most a few chunks ahead.  The
+ * next window is read once every chunk of the last one is done.
+ */
+#define SCAN_MIN_CHUNK  (64 * 1024)
+#define SCAN_MAX_CHUNK  (4 * 1024 * 1024)
+#define SCAN_MAX_THREADS 64
+#define SCAN_THREAD_BLOCK (1024 * 1024)
+
+typedef struct {
+    off_t  offset;     /* Offset of the line in the file. */
+    int    lineLen;
+    int    eolLen;
+    long   lineNum;    /* Line number within the chunk, from one. */
+} scanHit_t;
+
+typedef struct {
+    off_t       start;       /* Byte range of the chunk. */
+    off_t       end;
+    int         done;        /* Set by the worker when finished. */
+    long        numLines;
+    int         numHits;
+    int         maxHits;
+    scanHit_t  *hits;
+    char       *matched;     /* numPatterns flags for each hit. */
+} scanChunk_t;
+
+typedef struct {
+    Tcl_Mutex       mutex;         /* Protects the following four and the
+                                      done flags of the chunks. */
+    int             nextChunk;     /* Next chunk for a worker to take. */
+    int             consumed;      /* Chunks finished by the interpreter. */
+    int             abort;         /* Set to stop the workers. */
+    int             numChunks;     /* Chunks in the current window. */
+    Tcl_Condition   cond;          /* Notified on any change of the above. */
+    CONST char     *buf;           /* The window, from file offset */
+    off_t           bufOffset;     /* bufOffset. */
+    int             crIsEol;
+    Tcl_Encoding    encoding;
+    scanFilter_t   *filterPtr;
+    int             numPatterns;
+    char          **patterns;      /* Pattern strings, for compiling. */
+    int            *regExpFlags;
+    int             recordAll;     /* Record lines that match nothing. */
+    int             window;        /* How far workers may run ahead. */
+    int             maxChunks;
+    scanChunk_t    *chunks;
+} scanWork_t;
+#endif
+
 /*
  * Prototypes of internal functions.
  */
@@ -86,6 +285,13 @@ TclX_ScancontextObjCmd (ClientData  clientData,
                         int         objc,
                         Tcl_Obj    *CONST objv[]);
 
+static void
+MatchCopyToCloseHandler (ClientData clientData);
+
+static int
+FlushMatchActions (Tcl_Interp    *interp,
+                   scanContext_t *contextPtr);
+
 static int
 TclX_ScanmatchObjCmd (ClientData  clientData,
                       Tcl_Interp *interp,
@@ -107,10 +313,190 @@ static int
 SetMatchInfoVar (Tcl_Interp *interp,
                  scanData_t *scanData);
 
+static void
+FreeSubMatchRep (Tcl_Obj *objPtr);
+
+static void
+DupSubMatchRep (Tcl_Obj *srcPtr,
+                Tcl_Obj *copyPtr);
+
+static void
+SetSubMatchString (Tcl_Obj *objPtr,
+                   Tcl_Obj *listObj);
+
+static void
+UpdateSubMatches (Tcl_Obj *objPtr);
+
+static void
+UpdateSubIndices (Tcl_Obj *objPtr);
+
+static Tcl_Obj *
+SetSubMatchObj (Tcl_Obj        *objPtr,
+                Tcl_ObjType    *typePtr,
+                Tcl_Obj        *lineObj,
+                Tcl_RegExpInfo *infoPtr);
+
+static void
+PutMatchVarWide (Tcl_Obj     *dictObj,
+                 Tcl_Obj     *keyObj,
+                 Tcl_WideInt  value);
+
+static int
+SetMatchVarObj (Tcl_Interp *interp,
+                scanData_t *scanData);
+
+static void
+InitMatchVar (scanData_t *scanData,
+              Tcl_Obj    *matchVarObj);
+
+static void
+EndMatchVar (scanData_t *scanData);
+
+static char *
+SkipBracket (char *p);
+
+static void
+EndLiteralRun (Tcl_DString *runPtr,
+               Tcl_DString *literalPtr);
+
+static int
+FindRequiredLiteral (char        *pattern,
+                     int          nocase,
+                     Tcl_DString *literalPtr);
+
+static scanFilter_t *
+BuildScanFilter (scanContext_t *contextPtr);
+
+static void
+ReleaseScanFilter (scanFilter_t *filterPtr);
+
+static void
+PrefilterLine (scanFilter_t *filterPtr,
+               CONST char   *line,
+               int           lineLen,
+               char         *runPattern);
+
+static int
+DoMatchActions (Tcl_Interp *interp,
+                scanData_t *scanData);
+
+static int
+EvalScanCommand (Tcl_Interp *interp,
+                 scanData_t *scanData,
+                 Tcl_Obj    *command);
+
+static int
+ScanLine (Tcl_Interp   *interp,
+          scanData_t   *scanData,
+          scanFilter_t *filterPtr,
+          char         *runPattern,
+          int           prefiltered);
+
+static void
+NextLineObj (scanData_t *scanData);
+
+static int
+StartBlockScan (Tcl_Interp *interp,
+                scanData_t *scanData);
+
+static int
+ReadScanBlock (Tcl_Interp *interp,
+               scanData_t *scanData,
+               int         size);
+
+static CONST char *
+FindLineEnd (CONST char *linePtr,
+             CONST char *endPtr,
+             int         crIsEol,
+             int        *eolLenPtr);
+
+static void
+SetLineFromBytes (Tcl_Obj      *lineObj,
+                  CONST char   *linePtr,
+                  int           lineLen,
+                  Tcl_Encoding  encoding,
+                  Tcl_DString  *utfBufPtr);
+
+static int
+ScanBlockLines (Tcl_Interp   *interp,
+                scanData_t   *scanData,
+                scanFilter_t *filterPtr,
+                char         *runPattern);
+
+static void
+EndBlockScan (scanData_t *scanData,
+              int         result);
+
+#ifdef TCL_THREADS
+static void
+ScanChunk (scanWork_t  *workPtr,
+           scanChunk_t *chunkPtr,
+           Tcl_RegExp  *regExps,
+           Tcl_Obj     *lineObj,
+           char        *runPattern,
+           Tcl_DString *utfBufPtr);
+
+static Tcl_ThreadCreateType
+ScanWorker (ClientData clientData);
+
+static int
+SplitScanWindow (scanWork_t *workPtr,
+                 scanData_t *scanData,
+                 int         numThreads);
+
+static int
+ScanThreaded (Tcl_Interp   *interp,
+              scanData_t   *scanData,
+              int           numThreads,
+              scanFilter_t *filterPtr,
+              char         *runPattern);
+#endif
+
+static int
+SetCheckpointVar (Tcl_Interp *interp,
+                  Tcl_Obj    *varNameObj,
+                  Tcl_Channel channel,
+                  long        lineNum);
+
+static int
+FollowScan (scanFollow_t *followPtr,
+            int           completeLines);
+
 static int
-ScanFile (Tcl_Interp    *interp,
-          scanContext_t *contextPtr,
-          Tcl_Channel    channel);
+FollowRotated (scanFollow_t *followPtr);
+
+static void
+FollowFile (scanFollow_t *followPtr);
+
+static void
+FollowTimerProc (ClientData clientData);
+
+static void
+FollowWatchProc (ClientData clientData,
+                 int        moved);
+
+static void
+FollowCloseHandler (ClientData clientData);
+
+static void
+StartFollow (Tcl_Interp    *interp,
+             scanContext_t *contextPtr,
+             Tcl_Channel    channel,
+             Tcl_Obj       *fileNameObj,
+             Tcl_Obj       *matchVarObj,
+             Tcl_Obj       *checkpointVarObj,
+             int            numThreads,
+             int            interval,
+             int            clearCopyFile,
+             long           lineNum);
+
+static void
+StopFollow (scanFollow_t *followPtr);
+
+static int
+ScanFile (Tcl_Interp *interp,
+          scanData_t *dataPtr,
+          int         numThreads);
 
 static void
 ScanFileCloseHandler (ClientData clientData);
@@ -125,6 +511,21 @@ static void
 FileScanCleanUp (ClientData  clientData,
                  Tcl_Interp *interp);
 
+static Tcl_ObjType subMatchesType = {
+    "scanSubmatches",         /* name */
+    FreeSubMatchRep,          /* freeIntRepProc */
+    DupSubMatchRep,           /* dupIntRepProc */
+    UpdateSubMatches,         /* updateStringProc */
+    NULL                      /* setFromAnyProc */
+};
+
+static Tcl_ObjType subIndicesType = {
+    "scanSubindices",         /* name */
+    FreeSubMatchRep,          /* freeIntRepProc */
+    DupSubMatchRep,           /* dupIntRepProc */
+    UpdateSubIndices,         /* updateStringProc */
+    NULL                      /* setFromAnyProc */
+};
 
 /*-----------------------------------------------------------------------------
  * CleanUpContext --
@@ -138,10 +539,24 @@ CleanUpContext (void_pt scanTablePtr, scanContext_t *contextPtr)
 {
     matchDef_t  *matchPtr, *oldMatchPtr;
 
+    if (contextPtr->followPtr != NULL)
+        StopFollow (contextPtr->followPtr);
+
     for (matchPtr = contextPtr->matchListHead; matchPtr != NULL;) {
         Tcl_DecrRefCount(matchPtr->regExpObj);
         if (matchPtr->command != NULL)
             Tcl_DecrRefCount (matchPtr->command);
+        if (matchPtr->countVarObj != NULL)
+            Tcl_DecrRefCount (matchPtr->countVarObj);
+        if (matchPtr->appendVarObj != NULL)
+            Tcl_DecrRefCount (matchPtr->appendVarObj);
+        if (matchPtr->pendingAppend != NULL)
+            Tcl_DecrRefCount (matchPtr->pendingAppend);
+        if (matchPtr->copyToChannel != NULL) {
+            Tcl_DeleteCloseHandler (matchPtr->copyToChannel,
+                                    MatchCopyToCloseHandler,
+                                    (ClientData) matchPtr);
+        }
         oldMatchPtr = matchPtr;
         matchPtr = matchPtr->nextMatchDefPtr;
         ckfree ((char *) oldMatchPtr);
@@ -149,6 +564,9 @@ CleanUpContext (void_pt scanTablePtr, scanContext_t *contextPtr)
     if (contextPtr->defaultAction != NULL) {
         Tcl_DecrRefCount (contextPtr->defaultAction);
     }
+    if (contextPtr->filterPtr != NULL) {
+        ReleaseScanFilter (contextPtr->filterPtr);
+    }
     ClearCopyFile (contextPtr);
     ckfree ((char *) contextPtr);
 }
@@ -170,6 +588,10 @@ ScanContextCreate (Tcl_Interp *interp, void_pt scanTablePtr)
     contextPtr->matchListTail = NULL;
     contextPtr->defaultAction = NULL;
     contextPtr->copyFileChannel = NULL;
+    contextPtr->filterPtr = NULL;
+    contextPtr->actionsPending = FALSE;
+    contextPtr->followPtr = NULL;
+    contextPtr->inUse = 0;
 
     tableEntryPtr = (scanContext_t **)
         TclX_HandleAlloc (scanTablePtr,
@@ -186,6 +608,8 @@ ScanContextCreate (Tcl_Interp *interp, void_pt scanTablePtr)
  *
  *   Deletes the specified scan context, implements the subcommand:
  *         scancontext delete contexthandle
+ * A context can't be deleted by the commands run while it is scanning a
+ * file, as the scan still uses it.
  *-----------------------------------------------------------------------------
  */
 static int
@@ -193,7 +617,7 @@ ScanContextDelete (Tcl_Interp *interp,
                    void_pt scanTablePtr,
                    Tcl_Obj *contextHandleObj)
 {
-    scanContext_t **tableEntryPtr;
+    scanContext_t **tableEntryPtr, *contextPtr;
     char           *contextHandle;
 
     contextHandle = Tcl_GetStringFromObj (contextHandleObj, NULL);
@@ -203,8 +627,18 @@ ScanContextDelete (Tcl_Interp *interp,
                                                          contextHandle);
     if (tableEntryPtr == NULL)
         return TCL_ERROR;
+    contextPtr = *tableEntryPtr;
+
+    if ((contextPtr->inUse > 0) ||
+        ((contextPtr->followPtr != NULL) &&
+         contextPtr->followPtr->scanning)) {
+        TclX_AppendObjResult (interp, "scan context \"", contextHandle,
+                              "\" can't be deleted while it is scanning ",
+                              "a file", (char *) NULL);
+        return TCL_ERROR;
+    }
 
-    CleanUpContext (scanTablePtr, *tableEntryPtr);
+    CleanUpContext (scanTablePtr, contextPtr);
     TclX_HandleFree (scanTablePtr, tableEntryPtr);
 
     return TCL_OK;
@@ -383,11 +817,26 @@ TclX_ScancontextObjCmd (ClientData clientData,
     return TCL_ERROR;
 }
 
+/*-----------------------------------------------------------------------------
+ * MatchCopyToCloseHandler --
+ *   Close handler for the -copyto channel of a match.  Turns off copying.
+ * Parameters:
+ *   o clientData (I) - Pointer to the match definition.
+ *-----------------------------------------------------------------------------
+ */
+static void
+MatchCopyToCloseHandler (ClientData clientData)
+{
+    ((matchDef_t *) clientData)->copyToChannel = NULL;
+}
+
 /*-----------------------------------------------------------------------------
  * TclX_ScanmatchObjCmd --
  *
  *   Implements the TCL command:
  *         scanmatch ?-nocase? contexthandle ?regexp? command
+ *         scanmatch ?-nocase? ?-count varName? ?-append varName?
+ *                   ?-copyto channel? contexthandle regexp ?command?
  *-----------------------------------------------------------------------------
  */
 static int
@@ -398,22 +847,49 @@ TclX_ScanmatchObjCmd (ClientData clientData,
     scanContext_t  *contextPtr, **tableEntryPtr;
     matchDef_t     *newmatch;
     int             regExpFlags = TCL_REG_ADVANCED;
-    int             firstArg = 1;
-
-    if (objc < 3)
-        goto argError;
-
-    if (STREQU (Tcl_GetStringFromObj (objv[1], NULL), "-nocase")) {
-        regExpFlags |= TCL_REG_NOCASE;
-        firstArg = 2;
+    int             firstArg, numArgs, hasActions = FALSE;
+    char           *option;
+    Tcl_Obj        *countVarObj = NULL, *appendVarObj = NULL;
+    Tcl_Channel     copyToChannel = NULL;
+
+    for (firstArg = 1; firstArg < objc; firstArg++) {
+        option = Tcl_GetStringFromObj (objv [firstArg], NULL);
+        if (STREQU (option, "-nocase")) {
+            regExpFlags |= TCL_REG_NOCASE;
+            continue;
+        }
+        if (!(STREQU (option, "-count") || STREQU (option, "-append") ||
+              STREQU (option, "-copyto")))
+            break;
+        if (firstArg + 1 >= objc)
+            goto argError;
+        firstArg++;
+        hasActions = TRUE;
+        if (STREQU (option, "-count")) {
+            countVarObj = objv [firstArg];
+        } else if (STREQU (option, "-append")) {
+            appendVarObj = objv [firstArg];
+        } else {
+            copyToChannel = TclX_GetOpenChannelObj (interp, objv [firstArg],
+                                                    TCL_WRITABLE);
+            if (copyToChannel == NULL)
+                return TCL_ERROR;
+        }
     }
+    numArgs = objc - firstArg;
       
     /*
-     * If firstArg == 2 (-nocase), the both a regular expression and a command
-     * string must be specified, otherwise the regular expression is optional.
+     * With -nocase or an action, a regular expression must be specified.
+     * The command is optional if there is an action, otherwise it is
+     * required.
      */
-    if (((firstArg == 2) && (objc != 5)) || ((firstArg == 1) && (objc > 4)))
+    if (hasActions) {
+        if ((numArgs != 2) && (numArgs != 3))
+            goto argError;
+    } else if ((regExpFlags & TCL_REG_NOCASE) ? (numArgs != 3) :
+               ((numArgs != 2) && (numArgs != 3))) {
         goto argError;
+    }
 
     tableEntryPtr = (scanContext_t **)
         TclX_HandleXlateObj (interp,
@@ -426,7 +902,7 @@ TclX_ScanmatchObjCmd (ClientData clientData,
     /*
      * Handle the default case (no regular expression).
      */
-    if (objc == 3) {
+    if ((numArgs == 2) && !hasActions) {
         if (contextPtr->defaultAction) {
             Tcl_AppendStringsToObj (Tcl_GetObjResult (interp),
                                     Tcl_GetStringFromObj (objv[0], NULL),
@@ -434,8 +910,8 @@ TclX_ScanmatchObjCmd (ClientData clientData,
                                     (char *) NULL);
             return TCL_ERROR;
         }
-	Tcl_IncrRefCount (objv [2]);
-        contextPtr->defaultAction = objv [2];
+	Tcl_IncrRefCount (objv [firstArg + 1]);
+        contextPtr->defaultAction = objv [firstArg + 1];
 
         return TCL_OK;
     }
@@ -455,8 +931,29 @@ TclX_ScanmatchObjCmd (ClientData clientData,
 
     newmatch->regExpObj = objv[firstArg + 1],
     Tcl_IncrRefCount (newmatch->regExpObj);
-    newmatch->command = objv [firstArg + 2];
-    Tcl_IncrRefCount (newmatch->command);
+    newmatch->regExpFlags = regExpFlags;
+    if (numArgs == 3) {
+        newmatch->command = objv [firstArg + 2];
+        Tcl_IncrRefCount (newmatch->command);
+    } else {
+        newmatch->command = NULL;
+    }
+
+    newmatch->hasActions = hasActions;
+    newmatch->countVarObj = countVarObj;
+    if (countVarObj != NULL)
+        Tcl_IncrRefCount (countVarObj);
+    newmatch->pendingCount = 0;
+    newmatch->appendVarObj = appendVarObj;
+    if (appendVarObj != NULL)
+        Tcl_IncrRefCount (appendVarObj);
+    newmatch->pendingAppend = NULL;
+    newmatch->copyToChannel = copyToChannel;
+    if (copyToChannel != NULL) {
+        Tcl_CreateCloseHandler (copyToChannel,
+                                MatchCopyToCloseHandler,
+                                (ClientData) newmatch);
+    }
 
     /*
      * Link in the new match.
@@ -468,156 +965,1884 @@ TclX_ScanmatchObjCmd (ClientData clientData,
         contextPtr->matchListTail->nextMatchDefPtr = newmatch;
     contextPtr->matchListTail = newmatch;
 
+    /*
+     * The prefilter no longer covers every pattern; rebuild on next scan.
+     */
+    if (contextPtr->filterPtr != NULL) {
+        ReleaseScanFilter (contextPtr->filterPtr);
+        contextPtr->filterPtr = NULL;
+    }
+
     return TCL_OK;
 
 argError:
     return TclX_WrongArgs (interp, objv [0],
-                           "?-nocase? contexthandle ?regexp? command");
+                           "?-nocase? ?-count varName? ?-append varName? ?-copyto channel? contexthandle ?regexp? ?command?");
 }
-
+
 /*-----------------------------------------------------------------------------
- * SetMatchInfoVar --
+ * FlushMatchActions --
  *
- *   Sets the Tcl array variable "matchInfo" to contain information about the
- * current match.  This function is optimize to store per line information
- * only once.
+ *   Store the counts and lines gathered by the -count and -append actions of
+ * a context's matches in their variables.  Done before any Tcl code that
+ * could look at them is evaluated and at the end of a scan.
  *
  * Parameters:
- *   o interp - The Tcl interpreter to set the matchInfo variable in.
- *     Errors are returned in result.
- *   o scanData - Data about the current line being scanned.
- *     been stored.
+ *   o interp - The Tcl interpreter.  Errors are returned in result.
+ *   o contextPtr - The scan context.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
  *-----------------------------------------------------------------------------
  */
 static int
-SetMatchInfoVar (Tcl_Interp *interp, scanData_t *scanData)
+FlushMatchActions (Tcl_Interp *interp, scanContext_t *contextPtr)
 {
-    static char *MATCHINFO = "matchInfo";
-    int idx, start, end;
-    char *value;
-    Tcl_DString valueBuf;
-    char key [32];
-    Tcl_Obj *valueObjPtr, *indexObjv [2];
-    Tcl_RegExpInfo regExpInfo;
-
-    Tcl_DStringInit(&valueBuf);
-
-    /*
-     * Save information about the current line, if it hasn't been saved.
-     */
-    if (!scanData->storedLine) {
-        scanData->storedLine = TRUE;
+    matchDef_t *matchPtr;
+    Tcl_Obj *valueObj, *pendingObj, **elemv;
+    Tcl_WideInt count, oldCount;
+    int elemc, length, status, result = TCL_OK;
 
-        Tcl_UnsetVar (interp, MATCHINFO, 0);
-        
-        if (Tcl_SetVar2 (interp, MATCHINFO, "line", scanData->line, 
-                         TCL_LEAVE_ERR_MSG) == NULL)
-            goto errorExit;
-
-        valueObjPtr = Tcl_NewLongObj ((long) scanData->offset);
-        if (Tcl_SetVar2Ex(interp, MATCHINFO, "offset", valueObjPtr,
-                          TCL_LEAVE_ERR_MSG) == NULL) {
-            Tcl_DecrRefCount (valueObjPtr);
-            goto errorExit;
+    if (!contextPtr->actionsPending)
+        return TCL_OK;
+    contextPtr->actionsPending = FALSE;
+
+    for (matchPtr = contextPtr->matchListHead; matchPtr != NULL;
+         matchPtr = matchPtr->nextMatchDefPtr) {
+        if (matchPtr->pendingCount > 0) {
+            count = matchPtr->pendingCount;
+            matchPtr->pendingCount = 0;
+            valueObj = Tcl_ObjGetVar2 (interp, matchPtr->countVarObj, NULL, 0);
+            if (valueObj != NULL) {
+                if (Tcl_GetWideIntFromObj (interp, valueObj,
+                                           &oldCount) != TCL_OK) {
+                    result = TCL_ERROR;
+                    continue;
+                }
+                count += oldCount;
+            }
+            if (Tcl_ObjSetVar2 (interp, matchPtr->countVarObj, NULL,
+                                Tcl_NewWideIntObj (count),
+                                TCL_LEAVE_ERR_MSG) == NULL)
+                result = TCL_ERROR;
         }
-
-#if 0
-        /*
-         * FIX: Don't expose till we decide on semantics: Should it include the
-         * current line?  All the pieces are here, include doc and tests, just
-         * disabled.
-         */
-        valueObjPtr = Tcl_NewLongObj ((long) scanData->bytesRead);
-        if (Tcl_SetObjVar2 (interp, MATCHINFO, "bytesread", valueObjPtr,
-                            TCL_LEAVE_ERR_MSG) == NULL) {
-            Tcl_DecrRefCount (valueObjPtr);
-            goto errorExit;
+        if (matchPtr->pendingAppend != NULL) {
+            pendingObj = matchPtr->pendingAppend;
+            matchPtr->pendingAppend = NULL;
+            status = TCL_OK;
+            valueObj = Tcl_ObjGetVar2 (interp, matchPtr->appendVarObj, NULL, 0);
+            if (valueObj == NULL) {
+                valueObj = pendingObj;
+            } else {
+                if (Tcl_IsShared (valueObj))
+                    valueObj = Tcl_DuplicateObj (valueObj);
+                Tcl_ListObjGetElements (NULL, pendingObj, &elemc, &elemv);
+                status = Tcl_ListObjLength (interp, valueObj, &length);
+                if (status == TCL_OK)
+                    status = Tcl_ListObjReplace (interp, valueObj, length, 0,
+                                                 elemc, elemv);
+            }
+            Tcl_IncrRefCount (valueObj);
+            if ((status != TCL_OK) ||
+                (Tcl_ObjSetVar2 (interp, matchPtr->appendVarObj, NULL,
+                                 valueObj, TCL_LEAVE_ERR_MSG) == NULL))
+                result = TCL_ERROR;
+            Tcl_DecrRefCount (valueObj);
+            Tcl_DecrRefCount (pendingObj);
         }
-#endif
-        valueObjPtr = Tcl_NewIntObj ((long) scanData->lineNum);
-        if (Tcl_SetVar2Ex(interp, MATCHINFO, "linenum", valueObjPtr,
-                          TCL_LEAVE_ERR_MSG) == NULL) {
-            Tcl_DecrRefCount (valueObjPtr);
-            goto errorExit;
+    }
+    if (result == TCL_ERROR) {
+        Tcl_AddObjErrorInfo (interp,
+            "\n    while storing the result of a match action", -1);
+    }
+    return result;
+}
+
+/*-----------------------------------------------------------------------------
+ * SkipBracket --
+ *
+ *   Skip over a bracket expression in a regular expression.
+ *
+ * Parameters:
+ *   o p - Pointer to the opening `['.
+ * Returns:
+ *   Pointer to the character following the closing `]'.
+ *-----------------------------------------------------------------------------
+ */
+static char *
+SkipBracket (char *p)
+{
+    char delim;
+
+    p++;
+    if (*p == '^')
+        p++;
+    if (*p == ']')
+        p++;
+    while ((*p != '\0') && (*p != ']')) {
+        if ((p [0] == '[') &&
+            ((p [1] == ':') || (p [1] == '.') || (p [1] == '='))) {
+            delim = p [1];
+            p += 2;
+            while ((*p != '\0') && !((p [0] == delim) && (p [1] == ']')))
+                p++;
+            if (*p != '\0')
+                p += 2;
+        } else if ((p [0] == '\\') && (p [1] != '\0')) {
+            p += 2;
+        } else {
+            p++;
         }
+    }
+    if (*p == ']')
+        p++;
+    return p;
+}
 
-        if (Tcl_SetVar2 (interp, MATCHINFO, "context",
-                         scanData->contextPtr->contextHandle,
-                         TCL_LEAVE_ERR_MSG) == NULL)
-            goto errorExit;
+/*-----------------------------------------------------------------------------
+ * EndLiteralRun --
+ *
+ *   Finish a run of literal characters, keeping it if it is the longest seen.
+ *-----------------------------------------------------------------------------
+ */
+static void
+EndLiteralRun (Tcl_DString *runPtr, Tcl_DString *literalPtr)
+{
+    if (Tcl_DStringLength (runPtr) > Tcl_DStringLength (literalPtr)) {
+        Tcl_DStringSetLength (literalPtr, 0);
+        Tcl_DStringAppend (literalPtr, Tcl_DStringValue (runPtr),
+                           Tcl_DStringLength (runPtr));
+    }
+    Tcl_DStringSetLength (runPtr, 0);
+}
 
-        if (Tcl_SetVar2 (interp, MATCHINFO, "handle", 
-                         Tcl_GetChannelName (scanData->channel),
-                         TCL_LEAVE_ERR_MSG) == NULL)
-            goto errorExit;
+/*-----------------------------------------------------------------------------
+ * FindRequiredLiteral --
+ *
+ *   Find a literal string that must appear in any line matched by a regular
+ * expression.  Only runs of ordinary characters outside of any group are
+ * considered, and a pattern with an alternative at the top level has none.
+ * This is deliberately conservative: anything not understood ends the run
+ * or gives up, which only costs running the regexp.
+ *
+ * Parameters:
+ *   o pattern - The advanced regular expression.
+ *   o nocase - TRUE if the pattern ignores case.  The literal is returned
+ *     in lower case and may contain only ASCII characters.
+ *   o literalPtr - Initialized dynamic string the longest literal is
+ *     returned in.
+ * Returns:
+ *   TRUE if a literal was found, FALSE if not.
+ *-----------------------------------------------------------------------------
+ */
+static int
+FindRequiredLiteral (char *pattern, int nocase, Tcl_DString *literalPtr)
+{
+    Tcl_DString run;
+    char *p, *nextPtr;
+    int depth = 0;
 
-    }
+    Tcl_DStringSetLength (literalPtr, 0);
 
-    if (scanData->contextPtr->copyFileChannel != NULL) {
-        if (Tcl_SetVar2 (interp, MATCHINFO, "copyHandle", 
-                         Tcl_GetChannelName (scanData->contextPtr->copyFileChannel),
-                         TCL_LEAVE_ERR_MSG) == NULL)
-            goto errorExit;
+    /*
+     * Handle the ARE director prefixes.  "***=" makes the rest a literal.
+     */
+    p = pattern;
+    if (strncmp (p, "***=", 4) == 0) {
+        for (p += 4; *p != '\0'; p++) {
+            if (nocase && (UCHAR (*p) >= 0x80)) {
+                Tcl_DStringSetLength (literalPtr, 0);
+                return FALSE;
+            }
+            Tcl_DStringAppend (literalPtr, p, 1);
+            if (nocase)
+                Tcl_DStringValue (literalPtr) [Tcl_DStringLength (literalPtr) - 1] =
+                    SCAN_LOWER (*p);
+        }
+        return (Tcl_DStringLength (literalPtr) > 0);
     }
-
-    if (scanData->matchPtr == NULL) {
-        goto exitPoint;
+    if (strncmp (p, "***:", 4) == 0) {
+        p += 4;
+    } else if (strncmp (p, "***", 3) == 0) {
+        return FALSE;
     }
+    if ((p [0] == '(') && (p [1] == '?'))
+        return FALSE;  /* Embedded options */
 
-    Tcl_RegExpGetInfo(scanData->matchPtr->regExp, &regExpInfo);
-    for (idx = 0; idx < regExpInfo.nsubs; idx++) {
-	start = regExpInfo.matches[idx+1].start;
-	end = regExpInfo.matches[idx+1].end;
+    Tcl_DStringInit (&run);
+    while (*p != '\0') {
+        /*
+         * Inside a group: just find its end.
+         */
+        if (depth > 0) {
+            if ((p [0] == '\\') && (p [1] != '\0')) {
+                p += 2;
+            } else if (*p == '[') {
+                p = SkipBracket (p);
+            } else {
+                if (*p == '(')
+                    depth++;
+                else if (*p == ')')
+                    depth--;
+                p++;
+            }
+            continue;
+        }
 
-        sprintf (key, "subindex%d", idx);
+        switch (*p) {
+          case '|':
+            Tcl_DStringFree (&run);
+            Tcl_DStringSetLength (literalPtr, 0);
+            return FALSE;
+          case '\\':
+            if (p [1] == '\0') {
+                p++;
+            } else if (isalnum (UCHAR (p [1])) || (UCHAR (p [1]) >= 0x80)) {
+                /* Class, constraint, back reference or character entry. */
+                EndLiteralRun (&run, literalPtr);
+                p = (char *) Tcl_UtfNext (p + 1);
+            } else {
+                Tcl_DStringAppend (&run, p + 1, 1);
+                p += 2;
+            }
+            break;
+          case '[':
+            EndLiteralRun (&run, literalPtr);
+            p = SkipBracket (p);
+            break;
+          case '(':
+            EndLiteralRun (&run, literalPtr);
+            depth++;
+            p++;
+            break;
+          case '*':
+          case '?':
+          case '{':
+            /*
+             * The preceding character is optional.
+             */
+            if (Tcl_DStringLength (&run) > 0) {
+                nextPtr = (char *) Tcl_UtfPrev (Tcl_DStringValue (&run) +
+                                                Tcl_DStringLength (&run),
+                                                Tcl_DStringValue (&run));
+                Tcl_DStringSetLength (&run,
+                                      nextPtr - Tcl_DStringValue (&run));
+            }
+            EndLiteralRun (&run, literalPtr);
+            if (*p == '{') {
+                while ((*p != '\0') && (*p != '}'))
+                    p++;
+            }
+            if (*p != '\0')
+                p++;
+            break;
+          case '+':
+          case ')':
+          case '.':
+          case '^':
+          case '$':
+            EndLiteralRun (&run, literalPtr);
+            p++;
+            break;
+          default:
+            nextPtr = (char *) Tcl_UtfNext (p);
+            if (nocase && (UCHAR (*p) >= 0x80)) {
+                EndLiteralRun (&run, literalPtr);
+            } else if (nocase) {
+                Tcl_DStringAppend (&run, p, 1);
+                Tcl_DStringValue (&run) [Tcl_DStringLength (&run) - 1] =
+                    SCAN_LOWER (*p);
+            } else {
+                Tcl_DStringAppend (&run, p, nextPtr - p);
+            }
+            p = nextPtr;
+            break;
+        }
+    }
+    EndLiteralRun (&run, literalPtr);
+    Tcl_DStringFree (&run);
+    return (Tcl_DStringLength (literalPtr) > 0);
+}
+
+/*-----------------------------------------------------------------------------
+ * BuildScanFilter --
+ *
+ *   Build the literal prefilter for the patterns of a scan context.
+ *
+ * Parameters:
+ *   o contextPtr - The scan context.
+ * Returns:
+ *   The new filter, with a reference count of one.
+ *-----------------------------------------------------------------------------
+ */
+static scanFilter_t *
+BuildScanFilter (scanContext_t *contextPtr)
+{
+    scanFilter_t *filterPtr;
+    scanLiteral_t *litPtr;
+    matchDef_t *matchPtr;
+    Tcl_DString literal, store;
+    int numPatterns, numLiterals, idx, first, nocase, *offsets, *lengths;
+    char *bytes;
+
+    numPatterns = 0;
+    for (matchPtr = contextPtr->matchListHead; matchPtr != NULL;
+         matchPtr = matchPtr->nextMatchDefPtr)
+        numPatterns++;
+
+    /*
+     * Collect the literals end to end, remembering where each one starts.
+     */
+    offsets = (int *) ckalloc (2 * numPatterns * sizeof (int));
+    lengths = offsets + numPatterns;
+    Tcl_DStringInit (&literal);
+    Tcl_DStringInit (&store);
+    numLiterals = 0;
+    for (idx = 0, matchPtr = contextPtr->matchListHead; matchPtr != NULL;
+         idx++, matchPtr = matchPtr->nextMatchDefPtr) {
+        nocase = (matchPtr->regExpFlags & TCL_REG_NOCASE) != 0;
+        if (FindRequiredLiteral (Tcl_GetStringFromObj (matchPtr->regExpObj,
+                                                       NULL),
+                                 nocase, &literal)) {
+            offsets [idx] = Tcl_DStringLength (&store);
+            lengths [idx] = Tcl_DStringLength (&literal);
+            Tcl_DStringAppend (&store, Tcl_DStringValue (&literal),
+                               Tcl_DStringLength (&literal));
+            numLiterals++;
+        } else {
+            offsets [idx] = -1;
+        }
+    }
+
+    filterPtr = (scanFilter_t *)
+        ckalloc (sizeof (scanFilter_t) +
+                 (numLiterals * sizeof (scanLiteral_t)) +
+                 numPatterns + Tcl_DStringLength (&store));
+    filterPtr->refCount = 1;
+    filterPtr->numPatterns = numPatterns;
+    filterPtr->numLiterals = numLiterals;
+    filterPtr->noLiteral = (char *) &filterPtr->literals [numLiterals];
+    bytes = filterPtr->noLiteral + numPatterns;
+    memcpy (bytes, Tcl_DStringValue (&store), Tcl_DStringLength (&store));
+    for (idx = 0; idx < 256; idx++)
+        filterPtr->firstByte [idx] = -1;
+
+    litPtr = filterPtr->literals;
+    for (idx = 0, matchPtr = contextPtr->matchListHead; matchPtr != NULL;
+         idx++, matchPtr = matchPtr->nextMatchDefPtr) {
+        filterPtr->noLiteral [idx] = (offsets [idx] < 0);
+        if (offsets [idx] < 0)
+            continue;
+        litPtr->index = idx;
+        litPtr->nocase = (matchPtr->regExpFlags & TCL_REG_NOCASE) != 0;
+        litPtr->bytes = bytes + offsets [idx];
+        litPtr->length = lengths [idx];
+        first = SCAN_LOWER (UCHAR (litPtr->bytes [0]));
+        litPtr->next = filterPtr->firstByte [first];
+        filterPtr->firstByte [first] = litPtr - filterPtr->literals;
+        litPtr++;
+    }
+
+    Tcl_DStringFree (&literal);
+    Tcl_DStringFree (&store);
+    ckfree ((char *) offsets);
+    return filterPtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * ReleaseScanFilter --
+ *
+ *   Release a reference to a prefilter, freeing it if it was the last.
+ *-----------------------------------------------------------------------------
+ */
+static void
+ReleaseScanFilter (scanFilter_t *filterPtr)
+{
+    filterPtr->refCount--;
+    if (filterPtr->refCount <= 0)
+        ckfree ((char *) filterPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * PrefilterLine --
+ *
+ *   Find the patterns that could match a line, in one pass over the line.
+ *
+ * Parameters:
+ *   o filterPtr - The prefilter for the context.
+ *   o line, lineLen - The line being scanned.
+ *   o runPattern - Array of filterPtr->numPatterns flags, set to TRUE for
+ *     each pattern whose regexp must be run.
+ *-----------------------------------------------------------------------------
+ */
+static void
+PrefilterLine (scanFilter_t *filterPtr,
+               CONST char *line,
+               int lineLen,
+               char *runPattern)
+{
+    scanLiteral_t *litPtr;
+    CONST char *lp;
+    int idx, lit, cmp, remaining;
+
+    memcpy (runPattern, filterPtr->noLiteral, filterPtr->numPatterns);
+    remaining = filterPtr->numLiterals;
+
+    for (idx = 0; (idx < lineLen) && (remaining > 0); idx++) {
+        for (lit = filterPtr->firstByte [SCAN_LOWER (UCHAR (line [idx]))];
+             lit >= 0; lit = litPtr->next) {
+            litPtr = &filterPtr->literals [lit];
+            if (runPattern [litPtr->index] ||
+                (litPtr->length > lineLen - idx))
+                continue;
+            lp = line + idx;
+            if (litPtr->nocase) {
+                for (cmp = 0; cmp < litPtr->length; cmp++) {
+                    if (SCAN_LOWER (UCHAR (lp [cmp])) !=
+                        UCHAR (litPtr->bytes [cmp]))
+                        break;
+                }
+            } else {
+                cmp = (memcmp (lp, litPtr->bytes, litPtr->length) == 0) ?
+                    litPtr->length : 0;
+            }
+            if (cmp == litPtr->length) {
+                runPattern [litPtr->index] = TRUE;
+                remaining--;
+            }
+        }
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * FreeSubMatchRep --
+ *   Free the internal representation of a submatch list.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FreeSubMatchRep (Tcl_Obj *objPtr)
+{
+    subMatchRep_t *repPtr = SUBMATCH_REP (objPtr);
+
+    Tcl_DecrRefCount (repPtr->lineObj);
+    ckfree ((char *) repPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * DupSubMatchRep --
+ *   Duplicate the internal representation of a submatch list.
+ *-----------------------------------------------------------------------------
+ */
+static void
+DupSubMatchRep (Tcl_Obj *srcPtr, Tcl_Obj *copyPtr)
+{
+    subMatchRep_t *srcRepPtr = SUBMATCH_REP (srcPtr);
+    subMatchRep_t *copyRepPtr;
+
+    copyRepPtr = (subMatchRep_t *)
+        ckalloc (SUBMATCH_REP_SIZE (srcRepPtr->numSubs));
+    copyRepPtr->lineObj = srcRepPtr->lineObj;
+    Tcl_IncrRefCount (copyRepPtr->lineObj);
+    copyRepPtr->numSubs = srcRepPtr->numSubs;
+    copyRepPtr->maxSubs = srcRepPtr->numSubs;
+    memcpy (copyRepPtr->ranges, srcRepPtr->ranges,
+            2 * srcRepPtr->numSubs * sizeof (int));
+
+    copyPtr->internalRep.otherValuePtr = (VOID *) copyRepPtr;
+    copyPtr->typePtr = srcPtr->typePtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * SetSubMatchString --
+ *   Set the string representation of a submatch list object from a list
+ * object, which is then released.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SetSubMatchString (Tcl_Obj *objPtr, Tcl_Obj *listObj)
+{
+    char *listStr;
+    int listLen;
+
+    Tcl_IncrRefCount (listObj);
+    listStr = Tcl_GetStringFromObj (listObj, &listLen);
+    objPtr->bytes = ckalloc (listLen + 1);
+    memcpy (objPtr->bytes, listStr, listLen + 1);
+    objPtr->length = listLen;
+    Tcl_DecrRefCount (listObj);
+}
+
+/*-----------------------------------------------------------------------------
+ * UpdateSubMatches --
+ *   Update the string representation of a list of submatches, extracting
+ * them from the line.  Ranges are in characters, so the unicode rep the
+ * regexp engine cached on the line is used.
+ *-----------------------------------------------------------------------------
+ */
+static void
+UpdateSubMatches (Tcl_Obj *objPtr)
+{
+    subMatchRep_t *repPtr = SUBMATCH_REP (objPtr);
+    Tcl_Obj *listObj, *elemObj;
+    int idx, start;
+
+    listObj = Tcl_NewListObj (0, NULL);
+    for (idx = 0; idx < repPtr->numSubs; idx++) {
+        start = repPtr->ranges [2 * idx];
+        if (start < 0) {
+            elemObj = Tcl_NewObj ();
+        } else {
+            elemObj = Tcl_GetRange (repPtr->lineObj, start,
+                                    repPtr->ranges [2 * idx + 1] - 1);
+        }
+        Tcl_ListObjAppendElement (NULL, listObj, elemObj);
+    }
+    SetSubMatchString (objPtr, listObj);
+}
+
+/*-----------------------------------------------------------------------------
+ * UpdateSubIndices --
+ *   Update the string representation of a list of submatch indices.  Each
+ * is a list of the first and last character, or {-1 -1}.
+ *-----------------------------------------------------------------------------
+ */
+static void
+UpdateSubIndices (Tcl_Obj *objPtr)
+{
+    subMatchRep_t *repPtr = SUBMATCH_REP (objPtr);
+    Tcl_Obj *listObj, *indexObjv [2];
+    int idx, start;
+
+    listObj = Tcl_NewListObj (0, NULL);
+    for (idx = 0; idx < repPtr->numSubs; idx++) {
+        start = repPtr->ranges [2 * idx];
         indexObjv [0] = Tcl_NewIntObj (start);
         if (start < 0) {
             indexObjv [1] = Tcl_NewIntObj (-1);
         } else {
-            indexObjv [1] = Tcl_NewIntObj (end-1);
+            indexObjv [1] = Tcl_NewIntObj (repPtr->ranges [2 * idx + 1] - 1);
+        }
+        Tcl_ListObjAppendElement (NULL, listObj,
+                                  Tcl_NewListObj (2, indexObjv));
+    }
+    SetSubMatchString (objPtr, listObj);
+}
+
+/*-----------------------------------------------------------------------------
+ * SetSubMatchObj --
+ *
+ *   Record the submatches of a match in a submatch list object.
+ *
+ * Parameters:
+ *   o objPtr - The object holding the previous submatches.  It is updated in
+ *     place if it is a submatch list of the same type that is not shared.
+ *     May be NULL.
+ *   o typePtr - &subMatchesType or &subIndicesType.
+ *   o lineObj - The line matched.
+ *   o infoPtr - The match information, or NULL if there are no submatches.
+ * Returns:
+ *   The updated object, or a new one.
+ *-----------------------------------------------------------------------------
+ */
+static Tcl_Obj *
+SetSubMatchObj (Tcl_Obj *objPtr,
+                Tcl_ObjType *typePtr,
+                Tcl_Obj *lineObj,
+                Tcl_RegExpInfo *infoPtr)
+{
+    subMatchRep_t *repPtr;
+    int idx, numSubs;
+
+    numSubs = (infoPtr == NULL) ? 0 : infoPtr->nsubs;
+
+    Tcl_IncrRefCount (lineObj);
+    if ((objPtr == NULL) || (objPtr->typePtr != typePtr) ||
+        Tcl_IsShared (objPtr)) {
+        objPtr = Tcl_NewObj ();
+        Tcl_InvalidateStringRep (objPtr);
+        repPtr = (subMatchRep_t *) ckalloc (SUBMATCH_REP_SIZE (numSubs));
+        repPtr->maxSubs = numSubs;
+        objPtr->internalRep.otherValuePtr = (VOID *) repPtr;
+        objPtr->typePtr = typePtr;
+    } else {
+        repPtr = SUBMATCH_REP (objPtr);
+        Tcl_DecrRefCount (repPtr->lineObj);
+        if (repPtr->maxSubs < numSubs) {
+            repPtr = (subMatchRep_t *)
+                ckrealloc ((char *) repPtr, SUBMATCH_REP_SIZE (numSubs));
+            repPtr->maxSubs = numSubs;
+            objPtr->internalRep.otherValuePtr = (VOID *) repPtr;
+        }
+        Tcl_InvalidateStringRep (objPtr);
+    }
+    repPtr->lineObj = lineObj;
+    repPtr->numSubs = numSubs;
+    for (idx = 0; idx < numSubs; idx++) {
+        repPtr->ranges [2 * idx] = infoPtr->matches [idx + 1].start;
+        repPtr->ranges [2 * idx + 1] = infoPtr->matches [idx + 1].end;
+    }
+    return objPtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * PutMatchVarWide --
+ *   Store an integer in a -matchvar dictionary, reusing the previous value
+ * object if nothing else holds it.
+ *-----------------------------------------------------------------------------
+ */
+static void
+PutMatchVarWide (Tcl_Obj *dictObj, Tcl_Obj *keyObj, Tcl_WideInt value)
+{
+    Tcl_Obj *valueObj;
+
+    if ((Tcl_DictObjGet (NULL, dictObj, keyObj, &valueObj) == TCL_OK) &&
+        (valueObj != NULL) && !Tcl_IsShared (valueObj)) {
+        Tcl_SetWideIntObj (valueObj, value);
+    } else {
+        valueObj = Tcl_NewWideIntObj (value);
+    }
+    Tcl_DictObjPut (NULL, dictObj, keyObj, valueObj);
+}
+
+/*-----------------------------------------------------------------------------
+ * SetMatchVarObj --
+ *
+ *   Set the -matchvar variable to a dictionary describing the current match.
+ * The first match of a scan creates the dictionary.  After that, the value
+ * of the variable is updated in place unless a match command has kept a
+ * reference to it, so a match costs few allocations.  Keys and values that
+ * only change per scan are shared objects.
+ *
+ * Parameters:
+ *   o interp - The Tcl interpreter to set the variable in.  Errors are
+ *     returned in result.
+ *   o scanData - Data about the current line being scanned.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SetMatchVarObj (Tcl_Interp *interp, scanData_t *scanData)
+{
+    Tcl_Obj **keys = scanData->matchKeys;
+    Tcl_Channel copyChannel = scanData->contextPtr->copyFileChannel;
+    Tcl_Obj *dictObj = NULL, *valueObj;
+    Tcl_RegExpInfo regExpInfo, *infoPtr = NULL;
+    int size, fresh = FALSE, result = TCL_OK;
+
+    if (scanData->matchVarSet)
+        dictObj = Tcl_ObjGetVar2 (interp, scanData->matchVarObj, NULL, 0);
+    if ((dictObj == NULL) ||
+        (Tcl_DictObjSize (NULL, dictObj, &size) != TCL_OK)) {
+        dictObj = Tcl_NewDictObj ();
+        fresh = TRUE;
+    } else if (Tcl_IsShared (dictObj)) {
+        dictObj = Tcl_DuplicateObj (dictObj);
+    }
+
+    if (fresh || !scanData->storedLine) {
+        scanData->storedLine = TRUE;
+        Tcl_DictObjPut (NULL, dictObj, keys [MATCHVAR_LINE],
+                        scanData->lineObj);
+        PutMatchVarWide (dictObj, keys [MATCHVAR_OFFSET],
+                         (Tcl_WideInt) scanData->offset);
+        PutMatchVarWide (dictObj, keys [MATCHVAR_LINENUM],
+                         (Tcl_WideInt) scanData->lineNum);
+    }
+    if (fresh) {
+        Tcl_DictObjPut (NULL, dictObj, keys [MATCHVAR_CONTEXT],
+                        scanData->contextObj);
+        Tcl_DictObjPut (NULL, dictObj, keys [MATCHVAR_HANDLE],
+                        scanData->handleObj);
+    }
+
+    if (copyChannel != NULL) {
+        if (copyChannel != scanData->copyChannel) {
+            if (scanData->copyHandleObj != NULL)
+                Tcl_DecrRefCount (scanData->copyHandleObj);
+            scanData->copyHandleObj =
+                Tcl_NewStringObj (Tcl_GetChannelName (copyChannel), -1);
+            Tcl_IncrRefCount (scanData->copyHandleObj);
+            scanData->copyChannel = copyChannel;
+        }
+        Tcl_DictObjPut (NULL, dictObj, keys [MATCHVAR_COPYHANDLE],
+                        scanData->copyHandleObj);
+    }
+
+    if (scanData->matchPtr != NULL) {
+        Tcl_RegExpGetInfo (scanData->matchPtr->regExp, &regExpInfo);
+        infoPtr = &regExpInfo;
+    }
+    Tcl_DictObjGet (NULL, dictObj, keys [MATCHVAR_SUBMATCHES], &valueObj);
+    Tcl_DictObjPut (NULL, dictObj, keys [MATCHVAR_SUBMATCHES],
+                    SetSubMatchObj (valueObj, &subMatchesType,
+                                    scanData->lineObj, infoPtr));
+    Tcl_DictObjGet (NULL, dictObj, keys [MATCHVAR_SUBINDICES], &valueObj);
+    Tcl_DictObjPut (NULL, dictObj, keys [MATCHVAR_SUBINDICES],
+                    SetSubMatchObj (valueObj, &subIndicesType,
+                                    scanData->lineObj, infoPtr));
+
+    Tcl_IncrRefCount (dictObj);
+    if (Tcl_ObjSetVar2 (interp, scanData->matchVarObj, NULL, dictObj,
+                        TCL_LEAVE_ERR_MSG) == NULL) {
+        result = TCL_ERROR;
+    } else {
+        scanData->matchVarSet = TRUE;
+    }
+    Tcl_DecrRefCount (dictObj);
+    return result;
+}
+
+/*-----------------------------------------------------------------------------
+ * InitMatchVar --
+ *   Set up the -matchvar data of a scan.  If matchVarObj is NULL, the
+ * matchInfo array is used instead.
+ *-----------------------------------------------------------------------------
+ */
+static void
+InitMatchVar (scanData_t *scanData, Tcl_Obj *matchVarObj)
+{
+    int idx;
+
+    scanData->matchVarObj = matchVarObj;
+    scanData->matchVarSet = FALSE;
+    if (matchVarObj == NULL)
+        return;
+
+    Tcl_IncrRefCount (matchVarObj);
+    for (idx = 0; idx < MATCHVAR_NUM_KEYS; idx++) {
+        scanData->matchKeys [idx] = Tcl_NewStringObj (matchVarKeys [idx], -1);
+        Tcl_IncrRefCount (scanData->matchKeys [idx]);
+    }
+    scanData->contextObj =
+        Tcl_NewStringObj (scanData->contextPtr->contextHandle, -1);
+    Tcl_IncrRefCount (scanData->contextObj);
+    scanData->handleObj =
+        Tcl_NewStringObj (Tcl_GetChannelName (scanData->channel), -1);
+    Tcl_IncrRefCount (scanData->handleObj);
+    scanData->copyChannel = NULL;
+    scanData->copyHandleObj = NULL;
+}
+
+/*-----------------------------------------------------------------------------
+ * EndMatchVar --
+ *   Release the -matchvar data of a scan.
+ *-----------------------------------------------------------------------------
+ */
+static void
+EndMatchVar (scanData_t *scanData)
+{
+    int idx;
+
+    if (scanData->matchVarObj == NULL)
+        return;
+
+    for (idx = 0; idx < MATCHVAR_NUM_KEYS; idx++)
+        Tcl_DecrRefCount (scanData->matchKeys [idx]);
+    Tcl_DecrRefCount (scanData->contextObj);
+    Tcl_DecrRefCount (scanData->handleObj);
+    if (scanData->copyHandleObj != NULL)
+        Tcl_DecrRefCount (scanData->copyHandleObj);
+    Tcl_DecrRefCount (scanData->matchVarObj);
+}
+
+/*-----------------------------------------------------------------------------
+ * SetMatchInfoVar --
+ *
+ *   Sets the Tcl array variable "matchInfo" to contain information about the
+ * current match.  This function is optimize to store per line information
+ * only once.  With -matchvar, the dictionary variable is set instead.
+ *
+ * Parameters:
+ *   o interp - The Tcl interpreter to set the matchInfo variable in.
+ *     Errors are returned in result.
+ *   o scanData - Data about the current line being scanned.
+ *     been stored.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SetMatchInfoVar (Tcl_Interp *interp, scanData_t *scanData)
+{
+    static char *MATCHINFO = "matchInfo";
+    int idx, start, end;
+    char key [32];
+    Tcl_Obj *valueObjPtr, *indexObjv [2];
+    Tcl_RegExpInfo regExpInfo;
+
+    if (scanData->matchVarObj != NULL)
+        return SetMatchVarObj (interp, scanData);
+
+    /*
+     * Save information about the current line, if it hasn't been saved.
+     */
+    if (!scanData->storedLine) {
+        scanData->storedLine = TRUE;
+
+        Tcl_UnsetVar (interp, MATCHINFO, 0);
+        
+        if (Tcl_SetVar2Ex (interp, MATCHINFO, "line", scanData->lineObj,
+                           TCL_LEAVE_ERR_MSG) == NULL)
+            goto errorExit;
+
+        valueObjPtr = Tcl_NewLongObj ((long) scanData->offset);
+        if (Tcl_SetVar2Ex(interp, MATCHINFO, "offset", valueObjPtr,
+                          TCL_LEAVE_ERR_MSG) == NULL) {
+            Tcl_DecrRefCount (valueObjPtr);
+            goto errorExit;
+        }
+
+#if 0
+        /*
+         * FIX: Don't expose till we decide on semantics: Should it include the
+         * current line?  All the pieces are here, include doc and tests, just
+         * disabled.
+         */
+        valueObjPtr = Tcl_NewLongObj ((long) scanData->bytesRead);
+        if (Tcl_SetObjVar2 (interp, MATCHINFO, "bytesread", valueObjPtr,
+                            TCL_LEAVE_ERR_MSG) == NULL) {
+            Tcl_DecrRefCount (valueObjPtr);
+            goto errorExit;
+        }
+#endif
+        valueObjPtr = Tcl_NewIntObj ((long) scanData->lineNum);
+        if (Tcl_SetVar2Ex(interp, MATCHINFO, "linenum", valueObjPtr,
+                          TCL_LEAVE_ERR_MSG) == NULL) {
+            Tcl_DecrRefCount (valueObjPtr);
+            goto errorExit;
+        }
+
+        if (Tcl_SetVar2 (interp, MATCHINFO, "context",
+                         scanData->contextPtr->contextHandle,
+                         TCL_LEAVE_ERR_MSG) == NULL)
+            goto errorExit;
+
+        if (Tcl_SetVar2 (interp, MATCHINFO, "handle", 
+                         Tcl_GetChannelName (scanData->channel),
+                         TCL_LEAVE_ERR_MSG) == NULL)
+            goto errorExit;
+
+    }
+
+    if (scanData->contextPtr->copyFileChannel != NULL) {
+        if (Tcl_SetVar2 (interp, MATCHINFO, "copyHandle", 
+                         Tcl_GetChannelName (scanData->contextPtr->copyFileChannel),
+                         TCL_LEAVE_ERR_MSG) == NULL)
+            goto errorExit;
+    }
+
+    if (scanData->matchPtr == NULL) {
+        goto exitPoint;
+    }
+
+    Tcl_RegExpGetInfo(scanData->matchPtr->regExp, &regExpInfo);
+    for (idx = 0; idx < regExpInfo.nsubs; idx++) {
+	start = regExpInfo.matches[idx+1].start;
+	end = regExpInfo.matches[idx+1].end;
+
+        sprintf (key, "subindex%d", idx);
+        indexObjv [0] = Tcl_NewIntObj (start);
+        if (start < 0) {
+            indexObjv [1] = Tcl_NewIntObj (-1);
+        } else {
+            indexObjv [1] = Tcl_NewIntObj (end-1);
+        }
+        valueObjPtr = Tcl_NewListObj (2, indexObjv);
+        if (Tcl_SetVar2Ex(interp, MATCHINFO, key, valueObjPtr,
+                            TCL_LEAVE_ERR_MSG) == NULL) {
+            Tcl_DecrRefCount (valueObjPtr);
+            goto errorExit;
+        }
+
+        /*
+         * Match indices are in characters; Tcl_GetRange uses the unicode
+         * rep the regexp engine already cached on the line object.
+         */
+        sprintf (key, "submatch%d", idx);
+        if (start < 0) {
+            valueObjPtr = Tcl_NewObj ();
+        } else {
+            valueObjPtr = Tcl_GetRange (scanData->lineObj, start, end - 1);
+        }
+
+        if (Tcl_SetVar2Ex(interp, MATCHINFO, key, valueObjPtr,
+                            TCL_LEAVE_ERR_MSG) == NULL) {
+            Tcl_DecrRefCount (valueObjPtr);
+            goto errorExit;
+        }
+    }
+
+  exitPoint:
+    return TCL_OK;
+
+  errorExit:
+    return TCL_ERROR;
+}
+
+/*-----------------------------------------------------------------------------
+ * DoMatchActions --
+ *
+ *   Perform the -count, -append and -copyto actions of the current match.
+ * Counts and lines are kept with the match until FlushMatchActions.
+ *
+ * Parameters:
+ *   o interp - The Tcl interpreter.  Errors are returned in result.
+ *   o scanData - Data about the current line being scanned.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+DoMatchActions (Tcl_Interp *interp, scanData_t *scanData)
+{
+    matchDef_t *matchPtr = scanData->matchPtr;
+    char *line;
+    int lineLen;
+
+    if (matchPtr->countVarObj != NULL) {
+        matchPtr->pendingCount++;
+        scanData->contextPtr->actionsPending = TRUE;
+    }
+    if (matchPtr->appendVarObj != NULL) {
+        if (matchPtr->pendingAppend == NULL) {
+            matchPtr->pendingAppend = Tcl_NewListObj (0, NULL);
+            Tcl_IncrRefCount (matchPtr->pendingAppend);
+        }
+        Tcl_ListObjAppendElement (NULL, matchPtr->pendingAppend,
+                                  scanData->lineObj);
+        scanData->contextPtr->actionsPending = TRUE;
+    }
+    if (matchPtr->copyToChannel != NULL) {
+        line = Tcl_GetStringFromObj (scanData->lineObj, &lineLen);
+        if ((Tcl_Write (matchPtr->copyToChannel, line, lineLen) < 0) ||
+            (TclX_WriteNL (matchPtr->copyToChannel) < 0)) {
+            Tcl_SetStringObj (Tcl_GetObjResult (interp),
+                              Tcl_PosixError (interp), -1);
+            return TCL_ERROR;
+        }
+    }
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * EvalScanCommand --
+ *
+ *   Evaluate a match or default command for the current line.  Results of
+ * match actions are stored first, so the command sees them.  When the
+ * file is being read in blocks, the channel is first positioned
+ * after the line, just as if it had been read with gets, and any move the
+ * command makes is followed by the scan.
+ *
+ * Parameters:
+ *   o interp - The Tcl interpreter.
+ *   o scanData - Data about the current line being scanned.
+ *   o command - The command to evaluate.
+ * Returns:
+ *   The result of evaluating the command.
+ *-----------------------------------------------------------------------------
+ */
+static int
+EvalScanCommand (Tcl_Interp *interp, scanData_t *scanData, Tcl_Obj *command)
+{
+    Tcl_WideInt pos;
+    int result;
+
+    if (FlushMatchActions (interp, scanData->contextPtr) != TCL_OK)
+        return TCL_ERROR;
+    if (scanData->buf == NULL)
+        return Tcl_EvalObj (interp, command);
+
+    if (Tcl_Seek (scanData->channel, (Tcl_WideInt) scanData->nextOffset,
+                  SEEK_SET) < 0) {
+        Tcl_SetStringObj (Tcl_GetObjResult (interp),
+                          Tcl_PosixError (interp), -1);
+        return TCL_ERROR;
+    }
+    result = Tcl_EvalObj (interp, command);
+    if (scanData->contextPtr->fileOpen) {
+        pos = Tcl_Tell (scanData->channel);
+        if (pos >= 0)
+            scanData->nextOffset = (off_t) pos;
+    }
+    return result;
+}
+
+/*-----------------------------------------------------------------------------
+ * ScanLine --
+ *
+ *   Apply the patterns of a scan context to the current line, evaluating the
+ * commands of those that match, the default command or copying the line to
+ * the copyfile.
+ *
+ * Parameters:
+ *   o interp - The Tcl interpreter.  Errors are returned in result.
+ *   o scanData - Data about the current line being scanned.
+ *   o filterPtr - The literal prefilter the scan is using.
+ *   o runPattern - Buffer of filterPtr->numPatterns flags.
+ *   o prefiltered - TRUE if runPattern has already been filled in for this
+ *     line, by a scan thread.
+ * Returns:
+ *   TCL_OK to go on to the next line, TCL_BREAK if the scan was terminated
+ * by a command, or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ScanLine (Tcl_Interp *interp,
+          scanData_t *scanData,
+          scanFilter_t *filterPtr,
+          char *runPattern,
+          int prefiltered)
+{
+    scanContext_t *contextPtr = scanData->contextPtr;
+    int result, matchStat, matchedAtLeastOne, lineLen, patternIdx;
+    char *line;
+
+    line = Tcl_GetStringFromObj (scanData->lineObj, &lineLen);
+    scanData->bytesRead += (lineLen + 1);  /* Include EOLN */
+    scanData->lineNum++;
+    scanData->storedLine = FALSE;
+
+    if ((filterPtr->numLiterals > 0) && !prefiltered)
+        PrefilterLine (filterPtr, line, lineLen, runPattern);
+
+    matchedAtLeastOne = FALSE;
+
+    for (scanData->matchPtr = contextPtr->matchListHead, patternIdx = 0;
+         scanData->matchPtr != NULL; 
+         scanData->matchPtr = scanData->matchPtr->nextMatchDefPtr,
+             patternIdx++) {
+
+        /*
+         * Skip the regexp if the line lacks a literal it requires.
+         * Patterns added since the filter was built are always run.
+         */
+        if ((patternIdx < filterPtr->numPatterns) &&
+            !runPattern [patternIdx])
+            continue;
+
+        /*
+         * Exec against the object so the UTF-8 to unicode conversion is
+         * done at most once per line and shared by all patterns.
+         */
+        matchStat = Tcl_RegExpExecObj (interp, scanData->matchPtr->regExp,
+                                       scanData->lineObj, 0, -1, 0);
+        if (matchStat < 0) {
+            return TCL_ERROR;
+        }
+        if (matchStat == 0) {
+            continue;  /* Try next match pattern */
+        }
+        matchedAtLeastOne = TRUE;
+
+        if (scanData->matchPtr->hasActions &&
+            (DoMatchActions (interp, scanData) != TCL_OK))
+            return TCL_ERROR;
+        if (scanData->matchPtr->command == NULL)
+            continue;
+
+        if (SetMatchInfoVar (interp, scanData) != TCL_OK)
+            return TCL_ERROR;
+
+        result = EvalScanCommand (interp, scanData,
+                                  scanData->matchPtr->command);
+        if (result == TCL_ERROR) {
+            Tcl_AddObjErrorInfo (interp, 
+                "\n    while executing a match command", -1);
+            return TCL_ERROR;
+        }
+        if (result == TCL_CONTINUE) {
+            /* 
+             * Don't process any more matches for this line.
+             */
+            break;
+        }
+        if ((result == TCL_BREAK) || (result == TCL_RETURN)) {
+            /*
+             * Terminate scan.
+             */
+            return TCL_BREAK;
+        }
+    }
+
+    /*
+     * Process default action if required.
+     */
+    if ((contextPtr->defaultAction != NULL) && (!matchedAtLeastOne)) {
+        scanData->matchPtr = NULL;
+        if (SetMatchInfoVar (interp, scanData) != TCL_OK)
+            return TCL_ERROR;
+
+        result = EvalScanCommand (interp, scanData, contextPtr->defaultAction);
+        if (result == TCL_ERROR) {
+            Tcl_AddObjErrorInfo (interp, 
+                "\n    while executing a match default command", -1);
+            return TCL_ERROR;
+        }
+        if ((result == TCL_BREAK) || (result == TCL_RETURN)) {
+            /*
+             * Terminate scan.
+             */
+            return TCL_BREAK;
+        }
+    }
+
+    if ((contextPtr->copyFileChannel != NULL) && (!matchedAtLeastOne)) {
+        if ((Tcl_Write (contextPtr->copyFileChannel, line, lineLen) < 0) ||
+            (TclX_WriteNL (contextPtr->copyFileChannel) < 0)) {
+            Tcl_SetStringObj (Tcl_GetObjResult (interp),
+                              Tcl_PosixError (interp), -1);
+            return TCL_ERROR;
+        }
+    }
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * NextLineObj --
+ *
+ *   Get the object to store the next line in.  The line object is reused
+ * unless the last line was stored in matchInfo, in which case a match
+ * command may still hold it.
+ *-----------------------------------------------------------------------------
+ */
+static void
+NextLineObj (scanData_t *scanData)
+{
+    if (Tcl_IsShared (scanData->lineObj)) {
+        Tcl_DecrRefCount (scanData->lineObj);
+        scanData->lineObj = Tcl_NewObj ();
+        Tcl_IncrRefCount (scanData->lineObj);
+    } else {
+        Tcl_SetObjLength (scanData->lineObj, 0);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * StartBlockScan --
+ *
+ *   Set up to scan a file by reading it in blocks and splitting the lines
+ * out of them, rather than reading each line with gets.  This is only done
+ * when the channel's input is the file's bytes with simple line endings: a
+ * seekable, unstacked channel on a regular file, with an encoding in which a
+ * newline byte is always a newline, lf or auto translation and no end of
+ * file character.  A followed file is always read with gets.
+ *
+ * Parameters:
+ *   o interp - The Tcl interpreter, its result is not changed.
+ *   o scanData - The scan data.  If the file can be read in blocks, an empty
+ *     buffer is allocated and nextOffset, crIsEol and encoding are filled in.
+ * Returns:
+ *   TRUE if the file is read in blocks, FALSE if it must be read with gets.
+ *-----------------------------------------------------------------------------
+ */
+static int
+StartBlockScan (Tcl_Interp *interp, scanData_t *scanData)
+{
+    Tcl_Channel channel = scanData->channel;
+    Tcl_WideInt pos;
+    Tcl_Obj *saveResult;
+    int seekable;
+
+    scanData->buf = NULL;
+    scanData->encoding = NULL;
+
+    if (scanData->follow)
+        return FALSE;
+    pos = Tcl_Tell (channel);
+    if (pos < 0)
+        return FALSE;
+
+    /*
+     * An error checking the file just means reading it the ordinary way.
+     */
+    saveResult = Tcl_GetObjResult (interp);
+    Tcl_IncrRefCount (saveResult);
+    if (TclXOSSeekable (interp, channel, &seekable) != TCL_OK)
+        seekable = FALSE;
+    Tcl_SetObjResult (interp, saveResult);
+    Tcl_DecrRefCount (saveResult);
+    if (!seekable)
+        return FALSE;
+    if (!TclX_GetMappedLineInfo (channel, &scanData->crIsEol,
+                                 &scanData->encoding))
+        return FALSE;
+
+    scanData->buf = ckalloc (SCAN_BLOCK_SIZE);
+    scanData->bufSize = SCAN_BLOCK_SIZE;
+    scanData->bufOffset = (off_t) pos;
+    scanData->bufEnd = (off_t) pos;
+    scanData->bufEof = FALSE;
+    scanData->nextOffset = (off_t) pos;
+    return TRUE;
+}
+
+/*-----------------------------------------------------------------------------
+ * ReadScanBlock --
+ *
+ *   Read more of a file scanned in blocks.  The buffer is moved to start at
+ * scanData->nextOffset, keeping what it holds from there on, and filled from
+ * the file.  Reading stops at the end of the file as it is then, so a file
+ * truncated during the scan just ends the scan early.
+ *
+ * Parameters:
+ *   o interp - The Tcl interpreter.  Errors are returned in result.
+ *   o scanData - The scan data.
+ *   o size - The least size of the buffer.  A buffer already full of one
+ *     line is doubled.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ReadScanBlock (Tcl_Interp *interp, scanData_t *scanData, int size)
+{
+    int bufLen = 0, numRead;
+
+    if ((scanData->nextOffset >= scanData->bufOffset) &&
+        (scanData->nextOffset <= scanData->bufEnd)) {
+        bufLen = (int) (scanData->bufEnd - scanData->nextOffset);
+        memmove (scanData->buf,
+                 scanData->buf + (scanData->nextOffset - scanData->bufOffset),
+                 bufLen);
+    }
+    scanData->bufOffset = scanData->nextOffset;
+    scanData->bufEnd = scanData->nextOffset + bufLen;
+    scanData->bufEof = FALSE;
+
+    if (size < scanData->bufSize)
+        size = scanData->bufSize;
+    if (bufLen == size)
+        size *= 2;
+    if (size > scanData->bufSize) {
+        scanData->buf = ckrealloc (scanData->buf, size);
+        scanData->bufSize = size;
+    }
+
+    if (Tcl_Seek (scanData->channel, (Tcl_WideInt) scanData->bufEnd,
+                  SEEK_SET) < 0)
+        goto posixError;
+    while (bufLen < scanData->bufSize) {
+        numRead = Tcl_ReadRaw (scanData->channel, scanData->buf + bufLen,
+                               scanData->bufSize - bufLen);
+        if (numRead < 0)
+            goto posixError;
+        if (numRead == 0) {
+            scanData->bufEof = TRUE;
+            break;
+        }
+        bufLen += numRead;
+        scanData->bufEnd += numRead;
+    }
+    return TCL_OK;
+
+  posixError:
+    Tcl_SetStringObj (Tcl_GetObjResult (interp), Tcl_PosixError (interp), -1);
+    return TCL_ERROR;
+}
+
+/*-----------------------------------------------------------------------------
+ * FindLineEnd --
+ *
+ *   Find the end of a line in a block of a file.  A newline ends a line and,
+ * with auto translation, so does a lone CR or a CR LF pair.
+ *
+ * Parameters:
+ *   o linePtr - Start of the line.
+ *   o endPtr - End of the data in the block.
+ *   o crIsEol - TRUE for auto translation.
+ *   o eolLenPtr - The number of bytes in the line terminator is returned
+ *     here, zero for a last line without one.
+ * Returns:
+ *   Pointer to the end of the line text.
+ *-----------------------------------------------------------------------------
+ */
+static CONST char *
+FindLineEnd (CONST char *linePtr,
+             CONST char *endPtr,
+             int crIsEol,
+             int *eolLenPtr)
+{
+    CONST char *eolPtr, *crPtr;
+
+    eolPtr = memchr (linePtr, '\n', endPtr - linePtr);
+    *eolLenPtr = 1;
+    if (eolPtr == NULL) {
+        eolPtr = endPtr;
+        *eolLenPtr = 0;
+    }
+    if (crIsEol) {
+        crPtr = memchr (linePtr, '\r', eolPtr - linePtr);
+        if (crPtr != NULL) {
+            eolPtr = crPtr;
+            *eolLenPtr = ((crPtr + 1 < endPtr) && (crPtr [1] == '\n')) ? 2 : 1;
+        }
+    }
+    return eolPtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * SetLineFromBytes --
+ *
+ *   Set an unshared line object from bytes read from a file.  ASCII without
+ * NULs is already in Tcl's internal form and is copied as is.
+ *
+ * Parameters:
+ *   o lineObj - The unshared object to set.
+ *   o linePtr, lineLen - The line in the file.
+ *   o encoding - The channel encoding.
+ *   o utfBufPtr - Initialized dynamic string to use for conversion.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SetLineFromBytes (Tcl_Obj *lineObj,
+                  CONST char *linePtr,
+                  int lineLen,
+                  Tcl_Encoding encoding,
+                  Tcl_DString *utfBufPtr)
+{
+    CONST char *scanPtr, *endPtr = linePtr + lineLen;
+
+    for (scanPtr = linePtr; scanPtr < endPtr; scanPtr++) {
+        if ((UCHAR (*scanPtr) >= 0x80) || (*scanPtr == '\0'))
+            break;
+    }
+    if (scanPtr == endPtr) {
+        /*
+         * Truncate first: setting the length the object already has would
+         * leave the unicode rep of the previous line in place.
+         */
+        Tcl_SetObjLength (lineObj, 0);
+        Tcl_SetObjLength (lineObj, lineLen);
+        memcpy (Tcl_GetString (lineObj), linePtr, lineLen);
+    } else {
+        Tcl_DStringSetLength (utfBufPtr, 0);
+        Tcl_ExternalToUtfDString (encoding, linePtr, lineLen, utfBufPtr);
+        Tcl_SetStringObj (lineObj, Tcl_DStringValue (utfBufPtr),
+                          Tcl_DStringLength (utfBufPtr));
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * ScanBlockLines --
+ *
+ *   Scan the lines of a file read in blocks from scanData->nextOffset,
+ * splitting them in the buffer and computing their offsets instead of
+ * reading the channel.
+ *
+ * Parameters:
+ *   o interp - The Tcl interpreter.  Errors are returned in result.
+ *   o scanData - The scan data, set up by StartBlockScan.
+ *   o filterPtr, runPattern - The prefilter and its flags.
+ * Returns:
+ *   TCL_OK, TCL_BREAK or TCL_ERROR as returned by ScanLine, or TCL_ERROR if
+ * the file can't be read.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ScanBlockLines (Tcl_Interp *interp,
+                scanData_t *scanData,
+                scanFilter_t *filterPtr,
+                char *runPattern)
+{
+    CONST char *linePtr = NULL, *eolPtr = NULL, *endPtr = NULL;
+    Tcl_DString utfBuf;
+    int result = TCL_OK, eolLen = 0, haveLine;
+
+    Tcl_DStringInit (&utfBuf);
+    while (TRUE) {
+        if (!scanData->contextPtr->fileOpen)
+            break;  /* Closed by a callback */
+        if (scanData->nextOffset < 0)
+            break;
+
+        /*
+         * Read more of the file unless the buffer holds the whole line,
+         * including the LF that may follow a CR with auto translation.
+         */
+        haveLine = FALSE;
+        if ((scanData->nextOffset >= scanData->bufOffset) &&
+            (scanData->nextOffset <= scanData->bufEnd)) {
+            linePtr = scanData->buf +
+                (scanData->nextOffset - scanData->bufOffset);
+            endPtr = scanData->buf + (scanData->bufEnd - scanData->bufOffset);
+            eolPtr = FindLineEnd (linePtr, endPtr, scanData->crIsEol, &eolLen);
+            haveLine = scanData->bufEof ||
+                ((eolLen > 0) && ((eolPtr + 1 < endPtr) || (*eolPtr == '\n')));
+        }
+        if (!haveLine) {
+            if (ReadScanBlock (interp, scanData, SCAN_BLOCK_SIZE) != TCL_OK) {
+                result = TCL_ERROR;
+                break;
+            }
+            continue;
+        }
+        if (linePtr == endPtr)
+            break;  /* End of file */
+
+        scanData->offset = scanData->nextOffset;
+        scanData->nextOffset += (eolPtr - linePtr) + eolLen;
+
+        NextLineObj (scanData);
+        SetLineFromBytes (scanData->lineObj, linePtr, eolPtr - linePtr,
+                          scanData->encoding, &utfBuf);
+
+        result = ScanLine (interp, scanData, filterPtr, runPattern, FALSE);
+        if (result != TCL_OK)
+            break;
+    }
+    Tcl_DStringFree (&utfBuf);
+    return result;
+}
+
+/*-----------------------------------------------------------------------------
+ * EndBlockScan --
+ *
+ *   Leave the channel of a block scan where gets would have: after the last
+ * line scanned.  At the end of the file, read to set the end of file
+ * condition; if the file has grown, back up.
+ *
+ * Parameters:
+ *   o scanData - The scan data.
+ *   o result - The result of the scan.
+ *-----------------------------------------------------------------------------
+ */
+static void
+EndBlockScan (scanData_t *scanData, int result)
+{
+    Tcl_DString scratchBuf;
+
+    if ((result == TCL_ERROR) || !scanData->contextPtr->fileOpen)
+        return;
+    Tcl_Seek (scanData->channel, (Tcl_WideInt) scanData->nextOffset,
+              SEEK_SET);
+    if ((result == TCL_OK) && scanData->bufEof &&
+        (scanData->nextOffset >= scanData->bufEnd)) {
+        Tcl_DStringInit (&scratchBuf);
+        if (Tcl_Gets (scanData->channel, &scratchBuf) >= 0) {
+            Tcl_Seek (scanData->channel,
+                      (Tcl_WideInt) scanData->nextOffset, SEEK_SET);
+        }
+        Tcl_DStringFree (&scratchBuf);
+    }
+}
+
+#ifdef TCL_THREADS
+/*-----------------------------------------------------------------------------
+ * ScanChunk --
+ *
+ *   Match the lines of one chunk of a window of a file in a worker thread,
+ * recording the lines that the interpreter needs to see.
+ *
+ * Parameters:
+ *   o workPtr - The shared description of the scan.
+ *   o chunkPtr - The chunk to scan.
+ *   o regExps - The worker's compiled patterns; NULL entries are assumed to
+ *     match and are left for the interpreter to run.
+ *   o lineObj - Unshared object the worker keeps lines in.
+ *   o runPattern - Buffer of workPtr->numPatterns flags.
+ *   o utfBufPtr - Initialized dynamic string for encoding conversion.
+ *-----------------------------------------------------------------------------
+ */
+static void
+ScanChunk (scanWork_t *workPtr,
+           scanChunk_t *chunkPtr,
+           Tcl_RegExp *regExps,
+           Tcl_Obj *lineObj,
+           char *runPattern,
+           Tcl_DString *utfBufPtr)
+{
+    scanFilter_t *filterPtr = workPtr->filterPtr;
+    int numPatterns = workPtr->numPatterns;
+    CONST char *linePtr, *eolPtr, *endPtr;
+    scanHit_t *hitPtr;
+    char *line;
+    int idx, lineLen, eolLen, anyMatch;
+    long lineNum = 0;
+
+    linePtr = workPtr->buf + (chunkPtr->start - workPtr->bufOffset);
+    endPtr = workPtr->buf + (chunkPtr->end - workPtr->bufOffset);
+    while (linePtr < endPtr) {
+        eolPtr = FindLineEnd (linePtr, endPtr, workPtr->crIsEol, &eolLen);
+        lineNum++;
+        SetLineFromBytes (lineObj, linePtr, eolPtr - linePtr,
+                          workPtr->encoding, utfBufPtr);
+        line = Tcl_GetStringFromObj (lineObj, &lineLen);
+
+        if (filterPtr->numLiterals > 0) {
+            PrefilterLine (filterPtr, line, lineLen, runPattern);
+        } else {
+            memcpy (runPattern, filterPtr->noLiteral, numPatterns);
+        }
+        anyMatch = FALSE;
+        for (idx = 0; idx < numPatterns; idx++) {
+            if (runPattern [idx] && (regExps [idx] != NULL)) {
+                runPattern [idx] = (Tcl_RegExpExecObj (NULL, regExps [idx],
+                                                       lineObj, 0, 0, 0) != 0);
+            }
+            anyMatch |= runPattern [idx];
+        }
+
+        if (anyMatch || workPtr->recordAll) {
+            if (chunkPtr->numHits == chunkPtr->maxHits) {
+                chunkPtr->maxHits = (chunkPtr->maxHits == 0) ? 64 :
+                    chunkPtr->maxHits * 2;
+                chunkPtr->hits = (scanHit_t *)
+                    ckrealloc ((char *) chunkPtr->hits,
+                               chunkPtr->maxHits * sizeof (scanHit_t));
+                chunkPtr->matched =
+                    ckrealloc (chunkPtr->matched,
+                               chunkPtr->maxHits * numPatterns);
+            }
+            hitPtr = &chunkPtr->hits [chunkPtr->numHits];
+            hitPtr->offset = workPtr->bufOffset + (linePtr - workPtr->buf);
+            hitPtr->lineLen = eolPtr - linePtr;
+            hitPtr->eolLen = eolLen;
+            hitPtr->lineNum = lineNum;
+            memcpy (chunkPtr->matched + (chunkPtr->numHits * numPatterns),
+                    runPattern, numPatterns);
+            chunkPtr->numHits++;
+        }
+        linePtr = eolPtr + eolLen;
+    }
+    chunkPtr->numLines = lineNum;
+}
+
+/*-----------------------------------------------------------------------------
+ * ScanWorker --
+ *
+ *   Thread procedure of a scan worker.  Compiles its own copies of the
+ * patterns, then scans chunks as they are handed out until the scan is
+ * aborted.
+ *
+ * Parameters:
+ *   o clientData - Pointer to the scanWork_t of the scan.
+ *-----------------------------------------------------------------------------
+ */
+static Tcl_ThreadCreateType
+ScanWorker (ClientData clientData)
+{
+    scanWork_t *workPtr = (scanWork_t *) clientData;
+    int numPatterns = workPtr->numPatterns;
+    Tcl_Obj **patternObjs, *lineObj;
+    Tcl_RegExp *regExps;
+    Tcl_DString utfBuf;
+    char *runPattern;
+    int idx, chunkIdx;
+
+    patternObjs = (Tcl_Obj **) ckalloc (numPatterns * sizeof (Tcl_Obj *));
+    regExps = (Tcl_RegExp *) ckalloc (numPatterns * sizeof (Tcl_RegExp));
+    for (idx = 0; idx < numPatterns; idx++) {
+        patternObjs [idx] = Tcl_NewStringObj (workPtr->patterns [idx], -1);
+        Tcl_IncrRefCount (patternObjs [idx]);
+        regExps [idx] = Tcl_GetRegExpFromObj (NULL, patternObjs [idx],
+                                              workPtr->regExpFlags [idx]);
+    }
+    runPattern = ckalloc (numPatterns);
+    lineObj = Tcl_NewObj ();
+    Tcl_IncrRefCount (lineObj);
+    Tcl_DStringInit (&utfBuf);
+
+    while (TRUE) {
+        Tcl_MutexLock (&workPtr->mutex);
+        while (!workPtr->abort &&
+               ((workPtr->nextChunk >= workPtr->numChunks) ||
+                (workPtr->nextChunk >= workPtr->consumed + workPtr->window))) {
+            Tcl_ConditionWait (&workPtr->cond, &workPtr->mutex, NULL);
+        }
+        if (workPtr->abort) {
+            Tcl_MutexUnlock (&workPtr->mutex);
+            break;
+        }
+        chunkIdx = workPtr->nextChunk++;
+        Tcl_MutexUnlock (&workPtr->mutex);
+
+        ScanChunk (workPtr, &workPtr->chunks [chunkIdx], regExps, lineObj,
+                   runPattern, &utfBuf);
+
+        Tcl_MutexLock (&workPtr->mutex);
+        workPtr->chunks [chunkIdx].done = TRUE;
+        Tcl_ConditionNotify (&workPtr->cond);
+        Tcl_MutexUnlock (&workPtr->mutex);
+    }
+
+    Tcl_DStringFree (&utfBuf);
+    Tcl_DecrRefCount (lineObj);
+    ckfree (runPattern);
+    for (idx = 0; idx < numPatterns; idx++)
+        Tcl_DecrRefCount (patternObjs [idx]);
+    ckfree ((char *) patternObjs);
+    ckfree ((char *) regExps);
+
+    Tcl_FinalizeThread ();
+    TCL_THREAD_CREATE_RETURN;
+}
+
+/*-----------------------------------------------------------------------------
+ * SplitScanWindow --
+ *
+ *   Split the complete lines in the buffer from scanData->nextOffset into
+ * chunks ending after a newline, a few per thread so that they balance.  At
+ * the end of the file, a last line without a terminator is included.
+ *
+ * Parameters:
+ *   o workPtr - The shared description of the scan.  The chunks are stored
+ *     in its array, which must not be in use by the workers.
+ *   o scanData - The scan data, with the window read.
+ *   o numThreads - Number of worker threads.
+ * Returns:
+ *   The number of chunks.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SplitScanWindow (scanWork_t *workPtr, scanData_t *scanData, int numThreads)
+{
+    CONST char *buf = scanData->buf, *nlPtr;
+    off_t bufOffset = scanData->bufOffset;
+    off_t chunkSize, pos, end, limit;
+    scanChunk_t *chunkPtr;
+    int numChunks = 0;
+
+    limit = scanData->bufEnd;
+    if (!scanData->bufEof) {
+        while ((limit > scanData->nextOffset) &&
+               (buf [limit - 1 - bufOffset] != '\n'))
+            limit--;
+    }
+
+    chunkSize = (limit - scanData->nextOffset) / (numThreads * 4);
+    if (chunkSize < SCAN_MIN_CHUNK)
+        chunkSize = SCAN_MIN_CHUNK;
+    if (chunkSize > SCAN_MAX_CHUNK)
+        chunkSize = SCAN_MAX_CHUNK;
+
+    for (pos = scanData->nextOffset; pos < limit; pos = end) {
+        end = pos + chunkSize;
+        if (end >= limit) {
+            end = limit;
+        } else {
+            nlPtr = memchr (buf + (end - 1 - bufOffset), '\n',
+                            limit - (end - 1));
+            end = (nlPtr == NULL) ? limit : bufOffset + (nlPtr - buf) + 1;
         }
-        valueObjPtr = Tcl_NewListObj (2, indexObjv);
-        if (Tcl_SetVar2Ex(interp, MATCHINFO, key, valueObjPtr,
-                            TCL_LEAVE_ERR_MSG) == NULL) {
-            Tcl_DecrRefCount (valueObjPtr);
-            goto errorExit;
+        if (numChunks == workPtr->maxChunks) {
+            workPtr->maxChunks = (workPtr->maxChunks == 0) ? 16 :
+                workPtr->maxChunks * 2;
+            workPtr->chunks = (scanChunk_t *)
+                ckrealloc ((char *) workPtr->chunks,
+                           workPtr->maxChunks * sizeof (scanChunk_t));
         }
+        chunkPtr = &workPtr->chunks [numChunks++];
+        memset (chunkPtr, 0, sizeof (scanChunk_t));
+        chunkPtr->start = pos;
+        chunkPtr->end = end;
+    }
+    return numChunks;
+}
 
-        sprintf (key, "submatch%d", idx);
-        Tcl_DStringSetLength(&valueBuf, 0);
-        value = Tcl_UniCharToUtfDString(scanData->uniLine + start, end - start,
-                                        &valueBuf);
-        valueObjPtr = Tcl_NewStringObj(value, (end - start));
+/*-----------------------------------------------------------------------------
+ * ScanThreaded --
+ *
+ *   Scan a file read in blocks from scanData->nextOffset, matching lines on
+ * worker threads a window at a time.  If a match command moves the channel,
+ * adds a pattern or sets up handling of unmatched lines that the workers
+ * aren't recording, or what is left of the file is too small to split, the
+ * rest of the file is left to ScanBlockLines.
+ *
+ * Parameters:
+ *   o interp - The Tcl interpreter.  Errors are returned in result.
+ *   o scanData - The scan data, set up by StartBlockScan.  On a TCL_OK
+ *     return, nextOffset and lineNum tell where the scan stopped.
+ *   o numThreads - Number of worker threads to use.
+ *   o filterPtr, runPattern - The prefilter and its flags.
+ * Returns:
+ *   TCL_OK, TCL_BREAK or TCL_ERROR as returned by ScanLine, or TCL_ERROR if
+ * the file can't be read.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ScanThreaded (Tcl_Interp *interp,
+              scanData_t *scanData,
+              int numThreads,
+              scanFilter_t *filterPtr,
+              char *runPattern)
+{
+    scanContext_t *contextPtr = scanData->contextPtr;
+    Tcl_ThreadId threadIds [SCAN_MAX_THREADS];
+    scanWork_t work;
+    scanChunk_t *chunkPtr;
+    scanHit_t *hitPtr;
+    matchDef_t *matchPtr;
+    Tcl_DString utfBuf;
+    off_t expected;
+    int idx, hitIdx, numChunks, numStarted = 0, result = TCL_OK;
+    long baseLine;
+
+    if (numThreads > SCAN_MAX_THREADS)
+        numThreads = SCAN_MAX_THREADS;
+
+    memset (&work, 0, sizeof (work));
+    if (ReadScanBlock (interp, scanData,
+                       numThreads * SCAN_THREAD_BLOCK) != TCL_OK)
+        return TCL_ERROR;
+    numChunks = SplitScanWindow (&work, scanData, numThreads);
+    if (numChunks < 2) {
+        if (work.chunks != NULL)
+            ckfree ((char *) work.chunks);
+        return TCL_OK;
+    }
 
-        if (Tcl_SetVar2Ex(interp, MATCHINFO, key, valueObjPtr,
-                            TCL_LEAVE_ERR_MSG) == NULL) {
-            Tcl_DecrRefCount (valueObjPtr);
-            goto errorExit;
-        }
+    work.crIsEol = scanData->crIsEol;
+    work.encoding = scanData->encoding;
+    work.filterPtr = filterPtr;
+    work.numPatterns = filterPtr->numPatterns;
+    work.patterns = (char **) ckalloc (work.numPatterns * sizeof (char *));
+    work.regExpFlags = (int *) ckalloc (work.numPatterns * sizeof (int));
+    for (idx = 0, matchPtr = contextPtr->matchListHead;
+         idx < work.numPatterns;
+         idx++, matchPtr = matchPtr->nextMatchDefPtr) {
+        work.patterns [idx] =
+            ckstrdup (Tcl_GetStringFromObj (matchPtr->regExpObj, NULL));
+        work.regExpFlags [idx] = matchPtr->regExpFlags;
+    }
+    work.recordAll = (contextPtr->defaultAction != NULL) ||
+        (contextPtr->copyFileChannel != NULL);
+    work.window = numThreads * 2;
+
+    for (numStarted = 0; numStarted < numThreads; numStarted++) {
+        if (Tcl_CreateThread (&threadIds [numStarted], ScanWorker,
+                              (ClientData) &work, TCL_THREAD_STACK_DEFAULT,
+                              TCL_THREAD_JOINABLE) != TCL_OK)
+            break;
     }
+    if (numStarted == 0)
+        goto cleanUp;
 
-  exitPoint:
-    Tcl_DStringFree(&valueBuf);
-    return TCL_OK;
+    /*
+     * Hand each window's chunks to the workers and run the commands for
+     * the recorded lines, in file order.  Every chunk of a window is done
+     * before the next is read over it.
+     */
+    Tcl_DStringInit (&utfBuf);
+    baseLine = scanData->lineNum;
+    while (TRUE) {
+        Tcl_MutexLock (&work.mutex);
+        work.buf = scanData->buf;
+        work.bufOffset = scanData->bufOffset;
+        work.numChunks = numChunks;
+        work.nextChunk = 0;
+        work.consumed = 0;
+        Tcl_ConditionNotify (&work.cond);
+        Tcl_MutexUnlock (&work.mutex);
+
+        for (idx = 0; idx < numChunks; idx++) {
+            chunkPtr = &work.chunks [idx];
+            Tcl_MutexLock (&work.mutex);
+            while (!chunkPtr->done)
+                Tcl_ConditionWait (&work.cond, &work.mutex, NULL);
+            Tcl_MutexUnlock (&work.mutex);
+
+            for (hitIdx = 0; hitIdx < chunkPtr->numHits; hitIdx++) {
+                hitPtr = &chunkPtr->hits [hitIdx];
+                scanData->lineNum = baseLine + hitPtr->lineNum - 1;
+                scanData->offset = hitPtr->offset;
+                expected = hitPtr->offset + hitPtr->lineLen + hitPtr->eolLen;
+                scanData->nextOffset = expected;
+                NextLineObj (scanData);
+                SetLineFromBytes (scanData->lineObj, scanData->buf +
+                                  (hitPtr->offset - scanData->bufOffset),
+                                  hitPtr->lineLen, scanData->encoding,
+                                  &utfBuf);
+
+                result = ScanLine (interp, scanData, filterPtr,
+                                   chunkPtr->matched +
+                                   (hitIdx * work.numPatterns), TRUE);
+                if (result != TCL_OK)
+                    goto stopWorkers;
+                if (!contextPtr->fileOpen ||
+                    (scanData->nextOffset != expected) ||
+                    (contextPtr->filterPtr != filterPtr) ||
+                    (!work.recordAll &&
+                     ((contextPtr->defaultAction != NULL) ||
+                      (contextPtr->copyFileChannel != NULL))))
+                    goto stopWorkers;
+            }
+            baseLine += chunkPtr->numLines;
+            scanData->lineNum = baseLine;
+            scanData->nextOffset = chunkPtr->end;
+
+            ckfree ((char *) chunkPtr->hits);
+            ckfree (chunkPtr->matched);
+            chunkPtr->hits = NULL;
+            chunkPtr->matched = NULL;
+            Tcl_MutexLock (&work.mutex);
+            work.consumed++;
+            Tcl_ConditionNotify (&work.cond);
+            Tcl_MutexUnlock (&work.mutex);
+        }
 
-  errorExit:
-    Tcl_DStringFree(&valueBuf);
-    return TCL_ERROR;
+        if (scanData->bufEof && (scanData->nextOffset >= scanData->bufEnd))
+            break;
+        if (ReadScanBlock (interp, scanData,
+                           numThreads * SCAN_THREAD_BLOCK) != TCL_OK) {
+            result = TCL_ERROR;
+            break;
+        }
+        numChunks = SplitScanWindow (&work, scanData, numThreads);
+        if (numChunks < 2)
+            break;
+    }
+
+  stopWorkers:
+    Tcl_DStringFree (&utfBuf);
+    Tcl_MutexLock (&work.mutex);
+    work.abort = TRUE;
+    Tcl_ConditionNotify (&work.cond);
+    Tcl_MutexUnlock (&work.mutex);
+    for (idx = 0; idx < numStarted; idx++)
+        Tcl_JoinThread (threadIds [idx], NULL);
+
+  cleanUp:
+    for (idx = 0; idx < numChunks; idx++) {
+        if (work.chunks [idx].hits != NULL)
+            ckfree ((char *) work.chunks [idx].hits);
+        if (work.chunks [idx].matched != NULL)
+            ckfree (work.chunks [idx].matched);
+    }
+    ckfree ((char *) work.chunks);
+    for (idx = 0; idx < work.numPatterns; idx++)
+        ckfree (work.patterns [idx]);
+    ckfree ((char *) work.patterns);
+    ckfree ((char *) work.regExpFlags);
+    Tcl_ConditionFinalize (&work.cond);
+    Tcl_MutexFinalize (&work.mutex);
+    return result;
 }
-
+#endif
+
 /*-----------------------------------------------------------------------------
  * ScanFile --
  *
- *   Scan a file given a scancontext.
+ *   Scan a file given a scancontext, using up to numThreads threads to match
+ * lines of a file read in blocks.
+ *
+ * Parameters:
+ *   o interp - The Tcl interpreter.  Errors are returned in result.
+ *   o dataPtr - The scan data.  The caller fills in contextPtr, channel,
+ *     matchVarObj (NULL to use the matchInfo array), completeLines, follow
+ *     and the number of lines before the first one, lineNum.  On return,
+ *     lineNum is the number of the last line scanned and stopped is set if
+ *     a command terminated the scan.
+ *   o numThreads - Threads to use.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
  *-----------------------------------------------------------------------------
  */
 static int
-ScanFile (Tcl_Interp *interp, scanContext_t *contextPtr, Tcl_Channel channel)
+ScanFile (Tcl_Interp *interp,
+          scanData_t *dataPtr,
+          int numThreads)
 {
-    Tcl_DString lineBuf, uniLineBuf;
-    int result, matchedAtLeastOne;
-    scanData_t data;
-    int matchStat;
+    scanContext_t *contextPtr = dataPtr->contextPtr;
+    Tcl_Channel channel = dataPtr->channel;
+    int result;
+    scanFilter_t *filterPtr;
+    char staticRunPattern [SCAN_STATIC_PATTERNS], *runPattern;
     
     if (contextPtr->matchListHead == NULL) {
         TclX_AppendObjResult (interp, "no patterns in current scan context",
@@ -625,133 +2850,97 @@ ScanFile (Tcl_Interp *interp, scanContext_t *contextPtr, Tcl_Channel channel)
         return TCL_ERROR;
     }
 
-    data.storedLine = FALSE;
-    data.contextPtr = contextPtr;
-    data.channel = channel;
-    data.bytesRead = 0;
-    data.lineNum = 0;
-    
-    Tcl_DStringInit (&lineBuf);
-    Tcl_DStringInit (&uniLineBuf);
+    dataPtr->storedLine = FALSE;
+    dataPtr->stopped = FALSE;
+    dataPtr->bytesRead = 0;
+    dataPtr->lineObj = Tcl_NewObj ();
+    Tcl_IncrRefCount (dataPtr->lineObj);
+    InitMatchVar (dataPtr, dataPtr->matchVarObj);
+
+    /*
+     * Build the prefilter if the patterns have changed, and hold on to it
+     * in case a match command adds another pattern.
+     */
+    if (contextPtr->filterPtr == NULL)
+        contextPtr->filterPtr = BuildScanFilter (contextPtr);
+    filterPtr = contextPtr->filterPtr;
+    filterPtr->refCount++;
+    if (filterPtr->numPatterns > SCAN_STATIC_PATTERNS) {
+        runPattern = ckalloc (filterPtr->numPatterns);
+    } else {
+        runPattern = staticRunPattern;
+    }
+    memcpy (runPattern, filterPtr->noLiteral, filterPtr->numPatterns);
+
+    if (StartBlockScan (interp, dataPtr)) {
+        result = TCL_OK;
+#ifdef TCL_THREADS
+        if (numThreads > 1)
+            result = ScanThreaded (interp, dataPtr, numThreads, filterPtr,
+                                   runPattern);
+#endif
+        if (result == TCL_OK)
+            result = ScanBlockLines (interp, dataPtr, filterPtr, runPattern);
+        EndBlockScan (dataPtr, result);
+        ckfree (dataPtr->buf);
+        Tcl_FreeEncoding (dataPtr->encoding);
+        goto scanExit;
+    }
 
     result = TCL_OK;
     while (TRUE) {
         if (!contextPtr->fileOpen)
-            goto scanExit;  /* Closed by a callback */
+            break;  /* Closed by a callback */
 
-        data.offset = (off_t) Tcl_Tell (channel);
-        Tcl_DStringSetLength (&lineBuf, 0);
-        if (Tcl_Gets (channel, &lineBuf) < 0) {
+        NextLineObj (dataPtr);
+        dataPtr->offset = (off_t) Tcl_Tell (channel);
+        if (Tcl_GetsObj (channel, dataPtr->lineObj) < 0) {
             if (Tcl_Eof (channel) || Tcl_InputBlocked (channel))
-                goto scanExit;
+                break;
             Tcl_SetStringObj (Tcl_GetObjResult (interp),
                               Tcl_PosixError (interp), -1);
             result = TCL_ERROR;
             goto scanExit;
         }
 
-
-        data.line = Tcl_DStringValue(&lineBuf);
-        data.bytesRead += (lineBuf.length + 1);  /* Include EOLN */
-        data.lineNum++;
-        data.storedLine = FALSE;
-
-        /* Convert to UTF to UniCode */
-        Tcl_DStringSetLength (&uniLineBuf, 0);
-        data.uniLine = Tcl_UtfToUniCharDString(Tcl_DStringValue(&lineBuf),
-                                               Tcl_DStringLength(&lineBuf),
-                                               &uniLineBuf);
-        data.uniLineLen = Tcl_DStringLength(&uniLineBuf) / sizeof(Tcl_UniChar);
-
-        matchedAtLeastOne = FALSE;
-
-        for (data.matchPtr = contextPtr->matchListHead; 
-             data.matchPtr != NULL; 
-             data.matchPtr = data.matchPtr->nextMatchDefPtr) {
-
-            matchStat = Tcl_RegExpExec(interp,
-		    data.matchPtr->regExp,
-		    Tcl_DStringValue(&lineBuf),
-		    Tcl_DStringValue(&lineBuf));
-            if (matchStat < 0) {
-                result = TCL_ERROR;
-                goto scanExit;
-            }
-            if (matchStat == 0) {
-                continue;  /* Try next match pattern */
-            }
-            matchedAtLeastOne = TRUE;
-
-            result = SetMatchInfoVar (interp, &data);
-            if (result != TCL_OK)
-                goto scanExit;
-
-            result = Tcl_EvalObj (interp, data.matchPtr->command);
-            if (result == TCL_ERROR) {
-                Tcl_AddObjErrorInfo (interp, 
-                    "\n    while executing a match command", -1);
-                goto scanExit;
-            }
-            if (result == TCL_CONTINUE) {
-                /* 
-                 * Don't process any more matches for this line.
-                 */
-                goto matchLineExit;
-            }
-            if ((result == TCL_BREAK) || (result == TCL_RETURN)) {
-                /*
-                 * Terminate scan.
-                 */
-                result = TCL_OK;
-                goto scanExit;
-            }
-        }
-
-      matchLineExit:
         /*
-         * Process default action if required.
+         * A last line without a terminator may still be being written.
          */
-        if ((contextPtr->defaultAction != NULL) && (!matchedAtLeastOne)) {
-            data.matchPtr = NULL;
-            result = SetMatchInfoVar(interp,
-                                     &data);
-            if (result != TCL_OK)
-                goto scanExit;
-
-            result = Tcl_EvalObj (interp, contextPtr->defaultAction);
-            if (result == TCL_ERROR) {
-                Tcl_AddObjErrorInfo (interp, 
-                    "\n    while executing a match default command", -1);
-                goto scanExit;
-            }
-            if ((result == TCL_BREAK) || (result == TCL_RETURN)) {
-                /*
-                 * Terminate scan.
-                 */
-                result = TCL_OK;
-                goto scanExit;
-            }
+        if (dataPtr->completeLines && Tcl_Eof (channel)) {
+            Tcl_Seek (channel, (Tcl_WideInt) dataPtr->offset, SEEK_SET);
+            break;
         }
 
-	if ((contextPtr->copyFileChannel != NULL) && (!matchedAtLeastOne)) {
-	    if ((Tcl_Write (contextPtr->copyFileChannel, Tcl_DStringValue(&lineBuf),
-                            Tcl_DStringLength(&lineBuf)) < 0) ||
-                (TclX_WriteNL (contextPtr->copyFileChannel) < 0)) {
-                Tcl_SetStringObj (Tcl_GetObjResult (interp),
-                                  Tcl_PosixError (interp), -1);
-		return TCL_ERROR;
-	    }
-	}
+        result = ScanLine (interp, dataPtr, filterPtr, runPattern, FALSE);
+        if (result != TCL_OK)
+            break;
     }
 
   scanExit:
-    Tcl_DStringFree (&lineBuf);
-    Tcl_DStringFree (&uniLineBuf);
+    if (result == TCL_BREAK)
+        dataPtr->stopped = TRUE;
+
+    /*
+     * Store what match actions gathered, without losing an error.
+     */
+    if (result == TCL_ERROR) {
+        Tcl_InterpState state = Tcl_SaveInterpState (interp, result);
+        FlushMatchActions (interp, contextPtr);
+        Tcl_RestoreInterpState (interp, state);
+    } else if (FlushMatchActions (interp, contextPtr) != TCL_OK) {
+        result = TCL_ERROR;
+    }
+
+    Tcl_DecrRefCount (dataPtr->lineObj);
+    EndMatchVar (dataPtr);
+    ReleaseScanFilter (filterPtr);
+    if (runPattern != staticRunPattern)
+        ckfree (runPattern);
     if (result == TCL_ERROR)
         return TCL_ERROR;
     return TCL_OK;
 }
-
+
 /*-----------------------------------------------------------------------------
  * ScanFileCloseHandler --
  *   Close handler for the file being scanned.  Marks it as not open.
@@ -765,11 +2954,413 @@ ScanFileCloseHandler (ClientData clientData)
     ((scanContext_t *) clientData)->fileOpen = FALSE;
 }
 
+/*-----------------------------------------------------------------------------
+ * SetCheckpointVar --
+ *
+ *   Set the -checkpointvar variable to a dictionary of where a scan ended:
+ * offset is the position in the file after the last line scanned and linenum
+ * is the number of that line.
+ *
+ * Parameters:
+ *   o interp - Errors are returned in result.
+ *   o varNameObj - The variable.
+ *   o channel - The file scanned.
+ *   o lineNum - The number of the last line scanned.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SetCheckpointVar (Tcl_Interp *interp,
+                  Tcl_Obj *varNameObj,
+                  Tcl_Channel channel,
+                  long lineNum)
+{
+    Tcl_Obj *dictObj;
+    Tcl_WideInt pos;
+
+    pos = Tcl_Tell (channel);
+    if (pos < 0) {
+        Tcl_SetStringObj (Tcl_GetObjResult (interp),
+                          Tcl_PosixError (interp), -1);
+        return TCL_ERROR;
+    }
+    dictObj = Tcl_NewDictObj ();
+    Tcl_DictObjPut (NULL, dictObj, Tcl_NewStringObj ("offset", -1),
+                    Tcl_NewWideIntObj (pos));
+    Tcl_DictObjPut (NULL, dictObj, Tcl_NewStringObj ("linenum", -1),
+                    Tcl_NewLongObj (lineNum));
+    if (Tcl_ObjSetVar2 (interp, varNameObj, NULL, dictObj,
+                        TCL_LEAVE_ERR_MSG) == NULL)
+        return TCL_ERROR;
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * FollowScan --
+ *
+ *   Scan what has been added to a followed file since the last scan.  If
+ * the file is now shorter than what was scanned, it was truncated and is
+ * scanned from the start.
+ *
+ * Parameters:
+ *   o followPtr - The file being followed.
+ *   o completeLines - Leave a last line without a terminator unread.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.  The stop flag is set if a command terminated the
+ * scan.
+ *-----------------------------------------------------------------------------
+ */
+static int
+FollowScan (scanFollow_t *followPtr, int completeLines)
+{
+    scanContext_t *contextPtr = followPtr->contextPtr;
+    scanData_t data;
+    Tcl_WideInt pos;
+    off_t size;
+    int result;
+
+    pos = Tcl_Tell (followPtr->channel);
+    if ((pos < 0) || (TclXOSGetFileSize (followPtr->channel, &size) != TCL_OK))
+        return TCL_OK;
+    if (size < (off_t) pos) {
+        pos = 0;
+        followPtr->lineNum = 0;
+    }
+    if ((off_t) pos == size)
+        return TCL_OK;
+
+    /*
+     * Seeking clears the end of file left by the last scan.
+     */
+    Tcl_Seek (followPtr->channel, pos, SEEK_SET);
+
+    data.contextPtr = contextPtr;
+    data.channel = followPtr->channel;
+    data.matchVarObj = followPtr->matchVarObj;
+    data.completeLines = completeLines;
+    data.follow = TRUE;
+    data.lineNum = followPtr->lineNum;
+    contextPtr->fileOpen = TRUE;
+    result = ScanFile (followPtr->interp, &data, followPtr->numThreads);
+    followPtr->lineNum = data.lineNum;
+    if (data.stopped)
+        followPtr->stop = TRUE;
+    if ((result == TCL_OK) && (followPtr->checkpointVarObj != NULL) &&
+        (followPtr->channel != NULL)) {
+        result = SetCheckpointVar (followPtr->interp,
+                                   followPtr->checkpointVarObj,
+                                   followPtr->channel, data.lineNum);
+    }
+    return result;
+}
+
+/*-----------------------------------------------------------------------------
+ * FollowRotated --
+ *
+ *   Check if the name of a followed file now refers to a new file.  If it
+ * does, the rest of the old file, including a last line without a
+ * terminator, is scanned and the new file is opened in its place with the
+ * same translation and encoding.
+ *
+ * Parameters:
+ *   o followPtr - The file being followed.
+ * Returns:
+ *   TCL_OK if the new file was opened, TCL_CONTINUE if there is no new file
+ * or TCL_ERROR if scanning the old one failed.
+ *-----------------------------------------------------------------------------
+ */
+static int
+FollowRotated (scanFollow_t *followPtr)
+{
+    static char *options [] = {"-translation", "-encoding", "-eofchar", NULL};
+    Tcl_Interp *interp = followPtr->interp;
+    Tcl_StatBuf *pathStatPtr;
+    struct stat chanStat;
+    Tcl_Channel newChannel;
+    Tcl_DString optionBuf;
+    int idx, same;
+
+    pathStatPtr = Tcl_AllocStatBuf ();
+    if (Tcl_FSStat (followPtr->fileNameObj, pathStatPtr) != 0) {
+        ckfree ((char *) pathStatPtr);
+        followPtr->atPath = FALSE;
+        return TCL_CONTINUE;
+    }
+    if (TclXOSFstat (interp, followPtr->channel, &chanStat, NULL) != TCL_OK) {
+        Tcl_ResetResult (interp);
+        ckfree ((char *) pathStatPtr);
+        return TCL_CONTINUE;
+    }
+    same = (Tcl_GetFSDeviceFromStat (pathStatPtr) ==
+            (unsigned) chanStat.st_dev) &&
+           (Tcl_GetFSInodeFromStat (pathStatPtr) ==
+            (unsigned) chanStat.st_ino);
+    ckfree ((char *) pathStatPtr);
+    followPtr->atPath = same;
+    if (same)
+        return TCL_CONTINUE;
+
+    if (FollowScan (followPtr, FALSE) != TCL_OK)
+        return TCL_ERROR;
+    if (followPtr->stop || (followPtr->channel == NULL))
+        return TCL_CONTINUE;
+
+    newChannel = Tcl_FSOpenFileChannel (interp, followPtr->fileNameObj,
+                                        "r", 0);
+    if (newChannel == NULL) {
+        Tcl_ResetResult (interp);
+        return TCL_CONTINUE;
+    }
+    Tcl_DStringInit (&optionBuf);
+    for (idx = 0; options [idx] != NULL; idx++) {
+        Tcl_DStringSetLength (&optionBuf, 0);
+        if (Tcl_GetChannelOption (NULL, followPtr->channel, options [idx],
+                                  &optionBuf) == TCL_OK)
+            Tcl_SetChannelOption (NULL, newChannel, options [idx],
+                                  Tcl_DStringValue (&optionBuf));
+    }
+    Tcl_DStringFree (&optionBuf);
+
+    Tcl_DeleteCloseHandler (followPtr->channel, FollowCloseHandler,
+                            (ClientData) followPtr);
+    if (followPtr->ownChannel)
+        Tcl_Close (NULL, followPtr->channel);
+    followPtr->channel = newChannel;
+    followPtr->ownChannel = TRUE;
+    followPtr->lineNum = 0;
+    followPtr->atPath = TRUE;
+    Tcl_CreateCloseHandler (newChannel, FollowCloseHandler,
+                            (ClientData) followPtr);
+
+    if (followPtr->watchPtr != NULL)
+        TclXOSUnwatchFile (followPtr->watchPtr);
+    followPtr->watchPtr =
+        TclXOSWatchFile (Tcl_GetStringFromObj (followPtr->fileNameObj, NULL),
+                         FollowWatchProc, (ClientData) followPtr);
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * FollowFile --
+ *
+ *   Scan the new lines of a followed file and check for rotation.  Errors
+ * are reported as background errors and stop following the file, as does a
+ * command terminating the scan or the file being closed.  Otherwise, a
+ * timer is set if the file can't be watched for changes.
+ *
+ * Parameters:
+ *   o followPtr - The file being followed.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FollowFile (scanFollow_t *followPtr)
+{
+    int result = TCL_OK;
+
+    if (followPtr->scanning) {
+        followPtr->rescan = TRUE;
+        return;
+    }
+    followPtr->scanning = TRUE;
+    do {
+        followPtr->rescan = FALSE;
+        result = FollowScan (followPtr, TRUE);
+        if ((result != TCL_OK) || followPtr->stop ||
+            (followPtr->channel == NULL))
+            break;
+        if (followPtr->fileNameObj != NULL) {
+            result = FollowRotated (followPtr);
+            if (result == TCL_OK) {
+                followPtr->rescan = TRUE;
+            } else if (result == TCL_CONTINUE) {
+                result = TCL_OK;
+            }
+        }
+    } while ((result == TCL_OK) && followPtr->rescan && !followPtr->stop &&
+             (followPtr->channel != NULL));
+    followPtr->scanning = FALSE;
+
+    if (result == TCL_ERROR) {
+        Tcl_AddObjErrorInfo (followPtr->interp,
+                             "\n    (following file with scanfile)", -1);
+        Tcl_BackgroundError (followPtr->interp);
+        followPtr->stop = TRUE;
+    }
+    if (followPtr->stop || (followPtr->channel == NULL)) {
+        StopFollow (followPtr);
+        return;
+    }
+    if (((followPtr->watchPtr == NULL) || !followPtr->atPath) &&
+        (followPtr->timer == NULL)) {
+        followPtr->timer = Tcl_CreateTimerHandler (followPtr->interval,
+                                                   FollowTimerProc,
+                                                   (ClientData) followPtr);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * FollowTimerProc --
+ *   Timer handler to poll a followed file.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FollowTimerProc (ClientData clientData)
+{
+    scanFollow_t *followPtr = (scanFollow_t *) clientData;
+
+    followPtr->timer = NULL;
+    FollowFile (followPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * FollowWatchProc --
+ *   Called when a followed file changes.  Once it is moved, the name is
+ * polled until a new file appears.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FollowWatchProc (ClientData clientData, int moved)
+{
+    scanFollow_t *followPtr = (scanFollow_t *) clientData;
+
+    if (moved) {
+        TclXOSUnwatchFile (followPtr->watchPtr);
+        followPtr->watchPtr = NULL;
+    }
+    FollowFile (followPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * FollowCloseHandler --
+ *   Close handler for a followed file.  Stops following it.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FollowCloseHandler (ClientData clientData)
+{
+    scanFollow_t *followPtr = (scanFollow_t *) clientData;
+
+    followPtr->channel = NULL;
+    followPtr->contextPtr->fileOpen = FALSE;
+    if (!followPtr->scanning)
+        StopFollow (followPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * StartFollow --
+ *
+ *   Start following a file that has been scanned up to its last complete
+ * line.
+ *
+ * Parameters:
+ *   o interp - The interpreter to evaluate commands in.
+ *   o contextPtr - The scan context.
+ *   o channel - The file.
+ *   o fileNameObj - The name of the file, to detect rotation.
+ *   o matchVarObj - The -matchvar variable or NULL.
+ *   o checkpointVarObj - The -checkpointvar variable or NULL.
+ *   o numThreads - Threads to scan with.
+ *   o interval - Poll interval in milliseconds.
+ *   o clearCopyFile - Clear the copy file when done.
+ *   o lineNum - Lines already scanned.
+ *-----------------------------------------------------------------------------
+ */
+static void
+StartFollow (Tcl_Interp *interp,
+             scanContext_t *contextPtr,
+             Tcl_Channel channel,
+             Tcl_Obj *fileNameObj,
+             Tcl_Obj *matchVarObj,
+             Tcl_Obj *checkpointVarObj,
+             int numThreads,
+             int interval,
+             int clearCopyFile,
+             long lineNum)
+{
+    scanFollow_t *followPtr;
+
+    followPtr = (scanFollow_t *) ckalloc (sizeof (scanFollow_t));
+    followPtr->interp = interp;
+    followPtr->contextPtr = contextPtr;
+    followPtr->channel = channel;
+    followPtr->ownChannel = FALSE;
+    followPtr->fileNameObj = fileNameObj;
+    Tcl_IncrRefCount (fileNameObj);
+    followPtr->matchVarObj = matchVarObj;
+    if (matchVarObj != NULL)
+        Tcl_IncrRefCount (matchVarObj);
+    followPtr->checkpointVarObj = checkpointVarObj;
+    if (checkpointVarObj != NULL)
+        Tcl_IncrRefCount (checkpointVarObj);
+    followPtr->numThreads = numThreads;
+    followPtr->clearCopyFile = clearCopyFile;
+    followPtr->interval = interval;
+    followPtr->timer = NULL;
+    followPtr->atPath = TRUE;
+    followPtr->lineNum = lineNum;
+    followPtr->scanning = FALSE;
+    followPtr->rescan = FALSE;
+    followPtr->stop = FALSE;
+    contextPtr->followPtr = followPtr;
+
+    Tcl_CreateCloseHandler (channel, FollowCloseHandler,
+                            (ClientData) followPtr);
+    followPtr->watchPtr =
+        TclXOSWatchFile (Tcl_GetStringFromObj (fileNameObj, NULL),
+                         FollowWatchProc, (ClientData) followPtr);
+
+    /*
+     * Check the file now in case it grew or was rotated during the first
+     * scan; this also starts the timer when needed.
+     */
+    FollowFile (followPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * StopFollow --
+ *
+ *   Stop following a file and release the follow data.
+ *-----------------------------------------------------------------------------
+ */
+static void
+StopFollow (scanFollow_t *followPtr)
+{
+    scanContext_t *contextPtr = followPtr->contextPtr;
+
+    if (followPtr->scanning) {
+        followPtr->stop = TRUE;
+        return;
+    }
+    contextPtr->followPtr = NULL;
+    if (followPtr->timer != NULL)
+        Tcl_DeleteTimerHandler (followPtr->timer);
+    if (followPtr->watchPtr != NULL)
+        TclXOSUnwatchFile (followPtr->watchPtr);
+    if (followPtr->channel != NULL) {
+        Tcl_DeleteCloseHandler (followPtr->channel, FollowCloseHandler,
+                                (ClientData) followPtr);
+        if (followPtr->ownChannel)
+            Tcl_Close (NULL, followPtr->channel);
+    }
+    if (followPtr->clearCopyFile)
+        ClearCopyFile (contextPtr);
+    Tcl_DecrRefCount (followPtr->fileNameObj);
+    if (followPtr->matchVarObj != NULL)
+        Tcl_DecrRefCount (followPtr->matchVarObj);
+    if (followPtr->checkpointVarObj != NULL)
+        Tcl_DecrRefCount (followPtr->checkpointVarObj);
+    ckfree ((char *) followPtr);
+}
+
 /*-----------------------------------------------------------------------------
  * TclX_ScanfileObjCmd --
  *
  *   Implements the TCL command:
- *        scanfile ?-copyfile copyhandle? contexthandle filehandle
+ *        scanfile ?-copyfile copyhandle? ?-matchvar varName? ?-threads count?
+ *                 ?-follow fileName? ?-interval ms? ?-startoffset offset?
+ *                 ?-startline lineNum? ?-checkpointvar varName?
+ *                 contexthandle filehandle
  *-----------------------------------------------------------------------------
  */
 static int
@@ -779,37 +3370,131 @@ TclX_ScanfileObjCmd (ClientData clientData,
                      Tcl_Obj *CONST objv[])
 {
     scanContext_t *contextPtr, **tableEntryPtr;
-    Tcl_Obj       *contextHandleObj, *fileHandleObj, *copyFileHandleObj;
+    Tcl_Obj       *copyFileHandleObj = NULL;
+    Tcl_Obj       *matchVarObj = NULL;
+    Tcl_Obj       *followNameObj = NULL;
+    Tcl_Obj       *checkpointVarObj = NULL;
     Tcl_Channel    channel;
-    int            status;
-
-    if ((objc != 3) && (objc != 5))
-        goto argError;
-
-    if (objc == 3) {
-	contextHandleObj = objv [1];
-	fileHandleObj = objv [2];
-	copyFileHandleObj = NULL;
-    } else {
-	if (!STREQU (Tcl_GetStringFromObj (objv[1], NULL), "-copyfile"))
+    scanData_t     data;
+    char          *option;
+    int            status, argIdx, numThreads = 1, seekable;
+    int            interval = -1;
+    long           startLine = 1;
+    Tcl_WideInt    startOffset = -1;
+
+    for (argIdx = 1; argIdx < objc - 2; argIdx += 2) {
+        option = Tcl_GetStringFromObj (objv [argIdx], NULL);
+        if (STREQU (option, "-copyfile")) {
+            copyFileHandleObj = objv [argIdx + 1];
+        } else if (STREQU (option, "-matchvar")) {
+            matchVarObj = objv [argIdx + 1];
+        } else if (STREQU (option, "-follow")) {
+            if (Tcl_IsSafe (interp)) {
+                TclX_AppendObjResult (interp, Tcl_GetString (objv [0]),
+                        " -follow is not available in a safe interpreter",
+                        (char *) NULL);
+                return TCL_ERROR;
+            }
+            followNameObj = objv [argIdx + 1];
+        } else if (STREQU (option, "-checkpointvar")) {
+            checkpointVarObj = objv [argIdx + 1];
+        } else if (STREQU (option, "-startoffset")) {
+            if (Tcl_GetWideIntFromObj (interp, objv [argIdx + 1],
+                                       &startOffset) != TCL_OK)
+                return TCL_ERROR;
+            if (startOffset < 0) {
+                TclX_AppendObjResult (interp, "start offset must be at ",
+                                      "least 0, got \"",
+                                      Tcl_GetStringFromObj (objv [argIdx + 1],
+                                                            NULL),
+                                      "\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+        } else if (STREQU (option, "-startline")) {
+            if (Tcl_GetLongFromObj (interp, objv [argIdx + 1],
+                                    &startLine) != TCL_OK)
+                return TCL_ERROR;
+            if (startLine < 1) {
+                TclX_AppendObjResult (interp, "start line must be at ",
+                                      "least 1, got \"",
+                                      Tcl_GetStringFromObj (objv [argIdx + 1],
+                                                            NULL),
+                                      "\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+        } else if (STREQU (option, "-interval")) {
+            if (Tcl_GetIntFromObj (interp, objv [argIdx + 1],
+                                   &interval) != TCL_OK)
+                return TCL_ERROR;
+            if (interval < 1) {
+                TclX_AppendObjResult (interp, "poll interval must be at ",
+                                      "least 1, got \"",
+                                      Tcl_GetStringFromObj (objv [argIdx + 1],
+                                                            NULL),
+                                      "\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+        } else if (STREQU (option, "-threads")) {
+            if (Tcl_GetIntFromObj (interp, objv [argIdx + 1],
+                                   &numThreads) != TCL_OK)
+                return TCL_ERROR;
+            if (numThreads < 1) {
+                TclX_AppendObjResult (interp, "thread count must be at ",
+                                      "least 1, got \"",
+                                      Tcl_GetStringFromObj (objv [argIdx + 1],
+                                                            NULL),
+                                      "\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+        } else {
             goto argError;
-	copyFileHandleObj = objv [2];
-	contextHandleObj = objv [3];
-	fileHandleObj = objv [4];
+        }
+    }
+    if (argIdx != objc - 2)
+        goto argError;
+    if ((interval > 0) && (followNameObj == NULL)) {
+        TclX_AppendObjResult (interp, "-interval is only valid with -follow",
+                              (char *) NULL);
+        return TCL_ERROR;
     }
 
     tableEntryPtr = (scanContext_t **)
         TclX_HandleXlateObj (interp,
                              (void_pt) clientData, 
-                             contextHandleObj);
+                             objv [objc - 2]);
     if (tableEntryPtr == NULL)
         return TCL_ERROR;
     contextPtr = *tableEntryPtr;
 
-    channel = TclX_GetOpenChannelObj (interp, fileHandleObj, TCL_READABLE);
+    channel = TclX_GetOpenChannelObj (interp, objv [objc - 1], TCL_READABLE);
     if (channel == NULL)
         return TCL_ERROR;
 
+    if (followNameObj != NULL) {
+        if (contextPtr->followPtr != NULL) {
+            TclX_AppendObjResult (interp, "scan context \"",
+                                  contextPtr->contextHandle,
+                                  "\" is already following a file",
+                                  (char *) NULL);
+            return TCL_ERROR;
+        }
+        if (TclXOSSeekable (interp, channel, &seekable) != TCL_OK)
+            return TCL_ERROR;
+        if (!seekable) {
+            TclX_AppendObjResult (interp, Tcl_GetChannelName (channel),
+                                  ": can only follow regular files",
+                                  (char *) NULL);
+            return TCL_ERROR;
+        }
+    }
+
+    if ((startOffset >= 0) &&
+        (Tcl_Seek (channel, startOffset, SEEK_SET) < 0)) {
+        TclX_AppendObjResult (interp, Tcl_GetChannelName (channel), ": ",
+                              Tcl_PosixError (interp), (char *) NULL);
+        return TCL_ERROR;
+    }
+
     if (copyFileHandleObj != NULL) {
         if (SetCopyFileObj (interp, contextPtr, copyFileHandleObj) == TCL_ERROR)
             return TCL_ERROR;
@@ -820,16 +3505,46 @@ TclX_ScanfileObjCmd (ClientData clientData,
      * Watch for case where ScanFile may close the file during scan.
      * [Bug 1045190]
      */
+    data.contextPtr = contextPtr;
+    data.channel = channel;
+    data.matchVarObj = matchVarObj;
+    data.completeLines = (followNameObj != NULL);
+    data.follow = (followNameObj != NULL);
+    data.lineNum = startLine - 1;
     contextPtr->fileOpen = TRUE;
+    contextPtr->inUse++;
     Tcl_CreateCloseHandler (channel,
                             ScanFileCloseHandler,
                             (ClientData) contextPtr);
-    status = ScanFile(interp, contextPtr, channel);
+    status = ScanFile (interp, &data, numThreads);
     if (contextPtr->fileOpen == TRUE) {
 	Tcl_DeleteCloseHandler(channel, ScanFileCloseHandler,
 		(ClientData) contextPtr);
     }
 
+    /*
+     * Record where the scan ended, so a later one can resume there.
+     */
+    if ((status == TCL_OK) && (checkpointVarObj != NULL) &&
+        contextPtr->fileOpen) {
+        status = SetCheckpointVar (interp, checkpointVarObj, channel,
+                                   data.lineNum);
+    }
+
+    /*
+     * Keep scanning the file as it grows, unless the first scan ended it.
+     */
+    if ((followNameObj != NULL) && (status == TCL_OK) &&
+        contextPtr->fileOpen && !data.stopped) {
+        StartFollow (interp, contextPtr, channel, followNameObj, matchVarObj,
+                     checkpointVarObj, numThreads,
+                     (interval > 0) ? interval : SCAN_FOLLOW_INTERVAL,
+                     (copyFileHandleObj != NULL), data.lineNum);
+        contextPtr->inUse--;
+        return TCL_OK;
+    }
+    contextPtr->inUse--;
+
     /*
      * If we set the copyfile, disassociate it from the context.
      */
@@ -840,9 +3555,9 @@ TclX_ScanfileObjCmd (ClientData clientData,
 
   argError:
     return TclX_WrongArgs (interp, objv [0],
-		           "?-copyfile filehandle? contexthandle filehandle");
+		           "?-copyfile filehandle? ?-matchvar varName? ?-threads count? ?-follow fileName? ?-interval ms? ?-startoffset offset? ?-startline lineNum? ?-checkpointvar varName? contexthandle filehandle");
 }
-
+
 /*-----------------------------------------------------------------------------
  * FileScanCleanUp --
  *
@@ -233,6 +233,14 @@ TclX_InfoxObjCmd (ClientData clientData,
         Tcl_SetBooleanObj (resultPtr, TRUE);
 #       else
         Tcl_SetBooleanObj (resultPtr, FALSE);
+#       endif        
+        return TCL_OK;
+    }
+    if (STREQU ("have_poll", optionPtr)) {
+#       ifdef HAVE_POLL_H
+        Tcl_SetBooleanObj (resultPtr, TRUE);
+#       else
+        Tcl_SetBooleanObj (resultPtr, FALSE);
 #       endif        
         return TCL_OK;
     }
@@ -303,6 +311,7 @@ TclX_InfoxObjCmd (ClientData clientData,
                           "\", expect one of: version, patchlevel, ",
                           "have_fchown, have_fchmod, have_flock, ",
                           "have_fsync, have_ftruncate, have_msgcats, ",
+                          "have_poll, ",
                           "have_symlink, have_truncate, ",
                           "have_posix_signals, have_waitpid, appname, ",
                           "applongname, appversion, or apppatchlevel",
@@ -37,23 +37,83 @@
 /* #define NO_KEYLIST_HASH_TABLE */
 
 /*
- * An entry in a keyed list array.
+ * An entry in a keyed list array.  A NULL key marks a slot whose entry has
+ * been deleted; such slots are skipped when walking the array and are
+ * reclaimed by CompactKeyedList.
  *
- * JH: There was the supposition that making the key an object would
- * be faster, but I tried that and didn't find it to be true.  The
- * use of the layered hash table is a big win though.
+ * Keys are string objects taken from a per-thread intern table, so every
+ * keyed list in a thread that uses a given key shares a single object for
+ * it.  This saves a copy of the key per entry, lets the key be put straight
+ * into generated string reps and key lists, and lets the per keyed list hash
+ * table be keyed on the object's address.
  */
 typedef struct {
-    char *key;
-    int keyLen;
+    Tcl_Obj *keyPtr;
     Tcl_Obj *valuePtr;
 } keylEntry_t;
 
 /*
- * Internal representation of a keyed list object.
+ * Per-thread table of interned keys.  The table is keyed by the key string,
+ * passed as a counted keylKeyString_t so that a segment of a key path can be
+ * looked up in place, and each entry holds a reference to the key object,
+ * which is both the entry's key and its value.  Keys only referenced by the
+ * table are dropped by SweepKeyInternTable when the table grows to sweepSize
+ * entries.  Keys are interned per thread, not per process, as Tcl objects
+ * can't be shared between threads.
+ */
+typedef struct {
+    int		  initialized;
+    int		  sweepSize;  /* Table size that triggers a sweep.	*/
+    Tcl_HashTable keyTable;   /* Key string to interned key object.	*/
+} keylThreadData_t;
+
+typedef struct {
+    CONST char *bytes;
+    int		length;
+    Tcl_Obj    *objPtr;	      /* Object to intern, NULL to create one.	*/
+} keylKeyString_t;
+
+static Tcl_ThreadDataKey keylDataKey;
+
+/*
+ * Initial size of the intern table before unused keys are swept.
+ */
+#define KEYL_INTERN_SWEEP_SIZE 1024
+
+/*
+ * Number of keys handled by the multiple key functions without allocating
+ * scratch arrays.
+ */
+#define KEYL_STATIC_KEYS 16
+
+/*
+ * A key path, such as `a.b.c', compiled into the interned key object for
+ * each of its levels.  Key path objects passed to the keyed list commands
+ * cache their compiled path as their internal representation, so a key used
+ * over and over is only split, validated and interned once.  The path is
+ * reference counted so that it survives for the length of a call even if
+ * the key object is shimmered to another type while the call is using it.
+ */
+typedef struct {
+    int		 refCount;    /* Key objects and calls using the path.	*/
+    int		 numKeys;     /* Number of levels in the path.		*/
+    Tcl_Obj	*keys [1];    /* Interned key for each level; actually	*/
+                              /* numKeys long.				*/
+} keylPath_t;
+
+#define KEYL_PATH_SIZE(numKeys) \
+    (sizeof (keylPath_t) + ((numKeys) - 1) * sizeof (Tcl_Obj *))
+
+/*
+ * Internal representation of a keyed list object.  The representation is
+ * reference counted so that duplicating a keyed list object shares it rather
+ * than copying every entry.  It is copied, one level at a time, by
+ * UnshareKeyedListIntRep when an object sharing it is about to be modified.
  */
 typedef struct {
+    int		 refCount;    /* Number of objects sharing this rep.	*/
     int		 arraySize;   /* Current slots available in the array.	*/
+    int		 numSlots;    /* Slots used, including deleted entries. */
     int		 numEntries;  /* Number of actual entries in the array. */
     keylEntry_t *entries;     /* Array of keyed list entries.		*/
 #ifndef NO_KEYLIST_HASH_TABLE
@@ -62,23 +122,75 @@ typedef struct {
 #endif
 } keylIntObj_t;
 
+/*
+ * Serialized keyed lists.  The format is a header followed by the top level
+ * keyed list.  A keyed list is a count of entries, each of which is a key, a
+ * type byte and a value.  Keys and plain values are a length and the string
+ * bytes followed by a NUL.  A value that is itself a keyed list is the length
+ * of its serialized form, followed by the form.  All counts and lengths are
+ * four byte big-endian unsigned integers.
+ *
+ * Having the length of sub-lists lets them be skipped, so deserializing only
+ * decodes the top level.  Sub-lists become keylSerialized objects that point
+ * into the buffer, and are decoded when they are first accessed.  The buffer
+ * is a private copy of the data or of the file it was read from, and is
+ * reference counted by the objects pointing into it.
+ */
+#define KEYL_SERIAL_MAGIC	"TclXkeyl"
+#define KEYL_SERIAL_MAGIC_LEN	8
+#define KEYL_SERIAL_VERSION	1
+#define KEYL_SERIAL_HEADER_LEN	(KEYL_SERIAL_MAGIC_LEN + 4)
+
+#define KEYL_SERIAL_VALUE	'v'
+#define KEYL_SERIAL_KEYL	'k'
+
+/*
+ * Smallest possible serialized entry: a one byte key and an empty value.
+ */
+#define KEYL_SERIAL_MIN_ENTRY	11
+
+typedef struct {
+    int		 refCount;    /* Objects pointing into the buffer.	*/
+    char	*bytes;	      /* Serialized data.			*/
+    off_t	 length;      /* Length of the data.			*/
+} keylSerialBuf_t;
+
+/*
+ * Internal representation of a keylSerialized object, a keyed list still in
+ * its serialized form.
+ */
+typedef struct {
+    keylSerialBuf_t	*bufPtr;
+    CONST unsigned char *node;	 /* Start of the serialized keyed list.	*/
+    int			 length; /* Length of the serialized keyed list. */
+} keylSerialRep_t;
+
 /*
  * Amount to increment array size by when it needs to grow.
  */
 #define KEYEDLIST_ARRAY_INCR_SIZE 16
 
+/*
+ * Test for a deleted slot in the entries array.  Deleting an entry leaves a
+ * hole rather than shifting the array down, so that the slot indexes held
+ * in the hash table remain valid and deletion does not depend on the size
+ * of the keyed list.  Holes are squeezed out once they outnumber the live
+ * entries, preserving the insertion order of the remaining keys.
+ */
+#define KEYL_SLOT_DELETED(keylIntPtr, idx) \
+    ((keylIntPtr)->entries [idx].keyPtr == NULL)
+
 /*
  * Macro to duplicate a child entry of a keyed list if it is share by more
- * than the parent.
- * NO_KEYLIST_HASH_TABLE: We don't duplicate the hash table, so ensure
- * that consistency checks allow for portions where not all entries are
- * in the hash table.
+ * than the parent.  The duplicate shares the child's internal representation
+ * until it is modified.
  */
 #define DupSharedKeyListChild(keylIntPtr, idx) \
     if (Tcl_IsShared(keylIntPtr->entries [idx].valuePtr)) { \
-	keylIntPtr->entries [idx].valuePtr = \
-	    Tcl_DuplicateObj (keylIntPtr->entries [idx].valuePtr); \
+	Tcl_Obj *sharedPtr = keylIntPtr->entries [idx].valuePtr; \
+	keylIntPtr->entries [idx].valuePtr = Tcl_DuplicateObj (sharedPtr); \
 	Tcl_IncrRefCount(keylIntPtr->entries [idx].valuePtr); \
+	Tcl_DecrRefCount(sharedPtr); \
     }
 
 /*
@@ -106,12 +218,67 @@ ValidateKeyedList (keylIntObj_t *keylIntPtr);
 static int
 ValidateKey (Tcl_Interp *interp, char *key, int keyLen);
 
+static keylThreadData_t *
+GetKeylThreadData (void);
+
+static void
+FreeKeylThreadData (ClientData clientData);
+
+static void
+SweepKeyInternTable (keylThreadData_t *tsdPtr);
+
+static unsigned int
+HashKeyString (Tcl_HashTable *tablePtr, VOID *keyPtr);
+
+static int
+CompareKeyStrings (VOID *keyPtr, Tcl_HashEntry *hPtr);
+
+static Tcl_HashEntry *
+AllocInternEntry (Tcl_HashTable *tablePtr, VOID *keyPtr);
+
+static void
+FreeInternEntry (Tcl_HashEntry *hPtr);
+
+static Tcl_Obj *
+InternKey (CONST char *key, int keyLen, Tcl_Obj *objPtr);
+
+static keylPath_t *
+NewKeyPath (CONST char *key, int keyLen);
+
+static void
+ReleaseKeyPath (keylPath_t *pathPtr);
+
+static void
+FreeKeyPathInternalRep (Tcl_Obj *objPtr);
+
+static void
+DupKeyPathInternalRep (Tcl_Obj *srcPtr,
+                       Tcl_Obj *copyPtr);
+
+static keylPath_t *
+GetKeyPathFromObj (Tcl_Interp *interp,
+                   Tcl_Obj    *objPtr);
+
 static keylIntObj_t *
 AllocKeyedListIntRep (void);
 
 static void
 FreeKeyedListData (keylIntObj_t *keylIntPtr);
 
+static keylIntObj_t *
+CopyKeyedListData (keylIntObj_t *srcIntPtr);
+
+static keylIntObj_t *
+UnshareKeyedListIntRep (Tcl_Obj *keylPtr);
+
+static void
+CompactKeyedList (keylIntObj_t *keylIntPtr);
+
+#ifndef NO_KEYLIST_HASH_TABLE
+static void
+IndexKeyedList (keylIntObj_t *keylIntPtr);
+#endif
+
 static void
 EnsureKeyedListSpace (keylIntObj_t *keylIntPtr,
                       int		newNumEntries);
@@ -122,9 +289,50 @@ DeleteKeyedListEntry (keylIntObj_t *keylIntPtr,
 
 static int
 FindKeyedListEntry (keylIntObj_t *keylIntPtr,
-                    char	     *key,
-                    int	     *keyLenPtr,
-                    char	    **nextSubKeyPtr);
+                    Tcl_Obj	     *keyObjPtr);
+
+static int
+AddKeyedListEntry (keylIntObj_t *keylIntPtr,
+                   Tcl_Obj      *keyObjPtr,
+                   Tcl_Obj      *valuePtr);
+
+static void
+ReleaseKeyPaths (int          pathc,
+                 keylPath_t **pathv,
+                 keylPath_t **staticPathv);
+
+static int
+GatherKeyPathRun (int          depth,
+                  int          pathc,
+                  keylPath_t **pathv);
+
+static int
+SetKeyedListPaths (Tcl_Interp  *interp,
+                   Tcl_Obj     *keylPtr,
+                   int          depth,
+                   int          pathc,
+                   keylPath_t **pathv,
+                   Tcl_Obj    **valuev);
+
+static int
+GetKeyedListPaths (Tcl_Interp  *interp,
+                   Tcl_Obj     *keylPtr,
+                   int          depth,
+                   int          pathc,
+                   keylPath_t **pathv,
+                   Tcl_Obj    **valuev);
+
+static int
+DeleteKeyedListPath (Tcl_Interp *interp,
+                     Tcl_Obj    *keylPtr,
+                     int         depth,
+                     keylPath_t *pathPtr);
+
+static int
+GetKeyedListPathKeys (Tcl_Interp *interp,
+                      Tcl_Obj    *keylPtr,
+                      keylPath_t *pathPtr,
+                      Tcl_Obj   **listObjPtrPtr);
 
 static void
 DupKeyedListInternalRep (Tcl_Obj *srcPtr,
@@ -137,9 +345,56 @@ static int
 SetKeyedListFromAny (Tcl_Interp *interp,
                      Tcl_Obj    *objPtr);
 
+static void
+FormatKeyedList (keylIntObj_t *keylIntPtr,
+                 Tcl_Obj      *objPtr);
+
 static void
 UpdateStringOfKeyedList (Tcl_Obj *keylPtr);
 
+static void
+PutSerialLength (Tcl_DString   *bufPtr,
+                 unsigned long  length);
+
+static int
+GetSerialLength (CONST unsigned char **ptrPtr,
+                 CONST unsigned char  *end,
+                 unsigned long        *lengthPtr);
+
+static int
+SerializeKeyedList (Tcl_Interp  *interp,
+                    Tcl_Obj     *keylPtr,
+                    Tcl_DString *bufPtr);
+
+static keylIntObj_t *
+DecodeKeyedList (Tcl_Interp	     *interp,
+                 keylSerialBuf_t     *bufPtr,
+                 CONST unsigned char *node,
+                 int		      length);
+
+static int
+DecodeSerialBuffer (Tcl_Interp      *interp,
+                    keylSerialBuf_t *bufPtr,
+                    Tcl_Obj        **keylPtrPtr);
+
+static void
+ReleaseSerialBuffer (keylSerialBuf_t *bufPtr);
+
+static Tcl_Obj *
+NewSerialKeylObj (keylSerialBuf_t     *bufPtr,
+                  CONST unsigned char *node,
+                  int		       length);
+
+static void
+FreeSerialKeylInternalRep (Tcl_Obj *objPtr);
+
+static void
+DupSerialKeylInternalRep (Tcl_Obj *srcPtr,
+                          Tcl_Obj *copyPtr);
+
+static void
+UpdateStringOfSerialKeyl (Tcl_Obj *objPtr);
+
 static int 
 TclX_KeylgetObjCmd (ClientData   clientData,
                     Tcl_Interp  *interp,
@@ -164,6 +419,18 @@ TclX_KeylkeysObjCmd (ClientData   clientData,
                      int	      objc,
                      Tcl_Obj     *CONST objv[]);
 
+static int 
+TclX_KeylserializeObjCmd (ClientData   clientData,
+                          Tcl_Interp  *interp,
+                          int	       objc,
+                          Tcl_Obj     *CONST objv[]);
+
+static int 
+TclX_KeyldeserializeObjCmd (ClientData   clientData,
+                            Tcl_Interp  *interp,
+                            int		 objc,
+                            Tcl_Obj     *CONST objv[]);
+
 /*
  * Type definition.
  */
@@ -175,6 +442,31 @@ static Tcl_ObjType keyedListType = {
     SetKeyedListFromAny	      /* setFromAnyProc */
 };
 
+static Tcl_ObjType keylSerialType = {
+    "keylSerialized",	      /* name */
+    FreeSerialKeylInternalRep, /* freeIntRepProc */
+    DupSerialKeylInternalRep, /* dupIntRepProc */
+    UpdateStringOfSerialKeyl, /* updateStringProc */
+    NULL		      /* setFromAnyProc */
+};
+
+static Tcl_ObjType keyPathType = {
+    "keylKeyPath",	      /* name */
+    FreeKeyPathInternalRep,   /* freeIntRepProc */
+    DupKeyPathInternalRep,    /* dupIntRepProc */
+    NULL,		      /* updateStringProc */
+    NULL		      /* setFromAnyProc */
+};
+
+static Tcl_HashKeyType keyStringHashKeyType = {
+    TCL_HASH_KEY_TYPE_VERSION, /* version */
+    0,			      /* flags */
+    HashKeyString,	      /* hashKeyProc */
+    CompareKeyStrings,	      /* compareKeysProc */
+    AllocInternEntry,	      /* allocEntryProc */
+    FreeInternEntry	      /* freeEntryProc */
+};
+
 
 /*-----------------------------------------------------------------------------
  * ValidateKeyedList --
@@ -185,11 +477,13 @@ static Tcl_ObjType keyedListType = {
  */
 #ifdef TCLX_DEBUG
 static void
-ValidateKeyedList (KeylIntObj_t *keylIntPtr)
+ValidateKeyedList (keylIntObj_t *keylIntPtr)
 {
-    int idx;
+    int idx, numLive = 0;
 
-    TclX_Assert (keylIntPtr->arraySize >= keylIntPtr->numEntries);
+    TclX_Assert (keylIntPtr->refCount >= 1);
+    TclX_Assert (keylIntPtr->arraySize >= keylIntPtr->numSlots);
+    TclX_Assert (keylIntPtr->numSlots >= keylIntPtr->numEntries);
     TclX_Assert (keylIntPtr->arraySize >= 0);
     TclX_Assert (keylIntPtr->numEntries >= 0);
     TclX_Assert ((keylIntPtr->arraySize > 0) ?
@@ -197,14 +491,18 @@ ValidateKeyedList (KeylIntObj_t *keylIntPtr)
     TclX_Assert ((keylIntPtr->numEntries > 0) ?
 		 (keylIntPtr->entries != NULL) : TRUE);
 
-    for (idx = 0; idx < keylIntPtr->numEntries; idx++) {
+    for (idx = 0; idx < keylIntPtr->numSlots; idx++) {
 	keylEntry_t *entryPtr = &(keylIntPtr->entries [idx]);
-	TclX_Assert (entryPtr->key != NULL);
+	if (KEYL_SLOT_DELETED (keylIntPtr, idx))
+	    continue;
+	numLive++;
+	TclX_Assert (entryPtr->keyPtr->refCount >= 2);
 	TclX_Assert (entryPtr->valuePtr->refCount >= 1);
 	if (entryPtr->valuePtr->typePtr == &keyedListType) {
 	    ValidateKeyedList (entryPtr->valuePtr->internalRep.otherValuePtr);
 	}
     }
+    TclX_Assert (numLive == keylIntPtr->numEntries);
 }
 #endif
 
@@ -236,770 +534,2047 @@ ValidateKey (Tcl_Interp *interp, char *key, int keyLen)
     return TCL_OK;
 }
 
-
 /*-----------------------------------------------------------------------------
- * AllocKeyedListIntRep --
- *   Allocate an and initialize the keyed list internal representation.
+ * GetKeylThreadData --
+ *   Get the keyed list data for the current thread, initializing it on the
+ * first call.
  *
  * Returns:
- *    A pointer to the keyed list internal structure.
+ *    A pointer to the thread's keyed list data.
  *-----------------------------------------------------------------------------
  */
-static keylIntObj_t *
-AllocKeyedListIntRep ()
+static keylThreadData_t *
+GetKeylThreadData ()
 {
-    keylIntObj_t *keylIntPtr;
-
-    keylIntPtr = (keylIntObj_t *) ckalloc (sizeof (keylIntObj_t));
-    memset(keylIntPtr, 0, sizeof (keylIntObj_t));
-#ifndef NO_KEYLIST_HASH_TABLE
-    keylIntPtr->hashTbl = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
-    Tcl_InitHashTable(keylIntPtr->hashTbl, TCL_STRING_KEYS);
-#endif
-    return keylIntPtr;
+    keylThreadData_t *tsdPtr = (keylThreadData_t *)
+	Tcl_GetThreadData (&keylDataKey, sizeof (keylThreadData_t));
+
+    if (!tsdPtr->initialized) {
+	Tcl_InitCustomHashTable (&tsdPtr->keyTable, TCL_CUSTOM_PTR_KEYS,
+				 &keyStringHashKeyType);
+	tsdPtr->sweepSize = KEYL_INTERN_SWEEP_SIZE;
+	tsdPtr->initialized = TRUE;
+	Tcl_CreateThreadExitHandler (FreeKeylThreadData, (ClientData) tsdPtr);
+    }
+    return tsdPtr;
 }
-
+
 /*-----------------------------------------------------------------------------
- * FreeKeyedListData --
- *   Free the internal representation of a keyed list.
+ * FreeKeylThreadData --
+ *   Thread exit handler that releases the thread's interned keys.  Keys still
+ * used by keyed list objects are freed when those objects are.
  *
  * Parameters:
- *   o keylIntPtr - Keyed list internal structure to free.
+ *   o clientData - Pointer to the thread's keyed list data.
  *-----------------------------------------------------------------------------
  */
 static void
-FreeKeyedListData (keylIntObj_t *keylIntPtr)
+FreeKeylThreadData (ClientData clientData)
 {
-    int idx;
+    keylThreadData_t *tsdPtr = (keylThreadData_t *) clientData;
 
-    for (idx = 0; idx < keylIntPtr->numEntries ; idx++) {
-	ckfree (keylIntPtr->entries [idx].key);
-	Tcl_DecrRefCount(keylIntPtr->entries [idx].valuePtr);
-    }
-    if (keylIntPtr->entries != NULL)
-	ckfree ((VOID*) keylIntPtr->entries);
-#ifndef NO_KEYLIST_HASH_TABLE
-    if (keylIntPtr->hashTbl != NULL) {
-	Tcl_DeleteHashTable(keylIntPtr->hashTbl);
-	ckfree((char *) (keylIntPtr->hashTbl));
-    }
-#endif
-    ckfree ((VOID*) keylIntPtr);
+    Tcl_DeleteHashTable (&tsdPtr->keyTable);
+    tsdPtr->initialized = FALSE;
 }
-
+
 /*-----------------------------------------------------------------------------
- * EnsureKeyedListSpace --
- *   Ensure there is enough room in a keyed list array for a certain number
- * of entries, expanding if necessary.
+ * SweepKeyInternTable --
+ *   Drop interned keys that are no longer used by any keyed list.  The next
+ * sweep is scheduled for when the table has doubled from the surviving size,
+ * so the cost of sweeping is spread over the keys added in between.
  *
  * Parameters:
- *   o keylIntPtr - Keyed list internal representation.
- *   o newNumEntries - The number of entries that are going to be added to
- *     the keyed list.
+ *   o tsdPtr - The thread's keyed list data.
  *-----------------------------------------------------------------------------
  */
 static void
-EnsureKeyedListSpace (keylIntObj_t *keylIntPtr, int newNumEntries)
+SweepKeyInternTable (keylThreadData_t *tsdPtr)
 {
-    KEYL_REP_ASSERT (keylIntPtr);
+    Tcl_HashEntry *entryPtr;
+    Tcl_HashSearch search;
 
-    if ((keylIntPtr->arraySize - keylIntPtr->numEntries) < newNumEntries) {
-	int newSize = keylIntPtr->arraySize + newNumEntries +
-	    KEYEDLIST_ARRAY_INCR_SIZE;
-	if (keylIntPtr->entries == NULL) {
-	    keylIntPtr->entries = (keylEntry_t *)
-		ckalloc (newSize * sizeof (keylEntry_t));
-	} else {
-	    keylIntPtr->entries = (keylEntry_t *)
-		ckrealloc ((VOID *) keylIntPtr->entries,
-			   newSize * sizeof (keylEntry_t));
+    for (entryPtr = Tcl_FirstHashEntry (&tsdPtr->keyTable, &search);
+	 entryPtr != NULL; entryPtr = Tcl_NextHashEntry (&search)) {
+	if (((Tcl_Obj *) Tcl_GetHashValue (entryPtr))->refCount <= 1) {
+	    Tcl_DeleteHashEntry (entryPtr);
 	}
-	keylIntPtr->arraySize = newSize;
     }
-
-    KEYL_REP_ASSERT (keylIntPtr);
+    tsdPtr->sweepSize = 2 * tsdPtr->keyTable.numEntries;
+    if (tsdPtr->sweepSize < KEYL_INTERN_SWEEP_SIZE) {
+	tsdPtr->sweepSize = KEYL_INTERN_SWEEP_SIZE;
+    }
 }
-
+
 /*-----------------------------------------------------------------------------
- * DeleteKeyedListEntry --
- *   Delete an entry from a keyed list.
- *
- * Parameters:
- *   o keylIntPtr - Keyed list internal representation.
- *   o entryIdx - Index of entry to delete.
+ * HashKeyString, CompareKeyStrings, AllocInternEntry, FreeInternEntry --
+ *   Hash key type procedures for the intern table.  Lookups are done with a
+ * keylKeyString_t, which need not be NUL terminated.  A new entry interns
+ * the supplied object or creates one, and holds a reference to it as its
+ * key; the object's string is what later lookups are compared against.
  *-----------------------------------------------------------------------------
  */
-static void
-DeleteKeyedListEntry (keylIntObj_t *keylIntPtr, int entryIdx)
+static unsigned int
+HashKeyString (Tcl_HashTable *tablePtr, VOID *keyPtr)
 {
+    keylKeyString_t *keyStrPtr = (keylKeyString_t *) keyPtr;
+    CONST char *bytes = keyStrPtr->bytes;
+    unsigned int result = 0;
     int idx;
 
-#ifndef NO_KEYLIST_HASH_TABLE
-    if (keylIntPtr->hashTbl != NULL) {
-	Tcl_HashEntry *entryPtr;
-	Tcl_HashSearch search;
-	int nidx;
+    for (idx = 0; idx < keyStrPtr->length; idx++) {
+	result += (result << 3) + (unsigned char) bytes [idx];
+    }
+    return result;
+}
 
-	entryPtr = Tcl_FindHashEntry(keylIntPtr->hashTbl,
-		keylIntPtr->entries [entryIdx].key);
-	if (entryPtr != NULL) {
-	    Tcl_DeleteHashEntry(entryPtr);
-	}
+static int
+CompareKeyStrings (VOID *keyPtr, Tcl_HashEntry *hPtr)
+{
+    keylKeyString_t *keyStrPtr = (keylKeyString_t *) keyPtr;
+    Tcl_Obj *keyObjPtr = (Tcl_Obj *) hPtr->key.oneWordValue;
 
-	/*
-	 * In order to maintain consistency, we have to iterate over
-	 * the entire hash table to find and decr relevant idxs.
-	 * We have to do this even if the previous index was not found
-	 * in the hash table, as Dup'ing doesn't dup the hash tables.
-	 */
-	for (entryPtr = Tcl_FirstHashEntry(keylIntPtr->hashTbl, &search);
-	     entryPtr != NULL; entryPtr = Tcl_NextHashEntry(&search)) {
-	    nidx = (int) Tcl_GetHashValue(entryPtr);
-	    if (nidx > entryIdx) {
-		Tcl_SetHashValue(entryPtr, (ClientData) (uintptr_t) (nidx - 1));
-	    }
-	}
-    }
-#endif
+    return (keyObjPtr->length == keyStrPtr->length) &&
+	(memcmp (keyObjPtr->bytes, keyStrPtr->bytes, keyStrPtr->length) == 0);
+}
 
-    ckfree (keylIntPtr->entries [entryIdx].key);
-    Tcl_DecrRefCount(keylIntPtr->entries [entryIdx].valuePtr);
+static Tcl_HashEntry *
+AllocInternEntry (Tcl_HashTable *tablePtr, VOID *keyPtr)
+{
+    keylKeyString_t *keyStrPtr = (keylKeyString_t *) keyPtr;
+    Tcl_HashEntry *hPtr;
+    Tcl_Obj *keyObjPtr;
 
-    for (idx = entryIdx; idx < keylIntPtr->numEntries - 1; idx++)
-	keylIntPtr->entries [idx] = keylIntPtr->entries [idx + 1];
-    keylIntPtr->numEntries--;
+    keyObjPtr = keyStrPtr->objPtr;
+    if (keyObjPtr == NULL) {
+	keyObjPtr = Tcl_NewStringObj (keyStrPtr->bytes, keyStrPtr->length);
+    }
+    Tcl_IncrRefCount (keyObjPtr);
 
-    KEYL_REP_ASSERT (keylIntPtr);
+    hPtr = (Tcl_HashEntry *) ckalloc (sizeof (Tcl_HashEntry));
+    hPtr->key.oneWordValue = (char *) keyObjPtr;
+    hPtr->clientData = (ClientData) keyObjPtr;
+    return hPtr;
 }
-
+
+static void
+FreeInternEntry (Tcl_HashEntry *hPtr)
+{
+    Tcl_DecrRefCount ((Tcl_Obj *) hPtr->key.oneWordValue);
+    ckfree ((VOID *) hPtr);
+}
+
 /*-----------------------------------------------------------------------------
- * FindKeyedListEntry --
- *   Find an entry in keyed list.
+ * InternKey --
+ *   Get the interned object for a key, adding the key to the intern table if
+ * it is not already there.
  *
  * Parameters:
- *   o keylIntPtr - Keyed list internal representation.
- *   o key - Name of key to search for.
- *   o keyLenPtr - In not NULL, the length of the key for this
- *     level is returned here.	This excludes subkeys and the `.' delimiters.
- *   o nextSubKeyPtr - If not NULL, the start of the name of the next
- *     sub-key within key is returned.
+ *   o key - The key string, which doesn't need to be NUL terminated.
+ *   o keyLen - The length of the key string.
+ *   o objPtr - If not NULL, an existing object with key as its string rep,
+ *     which becomes the interned object if the key is not already interned.
+ *     This saves copying keys that already have an object, such as the
+ *     elements of a list being converted.
  * Returns:
- *   Index of the entry or -1 if not found.
+ *    The interned key object.  The object is owned by the table; the caller
+ *    must increment its reference count to keep it.
  *-----------------------------------------------------------------------------
  */
-static int
-FindKeyedListEntry (keylIntObj_t *keylIntPtr,
-                    char	     *key,
-                    int	     *keyLenPtr,
-                    char	    **nextSubKeyPtr)
+static Tcl_Obj *
+InternKey (CONST char *key, int keyLen, Tcl_Obj *objPtr)
 {
-    char *keySeparPtr;
-    int keyLen, findIdx = -1;
+    keylThreadData_t *tsdPtr = GetKeylThreadData ();
+    keylKeyString_t keyStr;
+    int new;
 
-    keySeparPtr = strchr (key, '.');
-    if (keySeparPtr != NULL) {
-	keyLen = keySeparPtr - key;
-    } else {
-	keyLen = strlen (key);
-    }
-
-#ifndef NO_KEYLIST_HASH_TABLE
-    if (keylIntPtr->hashTbl != NULL) {
-	Tcl_HashEntry *entryPtr;
-	char tmp = key[keyLen];
-	if (keySeparPtr != NULL) {
-	    /*
-	     * A few extra guards in setting this, as if we are passed
-	     * a const char, this can crash.
-	     */
-	    key[keyLen] = '\0';
-	}
-	entryPtr = Tcl_FindHashEntry(keylIntPtr->hashTbl, key);
-	if (entryPtr != NULL) {
-	    findIdx = (int) Tcl_GetHashValue(entryPtr);
-	}
-	if (keySeparPtr != NULL) {
-	    key[keyLen] = tmp;
-	}
+    if (tsdPtr->keyTable.numEntries >= tsdPtr->sweepSize) {
+	SweepKeyInternTable (tsdPtr);
     }
-#endif
+    keyStr.bytes = key;
+    keyStr.length = keyLen;
+    keyStr.objPtr = objPtr;
+    return (Tcl_Obj *) Tcl_GetHashValue (
+	Tcl_CreateHashEntry (&tsdPtr->keyTable, (char *) &keyStr, &new));
+}
 
-    if (findIdx == -1) {
-	for (findIdx = 0; findIdx < keylIntPtr->numEntries; findIdx++) {
-	    if (keylIntPtr->entries [findIdx].keyLen == keyLen
-		    && STRNEQU(keylIntPtr->entries [findIdx].key, key, keyLen)) {
-		break;
-	    }
-	}
-    }
+/*-----------------------------------------------------------------------------
+ * NewKeyPath --
+ *   Compile a key path, splitting it at the `.' separators and interning the
+ * key for each level.  The path holds a reference to each of its keys, so
+ * they are not swept from the intern table while it exists.
+ *
+ * Parameters:
+ *   o key - The key path string, which doesn't need to be NUL terminated.
+ *   o keyLen - The length of the key path string.
+ * Returns:
+ *    The compiled path, with a reference count of one.
+ *-----------------------------------------------------------------------------
+ */
+static keylPath_t *
+NewKeyPath (CONST char *key, int keyLen)
+{
+    keylPath_t *pathPtr;
+    CONST char *keyEnd = key + keyLen, *sepPtr;
+    int numKeys = 1, idx;
 
-    if (nextSubKeyPtr != NULL) {
-	if (keySeparPtr == NULL) {
-	    *nextSubKeyPtr = NULL;
-	} else {
-	    *nextSubKeyPtr = keySeparPtr + 1;
-	}
+    for (sepPtr = key; sepPtr < keyEnd; sepPtr++) {
+	if (*sepPtr == '.')
+	    numKeys++;
     }
-    if (keyLenPtr != NULL) {
-	*keyLenPtr = keyLen;
-    }
-
-    if (findIdx >= keylIntPtr->numEntries) {
-	return -1;
+    pathPtr = (keylPath_t *) ckalloc (KEYL_PATH_SIZE (numKeys));
+    pathPtr->refCount = 1;
+    pathPtr->numKeys = numKeys;
+
+    for (idx = 0; idx < numKeys; idx++) {
+	for (sepPtr = key; (sepPtr < keyEnd) && (*sepPtr != '.'); sepPtr++)
+	    continue;
+	pathPtr->keys [idx] = InternKey (key, sepPtr - key, NULL);
+	Tcl_IncrRefCount (pathPtr->keys [idx]);
+	key = sepPtr + 1;
     }
-
-    return findIdx;
+    return pathPtr;
 }
-
+
 /*-----------------------------------------------------------------------------
- * FreeKeyedListInternalRep --
- *   Free the internal representation of a keyed list.
+ * ReleaseKeyPath --
+ *   Release a reference to a compiled key path, freeing it when it is no
+ * longer used.
  *
  * Parameters:
- *   o keylPtr - Keyed list object being deleted.
+ *   o pathPtr - The compiled key path.
  *-----------------------------------------------------------------------------
  */
 static void
-FreeKeyedListInternalRep (Tcl_Obj *keylPtr)
+ReleaseKeyPath (keylPath_t *pathPtr)
 {
-    FreeKeyedListData ((keylIntObj_t *) keylPtr->internalRep.otherValuePtr);
+    int idx;
+
+    if (--pathPtr->refCount > 0)
+	return;
+    for (idx = 0; idx < pathPtr->numKeys; idx++) {
+	Tcl_DecrRefCount (pathPtr->keys [idx]);
+    }
+    ckfree ((VOID *) pathPtr);
 }
 
 /*-----------------------------------------------------------------------------
- * DupKeyedListInternalRep --
- *   Duplicate the internal representation of a keyed list.
+ * FreeKeyPathInternalRep --
+ *   Free the internal representation of a key path object.
  *
  * Parameters:
- *   o srcPtr - Keyed list object to copy.
- *   o copyPtr - Target object to copy internal representation to.
+ *   o objPtr - Key path object being deleted or converted.
  *-----------------------------------------------------------------------------
  */
 static void
-DupKeyedListInternalRep (Tcl_Obj *srcPtr, Tcl_Obj *copyPtr)
+FreeKeyPathInternalRep (Tcl_Obj *objPtr)
+{
+    ReleaseKeyPath ((keylPath_t *) objPtr->internalRep.otherValuePtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * DupKeyPathInternalRep --
+ *   Duplicate the internal representation of a key path object.  The
+ * compiled path is shared, as it is never modified.
+ *
+ * Parameters:
+ *   o srcPtr - Key path object to copy.
+ *   o copyPtr - Target object to copy internal representation to.
+ *-----------------------------------------------------------------------------
+ */
+static void
+DupKeyPathInternalRep (Tcl_Obj *srcPtr, Tcl_Obj *copyPtr)
+{
+    keylPath_t *pathPtr = (keylPath_t *) srcPtr->internalRep.otherValuePtr;
+
+    pathPtr->refCount++;
+    copyPtr->internalRep.otherValuePtr = (VOID *) pathPtr;
+    copyPtr->typePtr = &keyPathType;
+}
+
+/*-----------------------------------------------------------------------------
+ * GetKeyPathFromObj --
+ *   Get the compiled key path for a key object passed to a keyed list
+ * command, validating and compiling the key and caching it on the object if
+ * it has not already been.  An object that is itself an interned key is not
+ * converted, as the path would then hold a reference to the object it is
+ * the internal representation of.
+ *
+ * Parameters:
+ *   o interp - Error message will be returned in the result.
+ *   o objPtr - The key path object.
+ * Returns:
+ *    The compiled path, or NULL if the key is not valid.  The caller holds a
+ *    reference to the path and must release it with ReleaseKeyPath.
+ *-----------------------------------------------------------------------------
+ */
+static keylPath_t *
+GetKeyPathFromObj (Tcl_Interp *interp, Tcl_Obj *objPtr)
+{
+    keylPath_t *pathPtr;
+    char *key;
+    int keyLen, idx;
+
+    if (objPtr->typePtr == &keyPathType) {
+	pathPtr = (keylPath_t *) objPtr->internalRep.otherValuePtr;
+	pathPtr->refCount++;
+	return pathPtr;
+    }
+
+    key = Tcl_GetStringFromObj (objPtr, &keyLen);
+    if (ValidateKey (interp, key, keyLen) == TCL_ERROR) {
+	return NULL;
+    }
+    pathPtr = NewKeyPath (key, keyLen);
+    for (idx = 0; idx < pathPtr->numKeys; idx++) {
+	if (pathPtr->keys [idx] == objPtr)
+	    return pathPtr;
+    }
+
+    if ((objPtr->typePtr != NULL) &&
+	(objPtr->typePtr->freeIntRepProc != NULL)) {
+	(*objPtr->typePtr->freeIntRepProc) (objPtr);
+    }
+    pathPtr->refCount++;
+    objPtr->internalRep.otherValuePtr = (VOID *) pathPtr;
+    objPtr->typePtr = &keyPathType;
+    return pathPtr;
+}
+
+
+/*-----------------------------------------------------------------------------
+ * AllocKeyedListIntRep --
+ *   Allocate an and initialize the keyed list internal representation.
+ *
+ * Returns:
+ *    A pointer to the keyed list internal structure.
+ *-----------------------------------------------------------------------------
+ */
+static keylIntObj_t *
+AllocKeyedListIntRep ()
+{
+    keylIntObj_t *keylIntPtr;
+
+    keylIntPtr = (keylIntObj_t *) ckalloc (sizeof (keylIntObj_t));
+    memset(keylIntPtr, 0, sizeof (keylIntObj_t));
+    keylIntPtr->refCount = 1;
+#ifndef NO_KEYLIST_HASH_TABLE
+    keylIntPtr->hashTbl = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
+    Tcl_InitHashTable(keylIntPtr->hashTbl, TCL_ONE_WORD_KEYS);
+#endif
+    return keylIntPtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * FreeKeyedListData --
+ *   Free the internal representation of a keyed list.
+ *
+ * Parameters:
+ *   o keylIntPtr - Keyed list internal structure to free.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FreeKeyedListData (keylIntObj_t *keylIntPtr)
+{
+    int idx;
+
+    for (idx = 0; idx < keylIntPtr->numSlots ; idx++) {
+	if (KEYL_SLOT_DELETED (keylIntPtr, idx))
+	    continue;
+	Tcl_DecrRefCount(keylIntPtr->entries [idx].keyPtr);
+	Tcl_DecrRefCount(keylIntPtr->entries [idx].valuePtr);
+    }
+    if (keylIntPtr->entries != NULL)
+	ckfree ((VOID*) keylIntPtr->entries);
+#ifndef NO_KEYLIST_HASH_TABLE
+    if (keylIntPtr->hashTbl != NULL) {
+	Tcl_DeleteHashTable(keylIntPtr->hashTbl);
+	ckfree((char *) (keylIntPtr->hashTbl));
+    }
+#endif
+    ckfree ((VOID*) keylIntPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * CopyKeyedListData --
+ *   Make a private copy of a keyed list internal representation.  Only this
+ * level is copied; the values are shared with the source and will be
+ * duplicated by DupSharedKeyListChild if a change is made below them.  The
+ * slot layout is kept so that indexes into the source remain valid for the
+ * copy.  The hash table is rebuilt by IndexKeyedList on the first lookup.
+ *
+ * Parameters:
+ *   o srcIntPtr - Keyed list internal representation to copy.
+ * Returns:
+ *    A pointer to the new keyed list internal structure.
+ *-----------------------------------------------------------------------------
+ */
+static keylIntObj_t *
+CopyKeyedListData (keylIntObj_t *srcIntPtr)
 {
-    keylIntObj_t *srcIntPtr =
-	(keylIntObj_t *) srcPtr->internalRep.otherValuePtr;
     keylIntObj_t *copyIntPtr;
     int idx;
 
     KEYL_REP_ASSERT (srcIntPtr);
 
     copyIntPtr = (keylIntObj_t *) ckalloc (sizeof (keylIntObj_t));
-    copyIntPtr->arraySize = srcIntPtr->arraySize;
+    copyIntPtr->refCount = 1;
+    copyIntPtr->arraySize = srcIntPtr->numSlots;
+    copyIntPtr->numSlots = srcIntPtr->numSlots;
     copyIntPtr->numEntries = srcIntPtr->numEntries;
-    copyIntPtr->entries = (keylEntry_t *)
-	ckalloc (copyIntPtr->arraySize * sizeof (keylEntry_t));
+    copyIntPtr->entries = NULL;
 #ifndef NO_KEYLIST_HASH_TABLE
-#if 0
-    copyIntPtr->hashTbl = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
-    Tcl_InitHashTable(copyIntPtr->hashTbl, TCL_STRING_KEYS);
-#else
-    /*
-     * NO_KEYLIST_HASH_TABLE: We don't duplicate the hash table, so ensure
-     * that consistency checks allow for portions where not all entries are
-     * in the hash table.
-     */
     copyIntPtr->hashTbl = NULL;
 #endif
-#endif
+    if (copyIntPtr->arraySize > 0) {
+	copyIntPtr->entries = (keylEntry_t *)
+	    ckalloc (copyIntPtr->arraySize * sizeof (keylEntry_t));
+    }
 
-    for (idx = 0; idx < srcIntPtr->numEntries ; idx++) {
-	copyIntPtr->entries [idx].key =
-	    ckstrdup (srcIntPtr->entries [idx].key);
-	copyIntPtr->entries [idx].keyLen = srcIntPtr->entries [idx].keyLen;
-	copyIntPtr->entries [idx].valuePtr =
-	    Tcl_DuplicateObj(srcIntPtr->entries [idx].valuePtr);
+    for (idx = 0; idx < srcIntPtr->numSlots ; idx++) {
+	copyIntPtr->entries [idx] = srcIntPtr->entries [idx];
+	if (KEYL_SLOT_DELETED (srcIntPtr, idx))
+	    continue;
+	Tcl_IncrRefCount(copyIntPtr->entries [idx].keyPtr);
 	Tcl_IncrRefCount(copyIntPtr->entries [idx].valuePtr);
-#ifndef NO_KEYLIST_HASH_TABLE
-	/*
-	 * If we dup the hash table as well and do other better tracking
-	 * of all access, then we could remove the entries list.
-	 */
-#endif
     }
 
-    copyPtr->internalRep.otherValuePtr = (VOID *) copyIntPtr;
-    copyPtr->typePtr = &keyedListType;
-
     KEYL_REP_ASSERT (copyIntPtr);
+    return copyIntPtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * UnshareKeyedListIntRep --
+ *   Ensure a keyed list object has its own internal representation before
+ * it is modified, copying it if it is shared with other objects.
+ *
+ * Parameters:
+ *   o keylPtr - Keyed list object about to be modified.
+ * Returns:
+ *    The object's internal representation, which is not shared.
+ *-----------------------------------------------------------------------------
+ */
+static keylIntObj_t *
+UnshareKeyedListIntRep (Tcl_Obj *keylPtr)
+{
+    keylIntObj_t *keylIntPtr =
+	(keylIntObj_t *) keylPtr->internalRep.otherValuePtr;
+
+    if (keylIntPtr->refCount > 1) {
+	keylIntPtr->refCount--;
+	keylIntPtr = CopyKeyedListData (keylIntPtr);
+	keylPtr->internalRep.otherValuePtr = (VOID *) keylIntPtr;
+    }
+    return keylIntPtr;
 }
 
 /*-----------------------------------------------------------------------------
- * SetKeyedListFromAny --
- *   Convert an object to a keyed list from its string representation.	Only
- * the first level is converted, as there is no way of knowing how far down
- * the keyed list recurses until lower levels are accessed.
+ * CompactKeyedList --
+ *   Squeeze the deleted slots out of a keyed list array, keeping the live
+ * entries in their original order.  The hash table values of any moved
+ * entries are updated to their new slot.
  *
  * Parameters:
- *   o objPtr - Object to convert to a keyed list.
+ *   o keylIntPtr - Keyed list internal representation.
  *-----------------------------------------------------------------------------
  */
-static int
-SetKeyedListFromAny (Tcl_Interp *interp, Tcl_Obj *objPtr) 
+static void
+CompactKeyedList (keylIntObj_t *keylIntPtr)
 {
-    keylIntObj_t *keylIntPtr;
-    keylEntry_t *keyEntryPtr;
-    char *key;
-    int keyLen, idx, objc, subObjc;
-    Tcl_Obj **objv, **subObjv;
+    int srcIdx, dstIdx = 0;
+
+    for (srcIdx = 0; srcIdx < keylIntPtr->numSlots; srcIdx++) {
+	if (KEYL_SLOT_DELETED (keylIntPtr, srcIdx))
+	    continue;
+	if (srcIdx != dstIdx) {
+	    keylIntPtr->entries [dstIdx] = keylIntPtr->entries [srcIdx];
 #ifndef NO_KEYLIST_HASH_TABLE
-    int dummy;
-    Tcl_HashEntry *entryPtr;
+	    if (keylIntPtr->hashTbl != NULL) {
+		Tcl_HashEntry *entryPtr;
+
+		entryPtr = Tcl_FindHashEntry(keylIntPtr->hashTbl,
+			(char *) keylIntPtr->entries [dstIdx].keyPtr);
+		if (entryPtr != NULL) {
+		    Tcl_SetHashValue(entryPtr, (ClientData) (uintptr_t) dstIdx);
+		}
+	    }
 #endif
-
-    if (Tcl_ListObjGetElements (interp, objPtr, &objc, &objv) != TCL_OK) {
-	return TCL_ERROR;
+	}
+	dstIdx++;
     }
+    keylIntPtr->numSlots = dstIdx;
 
-    keylIntPtr = AllocKeyedListIntRep();
-
-    EnsureKeyedListSpace(keylIntPtr, objc);
+    KEYL_REP_ASSERT (keylIntPtr);
+}
 
-    for (idx = 0; idx < objc; idx++) {
-	if ((Tcl_ListObjGetElements(interp, objv[idx],
-		     &subObjc, &subObjv) != TCL_OK)
-		|| (subObjc != 2)) {
-	    Tcl_ResetResult(interp);
-	    Tcl_AppendStringsToObj(Tcl_GetObjResult (interp),
-		    "keyed list entry must be a valid, 2 element list, got \"",
-		    Tcl_GetString(objv[idx]), "\"", (char *) NULL);
-	    FreeKeyedListData(keylIntPtr);
-	    return TCL_ERROR;
-	}
+/*-----------------------------------------------------------------------------
+ * EnsureKeyedListSpace --
+ *   Ensure there is enough room in a keyed list array for a certain number
+ * of entries, reclaiming deleted slots or expanding if necessary.
+ *
+ * Parameters:
+ *   o keylIntPtr - Keyed list internal representation.
+ *   o newNumEntries - The number of entries that are going to be added to
+ *     the keyed list.
+ *-----------------------------------------------------------------------------
+ */
+static void
+EnsureKeyedListSpace (keylIntObj_t *keylIntPtr, int newNumEntries)
+{
+    KEYL_REP_ASSERT (keylIntPtr);
 
-	key = Tcl_GetStringFromObj(subObjv[0], &keyLen);
-	if (ValidateKey(interp, key, keyLen) == TCL_ERROR) {
-	    FreeKeyedListData (keylIntPtr);
-	    return TCL_ERROR;
-	}
-	/*
-	 * When setting from a random list/string, we cannot allow
-	 * keys to have embedded '.' path separators
-	 */
-	if ((strchr(key, '.') != NULL)) {
-	    Tcl_AppendStringsToObj (Tcl_GetObjResult (interp),
-		    "keyed list key may not contain a \".\"; ",
-		    "it is used as a separator in key paths",
-		    (char *) NULL);
-	    FreeKeyedListData (keylIntPtr);
-	    return TCL_ERROR;
+    /*
+     * Only reclaim deleted slots when there are enough of them to pay for
+     * the pass over the array, otherwise grow it.  Growth is proportional
+     * to the current size so that appending stays cheap on large lists.
+     */
+    if (((keylIntPtr->arraySize - keylIntPtr->numSlots) < newNumEntries) &&
+	    ((keylIntPtr->numSlots - keylIntPtr->numEntries) >
+	     (keylIntPtr->numEntries / 2) + newNumEntries)) {
+	CompactKeyedList (keylIntPtr);
+    }
+    if ((keylIntPtr->arraySize - keylIntPtr->numSlots) < newNumEntries) {
+	int newSize = keylIntPtr->arraySize + newNumEntries +
+	    (keylIntPtr->arraySize / 2) + KEYEDLIST_ARRAY_INCR_SIZE;
+	if (keylIntPtr->entries == NULL) {
+	    keylIntPtr->entries = (keylEntry_t *)
+		ckalloc (newSize * sizeof (keylEntry_t));
+	} else {
+	    keylIntPtr->entries = (keylEntry_t *)
+		ckrealloc ((VOID *) keylIntPtr->entries,
+			   newSize * sizeof (keylEntry_t));
 	}
-	keyEntryPtr = &(keylIntPtr->entries[idx]);
+	keylIntPtr->arraySize = newSize;
+    }
 
-	keyEntryPtr->key = ckstrdup(key);
-	keyEntryPtr->keyLen = keyLen;
-	keyEntryPtr->valuePtr = Tcl_DuplicateObj(subObjv[1]);
-	Tcl_IncrRefCount(keyEntryPtr->valuePtr);
+    KEYL_REP_ASSERT (keylIntPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * DeleteKeyedListEntry --
+ *   Delete an entry from a keyed list.  The slot is marked as deleted rather
+ * than shifting the rest of the array down, so the indexes of the other
+ * entries don't change.  Deleted slots at the end of the array are trimmed
+ * and the array is compacted once more than half of it is holes, which
+ * keeps the cost of a delete constant when amortized over many deletes.
+ *
+ * Parameters:
+ *   o keylIntPtr - Keyed list internal representation.
+ *   o entryIdx - Index of entry to delete.
+ *-----------------------------------------------------------------------------
+ */
+static void
+DeleteKeyedListEntry (keylIntObj_t *keylIntPtr, int entryIdx)
+{
 #ifndef NO_KEYLIST_HASH_TABLE
-	entryPtr = Tcl_CreateHashEntry(keylIntPtr->hashTbl,
-		keyEntryPtr->key, &dummy);
-	Tcl_SetHashValue(entryPtr, (ClientData) (uintptr_t) idx);
-#endif
+    if (keylIntPtr->hashTbl != NULL) {
+	Tcl_HashEntry *entryPtr;
 
-	keylIntPtr->numEntries++;
+	entryPtr = Tcl_FindHashEntry(keylIntPtr->hashTbl,
+		(char *) keylIntPtr->entries [entryIdx].keyPtr);
+	if (entryPtr != NULL) {
+	    Tcl_DeleteHashEntry(entryPtr);
+	}
     }
+#endif
 
-    if ((objPtr->typePtr != NULL) &&
-	(objPtr->typePtr->freeIntRepProc != NULL)) {
-	(*objPtr->typePtr->freeIntRepProc) (objPtr);
+    Tcl_DecrRefCount(keylIntPtr->entries [entryIdx].keyPtr);
+    Tcl_DecrRefCount(keylIntPtr->entries [entryIdx].valuePtr);
+    keylIntPtr->entries [entryIdx].keyPtr = NULL;
+    keylIntPtr->entries [entryIdx].valuePtr = NULL;
+    keylIntPtr->numEntries--;
+
+    while ((keylIntPtr->numSlots > 0) &&
+	    KEYL_SLOT_DELETED (keylIntPtr, keylIntPtr->numSlots - 1)) {
+	keylIntPtr->numSlots--;
+    }
+    if ((keylIntPtr->numSlots - keylIntPtr->numEntries) >
+	    keylIntPtr->numEntries + KEYEDLIST_ARRAY_INCR_SIZE) {
+	CompactKeyedList (keylIntPtr);
     }
-    objPtr->internalRep.otherValuePtr = (VOID *) keylIntPtr;
-    objPtr->typePtr = &keyedListType;
 
     KEYL_REP_ASSERT (keylIntPtr);
-    return TCL_OK;
 }
 
 /*-----------------------------------------------------------------------------
- * UpdateStringOfKeyedList --
- *    Update the string representation of a keyed list.
+ * IndexKeyedList --
+ *   Build the hash table over the entries of a keyed list that doesn't have
+ * one, such as a copy made by DupKeyedListInternalRep.  Once built, the hash
+ * table holds every live entry, so a key missing from it is not in the
+ * keyed list and no linear search is needed.
  *
  * Parameters:
- *   o objPtr - Object to convert to a keyed list.
+ *   o keylIntPtr - Keyed list internal representation.
  *-----------------------------------------------------------------------------
  */
+#ifndef NO_KEYLIST_HASH_TABLE
 static void
-UpdateStringOfKeyedList (Tcl_Obj *keylPtr)
+IndexKeyedList (keylIntObj_t *keylIntPtr)
 {
-#define UPDATE_STATIC_SIZE 32
-    int idx, strLen;
-    Tcl_Obj **listObjv, *entryObjv [2], *tmpListObj;
-    Tcl_Obj *staticListObjv [UPDATE_STATIC_SIZE];
-    char *listStr;
-    keylIntObj_t *keylIntPtr =
-	(keylIntObj_t *) keylPtr->internalRep.otherValuePtr;
-
-    /*
-     * Conversion to strings is done via list objects to support binary data.
-     */
-    if (keylIntPtr->numEntries > UPDATE_STATIC_SIZE) {
-	listObjv =
-	    (Tcl_Obj **) ckalloc (keylIntPtr->numEntries * sizeof (Tcl_Obj *));
-    } else {
-	listObjv = staticListObjv;
-    }
+    Tcl_HashEntry *entryPtr;
+    int idx, dummy;
 
-    /*
-     * Convert each keyed list entry to a two element list object.  No
-     * need to incr/decr ref counts, the list objects will take care of that.
-     * FIX: Keeping key as string object will speed this up.
-     */
-    for (idx = 0; idx < keylIntPtr->numEntries; idx++) {
-	entryObjv [0] = 
-	    Tcl_NewStringObj (keylIntPtr->entries [idx].key,
-		    keylIntPtr->entries [idx].keyLen);
-	entryObjv [1] = keylIntPtr->entries [idx].valuePtr;
-	listObjv [idx] = Tcl_NewListObj (2, entryObjv);
+    keylIntPtr->hashTbl = (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
+    Tcl_InitHashTable(keylIntPtr->hashTbl, TCL_ONE_WORD_KEYS);
+    for (idx = 0; idx < keylIntPtr->numSlots; idx++) {
+	if (KEYL_SLOT_DELETED (keylIntPtr, idx))
+	    continue;
+	entryPtr = Tcl_CreateHashEntry(keylIntPtr->hashTbl,
+		(char *) keylIntPtr->entries [idx].keyPtr, &dummy);
+	Tcl_SetHashValue(entryPtr, (ClientData) (uintptr_t) idx);
     }
-
-    tmpListObj = Tcl_NewListObj (keylIntPtr->numEntries, listObjv);
-    Tcl_IncrRefCount(tmpListObj);
-    listStr = Tcl_GetStringFromObj (tmpListObj, &strLen);
-    keylPtr->bytes = ckbinstrdup (listStr, strLen);
-    keylPtr->length = strLen;
-    Tcl_DecrRefCount(tmpListObj);
-
-    if (listObjv != staticListObjv)
-	ckfree ((VOID*) listObjv);
 }
-
+#endif
+
+/*-----------------------------------------------------------------------------
+ * FindKeyedListEntry --
+ *   Find an entry in keyed list.
+ *
+ * Parameters:
+ *   o keylIntPtr - Keyed list internal representation.
+ *   o keyObjPtr - Interned key object to search for.
+ * Returns:
+ *   Index of the entry or -1 if not found.
+ *-----------------------------------------------------------------------------
+ */
+static int
+FindKeyedListEntry (keylIntObj_t *keylIntPtr,
+                    Tcl_Obj	 *keyObjPtr)
+{
+#ifndef NO_KEYLIST_HASH_TABLE
+    Tcl_HashEntry *entryPtr;
+
+    if (keylIntPtr->hashTbl == NULL) {
+	IndexKeyedList (keylIntPtr);
+    }
+    entryPtr = Tcl_FindHashEntry(keylIntPtr->hashTbl, (char *) keyObjPtr);
+    if (entryPtr == NULL) {
+	return -1;
+    }
+    return (int) (uintptr_t) Tcl_GetHashValue(entryPtr);
+#else
+    int findIdx;
+
+    for (findIdx = 0; findIdx < keylIntPtr->numSlots; findIdx++) {
+	if (keylIntPtr->entries [findIdx].keyPtr == keyObjPtr) {
+	    return findIdx;
+	}
+    }
+    return -1;
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * AddKeyedListEntry --
+ *   Append a new entry to a keyed list.  The key must not already be in the
+ * keyed list.
+ *
+ * Parameters:
+ *   o keylIntPtr - Keyed list internal representation.
+ *   o keyObjPtr - Interned key object for the entry.
+ *   o valuePtr - Value of the entry.
+ * Returns:
+ *   Index of the new entry.
+ *-----------------------------------------------------------------------------
+ */
+static int
+AddKeyedListEntry (keylIntObj_t *keylIntPtr,
+                   Tcl_Obj      *keyObjPtr,
+                   Tcl_Obj      *valuePtr)
+{
+    keylEntry_t *keyEntryPtr;
+    int entryIdx;
+#ifndef NO_KEYLIST_HASH_TABLE
+    int dummy;
+    Tcl_HashEntry *entryPtr;
+#endif
+
+    EnsureKeyedListSpace (keylIntPtr, 1);
+    entryIdx = keylIntPtr->numSlots++;
+    keylIntPtr->numEntries++;
+
+    keyEntryPtr = &(keylIntPtr->entries [entryIdx]);
+    keyEntryPtr->keyPtr = keyObjPtr;
+    Tcl_IncrRefCount(keyObjPtr);
+    keyEntryPtr->valuePtr = valuePtr;
+    Tcl_IncrRefCount(valuePtr);
+#ifndef NO_KEYLIST_HASH_TABLE
+    if (keylIntPtr->hashTbl == NULL) {
+	IndexKeyedList (keylIntPtr);
+    } else {
+	entryPtr = Tcl_CreateHashEntry(keylIntPtr->hashTbl,
+		(char *) keyObjPtr, &dummy);
+	Tcl_SetHashValue(entryPtr, (ClientData) (uintptr_t) entryIdx);
+    }
+#endif
+    return entryIdx;
+}
+
+/*-----------------------------------------------------------------------------
+ * FreeKeyedListInternalRep --
+ *   Free the internal representation of a keyed list.
+ *
+ * Parameters:
+ *   o keylPtr - Keyed list object being deleted.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FreeKeyedListInternalRep (Tcl_Obj *keylPtr)
+{
+    keylIntObj_t *keylIntPtr =
+	(keylIntObj_t *) keylPtr->internalRep.otherValuePtr;
+
+    if (--keylIntPtr->refCount <= 0) {
+	FreeKeyedListData (keylIntPtr);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * DupKeyedListInternalRep --
+ *   Duplicate the internal representation of a keyed list.  The copy shares
+ * the source's entries and hash table until one of them is modified.
+ *
+ * Parameters:
+ *   o srcPtr - Keyed list object to copy.
+ *   o copyPtr - Target object to copy internal representation to.
+ *-----------------------------------------------------------------------------
+ */
+static void
+DupKeyedListInternalRep (Tcl_Obj *srcPtr, Tcl_Obj *copyPtr)
+{
+    keylIntObj_t *srcIntPtr =
+	(keylIntObj_t *) srcPtr->internalRep.otherValuePtr;
+
+    KEYL_REP_ASSERT (srcIntPtr);
+
+    srcIntPtr->refCount++;
+    copyPtr->internalRep.otherValuePtr = (VOID *) srcIntPtr;
+    copyPtr->typePtr = &keyedListType;
+}
+
+/*-----------------------------------------------------------------------------
+ * SetKeyedListFromAny --
+ *   Convert an object to a keyed list from its string representation.	Only
+ * the first level is converted, as there is no way of knowing how far down
+ * the keyed list recurses until lower levels are accessed.
+ *
+ * Parameters:
+ *   o objPtr - Object to convert to a keyed list.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SetKeyedListFromAny (Tcl_Interp *interp, Tcl_Obj *objPtr) 
+{
+    keylIntObj_t *keylIntPtr;
+    keylEntry_t *keyEntryPtr;
+    char *key;
+    int keyLen, idx, objc, subObjc;
+    Tcl_Obj **objv, **subObjv;
+#ifndef NO_KEYLIST_HASH_TABLE
+    int dummy;
+    Tcl_HashEntry *entryPtr;
+#endif
+
+    /*
+     * A keyed list that is still serialized is decoded directly, without
+     * generating its string rep.
+     */
+    if (objPtr->typePtr == &keylSerialType) {
+	keylSerialRep_t *serialPtr =
+	    (keylSerialRep_t *) objPtr->internalRep.otherValuePtr;
+
+	keylIntPtr = DecodeKeyedList (interp, serialPtr->bufPtr,
+				      serialPtr->node, serialPtr->length);
+	if (keylIntPtr == NULL) {
+	    return TCL_ERROR;
+	}
+	FreeSerialKeylInternalRep (objPtr);
+	objPtr->internalRep.otherValuePtr = (VOID *) keylIntPtr;
+	objPtr->typePtr = &keyedListType;
+	return TCL_OK;
+    }
+
+    if (Tcl_ListObjGetElements (interp, objPtr, &objc, &objv) != TCL_OK) {
+	return TCL_ERROR;
+    }
+
+    keylIntPtr = AllocKeyedListIntRep();
+
+    EnsureKeyedListSpace(keylIntPtr, objc);
+
+    for (idx = 0; idx < objc; idx++) {
+	if ((Tcl_ListObjGetElements(interp, objv[idx],
+		     &subObjc, &subObjv) != TCL_OK)
+		|| (subObjc != 2)) {
+	    Tcl_ResetResult(interp);
+	    Tcl_AppendStringsToObj(Tcl_GetObjResult (interp),
+		    "keyed list entry must be a valid, 2 element list, got \"",
+		    Tcl_GetString(objv[idx]), "\"", (char *) NULL);
+	    FreeKeyedListData(keylIntPtr);
+	    return TCL_ERROR;
+	}
+
+	key = Tcl_GetStringFromObj(subObjv[0], &keyLen);
+	if (ValidateKey(interp, key, keyLen) == TCL_ERROR) {
+	    FreeKeyedListData (keylIntPtr);
+	    return TCL_ERROR;
+	}
+	/*
+	 * When setting from a random list/string, we cannot allow
+	 * keys to have embedded '.' path separators
+	 */
+	if (memchr(key, '.', keyLen) != NULL) {
+	    Tcl_AppendStringsToObj (Tcl_GetObjResult (interp),
+		    "keyed list key may not contain a \".\"; ",
+		    "it is used as a separator in key paths",
+		    (char *) NULL);
+	    FreeKeyedListData (keylIntPtr);
+	    return TCL_ERROR;
+	}
+	keyEntryPtr = &(keylIntPtr->entries[idx]);
+
+	/*
+	 * The key and value objects are taken from the list rather than
+	 * copied.  The value is shared with the list until it is modified, at
+	 * which point DupSharedKeyListChild copies it if the list still holds
+	 * it.
+	 */
+	keyEntryPtr->keyPtr = InternKey(key, keyLen, subObjv[0]);
+	Tcl_IncrRefCount(keyEntryPtr->keyPtr);
+	keyEntryPtr->valuePtr = subObjv[1];
+	Tcl_IncrRefCount(keyEntryPtr->valuePtr);
+#ifndef NO_KEYLIST_HASH_TABLE
+	entryPtr = Tcl_CreateHashEntry(keylIntPtr->hashTbl,
+		(char *) keyEntryPtr->keyPtr, &dummy);
+	Tcl_SetHashValue(entryPtr, (ClientData) (uintptr_t) idx);
+#endif
+
+	keylIntPtr->numSlots++;
+	keylIntPtr->numEntries++;
+    }
+
+    if ((objPtr->typePtr != NULL) &&
+	(objPtr->typePtr->freeIntRepProc != NULL)) {
+	(*objPtr->typePtr->freeIntRepProc) (objPtr);
+    }
+    objPtr->internalRep.otherValuePtr = (VOID *) keylIntPtr;
+    objPtr->typePtr = &keyedListType;
+
+    KEYL_REP_ASSERT (keylIntPtr);
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * UpdateStringOfKeyedList --
+ *    Update the string representation of a keyed list.  The entries are
+ * formatted straight into a single dynamic string as a list of two element
+ * sublists, without building intermediate list objects.  Values that are
+ * keyed lists supply their own string rep, so only the entries on the path
+ * of a change are reformatted; unchanged sub-lists keep their cached ones.
+ *
+ * Parameters:
+ *   o objPtr - Object to convert to a keyed list.
+ *-----------------------------------------------------------------------------
+ */
+static void
+UpdateStringOfKeyedList (Tcl_Obj *keylPtr)
+{
+    FormatKeyedList ((keylIntObj_t *) keylPtr->internalRep.otherValuePtr,
+		     keylPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * FormatKeyedList --
+ *    Generate the string representation of a keyed list.
+ *
+ * Parameters:
+ *   o keylIntPtr - Keyed list internal representation to format.
+ *   o objPtr - Object to store the string representation in.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FormatKeyedList (keylIntObj_t *keylIntPtr, Tcl_Obj *objPtr)
+{
+    Tcl_DString strBuf;
+    int idx;
+
+    Tcl_DStringInit (&strBuf);
+    for (idx = 0; idx < keylIntPtr->numSlots; idx++) {
+	if (KEYL_SLOT_DELETED (keylIntPtr, idx))
+	    continue;
+	Tcl_DStringStartSublist (&strBuf);
+	Tcl_DStringAppendElement (&strBuf,
+		Tcl_GetString (keylIntPtr->entries [idx].keyPtr));
+	Tcl_DStringAppendElement (&strBuf,
+		Tcl_GetString (keylIntPtr->entries [idx].valuePtr));
+	Tcl_DStringEndSublist (&strBuf);
+    }
+
+    /*
+     * Take over the dynamic string's buffer if it was allocated, otherwise
+     * copy the string out of the static space.
+     */
+    objPtr->length = Tcl_DStringLength (&strBuf);
+    if (strBuf.string != strBuf.staticSpace) {
+	objPtr->bytes = strBuf.string;
+    } else {
+	objPtr->bytes = ckbinstrdup (strBuf.string, strBuf.length);
+    }
+}
+
 /*-----------------------------------------------------------------------------
  * TclX_NewKeyedListObj --
  *   Create and initialize a new keyed list object.
  *
- * Returns:
- *    A pointer to the object.
+ * Returns:
+ *    A pointer to the object.
+ *-----------------------------------------------------------------------------
+ */
+Tcl_Obj *
+TclX_NewKeyedListObj ()
+{
+    Tcl_Obj *keylPtr = Tcl_NewObj ();
+    keylIntObj_t *keylIntPtr = AllocKeyedListIntRep ();
+
+    keylPtr->internalRep.otherValuePtr = (VOID *) keylIntPtr;
+    keylPtr->typePtr = &keyedListType;
+    return keylPtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * ReleaseKeyPaths --
+ *   Release an array of compiled key paths, freeing the array if it was
+ * allocated.
+ *
+ * Parameters:
+ *   o pathc - Number of paths in pathv.
+ *   o pathv - Array of compiled key paths.
+ *   o staticPathv - Static array that pathv was allocated in place of.
+ *-----------------------------------------------------------------------------
+ */
+static void
+ReleaseKeyPaths (int          pathc,
+                 keylPath_t **pathv,
+                 keylPath_t **staticPathv)
+{
+    int idx;
+
+    for (idx = 0; idx < pathc; idx++) {
+	ReleaseKeyPath (pathv [idx]);
+    }
+    if (pathv != staticPathv)
+	ckfree ((VOID *) pathv);
+}
+
+/*-----------------------------------------------------------------------------
+ * GatherKeyPathRun --
+ *   Find the run of key paths, starting at pathv [0], that share the same
+ * key at a level and have sub-keys below it, so that the key only needs to
+ * be looked up once for all of them.  Only adjacent paths are gathered, so
+ * the keys are still processed in the order given.
+ *
+ * Parameters:
+ *   o depth - Level of the key path being looked up.
+ *   o pathc - Number of paths in pathv.
+ *   o pathv - Array of compiled key paths.  pathv [0] must have a sub-key
+ *     below depth.
+ * Returns:
+ *   The number of paths in the run, at least one.
+ *-----------------------------------------------------------------------------
+ */
+static int
+GatherKeyPathRun (int          depth,
+                  int          pathc,
+                  keylPath_t **pathv)
+{
+    Tcl_Obj *keyObjPtr = pathv [0]->keys [depth];
+    int runLen;
+
+    for (runLen = 1; runLen < pathc; runLen++) {
+	if ((pathv [runLen]->numKeys <= depth + 1) ||
+		(pathv [runLen]->keys [depth] != keyObjPtr))
+	    break;
+    }
+    return runLen;
+}
+
+/*-----------------------------------------------------------------------------
+ * SetKeyedListPaths --
+ *   Set a number of key values in a keyed list object.  Keys that share a
+ * leading key path are set with a single lookup of each shared level.
+ *
+ * Parameters:
+ *   o interp - Error message will be return in result object.
+ *   o keylPtr - Keyed list object to update.
+ *   o depth - Level of the key paths that keylPtr is at.
+ *   o pathc - Number of keys to set.
+ *   o pathv - The compiled paths of the keys to set.
+ *   o valuev - The values to set for the keys.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SetKeyedListPaths (Tcl_Interp  *interp,
+                   Tcl_Obj     *keylPtr,
+                   int          depth,
+                   int          pathc,
+                   keylPath_t **pathv,
+                   Tcl_Obj    **valuev)
+{
+    keylIntObj_t *keylIntPtr;
+    int idx, runLen, findIdx, status = TCL_OK;
+    Tcl_Obj *keyObjPtr, *newKeylPtr;
+
+    if (Tcl_ConvertToType (interp, keylPtr, &keyedListType) != TCL_OK)
+	return TCL_ERROR;
+    keylIntPtr = UnshareKeyedListIntRep (keylPtr);
+    KEYL_REP_ASSERT (keylIntPtr);
+
+    for (idx = 0; (idx < pathc) && (status == TCL_OK); idx += runLen) {
+	keyObjPtr = pathv [idx]->keys [depth];
+	findIdx = FindKeyedListEntry (keylIntPtr, keyObjPtr);
+
+	/*
+	 * If we are at the last subkey, either update or add an entry.
+	 */
+	if (depth == pathv [idx]->numKeys - 1) {
+	    if (findIdx < 0) {
+		AddKeyedListEntry (keylIntPtr, keyObjPtr, valuev [idx]);
+	    } else {
+		Tcl_IncrRefCount(valuev [idx]);
+		Tcl_DecrRefCount(keylIntPtr->entries [findIdx].valuePtr);
+		keylIntPtr->entries [findIdx].valuePtr = valuev [idx];
+	    }
+	    runLen = 1;
+	    continue;
+	}
+
+	/*
+	 * If we are not at the last subkey, recurse down with all the
+	 * following keys under the same subkey, creating new entries if
+	 * neccessary.  If this level key was not found, it means we must
+	 * build new subtree.  Don't insert the new tree until we come back
+	 * without error.
+	 */
+	runLen = GatherKeyPathRun (depth, pathc - idx, &(pathv [idx]));
+	if (findIdx >= 0) {
+	    DupSharedKeyListChild (keylIntPtr, findIdx);
+	    status = SetKeyedListPaths (interp,
+		    keylIntPtr->entries [findIdx].valuePtr, depth + 1,
+		    runLen, &(pathv [idx]), &(valuev [idx]));
+	} else {
+	    newKeylPtr = TclX_NewKeyedListObj ();
+	    Tcl_IncrRefCount(newKeylPtr);
+	    status = SetKeyedListPaths (interp, newKeylPtr, depth + 1,
+		    runLen, &(pathv [idx]), &(valuev [idx]));
+	    if (status == TCL_OK) {
+		AddKeyedListEntry (keylIntPtr, keyObjPtr, newKeylPtr);
+	    }
+	    Tcl_DecrRefCount(newKeylPtr);
+	}
+    }
+    Tcl_InvalidateStringRep (keylPtr);
+
+    KEYL_REP_ASSERT (keylIntPtr);
+    return status;
+}
+
+/*-----------------------------------------------------------------------------
+ * GetKeyedListPaths --
+ *   Retrieve a number of key values from a keyed list.  Keys that share a
+ * leading key path are looked up with a single lookup of each shared level.
+ *
+ * Parameters:
+ *   o interp - Error message will be return in result if there is an error.
+ *   o keylPtr - Keyed list object to get keys from.
+ *   o depth - Level of the key paths that keylPtr is at.
+ *   o pathc - Number of keys to get.
+ *   o pathv - The compiled paths of the keys to get.
+ *   o valuev - The value of each key is returned here, or NULL if the key
+ *     is not present.
+ * Returns:
+ *   o TCL_OK - If all of the key values were returned.
+ *   o TCL_BREAK - If one or more of the keys were not found.
+ *   o TCL_ERROR - If an error occured.
+ *-----------------------------------------------------------------------------
+ */
+static int
+GetKeyedListPaths (Tcl_Interp  *interp,
+                   Tcl_Obj     *keylPtr,
+                   int          depth,
+                   int          pathc,
+                   keylPath_t **pathv,
+                   Tcl_Obj    **valuev)
+{
+    keylIntObj_t *keylIntPtr;
+    int idx, runLen, findIdx, subStatus, status = TCL_OK;
+
+    if (Tcl_ConvertToType (interp, keylPtr, &keyedListType) != TCL_OK)
+	return TCL_ERROR;
+    keylIntPtr = (keylIntObj_t *) keylPtr->internalRep.otherValuePtr;
+    KEYL_REP_ASSERT (keylIntPtr);
+
+    for (idx = 0; idx < pathc; idx += runLen) {
+	findIdx = FindKeyedListEntry (keylIntPtr, pathv [idx]->keys [depth]);
+	if (depth == pathv [idx]->numKeys - 1) {
+	    runLen = 1;
+	    if (findIdx < 0) {
+		valuev [idx] = NULL;
+		status = TCL_BREAK;
+	    } else {
+		valuev [idx] = keylIntPtr->entries [findIdx].valuePtr;
+	    }
+	    continue;
+	}
+
+	runLen = GatherKeyPathRun (depth, pathc - idx, &(pathv [idx]));
+	if (findIdx < 0) {
+	    memset (&(valuev [idx]), 0, runLen * sizeof (Tcl_Obj *));
+	    status = TCL_BREAK;
+	    continue;
+	}
+	subStatus = GetKeyedListPaths (interp,
+		keylIntPtr->entries [findIdx].valuePtr, depth + 1,
+		runLen, &(pathv [idx]), &(valuev [idx]));
+	if (subStatus == TCL_ERROR)
+	    return TCL_ERROR;
+	if (subStatus == TCL_BREAK)
+	    status = TCL_BREAK;
+    }
+    return status;
+}
+
+/*-----------------------------------------------------------------------------
+ * DeleteKeyedListPath --
+ *   Delete a key value from keyed list.  If this leaves a sub-keyed list on
+ * the path to the key empty, it is deleted as well.
+ *
+ * Parameters:
+ *   o interp - Error message will be return in result if there is an error.
+ *   o keylPtr - Keyed list object to update.
+ *   o depth - Level of the key path that keylPtr is at.
+ *   o pathPtr - The compiled path of the key to delete.
+ * Returns:
+ *   o TCL_OK - If the key was deleted.
+ *   o TCL_BREAK - If the key was not found.
+ *   o TCL_ERROR - If an error occured.
+ *-----------------------------------------------------------------------------
+ */
+static int
+DeleteKeyedListPath (Tcl_Interp *interp,
+                     Tcl_Obj    *keylPtr,
+                     int         depth,
+                     keylPath_t *pathPtr)
+{
+    keylIntObj_t *keylIntPtr, *subKeylIntPtr;
+    int findIdx, status;
+
+    if (Tcl_ConvertToType (interp, keylPtr, &keyedListType) != TCL_OK)
+	return TCL_ERROR;
+    keylIntPtr = (keylIntObj_t *) keylPtr->internalRep.otherValuePtr;
+
+    findIdx = FindKeyedListEntry (keylIntPtr, pathPtr->keys [depth]);
+
+    /*
+     * If not found, return status.
+     */
+    if (findIdx < 0) {
+	KEYL_REP_ASSERT (keylIntPtr);
+	return TCL_BREAK;
+    }
+    keylIntPtr = UnshareKeyedListIntRep (keylPtr);
+
+    /*
+     * If we are at the last subkey, delete the entry.
+     */
+    if (depth == pathPtr->numKeys - 1) {
+	DeleteKeyedListEntry (keylIntPtr, findIdx);
+	Tcl_InvalidateStringRep (keylPtr);
+
+	KEYL_REP_ASSERT (keylIntPtr);
+	return TCL_OK;
+    }
+
+    /*
+     * If we are not at the last subkey, recurse down.	If the entry is
+     * deleted and the sub-keyed list is empty, delete it as well.  Must
+     * invalidate string, as it caches all representations below it.
+     */
+    DupSharedKeyListChild (keylIntPtr, findIdx);
+
+    status = DeleteKeyedListPath (interp,
+				  keylIntPtr->entries [findIdx].valuePtr,
+				  depth + 1, pathPtr);
+    if (status == TCL_OK) {
+	subKeylIntPtr = (keylIntObj_t *)
+	    keylIntPtr->entries [findIdx].valuePtr->internalRep.otherValuePtr;
+	if (subKeylIntPtr->numEntries == 0) {
+	    DeleteKeyedListEntry (keylIntPtr, findIdx);
+	}
+	Tcl_InvalidateStringRep (keylPtr);
+    }
+
+    KEYL_REP_ASSERT (keylIntPtr);
+    return status;
+}
+
+/*-----------------------------------------------------------------------------
+ * GetKeyedListPathKeys --
+ *   Retrieve a list of the keys of a keyed list, or of a sub-keyed list.
+ *
+ * Parameters:
+ *   o interp - Error message will be return in result if there is an error.
+ *   o keylPtr - Keyed list object to get key from.
+ *   o pathPtr - The compiled path of the key to get the sub keys for.  NULL
+ *     to retrieve all top level keys.
+ *   o listObjPtrPtr - List object is returned here with key as values.
+ * Returns:
+ *   o TCL_OK - If the zero or more key where returned.
+ *   o TCL_BREAK - If the key was not found.
+ *   o TCL_ERROR - If an error occured.
+ *-----------------------------------------------------------------------------
+ */
+static int
+GetKeyedListPathKeys (Tcl_Interp *interp,
+                      Tcl_Obj    *keylPtr,
+                      keylPath_t *pathPtr,
+                      Tcl_Obj   **listObjPtrPtr)
+{
+    keylIntObj_t *keylIntPtr;
+    Tcl_Obj *listObjPtr;
+    int idx, depth, findIdx;
+
+    /*
+     * Walk down the key path to the keyed list whose keys are wanted.
+     */
+    for (depth = 0; ; depth++) {
+	if (Tcl_ConvertToType (interp, keylPtr, &keyedListType) != TCL_OK)
+	    return TCL_ERROR;
+	keylIntPtr = (keylIntObj_t *) keylPtr->internalRep.otherValuePtr;
+	KEYL_REP_ASSERT (keylIntPtr);
+
+	if ((pathPtr == NULL) || (depth == pathPtr->numKeys))
+	    break;
+	findIdx = FindKeyedListEntry (keylIntPtr, pathPtr->keys [depth]);
+	if (findIdx < 0)
+	    return TCL_BREAK;
+	keylPtr = keylIntPtr->entries [findIdx].valuePtr;
+    }
+
+    /*
+     * Reached the end of the full key, return all keys at this level.
+     */
+    listObjPtr = Tcl_NewObj();
+    for (idx = 0; idx < keylIntPtr->numSlots; idx++) {
+	if (KEYL_SLOT_DELETED (keylIntPtr, idx))
+	    continue;
+	Tcl_ListObjAppendElement(interp, listObjPtr,
+		keylIntPtr->entries[idx].keyPtr);
+    }
+    *listObjPtrPtr = listObjPtr;
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclX_KeyedListGet --
+ *   Retrieve a key value from a keyed list.
+ *
+ * Parameters:
+ *   o interp - Error message will be return in result if there is an error.
+ *   o keylPtr - Keyed list object to get key from.
+ *   o key - The name of the key to extract.  Will recusively process sub-keys
+ *     seperated by `.'.
+ *   o valueObjPtrPtr - If the key is found, a pointer to the key object
+ *     is returned here.  NULL is returned if the key is not present.
+ * Returns:
+ *   o TCL_OK - If the key value was returned.
+ *   o TCL_BREAK - If the key was not found.
+ *   o TCL_ERROR - If an error occured.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclX_KeyedListGet (Tcl_Interp *interp,
+                   Tcl_Obj    *keylPtr,
+                   char       *key,
+                   Tcl_Obj   **valuePtrPtr)
+{
+    keylPath_t *pathPtr = NewKeyPath (key, strlen (key));
+    int status;
+
+    status = GetKeyedListPaths (interp, keylPtr, 0, 1, &pathPtr, valuePtrPtr);
+    ReleaseKeyPath (pathPtr);
+    return status;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclX_KeyedListSet --
+ *   Set a key value in keyed list object.
+ *
+ * Parameters:
+ *   o interp - Error message will be return in result object.
+ *   o keylPtr - Keyed list object to update.
+ *   o key - The name of the key to extract.  Will recursively process
+ *     sub-key seperated by `.'.
+ *   o valueObjPtr - The value to set for the key.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclX_KeyedListSet (Tcl_Interp *interp,
+                   Tcl_Obj    *keylPtr,
+                   char       *key,
+                   Tcl_Obj    *valuePtr)
+{
+    keylPath_t *pathPtr = NewKeyPath (key, strlen (key));
+    int status;
+
+    status = SetKeyedListPaths (interp, keylPtr, 0, 1, &pathPtr, &valuePtr);
+    ReleaseKeyPath (pathPtr);
+    return status;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclX_KeyedListSetMany --
+ *   Set a number of key values in keyed list object.  This is the same as
+ * calling TclX_KeyedListSet for each key in turn, except that adjacent keys
+ * with a common leading key path, such as `a.b.x' and `a.b.y', look up
+ * each of the shared levels once.
+ *
+ * Parameters:
+ *   o interp - Error message will be return in result object.
+ *   o keylPtr - Keyed list object to update.
+ *   o keyc - Number of keys in keyv and values in valuev.
+ *   o keyv - The names of the keys to set.  Will recursively process
+ *     sub-keys seperated by `.'.
+ *   o valuev - The values to set for the keys.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclX_KeyedListSetMany (Tcl_Interp *interp,
+                       Tcl_Obj    *keylPtr,
+                       int         keyc,
+                       char      **keyv,
+                       Tcl_Obj   **valuev)
+{
+    keylPath_t *staticPathv [KEYL_STATIC_KEYS], **pathv;
+    int idx, status;
+
+    pathv = (keyc > KEYL_STATIC_KEYS) ?
+	(keylPath_t **) ckalloc (keyc * sizeof (keylPath_t *)) : staticPathv;
+    for (idx = 0; idx < keyc; idx++) {
+	pathv [idx] = NewKeyPath (keyv [idx], strlen (keyv [idx]));
+    }
+
+    status = SetKeyedListPaths (interp, keylPtr, 0, keyc, pathv, valuev);
+
+    ReleaseKeyPaths (keyc, pathv, staticPathv);
+    return status;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclX_KeyedListGetMany --
+ *   Retrieve a number of key values from a keyed list.  Adjacent keys with a
+ * common leading key path look up each of the shared levels once.
+ *
+ * Parameters:
+ *   o interp - Error message will be return in result if there is an error.
+ *   o keylPtr - Keyed list object to get keys from.
+ *   o keyc - Number of keys in keyv.
+ *   o keyv - The names of the keys to extract.  Will recursively process
+ *     sub-keys seperated by `.'.
+ *   o valuev - Array of keyc elements.  A pointer to each key's value object
+ *     is returned here, or NULL if that key is not present.
+ * Returns:
+ *   o TCL_OK - If all of the key values were returned.
+ *   o TCL_BREAK - If one or more of the keys were not found.
+ *   o TCL_ERROR - If an error occured.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclX_KeyedListGetMany (Tcl_Interp *interp,
+                       Tcl_Obj    *keylPtr,
+                       int         keyc,
+                       char      **keyv,
+                       Tcl_Obj   **valuev)
+{
+    keylPath_t *staticPathv [KEYL_STATIC_KEYS], **pathv;
+    int idx, status;
+
+    pathv = (keyc > KEYL_STATIC_KEYS) ?
+	(keylPath_t **) ckalloc (keyc * sizeof (keylPath_t *)) : staticPathv;
+    for (idx = 0; idx < keyc; idx++) {
+	pathv [idx] = NewKeyPath (keyv [idx], strlen (keyv [idx]));
+    }
+
+    status = GetKeyedListPaths (interp, keylPtr, 0, keyc, pathv, valuev);
+
+    ReleaseKeyPaths (keyc, pathv, staticPathv);
+    return status;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclX_KeyedListDelete --
+ *   Delete a key value from keyed list.
+ *
+ * Parameters:
+ *   o interp - Error message will be return in result if there is an error.
+ *   o keylPtr - Keyed list object to update.
+ *   o key - The name of the key to extract.  Will recusively process
+ *     sub-key seperated by `.'.
+ * Returns:
+ *   o TCL_OK - If the key was deleted.
+ *   o TCL_BREAK - If the key was not found.
+ *   o TCL_ERROR - If an error occured.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclX_KeyedListDelete (Tcl_Interp *interp, Tcl_Obj *keylPtr, char *key)
+{
+    keylPath_t *pathPtr = NewKeyPath (key, strlen (key));
+    int status;
+
+    status = DeleteKeyedListPath (interp, keylPtr, 0, pathPtr);
+    ReleaseKeyPath (pathPtr);
+    return status;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclX_KeyedListGetKeys --
+ *   Retrieve a list of keyed list keys.
+ *
+ * Parameters:
+ *   o interp - Error message will be return in result if there is an error.
+ *   o keylPtr - Keyed list object to get key from.
+ *   o key - The name of the key to get the sub keys for.  NULL or empty
+ *     to retrieve all top level keys.
+ *   o listObjPtrPtr - List object is returned here with key as values.
+ * Returns:
+ *   o TCL_OK - If the zero or more key where returned.
+ *   o TCL_BREAK - If the key was not found.
+ *   o TCL_ERROR - If an error occured.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclX_KeyedListGetKeys (Tcl_Interp *interp,
+                       Tcl_Obj    *keylPtr,
+                       char       *key,
+                       Tcl_Obj   **listObjPtrPtr)
+{
+    keylPath_t *pathPtr;
+    int status;
+
+    if ((key == NULL) || (key [0] == '\0')) {
+	return GetKeyedListPathKeys (interp, keylPtr, NULL, listObjPtrPtr);
+    }
+    pathPtr = NewKeyPath (key, strlen (key));
+    status = GetKeyedListPathKeys (interp, keylPtr, pathPtr, listObjPtrPtr);
+    ReleaseKeyPath (pathPtr);
+    return status;
+}
+
+/*-----------------------------------------------------------------------------
+ * PutSerialLength --
+ *   Append a count or length to a serialized keyed list.
+ *
+ * Parameters:
+ *   o bufPtr - Buffer holding the serialized keyed list.
+ *   o length - The value to append.
+ *-----------------------------------------------------------------------------
+ */
+static void
+PutSerialLength (Tcl_DString *bufPtr, unsigned long length)
+{
+    unsigned char bytes [4];
+
+    bytes [0] = (unsigned char) (length >> 24);
+    bytes [1] = (unsigned char) (length >> 16);
+    bytes [2] = (unsigned char) (length >> 8);
+    bytes [3] = (unsigned char) length;
+    Tcl_DStringAppend (bufPtr, (char *) bytes, 4);
+}
+
+/*-----------------------------------------------------------------------------
+ * GetSerialLength --
+ *   Read a count or length from a serialized keyed list.
+ *
+ * Parameters:
+ *   o ptrPtr - Pointer to the current position, which is advanced past the
+ *     value.
+ *   o end - End of the serialized data.
+ *   o lengthPtr - The value is returned here.
+ * Returns:
+ *   TRUE if the value was read, FALSE if the data is truncated.
+ *-----------------------------------------------------------------------------
+ */
+static int
+GetSerialLength (CONST unsigned char **ptrPtr,
+                 CONST unsigned char  *end,
+                 unsigned long        *lengthPtr)
+{
+    CONST unsigned char *ptr = *ptrPtr;
+
+    if (end - ptr < 4)
+	return FALSE;
+    *lengthPtr = ((unsigned long) ptr [0] << 24) |
+	((unsigned long) ptr [1] << 16) | ((unsigned long) ptr [2] << 8) |
+	(unsigned long) ptr [3];
+    *ptrPtr = ptr + 4;
+    return TRUE;
+}
+
+/*-----------------------------------------------------------------------------
+ * SerializeKeyedList --
+ *   Append the serialized form of a keyed list to a buffer.  Values that are
+ * keyed lists are serialized recursively; sub-lists that were deserialized
+ * and never accessed are copied as they are.  Other values are stored as
+ * strings.
+ *
+ * Parameters:
+ *   o interp - Error message will be return in result if there is an error.
+ *   o keylPtr - Keyed list object to serialize.
+ *   o bufPtr - Buffer to append to.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SerializeKeyedList (Tcl_Interp  *interp,
+                    Tcl_Obj     *keylPtr,
+                    Tcl_DString *bufPtr)
+{
+    keylIntObj_t *keylIntPtr;
+    keylSerialRep_t *serialPtr;
+    Tcl_Obj *valuePtr;
+    char *str;
+    int idx, strLen, lenOffset;
+    unsigned long nodeLen;
+
+    if (Tcl_ConvertToType (interp, keylPtr, &keyedListType) != TCL_OK)
+	return TCL_ERROR;
+    keylIntPtr = (keylIntObj_t *) keylPtr->internalRep.otherValuePtr;
+
+    PutSerialLength (bufPtr, keylIntPtr->numEntries);
+    for (idx = 0; idx < keylIntPtr->numSlots; idx++) {
+	if (KEYL_SLOT_DELETED (keylIntPtr, idx))
+	    continue;
+	str = Tcl_GetStringFromObj (keylIntPtr->entries [idx].keyPtr, &strLen);
+	PutSerialLength (bufPtr, strLen);
+	Tcl_DStringAppend (bufPtr, str, strLen + 1);
+
+	valuePtr = keylIntPtr->entries [idx].valuePtr;
+	if (valuePtr->typePtr == &keylSerialType) {
+	    serialPtr = (keylSerialRep_t *) valuePtr->internalRep.otherValuePtr;
+	    Tcl_DStringAppend (bufPtr, "k", 1);
+	    PutSerialLength (bufPtr, serialPtr->length);
+	    Tcl_DStringAppend (bufPtr, (char *) serialPtr->node,
+			       serialPtr->length);
+	} else if (valuePtr->typePtr == &keyedListType) {
+	    /*
+	     * The length of the sub-list isn't known until it is written, so
+	     * write a place holder and fill it in afterwards.
+	     */
+	    Tcl_DStringAppend (bufPtr, "k", 1);
+	    lenOffset = Tcl_DStringLength (bufPtr);
+	    PutSerialLength (bufPtr, 0);
+	    if (SerializeKeyedList (interp, valuePtr, bufPtr) != TCL_OK)
+		return TCL_ERROR;
+	    nodeLen = Tcl_DStringLength (bufPtr) - lenOffset - 4;
+	    str = Tcl_DStringValue (bufPtr) + lenOffset;
+	    str [0] = (char) (nodeLen >> 24);
+	    str [1] = (char) (nodeLen >> 16);
+	    str [2] = (char) (nodeLen >> 8);
+	    str [3] = (char) nodeLen;
+	} else {
+	    str = Tcl_GetStringFromObj (valuePtr, &strLen);
+	    Tcl_DStringAppend (bufPtr, "v", 1);
+	    PutSerialLength (bufPtr, strLen);
+	    Tcl_DStringAppend (bufPtr, str, strLen + 1);
+	}
+    }
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * DecodeKeyedList --
+ *   Build the internal representation of a keyed list from its serialized
+ * form.  Only this level is decoded; values that are keyed lists are
+ * returned as keylSerialized objects.  The data is checked as it is decoded,
+ * so a damaged sub-list is only reported when it is accessed.
+ *
+ * Parameters:
+ *   o interp - Error message will be return in result if there is an error.
+ *     May be NULL.
+ *   o bufPtr - Buffer containing the serialized keyed list.
+ *   o node - Start of the serialized keyed list within the buffer.
+ *   o length - Length of the serialized keyed list.
+ * Returns:
+ *   The keyed list internal representation, or NULL if the data is not a
+ *   valid serialized keyed list.
+ *-----------------------------------------------------------------------------
+ */
+static keylIntObj_t *
+DecodeKeyedList (Tcl_Interp	     *interp,
+                 keylSerialBuf_t     *bufPtr,
+                 CONST unsigned char *node,
+                 int		      length)
+{
+    CONST unsigned char *ptr = node, *end = node + length;
+    keylIntObj_t *keylIntPtr = NULL;
+    Tcl_Obj *keyObjPtr, *valuePtr;
+    unsigned long numEntries, keyLen, valueLen, idx;
+    int type;
+
+    if (!GetSerialLength (&ptr, end, &numEntries) ||
+	    (numEntries > (unsigned long) (end - ptr) / KEYL_SERIAL_MIN_ENTRY))
+	goto badFormat;
+
+    keylIntPtr = AllocKeyedListIntRep ();
+    EnsureKeyedListSpace (keylIntPtr, (int) numEntries);
+
+    for (idx = 0; idx < numEntries; idx++) {
+	/*
+	 * Keys must be valid for a keyed list, and so must not be empty or
+	 * contain a `.' or a NUL.
+	 */
+	if (!GetSerialLength (&ptr, end, &keyLen) || (keyLen == 0) ||
+		(keyLen >= (unsigned long) (end - ptr)) ||
+		(ptr [keyLen] != '\0') ||
+		(memchr (ptr, '.', keyLen) != NULL) ||
+		(strlen ((char *) ptr) != keyLen))
+	    goto badFormat;
+	keyObjPtr = InternKey ((char *) ptr, (int) keyLen, NULL);
+	ptr += keyLen + 1;
+
+	if (ptr >= end)
+	    goto badFormat;
+	type = *ptr++;
+	if (!GetSerialLength (&ptr, end, &valueLen) ||
+		(valueLen > (unsigned long) (end - ptr)))
+	    goto badFormat;
+	if (type == KEYL_SERIAL_VALUE) {
+	    if ((valueLen == (unsigned long) (end - ptr)) ||
+		    (ptr [valueLen] != '\0'))
+		goto badFormat;
+	    valuePtr = Tcl_NewStringObj ((char *) ptr, (int) valueLen);
+	    ptr += valueLen + 1;
+	} else if (type == KEYL_SERIAL_KEYL) {
+	    valuePtr = NewSerialKeylObj (bufPtr, ptr, (int) valueLen);
+	    ptr += valueLen;
+	} else {
+	    goto badFormat;
+	}
+
+	if (FindKeyedListEntry (keylIntPtr, keyObjPtr) >= 0) {
+	    Tcl_IncrRefCount (valuePtr);
+	    Tcl_DecrRefCount (valuePtr);
+	    goto badFormat;
+	}
+	AddKeyedListEntry (keylIntPtr, keyObjPtr, valuePtr);
+    }
+    if (ptr != end)
+	goto badFormat;
+
+    KEYL_REP_ASSERT (keylIntPtr);
+    return keylIntPtr;
+
+  badFormat:
+    if (keylIntPtr != NULL)
+	FreeKeyedListData (keylIntPtr);
+    if (interp != NULL) {
+	Tcl_ResetResult (interp);
+	TclX_AppendObjResult (interp, "invalid serialized keyed list",
+			      (char *) NULL);
+    }
+    return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+ * DecodeSerialBuffer --
+ *   Check the header of a serialized keyed list and decode its top level.
+ *
+ * Parameters:
+ *   o interp - Error message will be return in result if there is an error.
+ *   o bufPtr - Buffer containing the serialized keyed list.
+ *   o keylPtrPtr - The new keyed list object is returned here.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+DecodeSerialBuffer (Tcl_Interp      *interp,
+                    keylSerialBuf_t *bufPtr,
+                    Tcl_Obj        **keylPtrPtr)
+{
+    CONST unsigned char *ptr = (unsigned char *) bufPtr->bytes;
+    keylIntObj_t *keylIntPtr;
+    unsigned long version;
+
+    if ((bufPtr->length < KEYL_SERIAL_HEADER_LEN) ||
+	    (memcmp (ptr, KEYL_SERIAL_MAGIC, KEYL_SERIAL_MAGIC_LEN) != 0)) {
+	TclX_AppendObjResult (interp, "data is not a serialized keyed list",
+			      (char *) NULL);
+	return TCL_ERROR;
+    }
+    ptr += KEYL_SERIAL_MAGIC_LEN;
+    GetSerialLength (&ptr, ptr + 4, &version);
+    if (version != KEYL_SERIAL_VERSION) {
+	TclX_AppendObjResult (interp,
+		"unsupported serialized keyed list version", (char *) NULL);
+	return TCL_ERROR;
+    }
+
+    keylIntPtr = DecodeKeyedList (interp, bufPtr, ptr,
+				  (int) (bufPtr->length - KEYL_SERIAL_HEADER_LEN));
+    if (keylIntPtr == NULL)
+	return TCL_ERROR;
+
+    *keylPtrPtr = Tcl_NewObj ();
+    Tcl_InvalidateStringRep (*keylPtrPtr);
+    (*keylPtrPtr)->internalRep.otherValuePtr = (VOID *) keylIntPtr;
+    (*keylPtrPtr)->typePtr = &keyedListType;
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * ReleaseSerialBuffer --
+ *   Release a reference to a serialized keyed list buffer, freeing it once
+ * nothing points into it.
+ *
+ * Parameters:
+ *   o bufPtr - The buffer.
+ *-----------------------------------------------------------------------------
+ */
+static void
+ReleaseSerialBuffer (keylSerialBuf_t *bufPtr)
+{
+    if (--bufPtr->refCount > 0)
+	return;
+    ckfree (bufPtr->bytes);
+    ckfree ((VOID *) bufPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * NewSerialKeylObj --
+ *   Create an object for a keyed list that is still in serialized form.
+ * The object has no string rep until one is asked for.
+ *
+ * Parameters:
+ *   o bufPtr - Buffer containing the serialized keyed list.
+ *   o node - Start of the serialized keyed list within the buffer.
+ *   o length - Length of the serialized keyed list.
+ * Returns:
+ *   The new object.
+ *-----------------------------------------------------------------------------
+ */
+static Tcl_Obj *
+NewSerialKeylObj (keylSerialBuf_t     *bufPtr,
+                  CONST unsigned char *node,
+                  int		       length)
+{
+    Tcl_Obj *objPtr = Tcl_NewObj ();
+    keylSerialRep_t *serialPtr;
+
+    serialPtr = (keylSerialRep_t *) ckalloc (sizeof (keylSerialRep_t));
+    serialPtr->bufPtr = bufPtr;
+    serialPtr->node = node;
+    serialPtr->length = length;
+    bufPtr->refCount++;
+
+    Tcl_InvalidateStringRep (objPtr);
+    objPtr->internalRep.otherValuePtr = (VOID *) serialPtr;
+    objPtr->typePtr = &keylSerialType;
+    return objPtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * FreeSerialKeylInternalRep --
+ *   Free the internal representation of a keylSerialized object.
+ *
+ * Parameters:
+ *   o objPtr - Object being deleted or converted.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FreeSerialKeylInternalRep (Tcl_Obj *objPtr)
+{
+    keylSerialRep_t *serialPtr =
+	(keylSerialRep_t *) objPtr->internalRep.otherValuePtr;
+
+    ReleaseSerialBuffer (serialPtr->bufPtr);
+    ckfree ((VOID *) serialPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * DupSerialKeylInternalRep --
+ *   Duplicate the internal representation of a keylSerialized object.  The
+ * copy points into the same buffer.
+ *
+ * Parameters:
+ *   o srcPtr - Object to copy.
+ *   o copyPtr - Target object to copy internal representation to.
+ *-----------------------------------------------------------------------------
+ */
+static void
+DupSerialKeylInternalRep (Tcl_Obj *srcPtr, Tcl_Obj *copyPtr)
+{
+    keylSerialRep_t *srcSerialPtr =
+	(keylSerialRep_t *) srcPtr->internalRep.otherValuePtr;
+    keylSerialRep_t *serialPtr;
+
+    serialPtr = (keylSerialRep_t *) ckalloc (sizeof (keylSerialRep_t));
+    *serialPtr = *srcSerialPtr;
+    serialPtr->bufPtr->refCount++;
+
+    copyPtr->internalRep.otherValuePtr = (VOID *) serialPtr;
+    copyPtr->typePtr = &keylSerialType;
+}
+
+/*-----------------------------------------------------------------------------
+ * UpdateStringOfSerialKeyl --
+ *   Update the string representation of a keylSerialized object.  The keyed
+ * list is decoded to format it.  As this can't fail, a damaged keyed list
+ * gets an empty string; the damage is reported if it is accessed as a keyed
+ * list.
+ *
+ * Parameters:
+ *   o objPtr - Object to generate the string rep for.
  *-----------------------------------------------------------------------------
  */
-Tcl_Obj *
-TclX_NewKeyedListObj ()
+static void
+UpdateStringOfSerialKeyl (Tcl_Obj *objPtr)
 {
-    Tcl_Obj *keylPtr = Tcl_NewObj ();
-    keylIntObj_t *keylIntPtr = AllocKeyedListIntRep ();
+    keylSerialRep_t *serialPtr =
+	(keylSerialRep_t *) objPtr->internalRep.otherValuePtr;
+    keylIntObj_t *keylIntPtr;
 
-    keylPtr->internalRep.otherValuePtr = (VOID *) keylIntPtr;
-    keylPtr->typePtr = &keyedListType;
-    return keylPtr;
+    keylIntPtr = DecodeKeyedList (NULL, serialPtr->bufPtr, serialPtr->node,
+				  serialPtr->length);
+    if (keylIntPtr == NULL) {
+	objPtr->bytes = ckalloc (1);
+	objPtr->bytes [0] = '\0';
+	objPtr->length = 0;
+	return;
+    }
+    FormatKeyedList (keylIntPtr, objPtr);
+    FreeKeyedListData (keylIntPtr);
 }
-
+
 /*-----------------------------------------------------------------------------
- * TclX_KeyedListGet --
- *   Retrieve a key value from a keyed list.
+ * TclX_KeyedListSerialize --
+ *   Serialize a keyed list into a compact binary form that can be quickly
+ * reloaded with TclX_KeyedListDeserialize or
+ * TclX_KeyedListDeserializeFile.
  *
  * Parameters:
  *   o interp - Error message will be return in result if there is an error.
- *   o keylPtr - Keyed list object to get key from.
- *   o key - The name of the key to extract.  Will recusively process sub-keys
- *     seperated by `.'.
- *   o valueObjPtrPtr - If the key is found, a pointer to the key object
- *     is returned here.  NULL is returned if the key is not present.
+ *   o keylPtr - Keyed list object to serialize.
+ *   o dataPtrPtr - A byte array object containing the serialized keyed list
+ *     is returned here.
  * Returns:
- *   o TCL_OK - If the key value was returned.
- *   o TCL_BREAK - If the key was not found.
- *   o TCL_ERROR - If an error occured.
+ *   TCL_OK or TCL_ERROR.
  *-----------------------------------------------------------------------------
  */
 int
-TclX_KeyedListGet (Tcl_Interp *interp,
-                   Tcl_Obj    *keylPtr,
-                   char       *key,
-                   Tcl_Obj   **valuePtrPtr)
+TclX_KeyedListSerialize (Tcl_Interp *interp,
+                         Tcl_Obj    *keylPtr,
+                         Tcl_Obj   **dataPtrPtr)
 {
-    keylIntObj_t *keylIntPtr;
-    char *nextSubKey;
-    int findIdx;
-
-    while (1) {
-        if (Tcl_ConvertToType (interp, keylPtr, &keyedListType) != TCL_OK)
-            return TCL_ERROR;
-
-        keylIntPtr = (keylIntObj_t *) keylPtr->internalRep.otherValuePtr;
-        KEYL_REP_ASSERT (keylIntPtr);
-
-        findIdx = FindKeyedListEntry(keylIntPtr, key, NULL, &nextSubKey);
+    Tcl_DString buf;
 
-        /*
-         * If not found, return status.
-         */
-        if (findIdx < 0) {
-            *valuePtrPtr = NULL;
-            return TCL_BREAK;
-        }
-
-        /*
-         * If we are at the last subkey, return the entry, otherwise recurse
-         * down looking for the entry.
-         */
-        if (nextSubKey == NULL) {
-            *valuePtrPtr = keylIntPtr->entries [findIdx].valuePtr;
-            return TCL_OK;
-        } else {
-            keylPtr = keylIntPtr->entries [findIdx].valuePtr;
-            key = nextSubKey;
-        }
+    Tcl_DStringInit (&buf);
+    Tcl_DStringAppend (&buf, KEYL_SERIAL_MAGIC, KEYL_SERIAL_MAGIC_LEN);
+    PutSerialLength (&buf, KEYL_SERIAL_VERSION);
+    if (SerializeKeyedList (interp, keylPtr, &buf) != TCL_OK) {
+	Tcl_DStringFree (&buf);
+	return TCL_ERROR;
     }
+    *dataPtrPtr = Tcl_NewByteArrayObj ((unsigned char *) Tcl_DStringValue (&buf),
+				       Tcl_DStringLength (&buf));
+    Tcl_DStringFree (&buf);
+    return TCL_OK;
 }
-
+
 /*-----------------------------------------------------------------------------
- * TclX_KeyedListSet --
- *   Set a key value in keyed list object.
+ * TclX_KeyedListDeserialize --
+ *   Create a keyed list from its serialized form.  Only the top level is
+ * decoded; sub-lists are decoded when they are first accessed.
  *
  * Parameters:
- *   o interp - Error message will be return in result object.
- *   o keylPtr - Keyed list object to update.
- *   o key - The name of the key to extract.  Will recursively process
- *     sub-key seperated by `.'.
- *   o valueObjPtr - The value to set for the key.
+ *   o interp - Error message will be return in result if there is an error.
+ *   o dataPtr - Byte array object containing the serialized keyed list.
+ *   o keylPtrPtr - The new keyed list object is returned here.
  * Returns:
  *   TCL_OK or TCL_ERROR.
  *-----------------------------------------------------------------------------
  */
 int
-TclX_KeyedListSet (Tcl_Interp *interp,
-                   Tcl_Obj    *keylPtr,
-                   char       *key,
-                   Tcl_Obj    *valuePtr)
+TclX_KeyedListDeserialize (Tcl_Interp *interp,
+                           Tcl_Obj    *dataPtr,
+                           Tcl_Obj   **keylPtrPtr)
 {
-    keylIntObj_t *keylIntPtr;
-    keylEntry_t *keyEntryPtr;
-    char *nextSubKey;
-    int findIdx, keyLen, status = TCL_OK;
-    Tcl_Obj *newKeylPtr;
-
-    while (1) {
-	if (Tcl_ConvertToType (interp, keylPtr, &keyedListType) != TCL_OK)
-	    return TCL_ERROR;
-	keylIntPtr = (keylIntObj_t *) keylPtr->internalRep.otherValuePtr;
-	KEYL_REP_ASSERT (keylIntPtr);
-
-	findIdx = FindKeyedListEntry (keylIntPtr, key, &keyLen, &nextSubKey);
-
-	/*
-	 * If we are at the last subkey, either update or add an entry.
-	 */
-	if (nextSubKey == NULL) {
-#ifndef NO_KEYLIST_HASH_TABLE
-	    int dummy;
-	    Tcl_HashEntry *entryPtr;
-#endif
-	    if (findIdx < 0) {
-		EnsureKeyedListSpace (keylIntPtr, 1);
-		findIdx = keylIntPtr->numEntries++;
-	    } else {
-		ckfree (keylIntPtr->entries [findIdx].key);
-		Tcl_DecrRefCount(keylIntPtr->entries [findIdx].valuePtr);
-	    }
-	    keyEntryPtr = &(keylIntPtr->entries[findIdx]);
-	    keyEntryPtr->key = (char *) ckalloc (keyLen + 1);
-	    memcpy(keyEntryPtr->key, key, keyLen);
-	    keyEntryPtr->key[keyLen] = '\0';
-	    keyEntryPtr->keyLen      = keyLen;
-	    keyEntryPtr->valuePtr    = valuePtr;
-	    Tcl_IncrRefCount(valuePtr);
-#ifndef NO_KEYLIST_HASH_TABLE
-	    if (keylIntPtr->hashTbl == NULL) {
-		keylIntPtr->hashTbl =
-		    (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
-		Tcl_InitHashTable(keylIntPtr->hashTbl, TCL_STRING_KEYS);
-	    }
-	    entryPtr = Tcl_CreateHashEntry(keylIntPtr->hashTbl,
-		    keyEntryPtr->key, &dummy);
-	    Tcl_SetHashValue(entryPtr, (ClientData) (uintptr_t) findIdx);
-#endif
-	    Tcl_InvalidateStringRep (keylPtr);
+    keylSerialBuf_t *bufPtr;
+    unsigned char *data;
+    int length, status;
 
-	    KEYL_REP_ASSERT (keylIntPtr);
-	    return TCL_OK;
-	}
+    data = Tcl_GetByteArrayFromObj (dataPtr, &length);
 
-	/*
-	 * If we are not at the last subkey, recurse down, creating new
-	 * entries if neccessary.  If this level key was not found, it
-	 * means we must build new subtree. Don't insert the new tree until we
-	 * come back without error.
-	 */
-	if (findIdx >= 0) {
-	    DupSharedKeyListChild (keylIntPtr, findIdx);
-	    status = TclX_KeyedListSet (interp,
-		    keylIntPtr->entries [findIdx].valuePtr,
-		    nextSubKey, valuePtr);
-	    if (status == TCL_OK) {
-		Tcl_InvalidateStringRep (keylPtr);
-	    }
-	} else {
-#ifndef NO_KEYLIST_HASH_TABLE
-	    int dummy;
-	    Tcl_HashEntry *entryPtr;
-#endif
-	    newKeylPtr = TclX_NewKeyedListObj ();
-	    Tcl_IncrRefCount(newKeylPtr);
-	    if (TclX_KeyedListSet (interp, newKeylPtr,
-			nextSubKey, valuePtr) != TCL_OK) {
-		Tcl_DecrRefCount(newKeylPtr);
-		return TCL_ERROR;
-	    }
-	    EnsureKeyedListSpace (keylIntPtr, 1);
-	    findIdx = keylIntPtr->numEntries++;
-	    keyEntryPtr = &(keylIntPtr->entries[findIdx]);
-	    keyEntryPtr->key = (char *) ckalloc (keyLen + 1);
-	    memcpy(keyEntryPtr->key, key, keyLen);
-	    keyEntryPtr->key[keyLen] = '\0';
-	    keyEntryPtr->keyLen      = keyLen;
-	    keyEntryPtr->valuePtr    = newKeylPtr;
-#ifndef NO_KEYLIST_HASH_TABLE
-	    if (keylIntPtr->hashTbl == NULL) {
-		keylIntPtr->hashTbl =
-		    (Tcl_HashTable *) ckalloc(sizeof(Tcl_HashTable));
-		Tcl_InitHashTable(keylIntPtr->hashTbl, TCL_STRING_KEYS);
-	    }
-	    entryPtr = Tcl_CreateHashEntry(keylIntPtr->hashTbl,
-		    keyEntryPtr->key, &dummy);
-	    Tcl_SetHashValue(entryPtr, (ClientData) (uintptr_t) findIdx);
-#endif
-	    Tcl_InvalidateStringRep (keylPtr);
-	}
+    bufPtr = (keylSerialBuf_t *) ckalloc (sizeof (keylSerialBuf_t));
+    bufPtr->refCount = 1;
+    bufPtr->bytes = ckalloc (length + 1);
+    bufPtr->length = length;
+    memcpy (bufPtr->bytes, data, length);
 
-	KEYL_REP_ASSERT (keylIntPtr);
-	return status;
-    }
+    status = DecodeSerialBuffer (interp, bufPtr, keylPtrPtr);
+    ReleaseSerialBuffer (bufPtr);
+    return status;
 }
-
+
 /*-----------------------------------------------------------------------------
- * TclX_KeyedListDelete --
- *   Delete a key value from keyed list.
+ * TclX_KeyedListDeserializeFile --
+ *   Create a keyed list from a file containing its serialized form.  The file
+ * is read into memory and only the top level is decoded, so the cost of
+ * decoding is in proportion to the part of the keyed list that is accessed.
+ * Sub-lists are decoded from the copy read, so changing the file afterwards
+ * doesn't affect the keyed list.
  *
  * Parameters:
  *   o interp - Error message will be return in result if there is an error.
- *   o keylPtr - Keyed list object to update.
- *   o key - The name of the key to extract.  Will recusively process
- *     sub-key seperated by `.'.
+ *   o fileName - Name of the file containing the serialized keyed list.
+ *   o keylPtrPtr - The new keyed list object is returned here.
  * Returns:
- *   o TCL_OK - If the key was deleted.
- *   o TCL_BREAK - If the key was not found.
- *   o TCL_ERROR - If an error occured.
+ *   TCL_OK or TCL_ERROR.
  *-----------------------------------------------------------------------------
  */
 int
-TclX_KeyedListDelete (Tcl_Interp *interp, Tcl_Obj *keylPtr, char *key)
+TclX_KeyedListDeserializeFile (Tcl_Interp *interp,
+                               char       *fileName,
+                               Tcl_Obj   **keylPtrPtr)
 {
-    keylIntObj_t *keylIntPtr, *subKeylIntPtr;
-    char *nextSubKey;
-    int findIdx, status;
-
-    if (Tcl_ConvertToType (interp, keylPtr, &keyedListType) != TCL_OK)
+    keylSerialBuf_t *bufPtr;
+    Tcl_Channel channel;
+    char *bytes;
+    off_t size;
+    int length, numRead, status;
+
+    channel = Tcl_OpenFileChannel (interp, fileName, "r", 0);
+    if (channel == NULL)
+	return TCL_ERROR;
+    if (TclXOSGetFileSize (channel, &size) != TCL_OK) {
+	TclX_AppendObjResult (interp, "error reading \"", fileName, "\": ",
+			      Tcl_PosixError (interp), (char *) NULL);
+	Tcl_Close (NULL, channel);
 	return TCL_ERROR;
-    keylIntPtr = (keylIntObj_t *) keylPtr->internalRep.otherValuePtr;
-
-    findIdx = FindKeyedListEntry (keylIntPtr, key, NULL, &nextSubKey);
-
-    /*
-     * If not found, return status.
-     */
-    if (findIdx < 0) {
-	KEYL_REP_ASSERT (keylIntPtr);
-	return TCL_BREAK;
     }
-
-    /*
-     * If we are at the last subkey, delete the entry.
-     */
-    if (nextSubKey == NULL) {
-	DeleteKeyedListEntry (keylIntPtr, findIdx);
-	Tcl_InvalidateStringRep (keylPtr);
-
-	KEYL_REP_ASSERT (keylIntPtr);
-	return TCL_OK;
+    if (size > INT_MAX) {
+	Tcl_Close (NULL, channel);
+	TclX_AppendObjResult (interp, "serialized keyed list file \"",
+			      fileName, "\" is too large", (char *) NULL);
+	return TCL_ERROR;
     }
 
     /*
-     * If we are not at the last subkey, recurse down.	If the entry is
-     * deleted and the sub-keyed list is empty, delete it as well.  Must
-     * invalidate string, as it caches all representations below it.
+     * Read what the file held when it was opened.  If it is truncated while
+     * being read, the short data is rejected when it is decoded.
      */
-    DupSharedKeyListChild (keylIntPtr, findIdx);
-
-    status = TclX_KeyedListDelete (interp,
-				   keylIntPtr->entries [findIdx].valuePtr,
-				   nextSubKey);
-    if (status == TCL_OK) {
-	subKeylIntPtr = (keylIntObj_t *)
-	    keylIntPtr->entries [findIdx].valuePtr->internalRep.otherValuePtr;
-	if (subKeylIntPtr->numEntries == 0) {
-	    DeleteKeyedListEntry (keylIntPtr, findIdx);
+    bytes = ckalloc ((int) size + 1);
+    length = 0;
+    while (length < (int) size) {
+	numRead = Tcl_ReadRaw (channel, bytes + length, (int) size - length);
+	if (numRead < 0) {
+	    TclX_AppendObjResult (interp, "error reading \"", fileName,
+				  "\": ", Tcl_PosixError (interp),
+				  (char *) NULL);
+	    ckfree (bytes);
+	    Tcl_Close (NULL, channel);
+	    return TCL_ERROR;
 	}
-	Tcl_InvalidateStringRep (keylPtr);
+	if (numRead == 0)
+	    break;
+	length += numRead;
     }
+    Tcl_Close (NULL, channel);
 
-    KEYL_REP_ASSERT (keylIntPtr);
+    bufPtr = (keylSerialBuf_t *) ckalloc (sizeof (keylSerialBuf_t));
+    bufPtr->refCount = 1;
+    bufPtr->bytes = bytes;
+    bufPtr->length = length;
+
+    status = DecodeSerialBuffer (interp, bufPtr, keylPtrPtr);
+    ReleaseSerialBuffer (bufPtr);
     return status;
 }
-
+
 /*-----------------------------------------------------------------------------
- * TclX_KeyedListGetKeys --
- *   Retrieve a list of keyed list keys.
- *
- * Parameters:
- *   o interp - Error message will be return in result if there is an error.
- *   o keylPtr - Keyed list object to get key from.
- *   o key - The name of the key to get the sub keys for.  NULL or empty
- *     to retrieve all top level keys.
- *   o listObjPtrPtr - List object is returned here with key as values.
- * Returns:
- *   o TCL_OK - If the zero or more key where returned.
- *   o TCL_BREAK - If the key was not found.
- *   o TCL_ERROR - If an error occured.
+ * KeylgetMulti --
+ *     Implements the -multi form of the keylget command:
+ *	   keylget -multi listvar key ?key ...?
  *-----------------------------------------------------------------------------
  */
-int
-TclX_KeyedListGetKeys (Tcl_Interp *interp,
-                       Tcl_Obj    *keylPtr,
-                       char       *key,
-                       Tcl_Obj   **listObjPtrPtr)
+static int
+KeylgetMulti (Tcl_Interp     *interp,
+              int             objc,
+              Tcl_Obj *CONST  objv[])
 {
-    keylIntObj_t *keylIntPtr;
-    Tcl_Obj *listObjPtr;
-    char *nextSubKey;
-    int idx, findIdx;
+    Tcl_Obj *keylPtr, *staticValuev [KEYL_STATIC_KEYS], **valuev;
+    keylPath_t *staticPathv [KEYL_STATIC_KEYS], **pathv;
+    int idx, keyc, numPaths, status = TCL_OK;
 
-    if (Tcl_ConvertToType (interp, keylPtr, &keyedListType) != TCL_OK)
+    if (objc < 4) {
+	return TclX_WrongArgs (interp, objv [0],
+			       "-multi listvar key ?key ...?");
+    }
+
+    keylPtr = Tcl_ObjGetVar2(interp, objv[2], NULL, TCL_LEAVE_ERR_MSG);
+    if (keylPtr == NULL) {
 	return TCL_ERROR;
-    keylIntPtr = (keylIntObj_t *) keylPtr->internalRep.otherValuePtr;
+    }
 
-    /*
-     * If key is not NULL or empty, then recurse down until we go past
-     * the end of all of the elements of the key.
-     */
-    if ((key != NULL) && (key [0] != '\0')) {
-	findIdx = FindKeyedListEntry (keylIntPtr, key, NULL, &nextSubKey);
-	if (findIdx < 0) {
-	    TclX_Assert (keylIntPtr->arraySize >= keylIntPtr->numEntries);
-	    return TCL_BREAK;
+    keyc = objc - 3;
+    if (keyc > KEYL_STATIC_KEYS) {
+	pathv = (keylPath_t **) ckalloc (keyc * sizeof (keylPath_t *));
+	valuev = (Tcl_Obj **) ckalloc (keyc * sizeof (Tcl_Obj *));
+    } else {
+	pathv = staticPathv;
+	valuev = staticValuev;
+    }
+
+    for (numPaths = 0; numPaths < keyc; numPaths++) {
+	pathv [numPaths] = GetKeyPathFromObj (interp, objv [numPaths + 3]);
+	if (pathv [numPaths] == NULL) {
+	    status = TCL_ERROR;
+	    break;
 	}
-	TclX_Assert (keylIntPtr->arraySize >= keylIntPtr->numEntries);
-	return TclX_KeyedListGetKeys (interp, 
-				      keylIntPtr->entries [findIdx].valuePtr,
-				      nextSubKey,
-				      listObjPtrPtr);
     }
 
-    /*
-     * Reached the end of the full key, return all keys at this level.
-     */
-    listObjPtr = Tcl_NewObj();
-    for (idx = 0; idx < keylIntPtr->numEntries; idx++) {
-	Tcl_ListObjAppendElement(interp, listObjPtr,
-		Tcl_NewStringObj(keylIntPtr->entries[idx].key,
-			keylIntPtr->entries[idx].keyLen));
+    if (status == TCL_OK) {
+	status = GetKeyedListPaths (interp, keylPtr, 0, keyc, pathv, valuev);
     }
-    *listObjPtrPtr = listObjPtr;
-    TclX_Assert (keylIntPtr->arraySize >= keylIntPtr->numEntries);
-    return TCL_OK;
+    if (status == TCL_BREAK) {
+	for (idx = 0; valuev [idx] != NULL; idx++)
+	    continue;
+	TclX_AppendObjResult (interp, "key \"",
+		Tcl_GetString (objv [idx + 3]),
+		"\" not found in keyed list", (char *) NULL);
+	status = TCL_ERROR;
+    } else if (status == TCL_OK) {
+	Tcl_SetObjResult (interp, Tcl_NewListObj (keyc, valuev));
+    }
+
+    ReleaseKeyPaths (numPaths, pathv, staticPathv);
+    if (valuev != staticValuev) {
+	ckfree ((VOID *) valuev);
+    }
+    return status;
 }
-
+
 /*-----------------------------------------------------------------------------
  * Tcl_KeylgetObjCmd --
  *     Implements the TCL keylget command:
  *	   keylget listvar ?key? ?retvar | {}?
+ *	   keylget -multi listvar key ?key ...?
  *-----------------------------------------------------------------------------
  */
 static int
@@ -1009,8 +2584,12 @@ TclX_KeylgetObjCmd (ClientData      clientData,
                     Tcl_Obj *CONST objv[])
 {
     Tcl_Obj *keylPtr, *valuePtr;
-    char *key;
-    int keyLen, status;
+    keylPath_t *pathPtr;
+    int status;
+
+    if ((objc >= 2) && STREQU (Tcl_GetString (objv [1]), "-multi")) {
+	return KeylgetMulti (interp, objc, objv);
+    }
 
     if ((objc < 2) || (objc > 4)) {
 	return TclX_WrongArgs (interp, objv [0],
@@ -1031,12 +2610,13 @@ TclX_KeylgetObjCmd (ClientData      clientData,
     /*
      * Handle retrieving a value for a specified key.
      */
-    key = Tcl_GetStringFromObj (objv [2], &keyLen);
-    if (ValidateKey(interp, key, keyLen) == TCL_ERROR) {
+    pathPtr = GetKeyPathFromObj (interp, objv [2]);
+    if (pathPtr == NULL) {
 	return TCL_ERROR;
     }
 
-    status = TclX_KeyedListGet (interp, keylPtr, key, &valuePtr);
+    status = GetKeyedListPaths (interp, keylPtr, 0, 1, &pathPtr, &valuePtr);
+    ReleaseKeyPath (pathPtr);
     if (status == TCL_ERROR)
 	return TCL_ERROR;
 
@@ -1045,7 +2625,7 @@ TclX_KeylgetObjCmd (ClientData      clientData,
      */
     if (status == TCL_BREAK) {
 	if (objc == 3) {
-	    TclX_AppendObjResult (interp, "key \"",  key,
+	    TclX_AppendObjResult (interp, "key \"",  Tcl_GetString (objv [2]),
 		    "\" not found in keyed list", (char *) NULL);
 	    return TCL_ERROR;
 	} else {
@@ -1087,8 +2667,9 @@ TclX_KeylsetObjCmd (ClientData     clientData,
                     Tcl_Obj *CONST objv[])
 {
     Tcl_Obj *keylVarPtr, *newVarObj;
-    char *key;
-    int idx, keyLen, result = TCL_OK;
+    Tcl_Obj *staticValuev [KEYL_STATIC_KEYS], **valuev;
+    keylPath_t *staticPathv [KEYL_STATIC_KEYS], **pathv;
+    int idx, keyc, result = TCL_OK;
 
     if ((objc < 4) || ((objc % 2) != 0)) {
 	return TclX_WrongArgs (interp, objv [0],
@@ -1111,15 +2692,34 @@ TclX_KeylsetObjCmd (ClientData     clientData,
 	newVarObj = NULL;
     }
 
-    for (idx = 2; idx < objc; idx += 2) {
-	key = Tcl_GetStringFromObj (objv [idx], &keyLen);
-	if ((ValidateKey(interp, key, keyLen) == TCL_ERROR)
-		|| (TclX_KeyedListSet (interp, keylVarPtr, key, objv [idx+1])
-			!= TCL_OK)) {
+    /*
+     * Set all of the keys in one pass, so that the keyed list is only
+     * converted and invalidated once per level and keys sharing a path
+     * prefix only look it up once.
+     */
+    keyc = (objc - 2) / 2;
+    if (keyc > KEYL_STATIC_KEYS) {
+	pathv = (keylPath_t **) ckalloc (keyc * sizeof (keylPath_t *));
+	valuev = (Tcl_Obj **) ckalloc (keyc * sizeof (Tcl_Obj *));
+    } else {
+	pathv = staticPathv;
+	valuev = staticValuev;
+    }
+    for (idx = 0; idx < keyc; idx++) {
+	pathv [idx] = GetKeyPathFromObj (interp, objv [2 + 2 * idx]);
+	valuev [idx] = objv [3 + 2 * idx];
+	if (pathv [idx] == NULL) {
 	    result = TCL_ERROR;
 	    break;
 	}
     }
+    if (result == TCL_OK) {
+	result = SetKeyedListPaths (interp, keylVarPtr, 0, keyc, pathv, valuev);
+    }
+    ReleaseKeyPaths (idx, pathv, staticPathv);
+    if (valuev != staticValuev) {
+	ckfree ((VOID *) valuev);
+    }
 
     if ((result == TCL_OK) &&
 	    (Tcl_ObjSetVar2(interp, objv[1], NULL, keylVarPtr,
@@ -1146,8 +2746,8 @@ TclX_KeyldelObjCmd (ClientData  clientData,
                     Tcl_Obj    *CONST objv[])
 {
     Tcl_Obj *keylVarPtr, *keylPtr;
-    char *key;
-    int idx, keyLen, status;
+    keylPath_t *pathPtr;
+    int idx, status;
 
     if (objc < 3) {
 	return TclX_WrongArgs (interp, objv [0], "listvar key ?key ...?");
@@ -1175,16 +2775,18 @@ TclX_KeyldelObjCmd (ClientData  clientData,
     keylPtr = keylVarPtr;
 
     for (idx = 2; idx < objc; idx++) {
-	key = Tcl_GetStringFromObj (objv [idx], &keyLen);
-	if (ValidateKey(interp, key, keyLen) == TCL_ERROR) {
+	pathPtr = GetKeyPathFromObj (interp, objv [idx]);
+	if (pathPtr == NULL) {
 	    return TCL_ERROR;
 	}
 
-	status = TclX_KeyedListDelete (interp, keylPtr, key);
+	status = DeleteKeyedListPath (interp, keylPtr, 0, pathPtr);
+	ReleaseKeyPath (pathPtr);
 	switch (status) {
 	  case TCL_BREAK:
 	    TclX_AppendObjResult (interp, "key not found: \"",
-				  key, "\"", (char *) NULL);
+				  Tcl_GetString (objv [idx]), "\"",
+				  (char *) NULL);
 	    return TCL_ERROR;
 	  case TCL_ERROR:
 	    return TCL_ERROR;
@@ -1207,8 +2809,8 @@ TclX_KeylkeysObjCmd (ClientData   clientData,
                      Tcl_Obj     *CONST objv[])
 {
     Tcl_Obj *keylPtr, *listObjPtr;
-    char *key;
-    int keyLen, status;
+    keylPath_t *pathPtr;
+    int status;
 
     if ((objc < 2) || (objc > 3)) {
 	return TclX_WrongArgs (interp, objv [0], "listvar ?key?");
@@ -1224,19 +2826,22 @@ TclX_KeylkeysObjCmd (ClientData   clientData,
      * meaning get top level keys.
      */
     if (objc < 3) {
-	key = NULL;
+	pathPtr = NULL;
     } else {
-	key = Tcl_GetStringFromObj (objv [2], &keyLen);
-	if (ValidateKey(interp, key, keyLen) == TCL_ERROR) {
+	pathPtr = GetKeyPathFromObj (interp, objv [2]);
+	if (pathPtr == NULL) {
 	    return TCL_ERROR;
 	}
     }
 
-    status = TclX_KeyedListGetKeys (interp, keylPtr, key, &listObjPtr);
+    status = GetKeyedListPathKeys (interp, keylPtr, pathPtr, &listObjPtr);
+    if (pathPtr != NULL) {
+	ReleaseKeyPath (pathPtr);
+    }
     switch (status) {
       case TCL_BREAK:
-	TclX_AppendObjResult (interp, "key not found: \"", key, "\"",
-			      (char *) NULL);
+	TclX_AppendObjResult (interp, "key not found: \"",
+			      Tcl_GetString (objv [2]), "\"", (char *) NULL);
 	return TCL_ERROR;
       case TCL_ERROR:
 	return TCL_ERROR;
@@ -1247,6 +2852,76 @@ TclX_KeylkeysObjCmd (ClientData   clientData,
     return TCL_OK;
 }
 
+/*-----------------------------------------------------------------------------
+ * Tcl_KeylserializeObjCmd --
+ *     Implements the TCL keylserialize command:
+ *	   keylserialize listvar
+ *-----------------------------------------------------------------------------
+ */
+static int
+TclX_KeylserializeObjCmd (ClientData   clientData,
+                          Tcl_Interp  *interp,
+                          int          objc,
+                          Tcl_Obj     *CONST objv[])
+{
+    Tcl_Obj *keylPtr, *dataPtr;
+
+    if (objc != 2) {
+	return TclX_WrongArgs (interp, objv [0], "listvar");
+    }
+
+    keylPtr = Tcl_ObjGetVar2(interp, objv[1], NULL, TCL_LEAVE_ERR_MSG);
+    if (keylPtr == NULL) {
+	return TCL_ERROR;
+    }
+
+    if (TclX_KeyedListSerialize (interp, keylPtr, &dataPtr) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    Tcl_SetObjResult (interp, dataPtr);
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * Tcl_KeyldeserializeObjCmd --
+ *     Implements the TCL keyldeserialize command:
+ *	   keyldeserialize data
+ *	   keyldeserialize -file fileName
+ *-----------------------------------------------------------------------------
+ */
+static int
+TclX_KeyldeserializeObjCmd (ClientData   clientData,
+                            Tcl_Interp  *interp,
+                            int          objc,
+                            Tcl_Obj     *CONST objv[])
+{
+    Tcl_Obj *keylPtr;
+    int status;
+
+    if (objc == 2) {
+	status = TclX_KeyedListDeserialize (interp, objv [1], &keylPtr);
+    } else if ((objc == 3) && STREQU (Tcl_GetString (objv [1]), "-file")) {
+	/*
+	 * Reading files isn't allowed in a safe interpreter.
+	 */
+	if (Tcl_IsSafe (interp)) {
+	    TclX_AppendObjResult (interp, Tcl_GetString (objv [0]),
+		    " -file is not available in a safe interpreter",
+		    (char *) NULL);
+	    return TCL_ERROR;
+	}
+	status = TclX_KeyedListDeserializeFile (interp,
+		Tcl_GetString (objv [2]), &keylPtr);
+    } else {
+	return TclX_WrongArgs (interp, objv [0], "?-file? data");
+    }
+    if (status != TCL_OK) {
+	return TCL_ERROR;
+    }
+    Tcl_SetObjResult (interp, keylPtr);
+    return TCL_OK;
+}
+
 /*-----------------------------------------------------------------------------
  * TclX_KeyedListInit --
  *   Initialize the keyed list commands for this interpreter.
@@ -1271,6 +2946,13 @@ TclX_KeyedListInit (Tcl_Interp *interp)
 
     Tcl_CreateObjCommand (interp, "keylkeys", TclX_KeylkeysObjCmd,
 	    (ClientData) NULL, (Tcl_CmdDeleteProc*) NULL);
+
+    Tcl_CreateObjCommand (interp, "keylserialize", TclX_KeylserializeObjCmd,
+	    (ClientData) NULL, (Tcl_CmdDeleteProc*) NULL);
+
+    Tcl_CreateObjCommand (interp, "keyldeserialize",
+	    TclX_KeyldeserializeObjCmd,
+	    (ClientData) NULL, (Tcl_CmdDeleteProc*) NULL);
 }
 
 /* vim: set ts=8 sw=4 sts=4 et : */
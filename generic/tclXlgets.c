@@ -26,15 +26,32 @@
 
 #include "tclExtdInt.h"
 
+/*
+ * Key for the interpreter's table of partly read lists.
+ */
+#define LGETS_ASSOC_KEY "TclX_lgets"
+
 /*
  * State for current list being read.
  */
 typedef struct {
     Tcl_Channel channel;   /* Channel to read from */
-    Tcl_DString buffer;    /* Buffer for line being read */
+    Tcl_Obj *bufferObj;    /* Buffer for line being read */
     int lineIdx;           /* Index of next line to read. */
 } ReadData;
 
+/*
+ * A list that a non-blocking channel had no more data for.  It is kept in
+ * the interpreter's table, by channel, until the next lgets finishes it or
+ * the channel is closed.  The element that the data ran out in is parsed
+ * again from its start.
+ */
+typedef struct {
+    Tcl_HashEntry *entryPtr;  /* Entry in the table of partial lists. */
+    ReadData readData;        /* Lines read, lineIdx at the next element. */
+    Tcl_Obj *dataObj;         /* Elements already parsed. */
+} PartialList;
+
 
 /*
  * Prototypes of internal functions.
@@ -48,10 +65,43 @@ ReadListInit (Tcl_Interp  *interp,
               Tcl_Channel  channel,
               ReadData    *dataPtr);
 
+static void
+AppendToElement (Tcl_Obj    **elemObjPtr,
+                 char        *bytes,
+                 int          length);
+
 static int
 ReadListElement (Tcl_Interp  *interp,
                  ReadData    *dataPtr,
-                 Tcl_Obj     *elemObjPtr);
+                 Tcl_Obj    **elemObjPtr);
+
+static int
+ReadList (Tcl_Interp  *interp,
+          Tcl_Channel  channel,
+          ReadData    *dataPtr,
+          Tcl_Obj    **dataObjPtr,
+          int         *lengthPtr);
+
+static PartialList *
+SavePartialList (Tcl_Interp  *interp,
+                 ReadData    *dataPtr,
+                 Tcl_Obj     *dataObj);
+
+static void
+PartialListCloseHandler (ClientData clientData);
+
+static void
+ReleasePartialList (PartialList *partialPtr);
+
+static void
+LgetsCleanUp (ClientData  clientData,
+              Tcl_Interp *interp);
+
+static int
+ReadLists (Tcl_Interp  *interp,
+           Tcl_Channel  channel,
+           int          maxLists,
+           Tcl_Obj     *listsObj);
 
 static int 
 TclX_LgetsObjCmd (ClientData  clientData, 
@@ -71,6 +121,8 @@ TclX_LgetsObjCmd (ClientData  clientData,
  * Returns:
  *   o TCL_OK if read succeeded..
  *   o TCL_BREAK if EOF without reading any data.
+ *   o TCL_CONTINUE if the channel is non-blocking and a whole line isn't
+ *     available yet.
  *   o TCL_ERROR if an error occured, with error message in interp.
  *-----------------------------------------------------------------------------
  */
@@ -81,7 +133,7 @@ ReadListLine (Tcl_Interp  *interp,
     /*
      * Read the first line of the list. 
      */
-    if (Tcl_Gets (dataPtr->channel, &dataPtr->buffer) < 0) {
+    if (Tcl_GetsObj (dataPtr->channel, dataPtr->bufferObj) < 0) {
         if (Tcl_Eof (dataPtr->channel)) {
             /*
              * If not first read, then we have failed in the middle of a list.
@@ -93,6 +145,8 @@ ReadListLine (Tcl_Interp  *interp,
             }
             return TCL_BREAK;  /* EOF with no data */
         }
+        if (Tcl_InputBlocked (dataPtr->channel))
+            return TCL_CONTINUE;
         TclX_AppendObjResult (interp, Tcl_PosixError (interp), (char *) NULL);
         return TCL_ERROR;
     }
@@ -111,7 +165,7 @@ ReadListLine (Tcl_Interp  *interp,
     /*
      * Add back in the newline.
      */
-    Tcl_DStringAppend (&dataPtr->buffer, "\n", 1);
+    Tcl_AppendToObj (dataPtr->bufferObj, "\n", 1);
     return TCL_OK;
 }
 
@@ -124,10 +178,13 @@ ReadListLine (Tcl_Interp  *interp,
  * Paramaters:
  *   o interp - Errors are returned in result.
  *   o channel - The channel to read from.
- *   o dataPtr - Data for list read.
+ *   o dataPtr - Data for list read.  The buffer object must have been
+ *     created; it is emptied, so one buffer can be used for many lists.
  * Returns:
  *   o TCL_OK if read to read.
  *   o TCL_BREAK if EOF without reading any data.
+ *   o TCL_CONTINUE if the channel is non-blocking and the first line isn't
+ *     available yet.
  *   o TCL_ERROR if an error occured, with error message in interp.
  *-----------------------------------------------------------------------------
  */
@@ -136,11 +193,11 @@ ReadListInit (Tcl_Interp  *interp,
               Tcl_Channel  channel,
               ReadData    *dataPtr)
 {
-    int rstat;
-    char *p, *limit;
+    int rstat, length;
+    char *start, *p, *limit;
 
     dataPtr->channel = channel;
-    Tcl_DStringInit (&dataPtr->buffer);
+    Tcl_SetObjLength (dataPtr->bufferObj, 0);
     dataPtr->lineIdx = 0;
 
     rstat = ReadListLine (interp, dataPtr);
@@ -150,16 +207,40 @@ ReadListInit (Tcl_Interp  *interp,
     /*
      * Advance to the first non-whitespace.
      */
-    p =  Tcl_DStringValue (&dataPtr->buffer);
-    limit = p + Tcl_DStringLength (&dataPtr->buffer);
+    start = Tcl_GetStringFromObj (dataPtr->bufferObj, &length);
+    p = start;
+    limit = start + length;
     while ((p < limit) && (isspace(UCHAR(*p)))) {
         p++;
     }
-    dataPtr->lineIdx = p - Tcl_DStringValue (&dataPtr->buffer);
+    dataPtr->lineIdx = p - start;
     return TCL_OK;
 }
 
 
+/*-----------------------------------------------------------------------------
+ * AppendToElement --
+ *
+ *    Append bytes to a list element.  The element object is created from
+ * the first bytes, so an element without backslashes is copied just once.
+ *
+ * Paramaters:
+ *   o elemObjPtr - The element object, NULL if none has been created yet.
+ *   o bytes, length - The bytes to append.
+ *-----------------------------------------------------------------------------
+ */
+static void
+AppendToElement (Tcl_Obj **elemObjPtr,
+                 char     *bytes,
+                 int       length)
+{
+    if (*elemObjPtr == NULL) {
+        *elemObjPtr = Tcl_NewStringObj (bytes, length);
+    } else {
+        Tcl_AppendToObj (*elemObjPtr, bytes, length);
+    }
+}
+
 /*-----------------------------------------------------------------------------
  * ReadListElement --
  *
@@ -169,10 +250,14 @@ ReadListInit (Tcl_Interp  *interp,
  * Paramaters:
  *   o interp - Errors are returned in result.
  *   o dataPtr - Data for list read.  As initialized by ReadListInit.
- *   o elemObjPtr - An object to copy the list element to.
+ *   o elemObjPtr - Must point to NULL.  The object the list element is
+ *     copied to is returned here, and must be freed if an error occurs.
  * Returns:
  *   o TCL_OK if an element was read.
  *   o TCL_BREAK if the end of the list was reached.
+ *   o TCL_CONTINUE if the channel is non-blocking and the element continues
+ *     on a line that isn't available yet.  The element will be parsed again
+ *     from its start.
  *   o TCL_ERROR if an error occured.
  * Notes:
  *   Code is a modified version of UCB procedure tclUtil.c:TclFindElement
@@ -181,7 +266,7 @@ ReadListInit (Tcl_Interp  *interp,
 static int
 ReadListElement (Tcl_Interp  *interp,
                  ReadData    *dataPtr,
-                 Tcl_Obj     *elemObjPtr)
+                 Tcl_Obj    **elemObjPtr)
 {
     register char *p;
     char *cpStart;		/* Points to next byte to copy. */
@@ -190,11 +275,13 @@ ReadListElement (Tcl_Interp  *interp,
     int inQuotes = 0;
     int numChars;
     char *p2;
-    int rstat, cpIdx;
+    char *start;		/* Start of the lines read. */
+    int rstat, cpIdx, elemIdx, length;
 
-    p = Tcl_DStringValue (&dataPtr->buffer) + dataPtr->lineIdx;
-    limit = Tcl_DStringValue (&dataPtr->buffer) +
-        Tcl_DStringLength (&dataPtr->buffer);
+    elemIdx = dataPtr->lineIdx;
+    start = Tcl_GetStringFromObj (dataPtr->bufferObj, &length);
+    p = start + dataPtr->lineIdx;
+    limit = start + length;
 
     /*
      * If we are at the end of the string, there are no more elements.
@@ -244,7 +331,7 @@ ReadListElement (Tcl_Interp  *interp,
 		if (openBraces > 1) {
 		    openBraces--;
 		} else if (openBraces == 1) {
-                    Tcl_AppendToObj (elemObjPtr, cpStart, (p - cpStart));
+                    AppendToElement (elemObjPtr, cpStart, (p - cpStart));
 		    p++;
 		    if ((p >= limit) || isspace(UCHAR(*p))) {
 			goto done;
@@ -287,8 +374,8 @@ ReadListElement (Tcl_Interp  *interp,
                 if (openBraces > 0) {
                     p += (numChars - 1);  /* Advanced again at end of loop */
                 } else {
-                    Tcl_AppendToObj (elemObjPtr, cpStart, (p - cpStart));
-                    Tcl_AppendToObj (elemObjPtr, &bsChar, 1);
+                    AppendToElement (elemObjPtr, cpStart, (p - cpStart));
+                    AppendToElement (elemObjPtr, &bsChar, 1);
                     p += (numChars - 1);
                     cpStart = p + 1;  /* already stored character */
                 }
@@ -307,7 +394,7 @@ ReadListElement (Tcl_Interp  *interp,
 	    case '\t':
 	    case '\v':
 		if ((openBraces == 0) && !inQuotes) {
-                    Tcl_AppendToObj (elemObjPtr, cpStart, (p - cpStart));
+                    AppendToElement (elemObjPtr, cpStart, (p - cpStart));
 		    goto done;
 		}
 		break;
@@ -318,7 +405,7 @@ ReadListElement (Tcl_Interp  *interp,
 
 	    case '"':
 		if (inQuotes) {
-                    Tcl_AppendToObj (elemObjPtr, cpStart, (p - cpStart));
+                    AppendToElement (elemObjPtr, cpStart, (p - cpStart));
 		    p++;
 		    if ((p >= limit) || isspace(UCHAR(*p))) {
 			goto done;
@@ -359,7 +446,7 @@ ReadListElement (Tcl_Interp  *interp,
                     break;  /* Byte of zero */
 
                 if ((openBraces == 0) && (inQuotes == 0)) {
-                    Tcl_AppendToObj (elemObjPtr, cpStart, (p - cpStart));
+                    AppendToElement (elemObjPtr, cpStart, (p - cpStart));
                     goto done;
                 }
                 
@@ -368,17 +455,19 @@ ReadListElement (Tcl_Interp  *interp,
                  * pointers.  Note we set `p' to one back, since we don't want
                  * the p++ below to miss the next character.
                  */
-                dataPtr->lineIdx = p - Tcl_DStringValue (&dataPtr->buffer);
-                cpIdx = cpStart - Tcl_DStringValue (&dataPtr->buffer);
+                dataPtr->lineIdx = p - start;
+                cpIdx = cpStart - start;
 
                 rstat = ReadListLine (interp, dataPtr);
+                if (rstat == TCL_CONTINUE)
+                    dataPtr->lineIdx = elemIdx;
                 if (rstat != TCL_OK)
                     return rstat;
 
-                p = Tcl_DStringValue (&dataPtr->buffer) + dataPtr->lineIdx - 1;
-                limit = Tcl_DStringValue (&dataPtr->buffer) +
-                    Tcl_DStringLength (&dataPtr->buffer);
-                cpStart = Tcl_DStringValue (&dataPtr->buffer) + cpIdx;
+                start = Tcl_GetStringFromObj (dataPtr->bufferObj, &length);
+                p = start + dataPtr->lineIdx - 1;
+                limit = start + length;
+                cpStart = start + cpIdx;
             }
         }
 	p++;
@@ -388,15 +477,234 @@ ReadListElement (Tcl_Interp  *interp,
     while ((p < limit) && (isspace(UCHAR(*p)))) {
 	p++;
     }
-    dataPtr->lineIdx = p - Tcl_DStringValue (&dataPtr->buffer);
+    dataPtr->lineIdx = p - start;
     return TCL_OK;
 }
 
+/*-----------------------------------------------------------------------------
+ * SavePartialList --
+ *
+ *    Keep a list that a non-blocking channel ran out of data in until the
+ * next lgets on the channel.
+ *
+ * Paramaters:
+ *   o interp - The interpreter whose table the list is kept in.
+ *   o dataPtr - Data for the list read.  The lines read are copied.
+ *   o dataObj - The elements parsed so far.  A reference is taken.
+ * Returns:
+ *   The partial list.
+ *-----------------------------------------------------------------------------
+ */
+static PartialList *
+SavePartialList (Tcl_Interp  *interp,
+                 ReadData    *dataPtr,
+                 Tcl_Obj     *dataObj)
+{
+    Tcl_HashTable *partialTablePtr;
+    PartialList *partialPtr;
+    int isNew;
+
+    partialTablePtr = (Tcl_HashTable *) Tcl_GetAssocData (interp,
+                                                          LGETS_ASSOC_KEY,
+                                                          NULL);
+    partialPtr = (PartialList *) ckalloc (sizeof (PartialList));
+    partialPtr->entryPtr = Tcl_CreateHashEntry (partialTablePtr,
+                                                (char *) dataPtr->channel,
+                                                &isNew);
+    Tcl_SetHashValue (partialPtr->entryPtr, partialPtr);
+
+    partialPtr->readData.channel = dataPtr->channel;
+    partialPtr->readData.bufferObj = Tcl_DuplicateObj (dataPtr->bufferObj);
+    Tcl_IncrRefCount (partialPtr->readData.bufferObj);
+    partialPtr->readData.lineIdx = dataPtr->lineIdx;
+    partialPtr->dataObj = dataObj;
+    Tcl_IncrRefCount (dataObj);
+
+    Tcl_CreateCloseHandler (dataPtr->channel, PartialListCloseHandler,
+                            (ClientData) partialPtr);
+    return partialPtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * PartialListCloseHandler --
+ *    Discard a partly read list when its channel is closed.
+ *-----------------------------------------------------------------------------
+ */
+static void
+PartialListCloseHandler (ClientData clientData)
+{
+    ReleasePartialList ((PartialList *) clientData);
+}
+
+/*-----------------------------------------------------------------------------
+ * ReleasePartialList --
+ *    Remove a partly read list from its table and free it.
+ *-----------------------------------------------------------------------------
+ */
+static void
+ReleasePartialList (PartialList *partialPtr)
+{
+    Tcl_DeleteCloseHandler (partialPtr->readData.channel,
+                            PartialListCloseHandler,
+                            (ClientData) partialPtr);
+    Tcl_DeleteHashEntry (partialPtr->entryPtr);
+    Tcl_DecrRefCount (partialPtr->readData.bufferObj);
+    if (partialPtr->dataObj != NULL)
+        Tcl_DecrRefCount (partialPtr->dataObj);
+    ckfree ((char *) partialPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * ReadList --
+ *
+ *    Read the next list from a channel, carrying on with the list that an
+ * earlier lgets ran out of data in if there is one.
+ *
+ * Paramaters:
+ *   o interp - Errors are returned in result.
+ *   o channel - The channel to read from.
+ *   o dataPtr - Data for reading a new list.  The buffer object must have
+ *     been created, and may be used for many lists.
+ *   o dataObjPtr - The list is returned here with a reference count of one.
+ *     On an error, the elements read are returned, with the data that
+ *     wasn't parsed as the last element.
+ *   o lengthPtr - The length of the list read, not counting the newline,
+ *     is returned here.
+ * Returns:
+ *   o TCL_OK if a list was read.
+ *   o TCL_BREAK if EOF without reading any data.
+ *   o TCL_CONTINUE if the channel is non-blocking and the rest of the list
+ *     isn't available yet.  What was read is kept for the next lgets.
+ *   o TCL_ERROR if an error occured, with error message in interp.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ReadList (Tcl_Interp  *interp,
+          Tcl_Channel  channel,
+          ReadData    *dataPtr,
+          Tcl_Obj    **dataObjPtr,
+          int         *lengthPtr)
+{
+    Tcl_HashEntry *entryPtr;
+    PartialList *partialPtr = NULL;
+    Tcl_Obj *dataObj, *elemObj;
+    char *start;
+    int rstat, length;
+
+    entryPtr = Tcl_FindHashEntry ((Tcl_HashTable *)
+                                  Tcl_GetAssocData (interp, LGETS_ASSOC_KEY,
+                                                    NULL),
+                                  (char *) channel);
+    if (entryPtr != NULL) {
+        partialPtr = (PartialList *) Tcl_GetHashValue (entryPtr);
+        dataPtr = &partialPtr->readData;
+        dataObj = partialPtr->dataObj;
+        partialPtr->dataObj = NULL;
+        rstat = TCL_OK;
+    } else {
+        dataObj = Tcl_NewListObj (0, NULL);
+        Tcl_IncrRefCount (dataObj);
+        rstat = ReadListInit (interp, channel, dataPtr);
+        if ((rstat == TCL_BREAK) || (rstat == TCL_CONTINUE)) {
+            Tcl_DecrRefCount (dataObj);
+            return rstat;
+        }
+    }
+
+    /*
+     * Parse off each element until the list is read.  More lines are read
+     * if newlines are encountered in the middle of a list.
+     */
+    while (rstat == TCL_OK) {
+        elemObj = NULL;
+        rstat = ReadListElement (interp, dataPtr, &elemObj);
+        if (rstat == TCL_OK) {
+            Tcl_ListObjAppendElement (NULL, dataObj, elemObj);
+        } else if (elemObj != NULL) {
+            Tcl_DecrRefCount (elemObj);
+        }
+    }
+
+    /*
+     * If a non-blocking channel doesn't have the rest of the list yet, keep
+     * what has been read.
+     */
+    if (rstat == TCL_CONTINUE) {
+        if (partialPtr != NULL) {
+            partialPtr->dataObj = dataObj;
+        } else {
+            SavePartialList (interp, dataPtr, dataObj);
+            Tcl_DecrRefCount (dataObj);
+        }
+        return TCL_CONTINUE;
+    }
+
+    start = Tcl_GetStringFromObj (dataPtr->bufferObj, &length);
+    if (rstat == TCL_ERROR) {
+        length -= dataPtr->lineIdx;
+        if (length > 0) {
+            Tcl_ListObjAppendElement (NULL, dataObj,
+                                      Tcl_NewStringObj (start, length));
+        }
+    } else {
+        /* Adjust length for extra newlines that are inserted */
+        *lengthPtr = length - 1;
+        rstat = TCL_OK;
+    }
+    if (partialPtr != NULL)
+        ReleasePartialList (partialPtr);
+    *dataObjPtr = dataObj;
+    return rstat;
+}
+
+/*-----------------------------------------------------------------------------
+ * ReadLists --
+ *
+ *    Read lists from a channel for lgets -all or -count.
+ *
+ * Paramaters:
+ *   o interp - Errors are returned in result.
+ *   o channel - The channel to read from.
+ *   o maxLists - The most lists to read, or -1 to read to EOF.
+ *   o listsObj - The lists read are appended to this list object.
+ * Returns:
+ *   o TCL_OK if maxLists lists were read.
+ *   o TCL_BREAK if EOF was reached first.
+ *   o TCL_CONTINUE if the channel is non-blocking and the next list isn't
+ *     available yet.
+ *   o TCL_ERROR if an error occured, with error message in interp.
+ *-----------------------------------------------------------------------------
+ */
+static int
+ReadLists (Tcl_Interp  *interp,
+           Tcl_Channel  channel,
+           int          maxLists,
+           Tcl_Obj     *listsObj)
+{
+    ReadData readData;
+    Tcl_Obj *dataObj;
+    int rstat = TCL_OK, numLists, length;
+
+    readData.bufferObj = Tcl_NewObj ();
+    Tcl_IncrRefCount (readData.bufferObj);
+    for (numLists = 0; (maxLists < 0) || (numLists < maxLists); numLists++) {
+        rstat = ReadList (interp, channel, &readData, &dataObj, &length);
+        if (rstat != TCL_OK)
+            break;
+        Tcl_ListObjAppendElement (NULL, listsObj, dataObj);
+        Tcl_DecrRefCount (dataObj);
+    }
+    if (rstat == TCL_ERROR)
+        Tcl_DecrRefCount (dataObj);
+    Tcl_DecrRefCount (readData.bufferObj);
+    return rstat;
+}
+
 /*-----------------------------------------------------------------------------
  * Tcl_LgetsObjCmd --
  *
  * Implements the `lgets' Tcl command:
- *    lgets fileId ?varName?
+ *    lgets ?-all|-count count? fileId ?varName?
  *
  * Results:
  *      A standard Tcl result.
@@ -413,77 +721,89 @@ TclX_LgetsObjCmd (ClientData  clientData,
 {
     Tcl_Channel channel;
     ReadData readData;
-    int rstat, optValue;
-    Tcl_Obj *elemObj, *dataObj;
-
-    if ((objc < 2) || (objc > 3)) {
-        return TclX_WrongArgs (interp, objv [0], "fileId ?varName?");
+    int rstat, argIdx = 1, maxLists = 0, resultLen = -1;
+    char *option;
+    Tcl_Obj *dataObj = NULL, *varObj, *saveResult;
+
+    if (objc > 1) {
+        option = Tcl_GetStringFromObj (objv [1], NULL);
+        if (STREQU (option, "-all")) {
+            maxLists = -1;
+            argIdx = 2;
+        } else if (STREQU (option, "-count")) {
+            if (objc < 4) {
+                return TclX_WrongArgs (interp, objv [0],
+                                       "?-all|-count count? fileId ?varName?");
+            }
+            if (Tcl_GetIntFromObj (interp, objv [2], &maxLists) != TCL_OK)
+                return TCL_ERROR;
+            if (maxLists < 0) {
+                TclX_AppendObjResult (interp, "count must be at least 0, ",
+                                      "got \"", Tcl_GetStringFromObj (objv [2],
+                                                                      NULL),
+                                      "\"", (char *) NULL);
+                return TCL_ERROR;
+            }
+            argIdx = 3;
+        }
     }
+    if ((objc - argIdx < 1) || (objc - argIdx > 2)) {
+        return TclX_WrongArgs (interp, objv [0],
+                               "?-all|-count count? fileId ?varName?");
+    }
+    varObj = (objc - argIdx == 2) ? objv [argIdx + 1] : NULL;
 
-    channel = TclX_GetOpenChannelObj (interp, objv [1], TCL_READABLE);
+    channel = TclX_GetOpenChannelObj (interp, objv [argIdx], TCL_READABLE);
     if (channel == NULL)
         return TCL_ERROR;
 
     /*
-     * If the channel is non-blocking, its an error, we don't support it
-     * yet.
-     * FIX: Make callback driven for non-blocking.
+     * Read a list of lists with -all or -count.  If a variable is supplied
+     * and an error occurs, the lists read before it are returned in it.
      */
-    if (TclX_GetChannelOption (interp, channel, TCLX_COPT_BLOCKING,
-                               &optValue) != TCL_OK)
-        return TCL_ERROR;
-    if (optValue == TCLX_MODE_NONBLOCKING) {
-        TclX_AppendObjResult (interp, "channel is non-blocking; not ",
-                              "currently supported by the lgets command",
-                              (char *) NULL);
-        return TCL_ERROR;
+    if (argIdx > 1) {
+        dataObj = Tcl_NewListObj (0, NULL);
+        Tcl_IncrRefCount (dataObj);
+        rstat = ReadLists (interp, channel, maxLists, dataObj);
+        Tcl_ListObjLength (NULL, dataObj, &resultLen);
+        if ((resultLen == 0) && (maxLists != 0) && (rstat != TCL_OK))
+            resultLen = -1;
+    } else {
+        readData.bufferObj = Tcl_NewObj ();
+        Tcl_IncrRefCount (readData.bufferObj);
+        rstat = ReadList (interp, channel, &readData, &dataObj, &resultLen);
+        Tcl_DecrRefCount (readData.bufferObj);
+        if ((rstat == TCL_OK) &&
+            (Tcl_Eof (channel) || Tcl_InputBlocked (channel)))
+            resultLen = -1;
     }
+    if (rstat == TCL_ERROR)
+        goto errorExit;
 
     /*
-     * Read the list, parsing off each element until the list is read.
-     * More lines are read if newlines are encountered in the middle of
-     * a list.
+     * At EOF, or when a non-blocking channel doesn't have the rest of the
+     * list yet, an empty string is returned as gets does.
      */
-    rstat = ReadListInit (interp, channel, &readData);
-
-    dataObj = Tcl_NewListObj (0, NULL);
-    Tcl_IncrRefCount (dataObj);
-
-    while (rstat == TCL_OK) {
-        elemObj = Tcl_NewStringObj ("", 0);
-        rstat = ReadListElement (interp, &readData, elemObj);
-        if (rstat == TCL_OK) {
-            Tcl_ListObjAppendElement (NULL, dataObj, elemObj);
-        } else {
-            Tcl_DecrRefCount (elemObj);
-        }
+    if (dataObj == NULL) {
+        dataObj = Tcl_NewObj ();
+        Tcl_IncrRefCount (dataObj);
+        resultLen = -1;
     }
-    if (rstat == TCL_ERROR)
-        goto errorExit;
 
     /*
      * Return the string as a result or in a variable.
      */
-    if (objc == 2) {
+    if (varObj == NULL) {
         Tcl_SetObjResult (interp, dataObj);
     } else {
-        int resultLen;
-
-        if (Tcl_ObjSetVar2(interp, objv[2], NULL, dataObj,
+        if (Tcl_ObjSetVar2(interp, varObj, NULL, dataObj,
                            TCL_PARSE_PART1|TCL_LEAVE_ERR_MSG) == NULL) {
-            goto errorExit;
-        }
-
-        if (Tcl_Eof (channel) || Tcl_InputBlocked (channel)) {
-            resultLen = -1;
-        } else {
-            /* Adjust length for extra newlines that are inserted */
-            resultLen = Tcl_DStringLength (&readData.buffer) - 1;
+            Tcl_DecrRefCount (dataObj);
+            return TCL_ERROR;
         }
         Tcl_SetIntObj (Tcl_GetObjResult (interp), resultLen);
     }
     Tcl_DecrRefCount (dataObj);
-    Tcl_DStringFree (&readData.buffer);
     return TCL_OK;
     
   errorExit:
@@ -492,17 +812,7 @@ TclX_LgetsObjCmd (ClientData  clientData,
      * that has not been processed.  The last bit of data is save as
      * the last element.  This is mostly good for debugging.
      */
-    if (objc > 2) {
-        Tcl_Obj *saveResult;
-        int len = Tcl_DStringLength (&readData.buffer) - readData.lineIdx;
-
-        if (len > 0) {
-            Tcl_ListObjAppendElement (
-                NULL, dataObj,
-                Tcl_NewStringObj (Tcl_DStringValue (&readData.buffer),
-                                  len));
-        }
-        
+    if (varObj != NULL) {
         saveResult = Tcl_GetObjResult (interp);
         Tcl_IncrRefCount (saveResult);
 
@@ -511,7 +821,7 @@ TclX_LgetsObjCmd (ClientData  clientData,
          * instead of original error.
          * FIX: Need functions to save/restore error state.
          */
-        if (Tcl_ObjSetVar2(interp, objv[2], NULL, dataObj,
+        if (Tcl_ObjSetVar2(interp, varObj, NULL, dataObj,
                            TCL_PARSE_PART1|TCL_LEAVE_ERR_MSG) != NULL) {
             Tcl_SetObjResult (interp, saveResult);  /* Restore old message */
         }
@@ -519,12 +829,30 @@ TclX_LgetsObjCmd (ClientData  clientData,
     }
 
     Tcl_DecrRefCount (dataObj);
-    Tcl_DStringFree (&readData.buffer);
-
     return TCL_ERROR;
 }
     
-
+
+/*-----------------------------------------------------------------------------
+ * LgetsCleanUp --
+ *     Discard the partly read lists when the interpreter is deleted.
+ *-----------------------------------------------------------------------------
+ */
+static void
+LgetsCleanUp (ClientData  clientData,
+              Tcl_Interp *interp)
+{
+    Tcl_HashTable *partialTablePtr = (Tcl_HashTable *) clientData;
+    Tcl_HashEntry *entryPtr;
+    Tcl_HashSearch search;
+
+    while ((entryPtr = Tcl_FirstHashEntry (partialTablePtr,
+                                           &search)) != NULL)
+        ReleasePartialList ((PartialList *) Tcl_GetHashValue (entryPtr));
+    Tcl_DeleteHashTable (partialTablePtr);
+    ckfree ((char *) partialTablePtr);
+}
+
 /*-----------------------------------------------------------------------------
  * TclX_LgetsInit --
  *     Initialize the lgets command.
@@ -533,6 +861,15 @@ TclX_LgetsObjCmd (ClientData  clientData,
 void
 TclX_LgetsInit (Tcl_Interp *interp)
 {
+    Tcl_HashTable *partialTablePtr;
+
+    if (Tcl_GetAssocData (interp, LGETS_ASSOC_KEY, NULL) == NULL) {
+        partialTablePtr = (Tcl_HashTable *) ckalloc (sizeof (Tcl_HashTable));
+        Tcl_InitHashTable (partialTablePtr, TCL_ONE_WORD_KEYS);
+        Tcl_SetAssocData (interp, LGETS_ASSOC_KEY, LgetsCleanUp,
+                          (ClientData) partialTablePtr);
+    }
+
     Tcl_CreateObjCommand (interp,
                           "lgets",
                           TclX_LgetsObjCmd,
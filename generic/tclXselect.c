@@ -2,12 +2,18 @@
  * tclXselect.c
  *
  * Select command.  This is the generic code associated with the select system
- * call.  It relies on the Unix style select, which operates on bit sets of
- * file numbers.  Platform specific code is called to translate channels into
- * file numbers, but all operations are generic.  On Win32, this only works
- * on sockets.  Ideally, it would push more code into the platform specific
- * modules and work on more file types.  However, right now, I don't see a
- * good way to do this on Win32.
+ * call.  Where poll is available, it is used instead, as it has no limit on
+ * the file numbers it can wait on and its cost depends on the number of
+ * files rather than on the highest file number.  Otherwise the Unix style
+ * select, which operates on bit sets of file numbers, is used.  Platform
+ * specific code is called to translate channels into file numbers, but all
+ * operations are generic.  On Win32, this only works on sockets.  Ideally,
+ * it would push more code into the platform specific modules and work on
+ * more file types.  However, right now, I don't see a good way to do this
+ * on Win32.
+ *
+ * The selector command keeps a set of channels to wait on between waits,
+ * using epoll where it is available.
  *-----------------------------------------------------------------------------
  * Copyright 1991-1999 Karl Lehenbauer and Mark Diekhans.
  *
@@ -52,27 +58,180 @@ typedef struct {
 #else
     int readFd;
     int writeFd;
+#endif
+    int pending;        /* Read data is buffered in the channel. */
+#ifdef HAVE_POLL_H
+    int pollIdx;        /* Index of the file's pollfd, -1 if none. */
 #endif
 } channelData_t;
 
+/*
+ * The set of files waited on, a pollfd for each channel in each of the read,
+ * write and exception lists, or the three select fd_sets.
+ */
+#ifdef HAVE_POLL_H
+typedef struct {
+    struct pollfd *fds;
+    int            numFds;
+    int            maxFds;
+} fileSet_t;
+#else
+typedef struct {
+    fd_set         fdSets [3];
+    int            maxFileId;
+} fileSet_t;
+#endif
+
+#define SELECT_READ   0
+#define SELECT_WRITE  1
+#define SELECT_EXCEPT 2
+
+/*
+ * A selector waits on a set of channels kept between waits.  The conditions
+ * waited for on a channel are a bit for each of SELECT_READ, SELECT_WRITE
+ * and SELECT_EXCEPT.
+ */
+#define SELECT_COND(setIdx) (1 << (setIdx))
+
+#define SELECTOR_ADD_ARGS \
+    "add selectorId ?-read? ?-write? ?-except? fileId ?fileId ...?"
+
+typedef struct selector_t selector_t;
+typedef struct selectorChannel_t selectorChannel_t;
+
+/*
+ * A file number a selector waits on for a channel.  A channel has a file for
+ * reading and one for writing, merged into the first if they are the same
+ * file number.  Exceptions are waited for on the read file, or on the write
+ * file of a channel that can't be read.
+ */
+typedef struct {
+    selectorChannel_t *chanPtr;
+    int                fileNum;      /* -1 if the file isn't waited on. */
+    int                conditions;   /* Conditions waited for on the file. */
+    int                fileIdx;      /* Index in the selector's file list,
+                                      * -1 if it isn't in the list. */
+} selectorFile_t;
+
+struct selectorChannel_t {
+    selector_t     *selectorPtr;
+    Tcl_HashEntry  *entryPtr;        /* Entry in the selector's channels. */
+    Tcl_Channel     channel;
+    Tcl_Obj        *channelIdObj;    /* Channel name returned by wait. */
+    int             conditions;      /* Conditions waited for. */
+    selectorFile_t  files [2];       /* Read and write files. */
+    unsigned long   waitNum;         /* Wait the reported conditions are
+                                      * for. */
+    int             reported;        /* Conditions already returned. */
+    int             bufferedIdx;     /* Index in the selector's buffered
+                                      * list, -1 if it isn't in the list. */
+};
+
+/*
+ * With epoll, the file list holds the files epoll can't wait on, regular
+ * files and directories, which are always ready.  Otherwise it holds all of
+ * the files, and with poll the file set has a pollfd for each entry.
+ *
+ * The buffered list holds the channels read waits for that may have input
+ * in their buffers: those added or changed since the last wait, and those
+ * the last wait found readable or with buffered input, as the program then
+ * reads them.  A wait checks only these buffers, dropping the channels found
+ * empty, which the system call waits on again.
+ */
+struct selector_t {
+    char             handle [16];
+    Tcl_HashTable    channelTbl;     /* selectorChannel_t keyed by channel. */
+    selectorFile_t **files;
+    int              numFiles;
+    int              maxFiles;
+    selectorChannel_t **buffered;
+    int              numBuffered;
+    int              maxBuffered;
+    unsigned long    waitNum;        /* Incremented by each wait. */
+#ifdef HAVE_SYS_EPOLL_H
+    int                 epollFd;
+    int                 numEpollFiles;
+    struct epoll_event *events;
+    int                 maxEvents;
+#else
+    fileSet_t        fileSet;
+#endif
+};
+
+/*
+ * Events for the conditions and events that make a file ready for every
+ * condition it is waited for.
+ */
+#ifdef HAVE_SYS_EPOLL_H
+#   define SELECTOR_IN   EPOLLIN
+#   define SELECTOR_OUT  EPOLLOUT
+#   define SELECTOR_PRI  EPOLLPRI
+#   define SELECTOR_HUP  (EPOLLHUP | EPOLLERR)
+#elif defined(HAVE_POLL_H)
+#   define SELECTOR_IN   POLLIN
+#   define SELECTOR_OUT  POLLOUT
+#   define SELECTOR_PRI  POLLPRI
+#   define SELECTOR_HUP  (POLLHUP | POLLERR)
+#endif
+
 /*
  * Prototypes of internal functions.
  */
+static void
+InitFileSet (fileSet_t *fileSetPtr);
+
+static void
+FreeFileSet (fileSet_t *fileSetPtr);
+
+#if !defined(HAVE_POLL_H) && !defined(WIN32)
+static int
+CheckSelectFileNum (Tcl_Interp  *interp,
+                    Tcl_Channel  channel,
+                    int          fileNum);
+#endif
+
+static int
+AddFileToSet (Tcl_Interp    *interp,
+              fileSet_t     *fileSetPtr,
+              int            setIdx,
+              channelData_t *channelPtr,
+              int            fileNum);
+
+static int
+FileIsSelected (fileSet_t     *fileSetPtr,
+                int            setIdx,
+                channelData_t *channelPtr,
+                int            fileNum);
+
+static int
+GetTimeoutObj (Tcl_Interp *interp,
+               Tcl_Obj    *timeoutObj,
+               double     *timeoutPtr);
+
+#if defined(HAVE_POLL_H) || defined(HAVE_SYS_EPOLL_H)
+static int
+TimeoutToMs (double timeout);
+#endif
+
+static int
+WaitOnFileSet (fileSet_t *fileSetPtr,
+               double     timeout);
+
 static int
 ParseSelectFileList (Tcl_Interp     *interp,
+                     int             setIdx,
                      int             chanAccess,
                      Tcl_Obj        *handleList,
-                     fd_set         *fileSetPtr,
-                     channelData_t **channelListPtr,
-                     int            *maxFileIdPtr);
+                     fileSet_t      *fileSetPtr,
+                     channelData_t **channelListPtr);
 
 static int
 FindPendingData (int            fileDescCnt,
-                 channelData_t *channelList,
-                 fd_set        *fileDescSetPtr);
+                 channelData_t *channelList);
 
 static Tcl_Obj *
-ReturnSelectedFileList (fd_set        *fileDescSetPtr,
+ReturnSelectedFileList (fileSet_t     *fileSetPtr,
+                        int            setIdx,
                         int            fileDescCnt,
                         channelData_t *channelListPtr);
 
@@ -82,7 +241,356 @@ TclX_SelectObjCmd (ClientData clientData,
                    int objc,
                    Tcl_Obj *CONST objv[]);
 
+#ifdef SELECTOR_IN
+static int
+SelectorEvents (int conditions);
+
+static int
+SelectorReadyConditions (int events,
+                         int conditions);
+#endif
+
+static void
+SelectorAppendFile (selector_t     *selectorPtr,
+                    selectorFile_t *filePtr);
+
+static void
+SelectorDeleteFile (selector_t     *selectorPtr,
+                    selectorFile_t *filePtr);
+
+static void
+SelectorAppendBuffered (selector_t        *selectorPtr,
+                        selectorChannel_t *chanPtr);
+
+static void
+SelectorDeleteBuffered (selector_t        *selectorPtr,
+                        selectorChannel_t *chanPtr);
+
+static int
+SelectorWatchFile (Tcl_Interp     *interp,
+                   selector_t     *selectorPtr,
+                   selectorFile_t *filePtr);
+
+static void
+SelectorUnwatchFile (selector_t     *selectorPtr,
+                     selectorFile_t *filePtr);
+
+static void
+SelectorChannelCloseHandler (ClientData clientData);
+
+static void
+SelectorRemoveChannel (selectorChannel_t *chanPtr,
+                       int                deleteHandler);
+
+static int
+SelectorAddChannel (Tcl_Interp  *interp,
+                    selector_t  *selectorPtr,
+                    Tcl_Channel  channel,
+                    int          conditions);
+
+static int
+SelectorReport (selector_t        *selectorPtr,
+                selectorChannel_t *chanPtr,
+                int                conditions,
+                Tcl_Obj           *handleSetList []);
+
+static int
+SelectorWait (Tcl_Interp *interp,
+              selector_t *selectorPtr,
+              double      timeout);
+
+static void
+SelectorFree (selector_t *selectorPtr);
+
+static int
+SelectorCreate (Tcl_Interp *interp,
+                void_pt     selectorTblPtr);
+
+static int
+SelectorAdd (Tcl_Interp     *interp,
+             selector_t     *selectorPtr,
+             int             objc,
+             Tcl_Obj *CONST  objv[]);
+
+static int
+SelectorRemove (Tcl_Interp     *interp,
+                selector_t     *selectorPtr,
+                int             objc,
+                Tcl_Obj *CONST  objv[]);
+
+static int
+TclX_SelectorObjCmd (ClientData clientData,
+                     Tcl_Interp *interp,
+                     int objc,
+                     Tcl_Obj *CONST objv[]);
+
+static void
+SelectorCleanUp (ClientData  clientData,
+                 Tcl_Interp *interp);
+
 
+/*-----------------------------------------------------------------------------
+ * InitFileSet --
+ *
+ *   Initialize an empty set of files to wait on.
+ *-----------------------------------------------------------------------------
+ */
+static void
+InitFileSet (fileSet_t *fileSetPtr)
+{
+#ifdef HAVE_POLL_H
+    fileSetPtr->fds = NULL;
+    fileSetPtr->numFds = 0;
+    fileSetPtr->maxFds = 0;
+#else
+    FD_ZERO (&fileSetPtr->fdSets [SELECT_READ]);
+    FD_ZERO (&fileSetPtr->fdSets [SELECT_WRITE]);
+    FD_ZERO (&fileSetPtr->fdSets [SELECT_EXCEPT]);
+    fileSetPtr->maxFileId = 0;
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * FreeFileSet --
+ *
+ *   Free the memory used by a set of files.
+ *-----------------------------------------------------------------------------
+ */
+static void
+FreeFileSet (fileSet_t *fileSetPtr)
+{
+#ifdef HAVE_POLL_H
+    if (fileSetPtr->fds != NULL)
+        ckfree ((char *) fileSetPtr->fds);
+#endif
+}
+
+#if !defined(HAVE_POLL_H) && !defined(WIN32)
+/*-----------------------------------------------------------------------------
+ * CheckSelectFileNum --
+ *
+ *   Check that a file number fits in the fd_sets select takes.
+ *
+ * Parameters:
+ *   o interp - Error messages are returned in the result.
+ *   o channel - The channel the file number is for.
+ *   o fileNum - The file number.
+ * Returns:
+ *   TCL_OK or TCL_ERROR if the file number is FD_SETSIZE or more.
+ *-----------------------------------------------------------------------------
+ */
+static int
+CheckSelectFileNum (Tcl_Interp  *interp,
+                    Tcl_Channel  channel,
+                    int          fileNum)
+{
+    char numBuf [32];
+
+    if (fileNum < FD_SETSIZE)
+        return TCL_OK;
+
+    sprintf (numBuf, "%d", FD_SETSIZE);
+    TclX_AppendObjResult (interp, "channel ", Tcl_GetChannelName (channel),
+                          " has a file number too large for select, ",
+                          "the limit is ", numBuf, (char *) NULL);
+    return TCL_ERROR;
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+ * AddFileToSet --
+ *
+ *   Add a file number to wait on to a set.
+ *
+ * Parameters:
+ *   o interp - Error messages are returned in the result.
+ *   o fileSetPtr - The set to add to.
+ *   o setIdx - SELECT_READ, SELECT_WRITE or SELECT_EXCEPT.
+ *   o channelPtr - The channel the file number is for.
+ *   o fileNum - The file number.
+ * Returns:
+ *   TCL_OK or TCL_ERROR if select can't wait on the file number.
+ *-----------------------------------------------------------------------------
+ */
+static int
+AddFileToSet (Tcl_Interp    *interp,
+              fileSet_t     *fileSetPtr,
+              int            setIdx,
+              channelData_t *channelPtr,
+              int            fileNum)
+{
+#ifdef HAVE_POLL_H
+    static short pollEvents [] = {POLLIN, POLLOUT, POLLPRI};
+    struct pollfd *pollPtr;
+
+    if (fileSetPtr->numFds == fileSetPtr->maxFds) {
+        fileSetPtr->maxFds = (fileSetPtr->maxFds == 0) ? 16 :
+            2 * fileSetPtr->maxFds;
+        fileSetPtr->fds = (struct pollfd *)
+            ckrealloc ((char *) fileSetPtr->fds,
+                       fileSetPtr->maxFds * sizeof (struct pollfd));
+    }
+    channelPtr->pollIdx = fileSetPtr->numFds++;
+    pollPtr = &fileSetPtr->fds [channelPtr->pollIdx];
+    pollPtr->fd = fileNum;
+    pollPtr->events = pollEvents [setIdx];
+    pollPtr->revents = 0;
+#else
+#ifndef WIN32
+    if (CheckSelectFileNum (interp, channelPtr->channel,
+                            fileNum) != TCL_OK)
+        return TCL_ERROR;
+#endif
+    FD_SET (fileNum, &fileSetPtr->fdSets [setIdx]);
+    if (fileNum > fileSetPtr->maxFileId)
+        fileSetPtr->maxFileId = fileNum;
+#endif
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * FileIsSelected --
+ *
+ *   Determine if a file was found ready by WaitOnFileSet.  As with select,
+ * a file that has been hung up or has an error counts as ready.
+ *
+ * Parameters:
+ *   o fileSetPtr - The set that was waited on.
+ *   o setIdx - SELECT_READ, SELECT_WRITE or SELECT_EXCEPT.
+ *   o channelPtr - The channel the file number is for.
+ *   o fileNum - The file number.
+ * Returns:
+ *   TRUE if the file is ready, FALSE if it isn't.
+ *-----------------------------------------------------------------------------
+ */
+static int
+FileIsSelected (fileSet_t     *fileSetPtr,
+                int            setIdx,
+                channelData_t *channelPtr,
+                int            fileNum)
+{
+#ifdef HAVE_POLL_H
+    static short pollEvents [] = {POLLIN | POLLHUP | POLLERR,
+                                  POLLOUT | POLLHUP | POLLERR,
+                                  POLLPRI};
+
+    return (fileSetPtr->fds [channelPtr->pollIdx].revents &
+            pollEvents [setIdx]) != 0;
+#else
+    return FD_ISSET (fileNum, &fileSetPtr->fdSets [setIdx]) != 0;
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * GetTimeoutObj --
+ *
+ *   Get a timeout in seconds from an object.  Zero is different from not
+ * specified, which is an empty object.
+ *
+ * Parameters:
+ *   o interp - Error messages are returned in the result.
+ *   o timeoutObj - The timeout object.
+ *   o timeoutPtr - The timeout is returned here, -1.0 if not specified.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+GetTimeoutObj (Tcl_Interp *interp,
+               Tcl_Obj    *timeoutObj,
+               double     *timeoutPtr)
+{
+    *timeoutPtr = -1.0;
+    if (TclX_IsNullObj (timeoutObj))
+        return TCL_OK;
+
+    if (Tcl_GetDoubleFromObj (interp, timeoutObj, timeoutPtr) != TCL_OK)
+        return TCL_ERROR;
+    if (*timeoutPtr < 0.0) {
+        TclX_AppendObjResult (interp, "timeout must be greater than ",
+                              "or equal to zero", (char *) NULL);
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+#if defined(HAVE_POLL_H) || defined(HAVE_SYS_EPOLL_H)
+/*-----------------------------------------------------------------------------
+ * TimeoutToMs --
+ *
+ *   Convert a timeout in seconds to the milliseconds poll and epoll_wait
+ * take.  It is rounded up, so a small timeout isn't a poll.
+ *
+ * Parameters:
+ *   o timeout - The timeout in seconds, or -1.0 to wait forever.
+ * Returns:
+ *   The timeout in milliseconds, or -1 to wait forever.
+ *-----------------------------------------------------------------------------
+ */
+static int
+TimeoutToMs (double timeout)
+{
+    if (timeout < 0.0)
+        return -1;
+    if (timeout * 1000.0 >= (double) INT_MAX)
+        return INT_MAX;
+    return (int) ceil (timeout * 1000.0);
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+ * WaitOnFileSet --
+ *
+ *   Wait for files in a set to be ready.
+ *
+ * Parameters:
+ *   o fileSetPtr - The set to wait on.  The files that are ready are
+ *     recorded in it, to be checked with FileIsSelected.
+ *   o timeout - The most seconds to wait, or -1.0 to wait until a file is
+ *     ready.
+ * Returns:
+ *   The number of files ready, or -1 with errno set if an error occured.
+ *-----------------------------------------------------------------------------
+ */
+static int
+WaitOnFileSet (fileSet_t *fileSetPtr,
+               double     timeout)
+{
+#ifdef HAVE_POLL_H
+    int idx, numSelected;
+
+    numSelected = poll (fileSetPtr->fds, fileSetPtr->numFds,
+                        TimeoutToMs (timeout));
+
+    /*
+     * select fails on a file number that isn't open, poll flags it.
+     */
+    for (idx = 0; (numSelected > 0) && (idx < fileSetPtr->numFds); idx++) {
+        if (fileSetPtr->fds [idx].revents & POLLNVAL) {
+            errno = EBADF;
+            return -1;
+        }
+    }
+    return numSelected;
+#else
+    struct timeval  timeoutRec;
+    struct timeval *timeoutRecPtr = NULL;
+    double seconds;
+
+    if (timeout >= 0.0) {
+        seconds = floor (timeout);
+        timeoutRec.tv_sec = (long) seconds;
+        timeoutRec.tv_usec = (long) ((timeout - seconds) * 1000000.0);
+        timeoutRecPtr = &timeoutRec;
+    }
+    return select (fileSetPtr->maxFileId + 1,
+                   &fileSetPtr->fdSets [SELECT_READ],
+                   &fileSetPtr->fdSets [SELECT_WRITE],
+                   &fileSetPtr->fdSets [SELECT_EXCEPT],
+                   timeoutRecPtr);
+#endif
+}
+
 /*-----------------------------------------------------------------------------
  * ParseSelectFileList --
  *
@@ -90,16 +598,15 @@ TclX_SelectObjCmd (ClientData clientData,
  *
  * Parameters:
  *   o interp - Error messages are returned in the result.
+ *   o setIdx - SELECT_READ, SELECT_WRITE or SELECT_EXCEPT, the list parsed.
  *   o chanAccess - TCL_READABLE for read direction, TCL_WRITABLE for write
  *     direction or both for both files.
  *   o handleList (I) - The list of file handles to parse, may be empty.
- *   o fileSetPtr - The select fd_set for the parsed handles is
- *     filled in.
+ *   o fileSetPtr - The file numbers of the parsed handles are added to this
+ *     set.
  *   o channelListPtr - A pointer to a dynamically allocated list of
  *     the channels that are in the set.  If the list is empty, NULL is
  *     returned.
- *   o maxFileIdPtr (I/O) - If a file id greater than the current value is
- *     encountered, it will be set to that file id.
  * Returns:
  *   The number of files in the list, or -1 if an error occured.
  * FIX: Should really pass in access and only get channels that are 
@@ -108,11 +615,11 @@ TclX_SelectObjCmd (ClientData clientData,
  */
 static int
 ParseSelectFileList (Tcl_Interp     *interp,
+                     int             setIdx,
                      int             chanAccess,
                      Tcl_Obj        *handleList,
-                     fd_set         *fileSetPtr,
-                     channelData_t **channelListPtr,
-                     int            *maxFileIdPtr)
+                     fileSet_t      *fileSetPtr,
+                     channelData_t **channelListPtr)
 {
     int handleCnt, idx;
     Tcl_Obj **handleObjv;
@@ -150,15 +657,19 @@ ParseSelectFileList (Tcl_Interp     *interp,
                                     chanAccess);
         if (channelList [idx].channel == NULL)
             goto errorExit;
+        channelList [idx].pending = FALSE;
+#ifdef HAVE_POLL_H
+        channelList [idx].pollIdx = -1;
+#endif
 
         if (chanAccess & TCL_READABLE) {
             if (TclXOSGetSelectFnum (interp, channelList [idx].channel,
 			TCL_READABLE,
 			&channelList [idx].readFd) != TCL_OK)
                 goto errorExit;
-            FD_SET (channelList [idx].readFd, fileSetPtr);
-            if ((int)channelList [idx].readFd > *maxFileIdPtr)
-                *maxFileIdPtr = (int)channelList [idx].readFd;
+            if (AddFileToSet (interp, fileSetPtr, setIdx, &channelList [idx],
+                              channelList [idx].readFd) != TCL_OK)
+                goto errorExit;
         } else {
             channelList [idx].readFd = -1;
         }
@@ -168,9 +679,9 @@ ParseSelectFileList (Tcl_Interp     *interp,
 			TCL_WRITABLE,
 			&channelList [idx].writeFd) != TCL_OK)
                 goto errorExit;
-            FD_SET (channelList [idx].writeFd, fileSetPtr);
-            if ((int)channelList [idx].writeFd > *maxFileIdPtr)
-                *maxFileIdPtr = (int)channelList [idx].writeFd;
+            if (AddFileToSet (interp, fileSetPtr, setIdx, &channelList [idx],
+                              channelList [idx].writeFd) != TCL_OK)
+                goto errorExit;
         } else {
             channelList [idx].writeFd = -1;
         }
@@ -193,26 +704,22 @@ ParseSelectFileList (Tcl_Interp     *interp,
  *
  * Parameters:
  *   o fileDescCnt (I) - Number of descriptors in the list.
- *   o channelListPtr (I) - A pointer to a list of the channel data for
- *     the channels to check.
- *   o fileDescSetPtr (I) - A select fd_set with will have a bit set for
- *     every file that has data pending it its buffer.
+ *   o channelListPtr (I/O) - A pointer to a list of the channel data for
+ *     the channels to check.  The pending flag is set for every channel that
+ *     has data pending it its buffer.
  * Returns:
  *   TRUE if any where found that had pending data, FALSE if none were found.
  *-----------------------------------------------------------------------------
  */
 static int
 FindPendingData (int            fileDescCnt,
-                 channelData_t *channelList,
-                 fd_set        *fileDescSetPtr)
+                 channelData_t *channelList)
 {
     int idx, found = FALSE;
 
-    FD_ZERO (fileDescSetPtr);
-
     for (idx = 0; idx < fileDescCnt; idx++) {
         if (Tcl_InputBuffered (channelList [idx].channel)) {
-            FD_SET (channelList [idx].readFd, fileDescSetPtr);
+            channelList [idx].pending = TRUE;
             found = TRUE;
         }
     }
@@ -222,11 +729,13 @@ FindPendingData (int            fileDescCnt,
 /*-----------------------------------------------------------------------------
  * ReturnSelectedFileList --
  *
- *   Take the resulting file descriptor sets from a select, and the
+ *   Take the resulting file set from a select, and the
  *   list of file descritpors and build up a list of Tcl file handles.
+ *   Channels with read data pending in their buffers are included.
  *
  * Parameters:
- *   o fileDescSetPtr (I) - The select fd_set.
+ *   o fileSetPtr (I) - The file set waited on.
+ *   o setIdx (I) - SELECT_READ, SELECT_WRITE or SELECT_EXCEPT, the list.
  *   o fileDescCnt (I) - Number of descriptors in the list.
  *   o channelListPtr (I) - A pointer to a list of the FILE pointers for
  *     files that are in the set.
@@ -235,7 +744,8 @@ FindPendingData (int            fileDescCnt,
  *-----------------------------------------------------------------------------
  */
 static Tcl_Obj *
-ReturnSelectedFileList (fd_set        *fileDescSetPtr,
+ReturnSelectedFileList (fileSet_t     *fileSetPtr,
+                        int            setIdx,
                         int            fileDescCnt,
                         channelData_t *channelList)
 {
@@ -244,10 +754,13 @@ ReturnSelectedFileList (fd_set        *fileDescSetPtr,
 
     handleCnt = 0;
     for (idx = 0; idx < fileDescCnt; idx++) {
-        if (((channelList [idx].readFd >= 0) &&
-             FD_ISSET (channelList [idx].readFd, fileDescSetPtr)) ||
+        if (channelList [idx].pending ||
+            ((channelList [idx].readFd >= 0) &&
+             FileIsSelected (fileSetPtr, setIdx, &channelList [idx],
+                             channelList [idx].readFd)) ||
             ((channelList [idx].writeFd >= 0) &&
-             FD_ISSET (channelList [idx].writeFd, fileDescSetPtr))) {
+             FileIsSelected (fileSetPtr, setIdx, &channelList [idx],
+                             channelList [idx].writeFd))) {
             Tcl_ListObjAppendElement (NULL, fileHandleList,
                                       channelList [idx].channelIdObj);
             handleCnt++;
@@ -279,14 +792,13 @@ TclX_SelectObjCmd (ClientData clientData,
 {
     static int chanAccess [] = {TCL_READABLE, TCL_WRITABLE, 0};
     int idx;
-    fd_set fdSets [3], readPendingFDSet;
+    fileSet_t fileSet;
     int descCnts [3];
     channelData_t *descLists [3];
     Tcl_Obj *handleSetList [3];
-    int numSelected, maxFileId = 0, pending;
+    int numSelected, pending;
     int result = TCL_ERROR;
-    struct timeval  timeoutRec;
-    struct timeval *timeoutRecPtr;
+    double timeout = -1.0;
 
     if (objc < 2) {
         return TclX_WrongArgs (interp, objv [0], 
@@ -296,8 +808,8 @@ TclX_SelectObjCmd (ClientData clientData,
     /*
      * Initialize. 0 == read, 1 == write and 2 == exception.
      */
+    InitFileSet (&fileSet);
     for (idx = 0; idx < 3; idx++) {
-        FD_ZERO (&fdSets [idx]);
         descCnts [idx] = 0;
         descLists [idx] = NULL;
     }
@@ -307,11 +819,11 @@ TclX_SelectObjCmd (ClientData clientData,
      */
     for (idx = 0; (idx < 3) && (idx < objc - 1); idx++) {
         descCnts [idx] = ParseSelectFileList (interp, 
+                                              idx,
                                               chanAccess [idx],
                                               objv [idx + 1],
-                                              &fdSets [idx],
-                                              &descLists [idx],
-                                              &maxFileId);
+                                              &fileSet,
+                                              &descLists [idx]);
         if (descCnts [idx] < 0)
             goto exitPoint;
     }
@@ -319,66 +831,38 @@ TclX_SelectObjCmd (ClientData clientData,
     /*
      * Get the time out.  Zero is different that not specified.
      */
-    timeoutRecPtr = NULL;
-    if ((objc > 4) && !TclX_IsNullObj (objv [4])) {
-        double  timeout, seconds, microseconds;
-
-        if (Tcl_GetDoubleFromObj (interp, objv [4], &timeout) != TCL_OK)
-            goto exitPoint;
-        if (timeout < 0.0) {
-            TclX_AppendObjResult (interp, "timeout must be greater than ",
-                                  "or equal to zero", (char *) NULL);
-            goto exitPoint;
-        }
-        seconds = floor (timeout);
-        microseconds = (timeout - seconds) * 1000000.0;
-        timeoutRec.tv_sec = (long) seconds;
-        timeoutRec.tv_usec = (long) microseconds;
-        timeoutRecPtr = &timeoutRec;
-    }
+    if ((objc > 4) && (GetTimeoutObj (interp, objv [4], &timeout) != TCL_OK))
+        goto exitPoint;
 
     /*
      * Check if any data is pending in the read buffers.  If there is,
      * then do the select, but don't block in it.
      */
-    pending = FindPendingData (descCnts [0], descLists [0], &readPendingFDSet);
+    pending = FindPendingData (descCnts [0], descLists [0]);
     if (pending) {
-        timeoutRec.tv_sec = 0;
-        timeoutRec.tv_usec = 0;
-        timeoutRecPtr = &timeoutRec;
+        timeout = 0.0;
     }
 
     /*
      * All set, do the select.
      */
-    numSelected = select (maxFileId + 1,
-                          &fdSets [0], &fdSets [1], &fdSets [2],
-                          timeoutRecPtr);
+    numSelected = WaitOnFileSet (&fileSet, timeout);
     if (numSelected < 0) {
         TclX_AppendObjResult (interp, "select error: ",
                               Tcl_PosixError (interp), (char *) NULL);
         goto exitPoint;
     }
-    
-    /*
-     * If there is read data pending in the buffers, force the bits to be set
-     * in the read fdSet.
-     */
-    if (pending) {
-        for (idx = 0; idx < descCnts [0]; idx++) {
-            if (FD_ISSET (descLists [0] [idx].readFd, &readPendingFDSet))
-                FD_SET (descLists [0] [idx].readFd, &(fdSets [0]));
-        }
-    }
 
     /*
      * Return the result, either a 3 element list, or leave the result
-     * empty if the timeout occured.
+     * empty if the timeout occured.  Channels with read data pending in
+     * the buffers are returned as readable.
      */
     if (numSelected > 0 || pending) {
         for (idx = 0; idx < 3; idx++) {
             handleSetList [idx] =
-                ReturnSelectedFileList (&fdSets [idx],
+                ReturnSelectedFileList (&fileSet,
+                                        idx,
                                         descCnts [idx],
                                         descLists [idx]);
         }
@@ -392,42 +876,945 @@ TclX_SelectObjCmd (ClientData clientData,
         if (descLists [idx] != NULL)
             ckfree ((char *) descLists [idx]);
     }
+    FreeFileSet (&fileSet);
     return result;
 }
-#else /* NO_SELECT */
+#ifdef SELECTOR_IN
 /*-----------------------------------------------------------------------------
- * TclX_SelectCmd --
- *     Dummy select command that returns an error for systems that don't
- *     have select.
+ * SelectorEvents --
+ *
+ *   Get the epoll or poll events to wait for on a selector file.
+ *
+ * Parameters:
+ *   o conditions - The conditions waited for on the file.
+ * Returns:
+ *   The events.
  *-----------------------------------------------------------------------------
  */
 static int
-TclX_SelectObjCmd (clientData, interp, objc, objv)
-    ClientData   clientData;
-    Tcl_Interp  *interp;
-    int          objc;
-    Tcl_Obj     *CONST objv[]
+SelectorEvents (int conditions)
 {
-    Tcl_AppendResult(interp, Tcl_GetString(objv[0]),
-	    " is not available on this OS", (char *) NULL);
-    return TCL_ERROR;
+    int events = 0;
+
+    if (conditions & SELECT_COND (SELECT_READ))
+        events |= SELECTOR_IN;
+    if (conditions & SELECT_COND (SELECT_WRITE))
+        events |= SELECTOR_OUT;
+    if (conditions & SELECT_COND (SELECT_EXCEPT))
+        events |= SELECTOR_PRI;
+    return events;
 }
-#endif /* NO_SELECT */
 
-
 /*-----------------------------------------------------------------------------
- * TclX_SelectInit --
- *     Initialize the select command.
+ * SelectorReadyConditions --
+ *
+ *   Get the conditions a selector file is ready for from the events
+ * returned for it.  A file that has been hung up or has an error is ready
+ * for all of its conditions, so that the wait doesn't keep returning it
+ * without it being reported.
+ *
+ * Parameters:
+ *   o events - The events returned for the file.
+ *   o conditions - The conditions waited for on the file.
+ * Returns:
+ *   The conditions the file is ready for.
  *-----------------------------------------------------------------------------
  */
-void
-TclX_SelectInit (Tcl_Interp *interp)
+static int
+SelectorReadyConditions (int events,
+                         int conditions)
 {
-    Tcl_CreateObjCommand (interp, 
-                          "select",
-                          TclX_SelectObjCmd,
-                          (ClientData) NULL,
-                          (Tcl_CmdDeleteProc*) NULL);
+    int ready = 0;
+
+    if (events & SELECTOR_HUP)
+        return conditions;
+    if (events & SELECTOR_IN)
+        ready |= SELECT_COND (SELECT_READ);
+    if (events & SELECTOR_OUT)
+        ready |= SELECT_COND (SELECT_WRITE);
+    if (events & SELECTOR_PRI)
+        ready |= SELECT_COND (SELECT_EXCEPT);
+    return ready & conditions;
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+ * SelectorAppendFile --
+ *
+ *   Add a file to the end of a selector's file list.  With poll, an empty
+ * pollfd is added to the file set for it.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SelectorAppendFile (selector_t     *selectorPtr,
+                    selectorFile_t *filePtr)
+{
+    if (selectorPtr->numFiles == selectorPtr->maxFiles) {
+        selectorPtr->maxFiles = (selectorPtr->maxFiles == 0) ? 16 :
+            2 * selectorPtr->maxFiles;
+        selectorPtr->files = (selectorFile_t **)
+            ckrealloc ((char *) selectorPtr->files,
+                       selectorPtr->maxFiles * sizeof (selectorFile_t *));
+#if !defined(HAVE_SYS_EPOLL_H) && defined(HAVE_POLL_H)
+        selectorPtr->fileSet.maxFds = selectorPtr->maxFiles;
+        selectorPtr->fileSet.fds = (struct pollfd *)
+            ckrealloc ((char *) selectorPtr->fileSet.fds,
+                       selectorPtr->maxFiles * sizeof (struct pollfd));
+#endif
+    }
+    filePtr->fileIdx = selectorPtr->numFiles++;
+    selectorPtr->files [filePtr->fileIdx] = filePtr;
+#if !defined(HAVE_SYS_EPOLL_H) && defined(HAVE_POLL_H)
+    selectorPtr->fileSet.numFds = selectorPtr->numFiles;
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectorDeleteFile --
+ *
+ *   Delete a file from a selector's file list, moving the last file into
+ * its place.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SelectorDeleteFile (selector_t     *selectorPtr,
+                    selectorFile_t *filePtr)
+{
+    int lastIdx = --selectorPtr->numFiles;
+
+    if (filePtr->fileIdx != lastIdx) {
+        selectorPtr->files [filePtr->fileIdx] = selectorPtr->files [lastIdx];
+        selectorPtr->files [filePtr->fileIdx]->fileIdx = filePtr->fileIdx;
+#if !defined(HAVE_SYS_EPOLL_H) && defined(HAVE_POLL_H)
+        selectorPtr->fileSet.fds [filePtr->fileIdx] =
+            selectorPtr->fileSet.fds [lastIdx];
+#endif
+    }
+    filePtr->fileIdx = -1;
+#if !defined(HAVE_SYS_EPOLL_H) && defined(HAVE_POLL_H)
+    selectorPtr->fileSet.numFds = selectorPtr->numFiles;
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectorAppendBuffered --
+ *
+ *   Add a channel waited on for reading to a selector's buffered list, so
+ * the next wait checks its read buffer.  Does nothing if it is already in
+ * the list or isn't waited on for reading.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SelectorAppendBuffered (selector_t        *selectorPtr,
+                        selectorChannel_t *chanPtr)
+{
+    if ((chanPtr->bufferedIdx >= 0) ||
+        !(chanPtr->conditions & SELECT_COND (SELECT_READ)))
+        return;
+    if (selectorPtr->numBuffered == selectorPtr->maxBuffered) {
+        selectorPtr->maxBuffered = (selectorPtr->maxBuffered == 0) ? 16 :
+            2 * selectorPtr->maxBuffered;
+        selectorPtr->buffered = (selectorChannel_t **)
+            ckrealloc ((char *) selectorPtr->buffered,
+                       selectorPtr->maxBuffered *
+                       sizeof (selectorChannel_t *));
+    }
+    chanPtr->bufferedIdx = selectorPtr->numBuffered++;
+    selectorPtr->buffered [chanPtr->bufferedIdx] = chanPtr;
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectorDeleteBuffered --
+ *
+ *   Delete a channel from a selector's buffered list, moving the last
+ * channel into its place.  Does nothing if it isn't in the list.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SelectorDeleteBuffered (selector_t        *selectorPtr,
+                        selectorChannel_t *chanPtr)
+{
+    int lastIdx;
+
+    if (chanPtr->bufferedIdx < 0)
+        return;
+    lastIdx = --selectorPtr->numBuffered;
+    if (chanPtr->bufferedIdx != lastIdx) {
+        selectorPtr->buffered [chanPtr->bufferedIdx] =
+            selectorPtr->buffered [lastIdx];
+        selectorPtr->buffered [chanPtr->bufferedIdx]->bufferedIdx =
+            chanPtr->bufferedIdx;
+    }
+    chanPtr->bufferedIdx = -1;
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectorWatchFile --
+ *
+ *   Start waiting on a selector file.
+ *
+ * Parameters:
+ *   o interp - Error messages are returned in the result.
+ *   o selectorPtr - The selector.
+ *   o filePtr - The file, with its file number and conditions set.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SelectorWatchFile (Tcl_Interp     *interp,
+                   selector_t     *selectorPtr,
+                   selectorFile_t *filePtr)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event event;
+
+    event.events = SelectorEvents (filePtr->conditions);
+    event.data.ptr = filePtr;
+    if (epoll_ctl (selectorPtr->epollFd, EPOLL_CTL_ADD, filePtr->fileNum,
+                   &event) == 0) {
+        selectorPtr->numEpollFiles++;
+        return TCL_OK;
+    }
+
+    /*
+     * epoll refuses regular files and directories, which select and poll
+     * always find ready.  Keep them in the file list, which wait returns as
+     * ready each time.
+     */
+    if (errno == EPERM) {
+        SelectorAppendFile (selectorPtr, filePtr);
+        return TCL_OK;
+    }
+    TclX_AppendObjResult (interp, "selector error: ",
+                          Tcl_PosixError (interp), (char *) NULL);
+    return TCL_ERROR;
+#elif defined(HAVE_POLL_H)
+    struct pollfd *pollPtr;
+
+    SelectorAppendFile (selectorPtr, filePtr);
+    pollPtr = &selectorPtr->fileSet.fds [filePtr->fileIdx];
+    pollPtr->fd = filePtr->fileNum;
+    pollPtr->events = SelectorEvents (filePtr->conditions);
+    pollPtr->revents = 0;
+    return TCL_OK;
+#else
+    int setIdx;
+
+#ifndef WIN32
+    if (CheckSelectFileNum (interp, filePtr->chanPtr->channel,
+                            filePtr->fileNum) != TCL_OK)
+        return TCL_ERROR;
+#endif
+    for (setIdx = 0; setIdx < 3; setIdx++) {
+        if (filePtr->conditions & SELECT_COND (setIdx))
+            FD_SET (filePtr->fileNum, &selectorPtr->fileSet.fdSets [setIdx]);
+    }
+    if (filePtr->fileNum > selectorPtr->fileSet.maxFileId)
+        selectorPtr->fileSet.maxFileId = filePtr->fileNum;
+    SelectorAppendFile (selectorPtr, filePtr);
+    return TCL_OK;
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectorUnwatchFile --
+ *
+ *   Stop waiting on a selector file.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SelectorUnwatchFile (selector_t     *selectorPtr,
+                     selectorFile_t *filePtr)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event event;
+
+    if (filePtr->fileIdx >= 0) {
+        SelectorDeleteFile (selectorPtr, filePtr);
+    } else {
+        epoll_ctl (selectorPtr->epollFd, EPOLL_CTL_DEL, filePtr->fileNum,
+                   &event);
+        selectorPtr->numEpollFiles--;
+    }
+#else
+#ifndef HAVE_POLL_H
+    int setIdx;
+
+    for (setIdx = 0; setIdx < 3; setIdx++) {
+        if (filePtr->conditions & SELECT_COND (setIdx))
+            FD_CLR (filePtr->fileNum, &selectorPtr->fileSet.fdSets [setIdx]);
+    }
+#endif
+    SelectorDeleteFile (selectorPtr, filePtr);
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectorChannelCloseHandler --
+ *   Close handler for a channel in a selector.  Removes it from the
+ * selector.
+ * Parameters:
+ *   o clientData (I) - Pointer to the selector channel.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SelectorChannelCloseHandler (ClientData clientData)
+{
+    SelectorRemoveChannel ((selectorChannel_t *) clientData, FALSE);
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectorRemoveChannel --
+ *
+ *   Stop waiting on a channel and release its data.
+ *
+ * Parameters:
+ *   o chanPtr - The selector channel.
+ *   o deleteHandler - TRUE to delete the close handler, FALSE if it is
+ *     being called.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SelectorRemoveChannel (selectorChannel_t *chanPtr,
+                       int                deleteHandler)
+{
+    int idx;
+
+    for (idx = 0; idx < 2; idx++) {
+        if (chanPtr->files [idx].fileNum >= 0)
+            SelectorUnwatchFile (chanPtr->selectorPtr, &chanPtr->files [idx]);
+    }
+    SelectorDeleteBuffered (chanPtr->selectorPtr, chanPtr);
+    if (deleteHandler) {
+        Tcl_DeleteCloseHandler (chanPtr->channel,
+                                SelectorChannelCloseHandler,
+                                (ClientData) chanPtr);
+    }
+    Tcl_DeleteHashEntry (chanPtr->entryPtr);
+    Tcl_DecrRefCount (chanPtr->channelIdObj);
+    ckfree ((char *) chanPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectorAddChannel --
+ *
+ *   Add a channel to a selector, or change the conditions waited for on a
+ * channel already in it.
+ *
+ * Parameters:
+ *   o interp - Error messages are returned in the result.
+ *   o selectorPtr - The selector.
+ *   o channel - The channel, open for the access the conditions need.
+ *   o conditions - The conditions to wait for.
+ * Returns:
+ *   TCL_OK or TCL_ERROR, in which case the channel is no longer in the
+ *   selector.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SelectorAddChannel (Tcl_Interp  *interp,
+                    selector_t  *selectorPtr,
+                    Tcl_Channel  channel,
+                    int          conditions)
+{
+    selectorChannel_t *chanPtr;
+    Tcl_HashEntry *entryPtr;
+    int readFd = -1, writeFd = -1;
+    int idx, newEntry;
+
+    if ((conditions & SELECT_COND (SELECT_READ)) ||
+        ((conditions & SELECT_COND (SELECT_EXCEPT)) &&
+         (Tcl_GetChannelMode (channel) & TCL_READABLE))) {
+        if (TclXOSGetSelectFnum (interp, channel, TCL_READABLE,
+                                 &readFd) != TCL_OK)
+            return TCL_ERROR;
+    }
+    if ((conditions & SELECT_COND (SELECT_WRITE)) ||
+        ((conditions & SELECT_COND (SELECT_EXCEPT)) && (readFd < 0))) {
+        if (TclXOSGetSelectFnum (interp, channel, TCL_WRITABLE,
+                                 &writeFd) != TCL_OK)
+            return TCL_ERROR;
+    }
+
+    entryPtr = Tcl_CreateHashEntry (&selectorPtr->channelTbl,
+                                    (char *) channel, &newEntry);
+    if (newEntry) {
+        chanPtr = (selectorChannel_t *) ckalloc (sizeof (selectorChannel_t));
+        chanPtr->selectorPtr = selectorPtr;
+        chanPtr->entryPtr = entryPtr;
+        chanPtr->channel = channel;
+        chanPtr->channelIdObj =
+            Tcl_NewStringObj (Tcl_GetChannelName (channel), -1);
+        Tcl_IncrRefCount (chanPtr->channelIdObj);
+        chanPtr->waitNum = 0;
+        chanPtr->reported = 0;
+        chanPtr->bufferedIdx = -1;
+        for (idx = 0; idx < 2; idx++) {
+            chanPtr->files [idx].chanPtr = chanPtr;
+            chanPtr->files [idx].fileNum = -1;
+            chanPtr->files [idx].fileIdx = -1;
+        }
+        Tcl_SetHashValue (entryPtr, chanPtr);
+        Tcl_CreateCloseHandler (channel, SelectorChannelCloseHandler,
+                                (ClientData) chanPtr);
+    } else {
+        chanPtr = (selectorChannel_t *) Tcl_GetHashValue (entryPtr);
+        for (idx = 0; idx < 2; idx++) {
+            if (chanPtr->files [idx].fileNum >= 0)
+                SelectorUnwatchFile (selectorPtr, &chanPtr->files [idx]);
+        }
+    }
+
+    chanPtr->conditions = conditions;
+    chanPtr->files [0].fileNum = readFd;
+    chanPtr->files [0].conditions = conditions &
+        ~SELECT_COND (SELECT_WRITE);
+    chanPtr->files [1].fileNum = writeFd;
+    chanPtr->files [1].conditions = conditions & SELECT_COND (SELECT_WRITE);
+    if (readFd < 0) {
+        chanPtr->files [1].conditions = conditions;
+    } else if (readFd == writeFd) {
+        chanPtr->files [0].conditions = conditions;
+        chanPtr->files [1].fileNum = -1;
+    }
+
+    for (idx = 0; idx < 2; idx++) {
+        if (chanPtr->files [idx].fileNum < 0)
+            continue;
+        if (SelectorWatchFile (interp, selectorPtr,
+                               &chanPtr->files [idx]) != TCL_OK) {
+            /*
+             * Neither this file nor any after it is being watched.
+             */
+            for (; idx < 2; idx++)
+                chanPtr->files [idx].fileNum = -1;
+            SelectorRemoveChannel (chanPtr, TRUE);
+            return TCL_ERROR;
+        }
+    }
+
+    /*
+     * The channel may already have been read into its buffer.
+     */
+    SelectorDeleteBuffered (selectorPtr, chanPtr);
+    SelectorAppendBuffered (selectorPtr, chanPtr);
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectorReport --
+ *
+ *   Add a channel to the lists returned by a wait for the conditions it is
+ * ready for, unless it was already added for them by this wait.  A channel
+ * ready for reading is put in the buffered list, as the program will read
+ * it.
+ *
+ * Parameters:
+ *   o selectorPtr - The selector waited on.
+ *   o chanPtr - The selector channel.
+ *   o conditions - The conditions the channel is ready for.
+ *   o handleSetList - The read, write and exception lists.
+ * Returns:
+ *   TRUE if the channel was added to any list, FALSE if not.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SelectorReport (selector_t        *selectorPtr,
+                selectorChannel_t *chanPtr,
+                int                conditions,
+                Tcl_Obj           *handleSetList [])
+{
+    int setIdx, found = FALSE;
+
+    if (chanPtr->waitNum != selectorPtr->waitNum) {
+        chanPtr->waitNum = selectorPtr->waitNum;
+        chanPtr->reported = 0;
+    }
+    conditions &= chanPtr->conditions & ~chanPtr->reported;
+    chanPtr->reported |= conditions;
+    if (conditions & SELECT_COND (SELECT_READ))
+        SelectorAppendBuffered (selectorPtr, chanPtr);
+
+    for (setIdx = 0; setIdx < 3; setIdx++) {
+        if (conditions & SELECT_COND (setIdx)) {
+            Tcl_ListObjAppendElement (NULL, handleSetList [setIdx],
+                                      chanPtr->channelIdObj);
+            found = TRUE;
+        }
+    }
+    return found;
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectorWait --
+ *
+ *   Wait for channels in a selector to be ready, implements the subcommand:
+ *         selector wait selectorId ?timeout?
+ *
+ *   As with select, channels with read data pending in their buffers are
+ * ready without waiting.  Only the channels in the buffered list are
+ * checked for them, so with epoll a wait costs only for the channels that
+ * are ready or were read since the last wait.
+ *
+ * Parameters:
+ *   o interp - The result is the read, write and exception lists, or empty
+ *     if the timeout expired.  Errors are also returned here.
+ *   o selectorPtr - The selector.
+ *   o timeout - The most seconds to wait, or -1.0 to wait until a channel
+ *     is ready.
+ * Returns:
+ *   TCL_OK or TCL_ERROR.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SelectorWait (Tcl_Interp *interp,
+              selector_t *selectorPtr,
+              double      timeout)
+{
+    Tcl_Obj *handleSetList [3];
+    selectorChannel_t *chanPtr;
+    selectorFile_t *filePtr;
+    int idx, numSelected, found = FALSE;
+    int result = TCL_ERROR;
+#if !defined(HAVE_SYS_EPOLL_H) && !defined(HAVE_POLL_H)
+    fileSet_t waitSet;
+    int ready, setIdx;
+#endif
+
+    for (idx = 0; idx < 3; idx++) {
+        handleSetList [idx] = Tcl_NewObj ();
+        Tcl_IncrRefCount (handleSetList [idx]);
+    }
+    selectorPtr->waitNum++;
+
+    /*
+     * Channels deleted from the buffered list are replaced by the last one,
+     * so the list is walked from its end.
+     */
+    for (idx = selectorPtr->numBuffered - 1; idx >= 0; idx--) {
+        chanPtr = selectorPtr->buffered [idx];
+        if (Tcl_InputBuffered (chanPtr->channel)) {
+            found |= SelectorReport (selectorPtr, chanPtr,
+                                     SELECT_COND (SELECT_READ),
+                                     handleSetList);
+        } else {
+            SelectorDeleteBuffered (selectorPtr, chanPtr);
+        }
+    }
+
+#ifdef HAVE_SYS_EPOLL_H
+    for (idx = 0; idx < selectorPtr->numFiles; idx++) {
+        filePtr = selectorPtr->files [idx];
+        found |= SelectorReport (selectorPtr, filePtr->chanPtr,
+                                 filePtr->conditions &
+                                 ~SELECT_COND (SELECT_EXCEPT),
+                                 handleSetList);
+    }
+#endif
+
+    /*
+     * If any channels are already ready, only poll for the others.
+     */
+    if (found)
+        timeout = 0.0;
+
+#ifdef HAVE_SYS_EPOLL_H
+    if ((selectorPtr->maxEvents == 0) ||
+        (selectorPtr->maxEvents < selectorPtr->numEpollFiles)) {
+        selectorPtr->maxEvents = (selectorPtr->numEpollFiles > 16) ?
+            selectorPtr->numEpollFiles : 16;
+        selectorPtr->events = (struct epoll_event *)
+            ckrealloc ((char *) selectorPtr->events,
+                       selectorPtr->maxEvents * sizeof (struct epoll_event));
+    }
+    numSelected = epoll_wait (selectorPtr->epollFd, selectorPtr->events,
+                              selectorPtr->maxEvents, TimeoutToMs (timeout));
+    for (idx = 0; idx < numSelected; idx++) {
+        filePtr = (selectorFile_t *) selectorPtr->events [idx].data.ptr;
+        found |= SelectorReport (selectorPtr, filePtr->chanPtr,
+            SelectorReadyConditions (selectorPtr->events [idx].events,
+                                     filePtr->conditions),
+            handleSetList);
+    }
+#elif defined(HAVE_POLL_H)
+    numSelected = WaitOnFileSet (&selectorPtr->fileSet, timeout);
+    for (idx = 0; (numSelected > 0) && (idx < selectorPtr->numFiles); idx++) {
+        filePtr = selectorPtr->files [idx];
+        found |= SelectorReport (selectorPtr, filePtr->chanPtr,
+            SelectorReadyConditions (selectorPtr->fileSet.fds [idx].revents,
+                                     filePtr->conditions),
+            handleSetList);
+    }
+#else
+    waitSet = selectorPtr->fileSet;
+    numSelected = WaitOnFileSet (&waitSet, timeout);
+    for (idx = 0; (numSelected > 0) && (idx < selectorPtr->numFiles); idx++) {
+        filePtr = selectorPtr->files [idx];
+        ready = 0;
+        for (setIdx = 0; setIdx < 3; setIdx++) {
+            if ((filePtr->conditions & SELECT_COND (setIdx)) &&
+                FD_ISSET (filePtr->fileNum, &waitSet.fdSets [setIdx]))
+                ready |= SELECT_COND (setIdx);
+        }
+        found |= SelectorReport (selectorPtr, filePtr->chanPtr, ready,
+                                 handleSetList);
+    }
+#endif
+    if (numSelected < 0) {
+        TclX_AppendObjResult (interp, "selector error: ",
+                              Tcl_PosixError (interp), (char *) NULL);
+        goto exitPoint;
+    }
+
+    if (found)
+        Tcl_SetObjResult (interp, Tcl_NewListObj (3, handleSetList));
+    result = TCL_OK;
+
+  exitPoint:
+    for (idx = 0; idx < 3; idx++)
+        Tcl_DecrRefCount (handleSetList [idx]);
+    return result;
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectorFree --
+ *
+ *   Remove all of the channels from a selector and free it.  Doesn't free
+ * the table entry.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SelectorFree (selector_t *selectorPtr)
+{
+    Tcl_HashSearch search;
+    Tcl_HashEntry *entryPtr;
+
+    while ((entryPtr = Tcl_FirstHashEntry (&selectorPtr->channelTbl,
+                                           &search)) != NULL) {
+        SelectorRemoveChannel ((selectorChannel_t *)
+                               Tcl_GetHashValue (entryPtr), TRUE);
+    }
+    Tcl_DeleteHashTable (&selectorPtr->channelTbl);
+    if (selectorPtr->files != NULL)
+        ckfree ((char *) selectorPtr->files);
+    if (selectorPtr->buffered != NULL)
+        ckfree ((char *) selectorPtr->buffered);
+#ifdef HAVE_SYS_EPOLL_H
+    close (selectorPtr->epollFd);
+    if (selectorPtr->events != NULL)
+        ckfree ((char *) selectorPtr->events);
+#else
+    FreeFileSet (&selectorPtr->fileSet);
+#endif
+    ckfree ((char *) selectorPtr);
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectorCreate --
+ *
+ *   Create a new selector, implements the subcommand:
+ *         selector create
+ *-----------------------------------------------------------------------------
+ */
+static int
+SelectorCreate (Tcl_Interp *interp,
+                void_pt     selectorTblPtr)
+{
+    selector_t *selectorPtr, **tableEntryPtr;
+
+    selectorPtr = (selector_t *) ckalloc (sizeof (selector_t));
+#ifdef HAVE_SYS_EPOLL_H
+    selectorPtr->epollFd = epoll_create (16);
+    if (selectorPtr->epollFd < 0) {
+        ckfree ((char *) selectorPtr);
+        TclX_AppendObjResult (interp, "selector error: ",
+                              Tcl_PosixError (interp), (char *) NULL);
+        return TCL_ERROR;
+    }
+    fcntl (selectorPtr->epollFd, F_SETFD, FD_CLOEXEC);
+    selectorPtr->numEpollFiles = 0;
+    selectorPtr->events = NULL;
+    selectorPtr->maxEvents = 0;
+#else
+    InitFileSet (&selectorPtr->fileSet);
+#endif
+    Tcl_InitHashTable (&selectorPtr->channelTbl, TCL_ONE_WORD_KEYS);
+    selectorPtr->files = NULL;
+    selectorPtr->numFiles = 0;
+    selectorPtr->maxFiles = 0;
+    selectorPtr->buffered = NULL;
+    selectorPtr->numBuffered = 0;
+    selectorPtr->maxBuffered = 0;
+    selectorPtr->waitNum = 0;
+
+    tableEntryPtr = (selector_t **)
+        TclX_HandleAlloc (selectorTblPtr, selectorPtr->handle);
+    *tableEntryPtr = selectorPtr;
+
+    Tcl_SetStringObj (Tcl_GetObjResult (interp), selectorPtr->handle, -1);
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectorAdd --
+ *
+ *   Add channels to a selector, implements the subcommand:
+ *         selector add selectorId ?-read? ?-write? ?-except? fileId ...
+ *
+ *   All of the channels are checked before any are added.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SelectorAdd (Tcl_Interp     *interp,
+             selector_t     *selectorPtr,
+             int             objc,
+             Tcl_Obj *CONST  objv[])
+{
+    static CONST char *options [] = {"-read", "-write", "-except", NULL};
+    int optIdx, objIdx, access = 0, conditions = 0;
+    Tcl_Channel channel;
+
+    for (objIdx = 3; objIdx < objc; objIdx++) {
+        if (Tcl_GetString (objv [objIdx]) [0] != '-')
+            break;
+        if (Tcl_GetIndexFromObj (interp, objv [objIdx], options, "option",
+                                 TCL_EXACT, &optIdx) != TCL_OK)
+            return TCL_ERROR;
+        conditions |= SELECT_COND (optIdx);
+    }
+    if (objIdx == objc)
+        return TclX_WrongArgs (interp, objv [0], SELECTOR_ADD_ARGS);
+    if (conditions == 0)
+        conditions = SELECT_COND (SELECT_READ);
+    if (conditions & SELECT_COND (SELECT_READ))
+        access |= TCL_READABLE;
+    if (conditions & SELECT_COND (SELECT_WRITE))
+        access |= TCL_WRITABLE;
+
+    for (optIdx = objIdx; optIdx < objc; optIdx++) {
+        if (TclX_GetOpenChannelObj (interp, objv [optIdx], access) == NULL)
+            return TCL_ERROR;
+    }
+    for (; objIdx < objc; objIdx++) {
+        channel = TclX_GetOpenChannelObj (interp, objv [objIdx], access);
+        if (SelectorAddChannel (interp, selectorPtr, channel,
+                                conditions) != TCL_OK)
+            return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectorRemove --
+ *
+ *   Remove channels from a selector, implements the subcommand:
+ *         selector remove selectorId fileId ?fileId ...?
+ *
+ *   All of the channels are checked before any are removed.
+ *-----------------------------------------------------------------------------
+ */
+static int
+SelectorRemove (Tcl_Interp     *interp,
+                selector_t     *selectorPtr,
+                int             objc,
+                Tcl_Obj *CONST  objv[])
+{
+    Tcl_Channel channel;
+    Tcl_HashEntry *entryPtr;
+    int objIdx;
+
+    for (objIdx = 3; objIdx < objc; objIdx++) {
+        channel = TclX_GetOpenChannelObj (interp, objv [objIdx], 0);
+        if (channel == NULL)
+            return TCL_ERROR;
+        if (Tcl_FindHashEntry (&selectorPtr->channelTbl,
+                               (char *) channel) == NULL) {
+            TclX_AppendObjResult (interp, "channel ",
+                                  Tcl_GetString (objv [objIdx]),
+                                  " is not in ", selectorPtr->handle,
+                                  (char *) NULL);
+            return TCL_ERROR;
+        }
+    }
+    for (objIdx = 3; objIdx < objc; objIdx++) {
+        channel = TclX_GetOpenChannelObj (interp, objv [objIdx], 0);
+        entryPtr = Tcl_FindHashEntry (&selectorPtr->channelTbl,
+                                      (char *) channel);
+        if (entryPtr != NULL) {
+            SelectorRemoveChannel ((selectorChannel_t *)
+                                   Tcl_GetHashValue (entryPtr), TRUE);
+        }
+    }
+    return TCL_OK;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclX_SelectorObjCmd --
+ *
+ *   Implements the selector TCL command, which has the following forms:
+ *         selector create
+ *         selector add selectorId ?-read? ?-write? ?-except? fileId ...
+ *         selector remove selectorId fileId ?fileId ...?
+ *         selector wait selectorId ?timeout?
+ *         selector delete selectorId
+ *-----------------------------------------------------------------------------
+ */
+static int
+TclX_SelectorObjCmd (ClientData clientData,
+                     Tcl_Interp *interp,
+                     int objc,
+                     Tcl_Obj *CONST objv[])
+{
+    selector_t **tableEntryPtr;
+    char *subCommand;
+    double timeout;
+
+    if (objc < 2)
+        return TclX_WrongArgs (interp, objv [0], "option ...");
+
+    subCommand = Tcl_GetStringFromObj (objv [1], NULL);
+
+    if (STREQU (subCommand, "create")) {
+        if (objc != 2)
+            return TclX_WrongArgs (interp, objv [0], "create");
+        return SelectorCreate (interp, (void_pt) clientData);
+    }
+
+    if (STREQU (subCommand, "add")) {
+        if (objc < 4)
+            return TclX_WrongArgs (interp, objv [0], SELECTOR_ADD_ARGS);
+        tableEntryPtr = (selector_t **)
+            TclX_HandleXlateObj (interp, (void_pt) clientData, objv [2]);
+        if (tableEntryPtr == NULL)
+            return TCL_ERROR;
+        return SelectorAdd (interp, *tableEntryPtr, objc, objv);
+    }
+
+    if (STREQU (subCommand, "remove")) {
+        if (objc < 4)
+            return TclX_WrongArgs (interp, objv [0],
+                                   "remove selectorId fileId ?fileId ...?");
+        tableEntryPtr = (selector_t **)
+            TclX_HandleXlateObj (interp, (void_pt) clientData, objv [2]);
+        if (tableEntryPtr == NULL)
+            return TCL_ERROR;
+        return SelectorRemove (interp, *tableEntryPtr, objc, objv);
+    }
+
+    if (STREQU (subCommand, "wait")) {
+        if ((objc < 3) || (objc > 4))
+            return TclX_WrongArgs (interp, objv [0],
+                                   "wait selectorId ?timeout?");
+        tableEntryPtr = (selector_t **)
+            TclX_HandleXlateObj (interp, (void_pt) clientData, objv [2]);
+        if (tableEntryPtr == NULL)
+            return TCL_ERROR;
+        timeout = -1.0;
+        if ((objc == 4) &&
+            (GetTimeoutObj (interp, objv [3], &timeout) != TCL_OK))
+            return TCL_ERROR;
+        return SelectorWait (interp, *tableEntryPtr, timeout);
+    }
+
+    if (STREQU (subCommand, "delete")) {
+        if (objc != 3)
+            return TclX_WrongArgs (interp, objv [0], "delete selectorId");
+        tableEntryPtr = (selector_t **)
+            TclX_HandleXlateObj (interp, (void_pt) clientData, objv [2]);
+        if (tableEntryPtr == NULL)
+            return TCL_ERROR;
+        SelectorFree (*tableEntryPtr);
+        TclX_HandleFree ((void_pt) clientData, tableEntryPtr);
+        return TCL_OK;
+    }
+
+    TclX_AppendObjResult (interp, "invalid argument, expected one of: ",
+                          "\"create\", \"add\", \"remove\", \"wait\", ",
+                          "or \"delete\"", (char *) NULL);
+    return TCL_ERROR;
+}
+
+/*-----------------------------------------------------------------------------
+ * SelectorCleanUp --
+ *
+ *   Called when the interpreter is deleted to free all of the selectors.
+ *-----------------------------------------------------------------------------
+ */
+static void
+SelectorCleanUp (ClientData  clientData,
+                 Tcl_Interp *interp)
+{
+    selector_t **tableEntryPtr;
+    int          walkKey = -1;
+
+    while (TRUE) {
+        tableEntryPtr = (selector_t **)
+            TclX_HandleWalk ((void_pt) clientData, &walkKey);
+        if (tableEntryPtr == NULL)
+            break;
+        SelectorFree (*tableEntryPtr);
+    }
+    TclX_HandleTblRelease ((void_pt) clientData);
+}
+#else /* NO_SELECT */
+/*-----------------------------------------------------------------------------
+ * TclX_SelectCmd --
+ *     Dummy select command that returns an error for systems that don't
+ *     have select.
+ *-----------------------------------------------------------------------------
+ */
+static int
+TclX_SelectObjCmd (clientData, interp, objc, objv)
+    ClientData   clientData;
+    Tcl_Interp  *interp;
+    int          objc;
+    Tcl_Obj     *CONST objv[]
+{
+    Tcl_AppendResult(interp, Tcl_GetString(objv[0]),
+	    " is not available on this OS", (char *) NULL);
+    return TCL_ERROR;
+}
+#endif /* NO_SELECT */
+
+
+/*-----------------------------------------------------------------------------
+ * TclX_SelectInit --
+ *     Initialize the select and selector commands.
+ *-----------------------------------------------------------------------------
+ */
+void
+TclX_SelectInit (Tcl_Interp *interp)
+{
+#ifndef NO_SELECT
+    void_pt selectorTblPtr;
+#endif
+
+    Tcl_CreateObjCommand (interp, 
+                          "select",
+                          TclX_SelectObjCmd,
+                          (ClientData) NULL,
+                          (Tcl_CmdDeleteProc*) NULL);
+
+#ifndef NO_SELECT
+    selectorTblPtr = TclX_HandleTblInit ("selector",
+                                         sizeof (selector_t *),
+                                         4);
+    Tcl_CallWhenDeleted (interp, SelectorCleanUp,
+                         (ClientData) selectorTblPtr);
+
+    Tcl_CreateObjCommand (interp,
+                          "selector",
+                          TclX_SelectorObjCmd,
+                          (ClientData) selectorTblPtr,
+                          (Tcl_CmdDeleteProc*) NULL);
+#else
+    Tcl_CreateObjCommand (interp,
+                          "selector",
+                          TclX_SelectObjCmd,
+                          (ClientData) NULL,
+                          (Tcl_CmdDeleteProc*) NULL);
+#endif
 }
 
 
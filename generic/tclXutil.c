@@ -718,6 +718,76 @@ TclX_SetChannelOption (Tcl_Interp *interp,
     panic ("TclX_SetChannelOption bug");
     return TCL_ERROR;  /* Not reached */
 }
+
+/*-----------------------------------------------------------------------------
+ * TclX_GetMappedLineInfo --
+ *
+ *   Check if the lines read from a channel can be found directly in a
+ * mapping of the file: the channel is not stacked, has lf, binary or auto
+ * translation, no end of file character and an encoding in which a newline
+ * byte is always a newline.
+ *
+ * Parameters:
+ *   o channel - The channel.
+ *   o crIsEolPtr - Set to TRUE for auto translation, when a CR also ends a
+ *     line.
+ *   o encodingPtr - The channel's encoding is returned here, to be released
+ *     with Tcl_FreeEncoding.  Binary is returned as iso8859-1.
+ * Returns:
+ *   TRUE if lines can be taken from a mapping, FALSE if not.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclX_GetMappedLineInfo (Tcl_Channel   channel,
+                        int          *crIsEolPtr,
+                        Tcl_Encoding *encodingPtr)
+{
+    Tcl_DString optionBuf;
+    char *name, *value;
+    int mappable = FALSE;
+
+    if (Tcl_GetStackedChannel (channel) != NULL)
+        return FALSE;
+
+    Tcl_DStringInit (&optionBuf);
+    if (Tcl_GetChannelOption (NULL, channel, "-translation",
+                              &optionBuf) != TCL_OK)
+        goto exitPoint;
+    value = Tcl_DStringValue (&optionBuf);
+    if (strncmp (value, "auto", 4) == 0) {
+        *crIsEolPtr = TRUE;
+    } else if ((strncmp (value, "lf", 2) == 0) ||
+               (strncmp (value, "binary", 6) == 0)) {
+        *crIsEolPtr = FALSE;
+    } else {
+        goto exitPoint;
+    }
+
+    Tcl_DStringSetLength (&optionBuf, 0);
+    if (Tcl_GetChannelOption (NULL, channel, "-eofchar",
+                              &optionBuf) != TCL_OK)
+        goto exitPoint;
+    value = Tcl_DStringValue (&optionBuf);
+    if (!((value [0] == '\0') || (strncmp (value, "{}", 2) == 0)))
+        goto exitPoint;
+
+    Tcl_DStringSetLength (&optionBuf, 0);
+    if (Tcl_GetChannelOption (NULL, channel, "-encoding",
+                              &optionBuf) != TCL_OK)
+        goto exitPoint;
+    name = Tcl_DStringValue (&optionBuf);
+    if (STREQU (name, "binary"))
+        name = "iso8859-1";
+    if (!(STREQU (name, "utf-8") || STREQU (name, "ascii") ||
+          STRNEQU (name, "iso8859-", 8) || STRNEQU (name, "cp125", 5)))
+        goto exitPoint;
+    *encodingPtr = Tcl_GetEncoding (NULL, name);
+    mappable = (*encodingPtr != NULL);
+
+  exitPoint:
+    Tcl_DStringFree (&optionBuf);
+    return mappable;
+}
 
 /*-----------------------------------------------------------------------------
  * TclX_JoinPath --
@@ -757,6 +757,146 @@ TclXOSGetFileSize (Tcl_Channel channel, off_t *fileSize)
     return TCL_OK;
 }
 
+#ifdef HAVE_SYS_INOTIFY_H
+/*
+ * A file watch made with inotify.
+ */
+typedef struct {
+    int                 fd;
+    TclX_WatchFileProc *proc;
+    ClientData          clientData;
+} fileWatch_t;
+
+/*-----------------------------------------------------------------------------
+ * WatchFileHandler --
+ *   File handler for an inotify descriptor.  Drains the pending events and
+ * calls the watch's callback.  The callback may remove the watch.
+ *-----------------------------------------------------------------------------
+ */
+static void
+WatchFileHandler (ClientData clientData, int mask)
+{
+    fileWatch_t *watchPtr = (fileWatch_t *) clientData;
+    char buf [4096], *bufPtr;
+    struct inotify_event *eventPtr;
+    ssize_t numRead;
+    int moved = FALSE;
+
+    while ((numRead = read (watchPtr->fd, buf, sizeof (buf))) > 0) {
+        for (bufPtr = buf; bufPtr < buf + numRead;
+             bufPtr += sizeof (struct inotify_event) + eventPtr->len) {
+            eventPtr = (struct inotify_event *) bufPtr;
+            if (eventPtr->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED))
+                moved = TRUE;
+        }
+    }
+    (*watchPtr->proc) (watchPtr->clientData, moved);
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+ * TclXOSWatchFile --
+ *   System dependent interface to be called from the event loop when a file
+ * is changed, renamed or removed.
+ *
+ * Parameters:
+ *   o path - The file to watch.
+ *   o proc - Called with clientData when the file changes.
+ *   o clientData - Passed to proc.
+ * Returns:
+ *   A handle for TclXOSUnwatchFile, or NULL if the file can't be watched
+ * and must be polled.
+ *-----------------------------------------------------------------------------
+ */
+VOID *
+TclXOSWatchFile (char *path, TclX_WatchFileProc *proc, ClientData clientData)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    fileWatch_t *watchPtr;
+    int fd;
+
+    fd = inotify_init ();
+    if (fd < 0)
+        return NULL;
+    if (inotify_add_watch (fd, path, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF |
+                           IN_DELETE_SELF) < 0) {
+        close (fd);
+        return NULL;
+    }
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+    fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+    watchPtr = (fileWatch_t *) ckalloc (sizeof (fileWatch_t));
+    watchPtr->fd = fd;
+    watchPtr->proc = proc;
+    watchPtr->clientData = clientData;
+    Tcl_CreateFileHandler (fd, TCL_READABLE, WatchFileHandler,
+                           (ClientData) watchPtr);
+    return (VOID *) watchPtr;
+#else
+    return NULL;
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSUnwatchFile --
+ *   System dependent interface to remove a watch made by TclXOSWatchFile.
+ *
+ * Parameters:
+ *   o watchPtr - The watch handle.
+ *-----------------------------------------------------------------------------
+ */
+void
+TclXOSUnwatchFile (VOID *watchPtr)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    fileWatch_t *filePtr = (fileWatch_t *) watchPtr;
+
+    Tcl_DeleteFileHandler (filePtr->fd);
+    close (filePtr->fd);
+    ckfree ((char *) filePtr);
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSGetChannelPath --
+ *   System dependent interface to find the path of the file open on a
+ * channel.  This is only known on systems that can report it for an open
+ * file descriptor.
+ *
+ * Parameters:
+ *   o channel - Channel open on a file.
+ *   o pathPtr - Initialized dynamic string the path is appended to.
+ * Returns:
+ *   TRUE if the path was found, FALSE if not.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSGetChannelPath (Tcl_Channel channel, Tcl_DString *pathPtr)
+{
+    int fileNum = ChannelToFnum (channel, 0);
+    char path [MAXPATHLEN];
+#ifndef F_GETPATH
+    char procPath [32];
+    int pathLen;
+#endif
+
+    if (fileNum < 0)
+        return FALSE;
+#ifdef F_GETPATH
+    if (fcntl (fileNum, F_GETPATH, path) < 0)
+        return FALSE;
+    Tcl_DStringAppend (pathPtr, path, -1);
+#else
+    sprintf (procPath, "/proc/self/fd/%d", fileNum);
+    pathLen = readlink (procPath, path, sizeof (path));
+    if ((pathLen <= 0) || (pathLen >= sizeof (path)) || (path [0] != '/'))
+        return FALSE;
+    Tcl_DStringAppend (pathPtr, path, pathLen);
+#endif
+    return TRUE;
+}
+
 /*-----------------------------------------------------------------------------
  * TclXOSftruncate --
  *   System dependent interface to ftruncate functionality.
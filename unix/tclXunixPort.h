@@ -47,6 +47,18 @@ extern int h_errno;
  */
 #include "tclUnixPort.h"
 
+#ifdef HAVE_SYS_INOTIFY_H
+#   include <sys/inotify.h>
+#endif
+
+#ifdef HAVE_POLL_H
+#   include <poll.h>
+#endif
+
+#ifdef HAVE_SYS_EPOLL_H
+#   include <sys/epoll.h>
+#endif
+
 /*
  * Define O_ACCMODE if <fcntl.h> does not define it.
  */
@@ -128,6 +140,15 @@ extern long random ();
  */
 #define TCLX_WAITPID(pid, status, options) waitpid (pid, status, options)
 
+/*
+ * Nanoseconds of a file's modification time, 0 where stat doesn't have them.
+ */
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+#   define TCLX_ST_MTIME_NSEC(statBufPtr) ((long) (statBufPtr)->st_mtim.tv_nsec)
+#else
+#   define TCLX_ST_MTIME_NSEC(statBufPtr) 0L
+#endif
+
 #endif
 
 /* vim: set ts=4 sw=4 sts=4 et : */
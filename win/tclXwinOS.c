@@ -929,6 +929,57 @@ TclXOSGetFileSize (Tcl_Channel  channel,
     return TCL_OK;
 }
 
+/*-----------------------------------------------------------------------------
+ * TclXOSWatchFile --
+ *   System dependent interface to be called from the event loop when a file
+ * is changed, renamed or removed.  Not available on Windows; files are
+ * polled instead.
+ *
+ * Parameters:
+ *   o path - The file to watch.
+ *   o proc - Called with clientData when the file changes.
+ *   o clientData - Passed to proc.
+ * Returns:
+ *   NULL.
+ *-----------------------------------------------------------------------------
+ */
+VOID *
+TclXOSWatchFile (char *path, TclX_WatchFileProc *proc, ClientData clientData)
+{
+    return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSUnwatchFile --
+ *   System dependent interface to remove a watch made by TclXOSWatchFile.
+ *
+ * Parameters:
+ *   o watchPtr - The watch handle.
+ *-----------------------------------------------------------------------------
+ */
+void
+TclXOSUnwatchFile (VOID *watchPtr)
+{
+}
+
+/*-----------------------------------------------------------------------------
+ * TclXOSGetChannelPath --
+ *   System dependent interface to find the path of the file open on a
+ * channel.  Not available on Windows.
+ *
+ * Parameters:
+ *   o channel - Channel open on a file.
+ *   o pathPtr - Initialized dynamic string the path is appended to.
+ * Returns:
+ *   FALSE.
+ *-----------------------------------------------------------------------------
+ */
+int
+TclXOSGetChannelPath (Tcl_Channel channel, Tcl_DString *pathPtr)
+{
+    return FALSE;
+}
+
 /*-----------------------------------------------------------------------------
  * TclXOSftruncate --
  *   System dependent interface to ftruncate functionality. 
@@ -82,6 +82,11 @@
 
 #define bcopy(from, to, length)    memmove((to), (from), (length))
 
+/*
+ * The stat structure has no nanoseconds of the modification time.
+ */
+#define TCLX_ST_MTIME_NSEC(statBufPtr) 0L
+
 /*
  * Compaibility functions.
  */